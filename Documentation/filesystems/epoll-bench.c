@@ -0,0 +1,273 @@
+/*
+ * epoll scalability benchmark
+ *
+ * Two tests, both run once with plain and once with EPOLLEXCLUSIVE items:
+ *
+ *  herd:  every thread has an epoll instance of its own, all of them
+ *         watching the same eventfds, as N workers sharing listen sockets
+ *         do.  One thread posts events, the workers collect them.  Prints
+ *         the event rate, how often workers were woken up and how often
+ *         they found an eventfd already drained by another worker: the
+ *         latter is the thundering herd.
+ *
+ *  ready: every thread waits on its own set of eventfds that are always
+ *         ready, level triggered, so epoll_wait() returns at once and the
+ *         cost of moving events to userspace is what gets measured.
+ *
+ * Build with:
+ *	gcc -O2 -Wall -o epoll-bench epoll-bench.c -lpthread
+ *
+ * Usage: epoll-bench [-t threads] [-f fds] [-n events] [-m maxevents]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE (1 << 28)
+#endif
+
+static int nthreads;
+static int nfds = 1024;
+static long nevents = 1000000;
+static int maxevents = 64;
+
+static int *shared_fds;
+static volatile int done;
+static long consumed;
+static long wakeups;
+static long wasted;
+
+static pthread_barrier_t start;
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int *open_fds(int n, int initval)
+{
+	int *fds, i;
+
+	fds = calloc(n, sizeof(*fds));
+	if (!fds) {
+		perror("calloc");
+		exit(1);
+	}
+	for (i = 0; i < n; i++) {
+		fds[i] = eventfd(initval, EFD_NONBLOCK);
+		if (fds[i] < 0) {
+			perror("eventfd");
+			exit(1);
+		}
+	}
+	return fds;
+}
+
+static void close_fds(int *fds, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		close(fds[i]);
+	free(fds);
+}
+
+static int watch(int *fds, int n, uint32_t flags)
+{
+	struct epoll_event ev;
+	int epfd, i;
+
+	epfd = epoll_create1(0);
+	if (epfd < 0) {
+		perror("epoll_create1");
+		exit(1);
+	}
+	for (i = 0; i < n; i++) {
+		ev.events = EPOLLIN | flags;
+		ev.data.fd = fds[i];
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i], &ev) < 0) {
+			perror("epoll_ctl");
+			exit(1);
+		}
+	}
+	return epfd;
+}
+
+static void *herd_worker(void *arg)
+{
+	struct epoll_event *ev;
+	uint32_t flags = *(uint32_t *)arg;
+	long got = 0, woken = 0, miss = 0;
+	uint64_t val;
+	int epfd, i, n;
+
+	ev = calloc(maxevents, sizeof(*ev));
+	epfd = watch(shared_fds, nfds, flags);
+	pthread_barrier_wait(&start);
+
+	while (!done) {
+		n = epoll_wait(epfd, ev, maxevents, 100);
+		if (n <= 0)
+			continue;
+		woken++;
+		for (i = 0; i < n; i++) {
+			if (read(ev[i].data.fd, &val, sizeof(val)) ==
+			    sizeof(val))
+				got += val;
+			else
+				miss++;
+		}
+		if (got && __sync_add_and_fetch(&consumed, got) >= nevents)
+			done = 1;
+		got = 0;
+	}
+
+	__sync_add_and_fetch(&wakeups, woken);
+	__sync_add_and_fetch(&wasted, miss);
+	close(epfd);
+	free(ev);
+	return NULL;
+}
+
+static void herd(uint32_t flags)
+{
+	pthread_t *tids;
+	uint64_t one = 1;
+	double t;
+	long i;
+
+	shared_fds = open_fds(nfds, 0);
+	tids = calloc(nthreads, sizeof(*tids));
+	done = 0;
+	consumed = wakeups = wasted = 0;
+	pthread_barrier_init(&start, NULL, nthreads + 1);
+
+	for (i = 0; i < nthreads; i++)
+		pthread_create(&tids[i], NULL, herd_worker, &flags);
+	pthread_barrier_wait(&start);
+
+	t = now();
+	for (i = 0; i < nevents && !done; i++) {
+		if (write(shared_fds[i % nfds], &one, sizeof(one)) < 0) {
+			perror("write");
+			exit(1);
+		}
+	}
+	for (i = 0; i < nthreads; i++)
+		pthread_join(tids[i], NULL);
+	t = now() - t;
+
+	printf("herd  %-9s %10.0f events/s %6.2f wakeups/event "
+	       "%6.2f empty reads/event\n",
+	       flags ? "exclusive" : "shared", consumed / t,
+	       (double)wakeups / consumed, (double)wasted / consumed);
+
+	pthread_barrier_destroy(&start);
+	close_fds(shared_fds, nfds);
+	free(tids);
+}
+
+static void *ready_worker(void *arg)
+{
+	struct epoll_event *ev;
+	uint32_t flags = *(uint32_t *)arg;
+	int *fds, epfd, n;
+	long got = 0;
+
+	ev = calloc(maxevents, sizeof(*ev));
+	fds = open_fds(nfds, 1);
+	epfd = watch(fds, nfds, flags);
+	pthread_barrier_wait(&start);
+
+	while (got < nevents) {
+		n = epoll_wait(epfd, ev, maxevents, 0);
+		if (n < 0) {
+			perror("epoll_wait");
+			exit(1);
+		}
+		got += n;
+	}
+
+	close(epfd);
+	close_fds(fds, nfds);
+	free(ev);
+	return NULL;
+}
+
+static void ready(uint32_t flags)
+{
+	pthread_t *tids;
+	double t;
+	int i;
+
+	tids = calloc(nthreads, sizeof(*tids));
+	pthread_barrier_init(&start, NULL, nthreads + 1);
+
+	for (i = 0; i < nthreads; i++)
+		pthread_create(&tids[i], NULL, ready_worker, &flags);
+	pthread_barrier_wait(&start);
+
+	t = now();
+	for (i = 0; i < nthreads; i++)
+		pthread_join(tids[i], NULL);
+	t = now() - t;
+
+	printf("ready %-9s %10.0f events/s per thread\n",
+	       flags ? "exclusive" : "shared", nevents / t);
+
+	pthread_barrier_destroy(&start);
+	free(tids);
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((c = getopt(argc, argv, "t:f:n:m:")) != -1) {
+		switch (c) {
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 'f':
+			nfds = atoi(optarg);
+			break;
+		case 'n':
+			nevents = atol(optarg);
+			break;
+		case 'm':
+			maxevents = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-t threads] [-f fds] "
+				"[-n events] [-m maxevents]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (nthreads < 1 || nfds < 1 || nevents < 1 || maxevents < 1) {
+		fprintf(stderr, "%s: arguments must be positive\n", argv[0]);
+		return 1;
+	}
+
+	printf("%d threads, %d fds, %ld events, %d events per wait\n",
+	       nthreads, nfds, nevents, maxevents);
+
+	herd(0);
+	herd(EPOLLEXCLUSIVE);
+	ready(0);
+	ready(EPOLLEXCLUSIVE);
+
+	return 0;
+}
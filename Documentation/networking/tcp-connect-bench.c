@@ -0,0 +1,186 @@
+/*
+ * TCP connection rate benchmark
+ *
+ * Opens and closes TCP connections to one listener on the loopback device
+ * from 1, 2, 4, ... client threads at the same time, up to the number of
+ * online cpus, and prints the connection rate for each.  Clients close
+ * with SO_LINGER set to zero so that no TIME_WAIT sockets pile up and the
+ * run is bound by connection setup: SYN processing on the listener, the
+ * SYN queue and the accept queue.
+ *
+ * Build with:
+ *	gcc -O2 -Wall -o tcp-connect-bench tcp-connect-bench.c -lpthread
+ *
+ * Usage: tcp-connect-bench [-t threads] [-a acceptors] [-n connections]
+ *			    [-b backlog]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static int nthreads;
+static int nacceptors;
+static long nconns = 100000;
+static int backlog = 4096;
+
+static struct sockaddr_in addr;
+static int listen_fd;
+static volatile int done;
+static long accepted;
+static long failed;
+
+static pthread_barrier_t start;
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void *acceptor(void *arg)
+{
+	struct pollfd pfd = { .fd = listen_fd, .events = POLLIN };
+	long got = 0;
+	int fd;
+
+	while (!done) {
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+		while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+			close(fd);
+			got++;
+		}
+	}
+
+	__sync_add_and_fetch(&accepted, got);
+	return NULL;
+}
+
+static void *client(void *arg)
+{
+	struct linger lin = { .l_onoff = 1, .l_linger = 0 };
+	long i, miss = 0;
+	int fd;
+
+	pthread_barrier_wait(&start);
+
+	for (i = 0; i < nconns; i++) {
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd < 0) {
+			perror("socket");
+			exit(1);
+		}
+		setsockopt(fd, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+		if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+			miss++;
+		close(fd);
+	}
+
+	__sync_add_and_fetch(&failed, miss);
+	return NULL;
+}
+
+static void run(int n)
+{
+	pthread_t *clients, *acceptors;
+	double t;
+	int i;
+
+	clients = calloc(n, sizeof(*clients));
+	acceptors = calloc(nacceptors, sizeof(*acceptors));
+	done = 0;
+	accepted = failed = 0;
+	pthread_barrier_init(&start, NULL, n + 1);
+
+	for (i = 0; i < nacceptors; i++)
+		pthread_create(&acceptors[i], NULL, acceptor, NULL);
+	for (i = 0; i < n; i++)
+		pthread_create(&clients[i], NULL, client, NULL);
+	pthread_barrier_wait(&start);
+
+	t = now();
+	for (i = 0; i < n; i++)
+		pthread_join(clients[i], NULL);
+	t = now() - t;
+
+	done = 1;
+	for (i = 0; i < nacceptors; i++)
+		pthread_join(acceptors[i], NULL);
+
+	printf("%3d threads %10.0f conns/s %8ld accepted %6ld failed\n",
+	       n, (n * nconns - failed) / t, accepted, failed);
+
+	pthread_barrier_destroy(&start);
+	free(acceptors);
+	free(clients);
+}
+
+int main(int argc, char **argv)
+{
+	socklen_t len = sizeof(addr);
+	int c, n, one = 1;
+
+	nthreads = nacceptors = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((c = getopt(argc, argv, "t:a:n:b:")) != -1) {
+		switch (c) {
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 'a':
+			nacceptors = atoi(optarg);
+			break;
+		case 'n':
+			nconns = atol(optarg);
+			break;
+		case 'b':
+			backlog = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-t threads] [-a acceptors] "
+				"[-n connections] [-b backlog]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (nthreads < 1 || nacceptors < 1 || nconns < 1 || backlog < 1) {
+		fprintf(stderr, "%s: arguments must be positive\n", argv[0]);
+		return 1;
+	}
+
+	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (listen_fd < 0) {
+		perror("socket");
+		return 1;
+	}
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(listen_fd, backlog) < 0 ||
+	    getsockname(listen_fd, (struct sockaddr *)&addr, &len) < 0) {
+		perror("listen");
+		return 1;
+	}
+	fcntl(listen_fd, F_SETFL, O_NONBLOCK);
+
+	printf("%ld connections per thread, backlog %d, %d acceptors, "
+	       "port %d\n", nconns, backlog, nacceptors, ntohs(addr.sin_port));
+
+	for (n = 1; n < nthreads; n <<= 1)
+		run(n);
+	run(nthreads);
+
+	close(listen_fd);
+	return 0;
+}
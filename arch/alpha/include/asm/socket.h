@@ -67,6 +67,11 @@
 #define SO_TIMESTAMPING		37
 #define SCM_TIMESTAMPING	SO_TIMESTAMPING
 
+#define SO_BUSY_POLL		46
+
+#define SO_ZEROCOPY		60
+#define SO_BUSY_POLL_STATS	61
+
 /* O_NONBLOCK clashes with the bits used for socket types.  Therefore we
  * have to define SOCK_NONBLOCK to a different value here.
  */
@@ -60,5 +60,10 @@
 #define SO_PROTOCOL		38
 #define SO_DOMAIN		39
 
+#define SO_BUSY_POLL		46
+
+#define SO_ZEROCOPY		60
+#define SO_BUSY_POLL_STATS	61
+
 #endif /* _ASM_SOCKET_H */
 
@@ -59,6 +59,11 @@
 #define SO_TIMESTAMPING		0x4020
 #define SCM_TIMESTAMPING	SO_TIMESTAMPING
 
+#define SO_BUSY_POLL		0x4027
+
+#define SO_ZEROCOPY		0x4035
+#define SO_BUSY_POLL_STATS	0x4036
+
 /* O_NONBLOCK clashes with the bits used for socket types.  Therefore we
  * have to define SOCK_NONBLOCK to a different value here.
  */
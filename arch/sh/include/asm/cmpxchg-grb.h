@@ -67,4 +67,59 @@ static inline unsigned long __cmpxchg_u32(volatile int *m, unsigned long old,
 	return retval;
 }
 
+/*
+ * Compare and exchange the two words at p1 and p2.  There is no double
+ * word store: p2 is stored first and p1 last, which commits the sequence.
+ * If it is interrupted in between, p2 alone has been updated, and the
+ * sequence fails when it is restarted.  That only suits a p2 that may
+ * move on its own, such as the transaction id of the SLUB cpu freelist.
+ *
+ * An interrupt before the LOGOUT restarts the sequence at the LOGIN, see
+ * prepare_stack(): its -16 is minus the size of the 8 instructions from
+ * the first load to the second store, and must follow any change to them.
+ */
+static inline int __cmpxchg_double_u32(volatile u32 *p1, volatile u32 *p2,
+				       unsigned long old1, unsigned long old2,
+				       unsigned long new1, unsigned long new2)
+{
+	unsigned long tmp;
+	int ret;
+
+	__asm__ __volatile__ (
+		"   .align  2             \n\t"
+		"   mova    1f,   r0      \n\t" /* r0 = end point */
+		"   nop                   \n\t"
+		"   mov    r15,   r1      \n\t" /* r1 = saved sp */
+		"   mov    #-16,  r15     \n\t" /* LOGIN */
+		"   mov.l  @%2,   %1      \n\t" /* load  first word */
+		"   cmp/eq  %1,   %4      \n\t"
+		"   bf            1f      \n\t" /* if not equal */
+		"   mov.l  @%3,   %1      \n\t" /* load  second word */
+		"   cmp/eq  %1,   %5      \n\t"
+		"   bf            1f      \n\t" /* if not equal */
+		"   mov.l   %7,   @%3     \n\t" /* store second word */
+		"   mov.l   %6,   @%2     \n\t" /* store first word */
+		"1: mov     r1,   r15     \n\t" /* LOGOUT */
+		"   movt    %0            \n\t" /* T is set if both matched */
+		: "=r"  (ret),
+		  "=&r" (tmp)
+		: "r"   (p1), "r" (p2),
+		  "r"   (old1), "r" (old2),
+		  "r"   (new1), "r" (new2)
+		: "memory" , "r0", "r1", "t");
+
+	return ret;
+}
+
+#define cmpxchg_double_local(p1, p2, o1, o2, n1, n2)			\
+({									\
+	BUILD_BUG_ON(sizeof(*(p1)) != 4);				\
+	BUILD_BUG_ON(sizeof(*(p2)) != 4);				\
+	__cmpxchg_double_u32((volatile u32 *)(p1), (volatile u32 *)(p2), \
+			     (unsigned long)(o1), (unsigned long)(o2),	\
+			     (unsigned long)(n1), (unsigned long)(n2));	\
+})
+
+#define system_has_cmpxchg_double()	1
+
 #endif /* __ASM_SH_CMPXCHG_GRB_H */
@@ -0,0 +1,826 @@
+/*
+ * BPF JIT compiler for SH-4
+ *
+ * Translates socket filters that passed sk_chk_filter() into native
+ * code.  The linear head of the skb is read inline, a byte at a time
+ * since packet data need not be aligned; every other packet or
+ * ancillary load goes through bpf_jit_load_slow(), so the generated
+ * code returns exactly what sk_run_filter() would.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+#include <linux/moduleloader.h>
+#include <linux/netdevice.h>
+#include <linux/filter.h>
+#include <linux/workqueue.h>
+#include <linux/slab.h>
+#include <asm/cacheflush.h>
+#include <asm/unaligned.h>
+
+int bpf_jit_enable __read_mostly;
+EXPORT_SYMBOL_GPL(bpf_jit_enable);
+
+/*
+ * Register usage of the generated code:
+ *  r8	A
+ *  r9	X
+ *  r10	skb
+ *  r11	skb->data
+ *  r12	skb headlen (len - data_len)
+ * r0 - r7 are scratch, r0 doubles as index register.
+ *
+ * Frame, above r15:
+ *  r15 + 0	BPF_MEMWORDS scratch memory words
+ *  r15 + 64	A, X and result words handed to bpf_jit_load_slow()
+ *  r15 + 80	saved pr, r12 - r8
+ */
+#define REGS_OFF	(BPF_MEMWORDS * 4)
+#define RES_OFF		(REGS_OFF + 8)
+#define STACK_SIZE	80
+
+#define R0		0
+#define R1		1
+#define R2		2
+#define R4		4
+#define R5		5
+#define R6		6
+#define R7		7
+#define REG_A		8
+#define REG_X		9
+#define REG_SKB		10
+#define REG_DATA	11
+#define REG_HLEN	12
+#define R15		15
+
+/* Instruction encodings */
+#define SH_NOP			0x0009
+#define SH_RTS			0x000b
+#define SH_MOV(m, n)		(0x6003 | (n) << 8 | (m) << 4)
+#define SH_MOVI(i, n)		(0xe000 | (n) << 8 | ((i) & 0xff))
+#define SH_MOVL_PC(d, n)	(0xd000 | (n) << 8 | (d))
+#define SH_MOVL_PUSH(m)		(0x2f06 | (m) << 4)	/* mov.l Rm,@-r15 */
+#define SH_MOVL_POP(n)		(0x60f6 | (n) << 8)	/* mov.l @r15+,Rn */
+#define SH_STSL_PR_PUSH		0x4f22			/* sts.l pr,@-r15 */
+#define SH_LDSL_PR_POP		0x4f26			/* lds.l @r15+,pr */
+#define SH_MOVL_LD(d, m, n)	(0x5000 | (n) << 8 | (m) << 4 | (d))
+#define SH_MOVL_ST(m, d, n)	(0x1000 | (n) << 8 | (m) << 4 | (d))
+#define SH_MOVL_LD_R0(m, n)	(0x000e | (n) << 8 | (m) << 4)
+#define SH_MOVW_LD_R0(m, n)	(0x000d | (n) << 8 | (m) << 4)
+#define SH_MOVB_LD_R0(m, n)	(0x000c | (n) << 8 | (m) << 4)
+#define SH_EXTUB(m, n)		(0x600c | (n) << 8 | (m) << 4)
+#define SH_EXTUW(m, n)		(0x600d | (n) << 8 | (m) << 4)
+#define SH_SWAPB(m, n)		(0x6008 | (n) << 8 | (m) << 4)
+#define SH_ADD(m, n)		(0x300c | (n) << 8 | (m) << 4)
+#define SH_ADDI(i, n)		(0x7000 | (n) << 8 | ((i) & 0xff))
+#define SH_SUB(m, n)		(0x3008 | (n) << 8 | (m) << 4)
+#define SH_NEG(m, n)		(0x600b | (n) << 8 | (m) << 4)
+#define SH_AND(m, n)		(0x2009 | (n) << 8 | (m) << 4)
+#define SH_ANDI(i)		(0xc900 | (i))		/* and #imm,r0 */
+#define SH_OR(m, n)		(0x200b | (n) << 8 | (m) << 4)
+#define SH_ORI(i)		(0xcb00 | (i))		/* or #imm,r0 */
+#define SH_TST(m, n)		(0x2008 | (n) << 8 | (m) << 4)
+#define SH_TSTI(i)		(0xc800 | (i))		/* tst #imm,r0 */
+#define SH_MULL(m, n)		(0x0007 | (n) << 8 | (m) << 4)
+#define SH_STS_MACL(n)		(0x001a | (n) << 8)
+#define SH_SHLD(m, n)		(0x400d | (n) << 8 | (m) << 4)
+#define SH_SHLL2(n)		(0x4008 | (n) << 8)
+#define SH_SHLL8(n)		(0x4018 | (n) << 8)
+#define SH_CMPEQ(m, n)		(0x3000 | (n) << 8 | (m) << 4)
+#define SH_CMPHS(m, n)		(0x3002 | (n) << 8 | (m) << 4)
+#define SH_CMPHI(m, n)		(0x3006 | (n) << 8 | (m) << 4)
+#define SH_BT(d)		(0x8900 | ((d) & 0xff))
+#define SH_BF(d)		(0x8b00 | ((d) & 0xff))
+#define SH_BRA(d)		(0xa000 | ((d) & 0xfff))
+#define SH_BRAF(m)		(0x0023 | (m) << 8)
+#define SH_JSR(m)		(0x400b | (m) << 8)
+
+/* Upper bound of the code generated for one BPF instruction */
+#define MAX_INSN_SIZE	192
+
+/* cleanup code, then the stub returning 0 */
+#define EPILOGUE_LEN	18
+
+#define EMIT(insn)	do { *(u16 *)prog = (insn); prog += 2; } while (0)
+
+/* offset in the image of the byte about to be emitted */
+#define CUR_POS		(pos + (prog - start))
+
+static inline bool is_imm8(int value)
+{
+	return value <= 127 && value >= -128;
+}
+
+/* branch displacement in instructions, from the branch at @from */
+static inline int disp(unsigned int from, unsigned int target)
+{
+	return ((int)target - (int)(from + 4)) >> 1;
+}
+
+/*
+ * Embed @value at image offset @pos, after a "mov.l @(1,pc),Rn" and two
+ * more instructions.  mov.l needs the literal 4 bytes aligned, so a nop
+ * pads it before or after: the sequence has the same length wherever
+ * it lands.
+ */
+static u8 *emit_literal(u8 *prog, unsigned int pos, u32 value)
+{
+	if (pos & 2)
+		EMIT(SH_NOP);
+	put_unaligned(value, (u32 *)prog);
+	prog += 4;
+	if (!(pos & 2))
+		EMIT(SH_NOP);
+	return prog;
+}
+
+/* Rn = K */
+static u8 *emit_mov_imm(u8 *prog, unsigned int pos, int reg, u32 K)
+{
+	u8 *start = prog;
+
+	if (is_imm8(K)) {
+		EMIT(SH_MOVI(K, reg));
+	} else if (K <= 0xff) {
+		EMIT(SH_MOVI(K, reg));
+		EMIT(SH_EXTUB(reg, reg));
+	} else {
+		EMIT(SH_MOVL_PC(1, reg));
+		EMIT(SH_BRA(3));
+		EMIT(SH_NOP);
+		prog = emit_literal(prog, CUR_POS, K);
+	}
+	return prog;
+}
+
+/* jump to the image offset @target */
+static u8 *emit_jmp(u8 *prog, unsigned int pos, unsigned int target)
+{
+	u8 *start = prog;
+	int d = disp(pos, target);
+
+	if (d >= -2048 && d <= 2047) {
+		EMIT(SH_BRA(d));
+		EMIT(SH_NOP);
+	} else {
+		/* braf is relative to its own address + 4 */
+		u32 off = target - (pos + 6);
+
+		EMIT(SH_MOVL_PC(1, R1));
+		EMIT(SH_BRAF(R1));
+		EMIT(SH_NOP);
+		prog = emit_literal(prog, CUR_POS, off);
+	}
+	return prog;
+}
+
+/* jump to the image offset @target if T is @cond */
+static u8 *emit_cond_jmp(u8 *prog, unsigned int pos, bool cond,
+			 unsigned int target)
+{
+	u8 *start = prog;
+	int d = disp(pos, target);
+
+	if (d >= -128 && d <= 127) {
+		EMIT(cond ? SH_BT(d) : SH_BF(d));
+		return prog;
+	}
+	d = disp(pos + 2, target);
+	if (d >= -2048 && d <= 2047) {
+		EMIT(cond ? SH_BF(1) : SH_BT(1));
+		EMIT(SH_BRA(d));
+		EMIT(SH_NOP);
+	} else {
+		u32 off = target - (pos + 8);
+
+		EMIT(cond ? SH_BF(5) : SH_BT(5));
+		EMIT(SH_MOVL_PC(1, R1));
+		EMIT(SH_BRAF(R1));
+		EMIT(SH_NOP);
+		prog = emit_literal(prog, CUR_POS, off);
+	}
+	return prog;
+}
+
+/* Rn = *(u32 *)(base + off), clobbers r0 for large offsets */
+static u8 *emit_ldl(u8 *prog, unsigned int pos, int base, unsigned int off,
+		    int reg)
+{
+	u8 *start = prog;
+
+	if (off <= 60 && !(off & 3)) {
+		EMIT(SH_MOVL_LD(off >> 2, base, reg));
+	} else {
+		prog = emit_mov_imm(prog, CUR_POS, R0, off);
+		EMIT(SH_MOVL_LD_R0(base, reg));
+	}
+	return prog;
+}
+
+static u8 *emit_call(u8 *prog, unsigned int pos, void *func)
+{
+	u8 *start = prog;
+
+	prog = emit_mov_imm(prog, CUR_POS, R1, (unsigned long)func);
+	EMIT(SH_JSR(R1));
+	EMIT(SH_NOP);
+	return prog;
+}
+
+/*
+ * Rn = the @size bytes at skb->data + r0, big endian.
+ * Clobbers r0 and r1.
+ */
+static u8 *emit_load_bytes(u8 *prog, int size, int reg)
+{
+	int i;
+
+	EMIT(SH_MOVB_LD_R0(REG_DATA, reg));
+	EMIT(SH_EXTUB(reg, reg));
+	for (i = 1; i < size; i++) {
+		EMIT(SH_ADDI(1, R0));
+		EMIT(SH_MOVB_LD_R0(REG_DATA, R1));
+		EMIT(SH_EXTUB(R1, R1));
+		EMIT(SH_SHLL8(reg));
+		EMIT(SH_OR(R1, reg));
+	}
+	return prog;
+}
+
+/*
+ * Rn = bpf_jit_load_slow(skb, k, size, regs) result, returning 0 from
+ * the filter if it fails.  k is K, or r0 if @k_in_r0.
+ */
+static u8 *emit_load_slow(u8 *prog, unsigned int pos, int size, bool k_in_r0,
+			  u32 K, int reg, unsigned int ret0_addr)
+{
+	u8 *start = prog;
+
+	if (k_in_r0)
+		EMIT(SH_MOV(R0, R5));
+	else
+		prog = emit_mov_imm(prog, CUR_POS, R5, K);
+	EMIT(SH_MOV(R15, R7));
+	EMIT(SH_ADDI(REGS_OFF, R7));
+	EMIT(SH_MOVL_ST(REG_A, 0, R7));
+	EMIT(SH_MOVL_ST(REG_X, 1, R7));
+	EMIT(SH_MOV(REG_SKB, R4));
+	EMIT(SH_MOVI(size, R6));
+	prog = emit_call(prog, CUR_POS, bpf_jit_load_slow);
+	EMIT(SH_TST(R0, R0));
+	prog = emit_cond_jmp(prog, CUR_POS, true, ret0_addr);
+	EMIT(SH_MOVI(RES_OFF, R0));
+	EMIT(SH_MOVL_LD_R0(R15, reg));
+	return prog;
+}
+
+/* patch the bt/bf/bra at @insn to branch to @prog */
+static inline void fixup_branch(u8 *insn, u8 *prog)
+{
+	u16 *op = (u16 *)insn;
+	int d = (prog - (insn + 4)) >> 1;
+
+	if ((*op & 0xf000) == 0xa000)
+		*op |= d & 0xfff;
+	else
+		*op |= d & 0xff;
+}
+
+static int bpf_load_size(u16 code)
+{
+	switch (BPF_SIZE(code)) {
+	case BPF_W:
+		return 4;
+	case BPF_H:
+		return 2;
+	default:
+		return 1;
+	}
+}
+
+static u32 bpf_jit_udiv(u32 a, u32 b)
+{
+	return a / b;
+}
+
+static void bpf_jit_dump(unsigned int flen, unsigned int proglen,
+			 u32 pass, void *image)
+{
+	printk(KERN_ERR "flen=%u proglen=%u pass=%u image=%p\n",
+	       flen, proglen, pass, image);
+	if (image)
+		print_hex_dump(KERN_ERR, "JIT code: ", DUMP_PREFIX_ADDRESS,
+			       16, 2, image, proglen, false);
+}
+
+void bpf_jit_compile(struct sk_filter *fp)
+{
+	u8 temp[MAX_INSN_SIZE + 64] __aligned(4);
+	u8 *prog, *start, *fix_slow, *fix_slow2, *fix_done;
+	unsigned int pos, proglen, oldproglen = 0;
+	int ilen, i;
+	unsigned int t_target, f_target;
+	bool t_cond;
+	u8 *image = NULL;
+	unsigned int *addrs;
+	unsigned int cleanup_addr;	/* epilogue code offset */
+	unsigned int ret0_addr;		/* "return 0" stub offset */
+	unsigned int mem_loaded = 0;	/* scratch words read by the filter */
+	struct sock_filter *filter = fp->insns;
+	int flen = fp->len;
+	int pass, size;
+
+	if (!bpf_jit_enable)
+		return;
+
+	addrs = kmalloc(flen * sizeof(*addrs), GFP_KERNEL);
+	if (addrs == NULL)
+		return;
+
+	/*
+	 * sk_chk_filter() lets a filter load scratch words it never stored.
+	 * Clear the ones it loads so that it cannot read stale kernel stack.
+	 */
+	for (i = 0; i < flen; i++) {
+		switch (filter[i].code) {
+		case BPF_LD|BPF_MEM:
+		case BPF_LDX|BPF_MEM:
+			mem_loaded |= 1 << filter[i].k;
+			break;
+		}
+	}
+
+	/* Before first pass, make a rough estimation of addrs[]
+	 * each bpf instruction is translated to less than MAX_INSN_SIZE bytes
+	 */
+	for (proglen = 0, i = 0; i < flen; i++) {
+		proglen += MAX_INSN_SIZE;
+		addrs[i] = proglen;
+	}
+	cleanup_addr = proglen; /* epilogue address */
+	ret0_addr = cleanup_addr + EPILOGUE_LEN;
+
+	/* once the image is allocated, one more pass fills it */
+	for (pass = 0; pass < 10 || image; pass++) {
+		/* prologue */
+		pos = 0;
+		prog = start = temp;
+
+		EMIT(SH_MOVL_PUSH(REG_A));
+		EMIT(SH_MOVL_PUSH(REG_X));
+		EMIT(SH_MOVL_PUSH(REG_SKB));
+		EMIT(SH_MOVL_PUSH(REG_DATA));
+		EMIT(SH_MOVL_PUSH(REG_HLEN));
+		EMIT(SH_STSL_PR_PUSH);
+		EMIT(SH_ADDI(-STACK_SIZE, R15));
+
+		EMIT(SH_MOV(R4, REG_SKB));
+		prog = emit_ldl(prog, CUR_POS, REG_SKB,
+				offsetof(struct sk_buff, len), REG_HLEN);
+		prog = emit_ldl(prog, CUR_POS, REG_SKB,
+				offsetof(struct sk_buff, data_len), R1);
+		EMIT(SH_SUB(R1, REG_HLEN));
+		prog = emit_ldl(prog, CUR_POS, REG_SKB,
+				offsetof(struct sk_buff, data), REG_DATA);
+		EMIT(SH_MOVI(0, REG_A));
+		EMIT(SH_MOVI(0, REG_X));
+		for (i = 0; i < BPF_MEMWORDS; i++)
+			if (mem_loaded & (1 << i))
+				EMIT(SH_MOVL_ST(REG_A, i, R15));
+
+		ilen = prog - temp;
+		if (image)
+			memcpy(image, temp, ilen);
+		proglen = ilen;
+
+		for (i = 0; i < flen; i++) {
+			unsigned int K = filter[i].k;
+
+			pos = proglen;
+			prog = start = temp;
+
+			switch (filter[i].code) {
+			case BPF_ALU|BPF_ADD|BPF_X: /* A += X; */
+				EMIT(SH_ADD(REG_X, REG_A));
+				break;
+			case BPF_ALU|BPF_ADD|BPF_K: /* A += K; */
+				if (!K)
+					break;
+				if (is_imm8(K)) {
+					EMIT(SH_ADDI(K, REG_A));
+					break;
+				}
+				prog = emit_mov_imm(prog, CUR_POS, R1, K);
+				EMIT(SH_ADD(R1, REG_A));
+				break;
+			case BPF_ALU|BPF_SUB|BPF_X: /* A -= X; */
+				EMIT(SH_SUB(REG_X, REG_A));
+				break;
+			case BPF_ALU|BPF_SUB|BPF_K: /* A -= K; */
+				if (!K)
+					break;
+				if (is_imm8(-K)) {
+					EMIT(SH_ADDI(-K, REG_A));
+					break;
+				}
+				prog = emit_mov_imm(prog, CUR_POS, R1, K);
+				EMIT(SH_SUB(R1, REG_A));
+				break;
+			case BPF_ALU|BPF_MUL|BPF_X: /* A *= X; */
+				EMIT(SH_MULL(REG_X, REG_A));
+				EMIT(SH_STS_MACL(REG_A));
+				break;
+			case BPF_ALU|BPF_MUL|BPF_K: /* A *= K; */
+				prog = emit_mov_imm(prog, CUR_POS, R1, K);
+				EMIT(SH_MULL(R1, REG_A));
+				EMIT(SH_STS_MACL(REG_A));
+				break;
+			case BPF_ALU|BPF_DIV|BPF_X: /* A /= X; */
+				EMIT(SH_TST(REG_X, REG_X));
+				prog = emit_cond_jmp(prog, CUR_POS, true, ret0_addr);
+				EMIT(SH_MOV(REG_A, R4));
+				EMIT(SH_MOV(REG_X, R5));
+				prog = emit_call(prog, CUR_POS, bpf_jit_udiv);
+				EMIT(SH_MOV(R0, REG_A));
+				break;
+			case BPF_ALU|BPF_DIV|BPF_K: /* A /= K; */
+				if (K == 1)
+					break;
+				if (!(K & (K - 1))) {
+					/* shld by a negative count shifts right */
+					EMIT(SH_MOVI(-ilog2(K), R1));
+					EMIT(SH_SHLD(R1, REG_A));
+					break;
+				}
+				EMIT(SH_MOV(REG_A, R4));
+				prog = emit_mov_imm(prog, CUR_POS, R5, K);
+				prog = emit_call(prog, CUR_POS, bpf_jit_udiv);
+				EMIT(SH_MOV(R0, REG_A));
+				break;
+			case BPF_ALU|BPF_AND|BPF_X:
+				EMIT(SH_AND(REG_X, REG_A));
+				break;
+			case BPF_ALU|BPF_AND|BPF_K:
+				if (K <= 0xff) {
+					EMIT(SH_MOV(REG_A, R0));
+					EMIT(SH_ANDI(K));
+					EMIT(SH_MOV(R0, REG_A));
+					break;
+				}
+				prog = emit_mov_imm(prog, CUR_POS, R1, K);
+				EMIT(SH_AND(R1, REG_A));
+				break;
+			case BPF_ALU|BPF_OR|BPF_X:
+				EMIT(SH_OR(REG_X, REG_A));
+				break;
+			case BPF_ALU|BPF_OR|BPF_K:
+				if (K <= 0xff) {
+					EMIT(SH_MOV(REG_A, R0));
+					EMIT(SH_ORI(K));
+					EMIT(SH_MOV(R0, REG_A));
+					break;
+				}
+				prog = emit_mov_imm(prog, CUR_POS, R1, K);
+				EMIT(SH_OR(R1, REG_A));
+				break;
+			/*
+			 * Shifts use shld like the compiled sk_run_filter()
+			 * does, so counts of 32 and more behave the same.
+			 */
+			case BPF_ALU|BPF_LSH|BPF_X: /* A <<= X; */
+				EMIT(SH_SHLD(REG_X, REG_A));
+				break;
+			case BPF_ALU|BPF_LSH|BPF_K:
+				if (!K)
+					break;
+				prog = emit_mov_imm(prog, CUR_POS, R1, K);
+				EMIT(SH_SHLD(R1, REG_A));
+				break;
+			case BPF_ALU|BPF_RSH|BPF_X: /* A >>= X; */
+				EMIT(SH_NEG(REG_X, R1));
+				EMIT(SH_SHLD(R1, REG_A));
+				break;
+			case BPF_ALU|BPF_RSH|BPF_K: /* A >>= K; */
+				if (!K)
+					break;
+				prog = emit_mov_imm(prog, CUR_POS, R1, -K);
+				EMIT(SH_SHLD(R1, REG_A));
+				break;
+			case BPF_ALU|BPF_NEG:
+				EMIT(SH_NEG(REG_A, REG_A));
+				break;
+			case BPF_RET|BPF_K:
+				prog = emit_mov_imm(prog, CUR_POS, REG_A, K);
+				/* fallinto */
+			case BPF_RET|BPF_A:
+				if (i != flen - 1)
+					prog = emit_jmp(prog, CUR_POS, cleanup_addr);
+				break;
+			case BPF_MISC|BPF_TAX: /* X = A */
+				EMIT(SH_MOV(REG_A, REG_X));
+				break;
+			case BPF_MISC|BPF_TXA: /* A = X */
+				EMIT(SH_MOV(REG_X, REG_A));
+				break;
+			case BPF_LD|BPF_IMM: /* A = K */
+				prog = emit_mov_imm(prog, CUR_POS, REG_A, K);
+				break;
+			case BPF_LDX|BPF_IMM: /* X = K */
+				prog = emit_mov_imm(prog, CUR_POS, REG_X, K);
+				break;
+			case BPF_LD|BPF_MEM: /* A = mem[K] */
+				EMIT(SH_MOVL_LD(K, R15, REG_A));
+				break;
+			case BPF_LDX|BPF_MEM: /* X = mem[K] */
+				EMIT(SH_MOVL_LD(K, R15, REG_X));
+				break;
+			case BPF_ST: /* mem[K] = A */
+				EMIT(SH_MOVL_ST(REG_A, K, R15));
+				break;
+			case BPF_STX: /* mem[K] = X */
+				EMIT(SH_MOVL_ST(REG_X, K, R15));
+				break;
+			case BPF_LD|BPF_W|BPF_LEN: /* A = skb->len; */
+				prog = emit_ldl(prog, CUR_POS, REG_SKB,
+						offsetof(struct sk_buff, len), REG_A);
+				break;
+			case BPF_LDX|BPF_W|BPF_LEN: /* X = skb->len; */
+				prog = emit_ldl(prog, CUR_POS, REG_SKB,
+						offsetof(struct sk_buff, len), REG_X);
+				break;
+			case BPF_LD|BPF_W|BPF_ABS:
+			case BPF_LD|BPF_H|BPF_ABS:
+			case BPF_LD|BPF_B|BPF_ABS:
+				size = bpf_load_size(filter[i].code);
+				fix_done = NULL;
+				if ((int)K >= 0) {
+					/* headlen > K + size - 1 : cmp/hi */
+					prog = emit_mov_imm(prog, CUR_POS, R1,
+							    K + size - 1);
+					EMIT(SH_CMPHI(R1, REG_HLEN));
+					fix_slow = prog;
+					EMIT(SH_BF(0));
+					prog = emit_mov_imm(prog, CUR_POS, R0, K);
+					prog = emit_load_bytes(prog, size, REG_A);
+					fix_done = prog;
+					EMIT(SH_BRA(0));
+					EMIT(SH_NOP);
+					fixup_branch(fix_slow, prog);
+				} else if ((int)K >= SKF_AD_OFF) {
+					switch (K - SKF_AD_OFF) {
+					case SKF_AD_PROTOCOL:
+						prog = emit_mov_imm(prog, CUR_POS, R0,
+							offsetof(struct sk_buff, protocol));
+						EMIT(SH_MOVW_LD_R0(REG_SKB, REG_A));
+#ifdef CONFIG_CPU_LITTLE_ENDIAN
+						EMIT(SH_SWAPB(REG_A, REG_A)); /* ntohs() */
+#endif
+						EMIT(SH_EXTUW(REG_A, REG_A));
+						goto next;
+					case SKF_AD_IFINDEX:
+						prog = emit_ldl(prog, CUR_POS, REG_SKB,
+							offsetof(struct sk_buff, dev), R1);
+						EMIT(SH_TST(R1, R1));
+						prog = emit_cond_jmp(prog, CUR_POS, true,
+								     ret0_addr);
+						prog = emit_ldl(prog, CUR_POS, R1,
+							offsetof(struct net_device, ifindex),
+							REG_A);
+						goto next;
+					}
+				}
+				/* ancillary data and negative offsets */
+				prog = emit_load_slow(prog, CUR_POS, size, false, K,
+						      REG_A, ret0_addr);
+				if (fix_done)
+					fixup_branch(fix_done, prog);
+				break;
+			case BPF_LD|BPF_W|BPF_IND:
+			case BPF_LD|BPF_H|BPF_IND:
+			case BPF_LD|BPF_B|BPF_IND:
+				size = bpf_load_size(filter[i].code);
+				if (K) {
+					prog = emit_mov_imm(prog, CUR_POS, R0, K);
+					EMIT(SH_ADD(REG_X, R0));
+				} else {
+					EMIT(SH_MOV(REG_X, R0));
+				}
+				/* headlen >= k && headlen - k > size - 1 */
+				EMIT(SH_MOV(REG_HLEN, R1));
+				EMIT(SH_CMPHS(R0, REG_HLEN));
+				fix_slow = prog;
+				EMIT(SH_BF(0));
+				EMIT(SH_SUB(R0, R1));
+				EMIT(SH_MOVI(size - 1, R2));
+				EMIT(SH_CMPHI(R2, R1));
+				fix_slow2 = prog;
+				EMIT(SH_BF(0));
+				prog = emit_load_bytes(prog, size, REG_A);
+				fix_done = prog;
+				EMIT(SH_BRA(0));
+				EMIT(SH_NOP);
+				fixup_branch(fix_slow, prog);
+				fixup_branch(fix_slow2, prog);
+				prog = emit_load_slow(prog, CUR_POS, size, true, 0,
+						      REG_A, ret0_addr);
+				fixup_branch(fix_done, prog);
+				break;
+			case BPF_LDX|BPF_B|BPF_MSH: /* X = 4 * (P[K] & 0xf) */
+				if ((int)K < 0 && (int)K >= SKF_AD_OFF) {
+					/* sk_run_filter() has no ancillary data here */
+					prog = emit_jmp(prog, CUR_POS, ret0_addr);
+					break;
+				}
+				fix_done = NULL;
+				if ((int)K >= 0) {
+					prog = emit_mov_imm(prog, CUR_POS, R1, K);
+					EMIT(SH_CMPHI(R1, REG_HLEN));
+					fix_slow = prog;
+					EMIT(SH_BF(0));
+					prog = emit_mov_imm(prog, CUR_POS, R0, K);
+					EMIT(SH_MOVB_LD_R0(REG_DATA, R0));
+					fix_done = prog;
+					EMIT(SH_BRA(0));
+					EMIT(SH_NOP);
+					fixup_branch(fix_slow, prog);
+				}
+				prog = emit_load_slow(prog, CUR_POS, 1, false, K,
+						      R0, ret0_addr);
+				if (fix_done)
+					fixup_branch(fix_done, prog);
+				EMIT(SH_ANDI(0x0f));
+				EMIT(SH_SHLL2(R0));
+				EMIT(SH_MOV(R0, REG_X));
+				break;
+			case BPF_JMP|BPF_JA:
+				if (K)
+					prog = emit_jmp(prog, CUR_POS, addrs[i + K]);
+				break;
+			case BPF_JMP|BPF_JGT|BPF_K:
+			case BPF_JMP|BPF_JGT|BPF_X:
+			case BPF_JMP|BPF_JGE|BPF_K:
+			case BPF_JMP|BPF_JGE|BPF_X:
+			case BPF_JMP|BPF_JEQ|BPF_K:
+			case BPF_JMP|BPF_JEQ|BPF_X:
+			case BPF_JMP|BPF_JSET|BPF_K:
+			case BPF_JMP|BPF_JSET|BPF_X:
+				t_target = addrs[i + filter[i].jt];
+				f_target = addrs[i + filter[i].jf];
+
+				/* same targets, can avoid doing the test :) */
+				if (filter[i].jt == filter[i].jf) {
+					if (filter[i].jt)
+						prog = emit_jmp(prog, CUR_POS, t_target);
+					break;
+				}
+
+				/* T is set when the condition holds, but tst
+				 * sets it when A & K is 0
+				 */
+				t_cond = true;
+				switch (filter[i].code) {
+				case BPF_JMP|BPF_JGT|BPF_X:
+					EMIT(SH_CMPHI(REG_X, REG_A));
+					break;
+				case BPF_JMP|BPF_JGE|BPF_X:
+					EMIT(SH_CMPHS(REG_X, REG_A));
+					break;
+				case BPF_JMP|BPF_JEQ|BPF_X:
+					EMIT(SH_CMPEQ(REG_X, REG_A));
+					break;
+				case BPF_JMP|BPF_JSET|BPF_X:
+					EMIT(SH_TST(REG_X, REG_A));
+					t_cond = false;
+					break;
+				case BPF_JMP|BPF_JGT|BPF_K:
+					prog = emit_mov_imm(prog, CUR_POS, R1, K);
+					EMIT(SH_CMPHI(R1, REG_A));
+					break;
+				case BPF_JMP|BPF_JGE|BPF_K:
+					prog = emit_mov_imm(prog, CUR_POS, R1, K);
+					EMIT(SH_CMPHS(R1, REG_A));
+					break;
+				case BPF_JMP|BPF_JEQ|BPF_K:
+					if (K == 0) {
+						EMIT(SH_TST(REG_A, REG_A));
+						break;
+					}
+					prog = emit_mov_imm(prog, CUR_POS, R1, K);
+					EMIT(SH_CMPEQ(R1, REG_A));
+					break;
+				case BPF_JMP|BPF_JSET|BPF_K:
+					if (K <= 0xff) {
+						EMIT(SH_MOV(REG_A, R0));
+						EMIT(SH_TSTI(K));
+					} else {
+						prog = emit_mov_imm(prog, CUR_POS, R1, K);
+						EMIT(SH_TST(R1, REG_A));
+					}
+					t_cond = false;
+					break;
+				}
+				if (filter[i].jt != 0) {
+					prog = emit_cond_jmp(prog, CUR_POS, t_cond,
+							     t_target);
+					if (filter[i].jf)
+						prog = emit_jmp(prog, CUR_POS, f_target);
+					break;
+				}
+				prog = emit_cond_jmp(prog, CUR_POS, !t_cond, f_target);
+				break;
+			default:
+				/* hmm, too complex filter, give up with jit compiler */
+				goto out;
+			}
+next:
+			ilen = prog - temp;
+			if (image) {
+				if (unlikely(proglen + ilen > oldproglen)) {
+					printk(KERN_ERR "bpf_jit_compile fatal error\n");
+					kfree(addrs);
+					module_free(NULL, image);
+					return;
+				}
+				memcpy(image + proglen, temp, ilen);
+			}
+			proglen += ilen;
+			addrs[i] = proglen;
+		}
+		/* last bpf instruction is always a RET :
+		 * use it to give the cleanup instruction(s) addr
+		 */
+		cleanup_addr = proglen;
+		ret0_addr = cleanup_addr + EPILOGUE_LEN;
+
+		pos = proglen;
+		prog = start = temp;
+		EMIT(SH_MOV(REG_A, R0));
+		EMIT(SH_ADDI(STACK_SIZE, R15));
+		EMIT(SH_LDSL_PR_POP);
+		EMIT(SH_MOVL_POP(REG_HLEN));
+		EMIT(SH_MOVL_POP(REG_DATA));
+		EMIT(SH_MOVL_POP(REG_SKB));
+		EMIT(SH_MOVL_POP(REG_X));
+		EMIT(SH_RTS);
+		EMIT(SH_MOVL_POP(REG_A));	/* in the delay slot */
+		/* return 0 */
+		EMIT(SH_BRA(disp(CUR_POS, cleanup_addr)));
+		EMIT(SH_MOVI(0, REG_A));	/* in the delay slot */
+		ilen = prog - temp;
+		if (image)
+			memcpy(image + proglen, temp, ilen);
+		proglen += ilen;
+
+		if (image) {
+			if (unlikely(proglen != oldproglen))
+				goto fatal;
+			break;
+		}
+		if (proglen == oldproglen) {
+			image = module_alloc(max_t(unsigned int,
+						   proglen,
+						   sizeof(struct work_struct)));
+			if (!image)
+				goto out;
+		}
+		oldproglen = proglen;
+	}
+	if (bpf_jit_enable > 1)
+		bpf_jit_dump(flen, proglen, pass, image);
+
+	if (image) {
+		flush_icache_range((unsigned long)image,
+				   (unsigned long)image + proglen);
+		fp->bpf_func = (void *)image;
+	}
+out:
+	kfree(addrs);
+	return;
+
+fatal:
+	printk(KERN_ERR "bpf_jit_compile fatal error\n");
+	kfree(addrs);
+	module_free(NULL, image);
+}
+EXPORT_SYMBOL_GPL(bpf_jit_compile);
+
+static void jit_free_defer(struct work_struct *arg)
+{
+	module_free(NULL, arg);
+}
+
+/* run from softirq, we must use a work_struct to call
+ * module_free() from process context
+ */
+void bpf_jit_free(struct sk_filter *fp)
+{
+	if (fp->bpf_func) {
+		struct work_struct *work = (struct work_struct *)fp->bpf_func;
+
+		INIT_WORK(work, jit_free_defer);
+		schedule_work(work);
+	}
+}
+EXPORT_SYMBOL_GPL(bpf_jit_free);
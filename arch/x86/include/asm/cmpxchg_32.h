@@ -316,4 +316,25 @@ extern unsigned long long cmpxchg_486_u64(volatile void *, u64, u64);
 
 #endif
 
+/*
+ * Compare and exchange the two adjacent words at p1 and p2, with p1
+ * 8 byte aligned, atomically with respect to this cpu only.  Returns
+ * true if both words matched and were replaced.
+ */
+#define cmpxchg_double_local(p1, p2, o1, o2, n1, n2)			\
+({									\
+	bool __ret;							\
+	__typeof__(*(p1)) __old1 = (o1), __new1 = (n1);			\
+	__typeof__(*(p2)) __old2 = (o2), __new2 = (n2);			\
+	BUILD_BUG_ON(sizeof(*(p1)) != 4);				\
+	BUILD_BUG_ON(sizeof(*(p2)) != 4);				\
+	asm volatile("cmpxchg8b %2; sete %0"				\
+		     : "=a" (__ret), "+d" (__old2),			\
+		       "+m" (*(p1)), "+m" (*(p2))			\
+		     : "a" (__old1), "b" (__new1), "c" (__new2));	\
+	__ret;								\
+})
+
+#define system_has_cmpxchg_double() boot_cpu_has(X86_FEATURE_CX8)
+
 #endif /* _ASM_X86_CMPXCHG_32_H */
@@ -0,0 +1,684 @@
+/*
+ * BPF JIT compiler for x86_64
+ *
+ * Translates socket filters that passed sk_chk_filter() into native
+ * code.  The linear head of the skb is read inline; every other packet
+ * or ancillary load goes through bpf_jit_load_slow(), so the generated
+ * code returns exactly what sk_run_filter() would.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+#include <linux/moduleloader.h>
+#include <linux/netdevice.h>
+#include <linux/filter.h>
+#include <linux/workqueue.h>
+#include <linux/slab.h>
+#include <asm/cacheflush.h>
+
+int bpf_jit_enable __read_mostly;
+EXPORT_SYMBOL_GPL(bpf_jit_enable);
+
+/*
+ * Register usage of the generated code:
+ *  eax	A
+ *  ebx	X
+ *  r12d	skb headlen (len - data_len)
+ *  r14	skb
+ *  r15	skb->data
+ * rcx, rdx, rsi and rdi are scratch.
+ *
+ * Frame, below the saved rbp:
+ *  rbp - 32	saved rbx, r12, r14, r15
+ *  rbp - 48	A, X and result words handed to bpf_jit_load_slow()
+ *  rbp - 112	BPF_MEMWORDS scratch memory words
+ */
+#define REGS_OFF	-48
+#define RES_OFF		(REGS_OFF + 8)
+#define MEM_OFF		(REGS_OFF - BPF_MEMWORDS * 4)
+#define STACK_SIZE	80	/* keeps rsp 16 bytes aligned for calls */
+
+/* Upper bound of the code generated for one BPF instruction */
+#define MAX_INSN_SIZE	128
+
+static inline u8 *emit_code(u8 *ptr, u32 bytes, unsigned int len)
+{
+	if (len == 1)
+		*ptr = bytes;
+	else if (len == 2)
+		*(u16 *)ptr = bytes;
+	else {
+		*(u32 *)ptr = bytes;
+		barrier();
+	}
+	return ptr + len;
+}
+
+#define EMIT(bytes, len)	do { prog = emit_code(prog, bytes, len); } while (0)
+
+#define EMIT1(b1)		EMIT(b1, 1)
+#define EMIT2(b1, b2)		EMIT((b1) + ((b2) << 8), 2)
+#define EMIT3(b1, b2, b3)	EMIT((b1) + ((b2) << 8) + ((b3) << 16), 3)
+#define EMIT4(b1, b2, b3, b4)	EMIT((b1) + ((b2) << 8) + ((b3) << 16) + ((b4) << 24), 4)
+#define EMIT1_off32(b1, off)	do { EMIT1(b1); EMIT(off, 4); } while (0)
+#define EMIT2_off32(b1, b2, off) do { EMIT2(b1, b2); EMIT(off, 4); } while (0)
+#define EMIT3_off32(b1, b2, b3, off) do { EMIT3(b1, b2, b3); EMIT(off, 4); } while (0)
+#define EMIT4_off32(b1, b2, b3, b4, off) \
+	do { EMIT4(b1, b2, b3, b4); EMIT(off, 4); } while (0)
+
+#define CLEAR_A()	EMIT2(0x31, 0xc0)	/* xor %eax,%eax */
+#define CLEAR_X()	EMIT2(0x31, 0xdb)	/* xor %ebx,%ebx */
+
+static inline bool is_imm8(int value)
+{
+	return value <= 127 && value >= -128;
+}
+
+static inline bool is_near(int offset)
+{
+	return offset <= 127 && offset >= -128;
+}
+
+/* offset in the image of the byte about to be emitted */
+#define CUR_POS		(proglen + (prog - temp))
+
+/* jmp to the image offset @target */
+#define EMIT_JMP_TO(target)						\
+do {									\
+	int __off = (target) - (CUR_POS + 2);				\
+	if (is_near(__off))						\
+		EMIT2(0xeb, __off);		/* jmp .+off8 */	\
+	else {								\
+		__off = (target) - (CUR_POS + 5);			\
+		EMIT1_off32(0xe9, __off);	/* jmp .+off32 */	\
+	}								\
+} while (0)
+
+/* jcc to the image offset @target */
+#define EMIT_COND_JMP_TO(op, target)					\
+do {									\
+	int __off = (target) - (CUR_POS + 2);				\
+	if (is_near(__off))						\
+		EMIT2(op, __off);		/* jxx .+off8 */	\
+	else {								\
+		__off = (target) - (CUR_POS + 6);			\
+		EMIT2(0x0f, (op) + 0x10);				\
+		EMIT(__off, 4);			/* jxx .+off32 */	\
+	}								\
+} while (0)
+
+/* jcc with a 32 bit offset, so the size does not depend on @target */
+#define EMIT_COND_JMP32_TO(op, target)					\
+do {									\
+	int __off = (target) - (CUR_POS + 6);				\
+	EMIT2(0x0f, (op) + 0x10);					\
+	EMIT(__off, 4);							\
+} while (0)
+
+/* return 0 from the filter, always 7 bytes */
+#define EMIT_RET0()							\
+do {									\
+	int __off;							\
+	CLEAR_A();							\
+	__off = cleanup_addr - (CUR_POS + 5);				\
+	EMIT1_off32(0xe9, __off);					\
+} while (0)
+
+#define X86_JAE 0x73
+#define X86_JE  0x74
+#define X86_JNE 0x75
+#define X86_JBE 0x76
+#define X86_JA  0x77
+#define X86_JB  0x72
+
+/*
+ * Call bpf_jit_load_slow(skb, %esi, size, regs) and return 0 from the
+ * filter if it fails.  Always 31 bytes.
+ */
+#define SLOW_LEN	31
+#define EMIT_LOAD_SLOW(size)						\
+do {									\
+	int __off;							\
+	EMIT1_off32(0xba, size);		/* mov $size,%edx */	\
+	EMIT3(0x89, 0x45, REGS_OFF);		/* mov %eax,A(%rbp) */	\
+	EMIT3(0x89, 0x5d, REGS_OFF + 4);	/* mov %ebx,X(%rbp) */	\
+	EMIT3(0x4c, 0x89, 0xf7);		/* mov %r14,%rdi */	\
+	EMIT4(0x48, 0x8d, 0x4d, REGS_OFF);	/* lea regs(%rbp),%rcx */ \
+	__off = image ? (u8 *)bpf_jit_load_slow -			\
+			(image + CUR_POS + 5) : 0;			\
+	EMIT1_off32(0xe8, __off);		/* call */		\
+	EMIT2(0x85, 0xc0);			/* test %eax,%eax */	\
+	EMIT_COND_JMP32_TO(X86_JE, cleanup_addr); /* A is 0 */		\
+} while (0)
+
+static int bpf_load_size(u16 code)
+{
+	switch (BPF_SIZE(code)) {
+	case BPF_W:
+		return 4;
+	case BPF_H:
+		return 2;
+	default:
+		return 1;
+	}
+}
+
+/* mov off32(%r15),%eax, movzwl or movzbl, then to host order */
+static u8 *emit_load_abs(u8 *prog, int size, u32 K)
+{
+	switch (size) {
+	case 4:
+		EMIT3_off32(0x41, 0x8b, 0x87, K);	/* mov off32(%r15),%eax */
+		EMIT2(0x0f, 0xc8);			/* bswap %eax */
+		break;
+	case 2:
+		EMIT4_off32(0x41, 0x0f, 0xb7, 0x87, K);	/* movzwl off32(%r15),%eax */
+		EMIT2(0x86, 0xc4);			/* xchg %al,%ah */
+		break;
+	default:
+		EMIT4_off32(0x41, 0x0f, 0xb6, 0x87, K);	/* movzbl off32(%r15),%eax */
+		break;
+	}
+	return prog;
+}
+
+static const int abs_load_len[5] = { [1] = 8, [2] = 10, [4] = 9 };
+
+/* same, from (%r15,%rsi) */
+static u8 *emit_load_ind(u8 *prog, int size)
+{
+	switch (size) {
+	case 4:
+		EMIT4(0x41, 0x8b, 0x04, 0x37);		/* mov (%r15,%rsi),%eax */
+		EMIT2(0x0f, 0xc8);			/* bswap %eax */
+		break;
+	case 2:
+		EMIT1(0x41);
+		EMIT4(0x0f, 0xb7, 0x04, 0x37);		/* movzwl (%r15,%rsi),%eax */
+		EMIT2(0x86, 0xc4);			/* xchg %al,%ah */
+		break;
+	default:
+		EMIT1(0x41);
+		EMIT4(0x0f, 0xb6, 0x04, 0x37);		/* movzbl (%r15,%rsi),%eax */
+		break;
+	}
+	return prog;
+}
+
+static const int ind_load_len[5] = { [1] = 5, [2] = 7, [4] = 6 };
+
+static void bpf_jit_dump(unsigned int flen, unsigned int proglen,
+			 u32 pass, void *image)
+{
+	printk(KERN_ERR "flen=%u proglen=%u pass=%u image=%p\n",
+	       flen, proglen, pass, image);
+	if (image)
+		print_hex_dump(KERN_ERR, "JIT code: ", DUMP_PREFIX_ADDRESS,
+			       16, 1, image, proglen, false);
+}
+
+void bpf_jit_compile(struct sk_filter *fp)
+{
+	u8 temp[MAX_INSN_SIZE + 64];
+	u8 *prog;
+	unsigned int proglen, oldproglen = 0;
+	int ilen, i;
+	unsigned int t_target, f_target;
+	u8 t_op, f_op;
+	u8 *image = NULL;
+	unsigned int *addrs;
+	unsigned int cleanup_addr;	/* epilogue code offset */
+	unsigned int mem_loaded = 0;	/* scratch words read by the filter */
+	struct sock_filter *filter = fp->insns;
+	int flen = fp->len;
+	int pass, size;
+
+	if (!bpf_jit_enable)
+		return;
+
+	addrs = kmalloc(flen * sizeof(*addrs), GFP_KERNEL);
+	if (addrs == NULL)
+		return;
+
+	/*
+	 * sk_chk_filter() lets a filter load scratch words it never stored.
+	 * Clear the ones it loads so that it cannot read stale kernel stack.
+	 */
+	for (i = 0; i < flen; i++) {
+		switch (filter[i].code) {
+		case BPF_LD|BPF_MEM:
+		case BPF_LDX|BPF_MEM:
+			mem_loaded |= 1 << filter[i].k;
+			break;
+		}
+	}
+
+	/* Before first pass, make a rough estimation of addrs[]
+	 * each bpf instruction is translated to less than MAX_INSN_SIZE bytes
+	 */
+	for (proglen = 0, i = 0; i < flen; i++) {
+		proglen += MAX_INSN_SIZE;
+		addrs[i] = proglen;
+	}
+	cleanup_addr = proglen; /* epilogue address */
+
+	/* once the image is allocated, one more pass fills it */
+	for (pass = 0; pass < 10 || image; pass++) {
+		/* prologue */
+		proglen = 0;
+		prog = temp;
+
+		EMIT1(0x55);			/* push %rbp */
+		EMIT3(0x48, 0x89, 0xe5);	/* mov %rsp,%rbp */
+		EMIT1(0x53);			/* push %rbx */
+		EMIT2(0x41, 0x54);		/* push %r12 */
+		EMIT2(0x41, 0x56);		/* push %r14 */
+		EMIT2(0x41, 0x57);		/* push %r15 */
+		EMIT4(0x48, 0x83, 0xec, STACK_SIZE); /* sub $STACK_SIZE,%rsp */
+
+		EMIT3(0x49, 0x89, 0xfe);	/* mov %rdi,%r14 */
+		/* mov skb->len,%r12d */
+		EMIT3_off32(0x44, 0x8b, 0xa7, offsetof(struct sk_buff, len));
+		/* sub skb->data_len,%r12d */
+		EMIT3_off32(0x44, 0x2b, 0xa7,
+			    offsetof(struct sk_buff, data_len));
+		/* mov skb->data,%r15 */
+		EMIT3_off32(0x4c, 0x8b, 0xbf, offsetof(struct sk_buff, data));
+		CLEAR_A();
+		CLEAR_X();
+		for (i = 0; i < BPF_MEMWORDS; i++)
+			if (mem_loaded & (1 << i))
+				/* mov %eax,mem(%rbp) */
+				EMIT3(0x89, 0x45, MEM_OFF + i * 4);
+
+		ilen = prog - temp;
+		if (image)
+			memcpy(image + proglen, temp, ilen);
+		proglen += ilen;
+
+		for (i = 0; i < flen; i++) {
+			unsigned int K = filter[i].k;
+			int slow_len, fast_len;
+
+			prog = temp;
+
+			switch (filter[i].code) {
+			case BPF_ALU|BPF_ADD|BPF_X: /* A += X; */
+				EMIT2(0x01, 0xd8);		/* add %ebx,%eax */
+				break;
+			case BPF_ALU|BPF_ADD|BPF_K: /* A += K; */
+				if (!K)
+					break;
+				if (is_imm8(K))
+					EMIT3(0x83, 0xc0, K);	/* add imm8,%eax */
+				else
+					EMIT1_off32(0x05, K);	/* add imm32,%eax */
+				break;
+			case BPF_ALU|BPF_SUB|BPF_X: /* A -= X; */
+				EMIT2(0x29, 0xd8);		/* sub %ebx,%eax */
+				break;
+			case BPF_ALU|BPF_SUB|BPF_K: /* A -= K */
+				if (!K)
+					break;
+				if (is_imm8(K))
+					EMIT3(0x83, 0xe8, K);	/* sub imm8,%eax */
+				else
+					EMIT1_off32(0x2d, K);	/* sub imm32,%eax */
+				break;
+			case BPF_ALU|BPF_MUL|BPF_X: /* A *= X; */
+				EMIT3(0x0f, 0xaf, 0xc3);	/* imul %ebx,%eax */
+				break;
+			case BPF_ALU|BPF_MUL|BPF_K: /* A *= K */
+				if (is_imm8(K))
+					EMIT3(0x6b, 0xc0, K);	/* imul imm8,%eax,%eax */
+				else
+					EMIT2_off32(0x69, 0xc0, K); /* imul imm32,%eax,%eax */
+				break;
+			case BPF_ALU|BPF_DIV|BPF_X: /* A /= X; */
+				EMIT2(0x85, 0xdb);		/* test %ebx,%ebx */
+				EMIT2(X86_JNE, 7);		/* jne .+7 */
+				EMIT_RET0();
+				EMIT2(0x31, 0xd2);		/* xor %edx,%edx */
+				EMIT2(0xf7, 0xf3);		/* div %ebx */
+				break;
+			case BPF_ALU|BPF_DIV|BPF_K: /* A /= K */
+				EMIT1_off32(0xb9, K);		/* mov imm32,%ecx */
+				EMIT2(0x31, 0xd2);		/* xor %edx,%edx */
+				EMIT2(0xf7, 0xf1);		/* div %ecx */
+				break;
+			case BPF_ALU|BPF_AND|BPF_X:
+				EMIT2(0x21, 0xd8);		/* and %ebx,%eax */
+				break;
+			case BPF_ALU|BPF_AND|BPF_K:
+				if (K >= 0xFFFFFF00) {
+					EMIT2(0x24, K & 0xFF); /* and imm8,%al */
+				} else if (K >= 0xFFFF0000) {
+					EMIT2(0x66, 0x25);	/* and imm16,%ax */
+					EMIT(K, 2);
+				} else {
+					EMIT1_off32(0x25, K);	/* and imm32,%eax */
+				}
+				break;
+			case BPF_ALU|BPF_OR|BPF_X:
+				EMIT2(0x09, 0xd8);		/* or %ebx,%eax */
+				break;
+			case BPF_ALU|BPF_OR|BPF_K:
+				if (is_imm8(K))
+					EMIT3(0x83, 0xc8, K);	/* or imm8,%eax */
+				else
+					EMIT1_off32(0x0d, K);	/* or imm32,%eax */
+				break;
+			case BPF_ALU|BPF_LSH|BPF_X: /* A <<= X; */
+				EMIT4(0x89, 0xd9, 0xd3, 0xe0);	/* mov %ebx,%ecx; shl %cl,%eax */
+				break;
+			case BPF_ALU|BPF_LSH|BPF_K:
+				if (K == 0)
+					break;
+				else if (K == 1)
+					EMIT2(0xd1, 0xe0);	/* shl %eax */
+				else
+					EMIT3(0xc1, 0xe0, K);	/* shl imm8,%eax */
+				break;
+			case BPF_ALU|BPF_RSH|BPF_X: /* A >>= X; */
+				EMIT4(0x89, 0xd9, 0xd3, 0xe8);	/* mov %ebx,%ecx; shr %cl,%eax */
+				break;
+			case BPF_ALU|BPF_RSH|BPF_K: /* A >>= K; */
+				if (K == 0)
+					break;
+				else if (K == 1)
+					EMIT2(0xd1, 0xe8);	/* shr %eax */
+				else
+					EMIT3(0xc1, 0xe8, K);	/* shr imm8,%eax */
+				break;
+			case BPF_ALU|BPF_NEG:
+				EMIT2(0xf7, 0xd8);		/* neg %eax */
+				break;
+			case BPF_RET|BPF_K:
+				if (!K)
+					CLEAR_A();
+				else
+					EMIT1_off32(0xb8, K);	/* mov $imm32,%eax */
+				/* fallinto */
+			case BPF_RET|BPF_A:
+				if (i != flen - 1)
+					EMIT_JMP_TO(cleanup_addr);
+				break;
+			case BPF_MISC|BPF_TAX: /* X = A */
+				EMIT2(0x89, 0xc3);		/* mov %eax,%ebx */
+				break;
+			case BPF_MISC|BPF_TXA: /* A = X */
+				EMIT2(0x89, 0xd8);		/* mov %ebx,%eax */
+				break;
+			case BPF_LD|BPF_IMM: /* A = K */
+				if (!K)
+					CLEAR_A();
+				else
+					EMIT1_off32(0xb8, K);	/* mov $imm32,%eax */
+				break;
+			case BPF_LDX|BPF_IMM: /* X = K */
+				if (!K)
+					CLEAR_X();
+				else
+					EMIT1_off32(0xbb, K);	/* mov $imm32,%ebx */
+				break;
+			case BPF_LD|BPF_MEM: /* A = mem[K] : mov off8(%rbp),%eax */
+				EMIT3(0x8b, 0x45, MEM_OFF + K * 4);
+				break;
+			case BPF_LDX|BPF_MEM: /* X = mem[K] : mov off8(%rbp),%ebx */
+				EMIT3(0x8b, 0x5d, MEM_OFF + K * 4);
+				break;
+			case BPF_ST: /* mem[K] = A : mov %eax,off8(%rbp) */
+				EMIT3(0x89, 0x45, MEM_OFF + K * 4);
+				break;
+			case BPF_STX: /* mem[K] = X : mov %ebx,off8(%rbp) */
+				EMIT3(0x89, 0x5d, MEM_OFF + K * 4);
+				break;
+			case BPF_LD|BPF_W|BPF_LEN: /* A = skb->len; */
+				EMIT3_off32(0x41, 0x8b, 0x86,	/* mov off32(%r14),%eax */
+					    offsetof(struct sk_buff, len));
+				break;
+			case BPF_LDX|BPF_W|BPF_LEN: /* X = skb->len; */
+				EMIT3_off32(0x41, 0x8b, 0x9e,	/* mov off32(%r14),%ebx */
+					    offsetof(struct sk_buff, len));
+				break;
+			case BPF_LD|BPF_W|BPF_ABS:
+			case BPF_LD|BPF_H|BPF_ABS:
+			case BPF_LD|BPF_B|BPF_ABS:
+				size = bpf_load_size(filter[i].code);
+				if ((int)K >= 0) {
+					fast_len = abs_load_len[size];
+					slow_len = 5 + SLOW_LEN + 3;
+					/* cmp $K+size-1,%r12d ; jbe slow */
+					EMIT3_off32(0x41, 0x81, 0xfc,
+						    K + size - 1);
+					EMIT2(X86_JBE, fast_len + 2);
+					prog = emit_load_abs(prog, size, K);
+					EMIT2(0xeb, slow_len);	/* jmp .+slow_len */
+				} else if ((int)K >= SKF_AD_OFF) {
+					switch (K - SKF_AD_OFF) {
+					case SKF_AD_PROTOCOL:
+						/* movzwl off32(%r14),%eax */
+						EMIT4_off32(0x41, 0x0f, 0xb7, 0x86,
+							    offsetof(struct sk_buff, protocol));
+						EMIT2(0x86, 0xc4); /* ntohs() : xchg %al,%ah */
+						goto next;
+					case SKF_AD_IFINDEX:
+						/* mov off32(%r14),%rax */
+						EMIT3_off32(0x49, 0x8b, 0x86,
+							    offsetof(struct sk_buff, dev));
+						EMIT3(0x48, 0x85, 0xc0);	/* test %rax,%rax */
+						EMIT_COND_JMP_TO(X86_JE, cleanup_addr);
+						/* mov off32(%rax),%eax */
+						EMIT2_off32(0x8b, 0x80,
+							    offsetof(struct net_device, ifindex));
+						goto next;
+					}
+				}
+				/* ancillary data and negative offsets */
+				EMIT1_off32(0xbe, K);		/* mov imm32,%esi */
+				EMIT_LOAD_SLOW(size);
+				EMIT3(0x8b, 0x45, RES_OFF);	/* mov res(%rbp),%eax */
+				break;
+			case BPF_LD|BPF_W|BPF_IND:
+			case BPF_LD|BPF_H|BPF_IND:
+			case BPF_LD|BPF_B|BPF_IND:
+				size = bpf_load_size(filter[i].code);
+				fast_len = ind_load_len[size];
+				slow_len = SLOW_LEN + 3;
+				if (K)
+					EMIT2_off32(0x8d, 0xb3, K); /* lea imm32(%rbx),%esi */
+				else
+					EMIT2(0x89, 0xde);	/* mov %ebx,%esi */
+				EMIT3(0x44, 0x89, 0xe2);	/* mov %r12d,%edx */
+				EMIT2(0x29, 0xf2);		/* sub %esi,%edx */
+				EMIT2(X86_JB, 3 + 2 + fast_len + 2);
+				EMIT3(0x83, 0xfa, size - 1);	/* cmp $size-1,%edx */
+				EMIT2(X86_JBE, fast_len + 2);
+				prog = emit_load_ind(prog, size);
+				EMIT2(0xeb, slow_len);		/* jmp .+slow_len */
+				EMIT_LOAD_SLOW(size);
+				EMIT3(0x8b, 0x45, RES_OFF);	/* mov res(%rbp),%eax */
+				break;
+			case BPF_LDX|BPF_B|BPF_MSH: /* X = 4 * (P[K] & 0xf) */
+				if ((int)K < 0 && (int)K >= SKF_AD_OFF) {
+					/* sk_run_filter() has no ancillary data here */
+					EMIT_RET0();
+					break;
+				}
+				slow_len = 5 + SLOW_LEN + 3 + 3;
+				if ((int)K >= 0) {
+					EMIT3_off32(0x41, 0x81, 0xfc, K); /* cmp $K,%r12d */
+					EMIT2(X86_JBE, 8 + 2);
+					/* movzbl off32(%r15),%ebx */
+					EMIT4_off32(0x41, 0x0f, 0xb6, 0x9f, K);
+					EMIT2(0xeb, slow_len);	/* jmp .+slow_len */
+				}
+				EMIT1_off32(0xbe, K);		/* mov imm32,%esi */
+				EMIT_LOAD_SLOW(1);
+				EMIT3(0x8b, 0x5d, RES_OFF);	/* mov res(%rbp),%ebx */
+				EMIT3(0x8b, 0x45, REGS_OFF);	/* mov A(%rbp),%eax */
+				EMIT3(0x83, 0xe3, 0x0f);	/* and $0xf,%ebx */
+				EMIT3(0xc1, 0xe3, 0x02);	/* shl $2,%ebx */
+				break;
+			case BPF_JMP|BPF_JA:
+				if (K)
+					EMIT_JMP_TO(addrs[i + K]);
+				break;
+			case BPF_JMP|BPF_JGT|BPF_K:
+			case BPF_JMP|BPF_JGT|BPF_X:
+				t_op = X86_JA;
+				f_op = X86_JBE;
+				goto cond_branch;
+			case BPF_JMP|BPF_JGE|BPF_K:
+			case BPF_JMP|BPF_JGE|BPF_X:
+				t_op = X86_JAE;
+				f_op = X86_JB;
+				goto cond_branch;
+			case BPF_JMP|BPF_JEQ|BPF_K:
+			case BPF_JMP|BPF_JEQ|BPF_X:
+				t_op = X86_JE;
+				f_op = X86_JNE;
+				goto cond_branch;
+			case BPF_JMP|BPF_JSET|BPF_K:
+			case BPF_JMP|BPF_JSET|BPF_X:
+				t_op = X86_JNE;
+				f_op = X86_JE;
+cond_branch:
+				t_target = addrs[i + filter[i].jt];
+				f_target = addrs[i + filter[i].jf];
+
+				/* same targets, can avoid doing the test :) */
+				if (filter[i].jt == filter[i].jf) {
+					if (filter[i].jt)
+						EMIT_JMP_TO(t_target);
+					break;
+				}
+
+				switch (filter[i].code) {
+				case BPF_JMP|BPF_JGT|BPF_X:
+				case BPF_JMP|BPF_JGE|BPF_X:
+				case BPF_JMP|BPF_JEQ|BPF_X:
+					EMIT2(0x39, 0xd8); /* cmp %ebx,%eax */
+					break;
+				case BPF_JMP|BPF_JSET|BPF_X:
+					EMIT2(0x85, 0xd8); /* test %ebx,%eax */
+					break;
+				case BPF_JMP|BPF_JEQ|BPF_K:
+					if (K == 0) {
+						EMIT2(0x85, 0xc0); /* test %eax,%eax */
+						break;
+					}
+				case BPF_JMP|BPF_JGT|BPF_K:
+				case BPF_JMP|BPF_JGE|BPF_K:
+					if (K <= 127)
+						EMIT3(0x83, 0xf8, K); /* cmp imm8,%eax */
+					else
+						EMIT1_off32(0x3d, K); /* cmp imm32,%eax */
+					break;
+				case BPF_JMP|BPF_JSET|BPF_K:
+					if (K <= 0xFF)
+						EMIT2(0xa8, K); /* test imm8,%al */
+					else if (!(K & 0xFFFF00FF))
+						EMIT3(0xf6, 0xc4, K >> 8); /* test imm8,%ah */
+					else if (K <= 0xFFFF) {
+						EMIT2(0x66, 0xa9); /* test imm16,%ax */
+						EMIT(K, 2);
+					} else {
+						EMIT1_off32(0xa9, K); /* test imm32,%eax */
+					}
+					break;
+				}
+				if (filter[i].jt != 0) {
+					EMIT_COND_JMP_TO(t_op, t_target);
+					if (filter[i].jf)
+						EMIT_JMP_TO(f_target);
+					break;
+				}
+				EMIT_COND_JMP_TO(f_op, f_target);
+				break;
+			default:
+				/* hmm, too complex filter, give up with jit compiler */
+				goto out;
+			}
+next:
+			ilen = prog - temp;
+			if (image) {
+				if (unlikely(proglen + ilen > oldproglen)) {
+					printk(KERN_ERR "bpf_jit_compile fatal error\n");
+					kfree(addrs);
+					module_free(NULL, image);
+					return;
+				}
+				memcpy(image + proglen, temp, ilen);
+			}
+			proglen += ilen;
+			addrs[i] = proglen;
+		}
+		/* last bpf instruction is always a RET :
+		 * use it to give the cleanup instruction(s) addr
+		 */
+		cleanup_addr = proglen;
+
+		prog = temp;
+		EMIT4(0x48, 0x8b, 0x5d, 0xf8);	/* mov -8(%rbp),%rbx */
+		EMIT4(0x4c, 0x8b, 0x65, 0xf0);	/* mov -16(%rbp),%r12 */
+		EMIT4(0x4c, 0x8b, 0x75, 0xe8);	/* mov -24(%rbp),%r14 */
+		EMIT4(0x4c, 0x8b, 0x7d, 0xe0);	/* mov -32(%rbp),%r15 */
+		EMIT1(0xc9);			/* leaveq */
+		EMIT1(0xc3);			/* ret */
+		ilen = prog - temp;
+		if (image)
+			memcpy(image + proglen, temp, ilen);
+		proglen += ilen;
+
+		if (image) {
+			if (unlikely(proglen != oldproglen))
+				goto fatal;
+			break;
+		}
+		if (proglen == oldproglen) {
+			image = module_alloc(max_t(unsigned int,
+						   proglen,
+						   sizeof(struct work_struct)));
+			if (!image)
+				goto out;
+		}
+		oldproglen = proglen;
+	}
+	if (bpf_jit_enable > 1)
+		bpf_jit_dump(flen, proglen, pass, image);
+
+	if (image) {
+		fp->bpf_func = (void *)image;
+	}
+out:
+	kfree(addrs);
+	return;
+
+fatal:
+	printk(KERN_ERR "bpf_jit_compile fatal error\n");
+	kfree(addrs);
+	module_free(NULL, image);
+}
+EXPORT_SYMBOL_GPL(bpf_jit_compile);
+
+static void jit_free_defer(struct work_struct *arg)
+{
+	module_free(NULL, arg);
+}
+
+/* run from softirq, we must use a work_struct to call
+ * module_free() from process context
+ */
+void bpf_jit_free(struct sk_filter *fp)
+{
+	if (fp->bpf_func) {
+		struct work_struct *work = (struct work_struct *)fp->bpf_func;
+
+		INIT_WORK(work, jit_free_defer);
+		schedule_work(work);
+	}
+}
+EXPORT_SYMBOL_GPL(bpf_jit_free);
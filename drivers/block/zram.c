@@ -0,0 +1,988 @@
+/*
+ * Compressed RAM block device
+ *
+ * Each zram device is a RAM disk whose pages are kept LZO-compressed in a
+ * zbud pool.  Pages filled with a single repeated word (most commonly
+ * zero-filled pages) use no pool memory at all, and pages that do not
+ * compress well are kept as they are.  Discarded sectors free their
+ * memory, so a swap device or a filesystem mounted with -o discard on a
+ * zram device only uses memory for the data it actually holds.
+ *
+ * The device is sized, and its memory allocated, by writing the size to
+ * /sys/block/zram<id>/disksize.  See Documentation/blockdev/zram.txt.
+ *
+ * Parts derived from drivers/block/brd.c.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/kernel.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/bitops.h>
+#include <linux/bit_spinlock.h>
+#include <linux/cpu.h>
+#include <linux/device.h>
+#include <linux/genhd.h>
+#include <linux/highmem.h>
+#include <linux/lzo.h>
+#include <linux/percpu.h>
+#include <linux/rwsem.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+#include <linux/zbud.h>
+
+#define SECTOR_SHIFT		9
+#define SECTORS_PER_PAGE_SHIFT	(PAGE_SHIFT - SECTOR_SHIFT)
+#define SECTORS_PER_PAGE	(1 << SECTORS_PER_PAGE_SHIFT)
+#define ZRAM_LOGICAL_BLOCK_SHIFT 12
+#define ZRAM_LOGICAL_BLOCK_SIZE	(1 << ZRAM_LOGICAL_BLOCK_SHIFT)
+#define ZRAM_SECTOR_PER_LOGICAL_BLOCK	\
+	(1 << (ZRAM_LOGICAL_BLOCK_SHIFT - SECTOR_SHIFT))
+
+/*
+ * Pages that compress to more than this are stored uncompressed: the
+ * space saved would not be worth the decompression on every read.
+ */
+static const size_t max_zpage_size = PAGE_SIZE / 4 * 3;
+
+/* Flags for the entries of the zram table, in zram_table_entry.flags */
+enum zram_pageflags {
+	/* bit spinlock serializing access to the entry */
+	ZRAM_LOCK,
+	/* page is filled with one repeated word, kept in ->handle */
+	ZRAM_SAME,
+	/* incompressible page, ->handle is a struct page * */
+	ZRAM_HUGE,
+};
+
+/*
+ * One entry per page of the device.  An entry with neither a handle nor
+ * ZRAM_SAME set has never been written, or was discarded, and reads back
+ * as zeroes.
+ */
+struct zram_table_entry {
+	unsigned long handle;
+	unsigned long flags;
+	unsigned int size;
+};
+
+enum zram_stats_item {
+	ZRAM_STAT_NUM_READS,
+	ZRAM_STAT_NUM_WRITES,
+	ZRAM_STAT_FAILED_READS,
+	ZRAM_STAT_FAILED_WRITES,
+	ZRAM_STAT_INVALID_IO,
+	ZRAM_STAT_DISCARDED,	/* pages freed by discard */
+	ZRAM_STAT_PAGES_STORED,	/* all pages holding data */
+	ZRAM_STAT_COMPR_SIZE,	/* bytes used by compressed and huge pages */
+	ZRAM_STAT_SAME_PAGES,	/* pages stored as metadata only */
+	ZRAM_STAT_HUGE_PAGES,	/* pages stored uncompressed */
+	NR_ZRAM_STATS
+};
+
+/*
+ * Statistics are kept per cpu so that the I/O path does not bounce a
+ * shared cacheline between the cpus doing I/O to the same device.
+ */
+struct zram_stats_cpu {
+	s64 count[NR_ZRAM_STATS];
+};
+
+struct zram {
+	struct zram_table_entry *table;
+	struct zbud_pool *pool;
+	struct zram_stats_cpu *stats;
+
+	struct request_queue *queue;
+	struct gendisk *disk;
+
+	/*
+	 * Held for read by I/O and statistics, for write while the table
+	 * and pool are set up or torn down.
+	 */
+	struct rw_semaphore init_lock;
+	int init_done;
+	u64 disksize;	/* bytes */
+};
+
+static int zram_major;
+static struct zram *zram_devices;
+
+/* Module params (documentation at end) */
+static unsigned int num_devices = 1;
+
+/*
+ * Per-cpu LZO work memory and compression buffer, shared by all devices.
+ * They are only used with preemption disabled.
+ */
+static DEFINE_PER_CPU(void *, zram_wrkmem);
+static DEFINE_PER_CPU(u8 *, zram_dstmem);
+
+static void zram_stat_add(struct zram *zram, enum zram_stats_item item,
+			  s64 val)
+{
+	struct zram_stats_cpu *stats;
+
+	stats = per_cpu_ptr(zram->stats, get_cpu());
+	stats->count[item] += val;
+	put_cpu();
+}
+
+static void zram_stat_inc(struct zram *zram, enum zram_stats_item item)
+{
+	zram_stat_add(zram, item, 1);
+}
+
+static s64 zram_stat_read(struct zram *zram, enum zram_stats_item item)
+{
+	s64 val = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		val += per_cpu_ptr(zram->stats, cpu)->count[item];
+	return val;
+}
+
+static void zram_slot_lock(struct zram *zram, u32 index)
+{
+	bit_spin_lock(ZRAM_LOCK, &zram->table[index].flags);
+}
+
+static void zram_slot_unlock(struct zram *zram, u32 index)
+{
+	bit_spin_unlock(ZRAM_LOCK, &zram->table[index].flags);
+}
+
+static int zram_test_flag(struct zram *zram, u32 index,
+			  enum zram_pageflags flag)
+{
+	return zram->table[index].flags & (1UL << flag);
+}
+
+static int page_same_filled(void *ptr, unsigned long *element)
+{
+	unsigned long *page = ptr;
+	unsigned int pos;
+
+	for (pos = 0; pos < PAGE_SIZE / sizeof(*page) - 1; pos++) {
+		if (page[pos] != page[pos + 1])
+			return 0;
+	}
+
+	*element = page[0];
+	return 1;
+}
+
+static void zram_fill_page(void *ptr, unsigned long element)
+{
+	unsigned long *page = ptr;
+	unsigned int pos;
+
+	for (pos = 0; pos < PAGE_SIZE / sizeof(*page); pos++)
+		page[pos] = element;
+}
+
+/*
+ * Free the memory of a table entry and clear it.  Called with the entry
+ * locked, or with I/O excluded by init_lock.
+ */
+static void zram_free_page(struct zram *zram, u32 index)
+{
+	struct zram_table_entry *entry = &zram->table[index];
+
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		zram_stat_add(zram, ZRAM_STAT_SAME_PAGES, -1);
+	} else if (zram_test_flag(zram, index, ZRAM_HUGE)) {
+		__free_page((struct page *)entry->handle);
+		zram_stat_add(zram, ZRAM_STAT_HUGE_PAGES, -1);
+	} else if (entry->handle) {
+		zbud_free(zram->pool, entry->handle);
+	} else
+		return;
+
+	zram_stat_add(zram, ZRAM_STAT_PAGES_STORED, -1);
+	zram_stat_add(zram, ZRAM_STAT_COMPR_SIZE, -(s64)entry->size);
+
+	entry->handle = 0;
+	entry->size = 0;
+	entry->flags &= 1UL << ZRAM_LOCK;
+}
+
+/*
+ * Read page @index of the device into the whole of @page.
+ */
+static int zram_read_page(struct zram *zram, struct page *page, u32 index)
+{
+	struct zram_table_entry *entry = &zram->table[index];
+	size_t dlen = PAGE_SIZE;
+	void *dst, *src;
+	int ret = LZO_E_OK;
+
+	zram_slot_lock(zram, index);
+	dst = kmap_atomic(page, KM_USER0);
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		zram_fill_page(dst, entry->handle);
+	} else if (zram_test_flag(zram, index, ZRAM_HUGE)) {
+		src = kmap_atomic((struct page *)entry->handle, KM_USER1);
+		memcpy(dst, src, PAGE_SIZE);
+		kunmap_atomic(src, KM_USER1);
+	} else if (entry->handle) {
+		src = zbud_map(zram->pool, entry->handle);
+		ret = lzo1x_decompress_safe(src, entry->size, dst, &dlen);
+		zbud_unmap(zram->pool, entry->handle);
+	} else
+		memset(dst, 0, PAGE_SIZE);
+	kunmap_atomic(dst, KM_USER0);
+	zram_slot_unlock(zram, index);
+
+	if (unlikely(ret != LZO_E_OK || dlen != PAGE_SIZE)) {
+		printk(KERN_ERR "zram: decompression failed, err=%d, "
+			"page=%u\n", ret, index);
+		return -EIO;
+	}
+	flush_dcache_page(page);
+	return 0;
+}
+
+/*
+ * Write the whole of @page to page @index of the device.
+ */
+static int zram_write_page(struct zram *zram, struct page *page, u32 index)
+{
+	struct zram_table_entry *entry = &zram->table[index];
+	unsigned long handle = 0, element, flags = 0;
+	size_t clen = 0, alloced = 0;
+	struct page *huge;
+	void *src, *dst;
+	u8 *cmem;
+	int ret;
+
+	src = kmap_atomic(page, KM_USER0);
+	if (page_same_filled(src, &element)) {
+		kunmap_atomic(src, KM_USER0);
+		handle = element;
+		flags = 1UL << ZRAM_SAME;
+		goto store;
+	}
+	kunmap_atomic(src, KM_USER0);
+
+compress_again:
+	cmem = get_cpu_var(zram_dstmem);
+	src = kmap_atomic(page, KM_USER0);
+	ret = lzo1x_1_compress(src, PAGE_SIZE, cmem, &clen,
+			       __get_cpu_var(zram_wrkmem));
+	kunmap_atomic(src, KM_USER0);
+	if (unlikely(ret != LZO_E_OK)) {
+		put_cpu_var(zram_dstmem);
+		printk(KERN_ERR "zram: compression failed, err=%d, page=%u\n",
+			ret, index);
+		ret = -EIO;
+		goto out_free;
+	}
+
+	if (unlikely(clen > max_zpage_size)) {
+		put_cpu_var(zram_dstmem);
+		if (handle)
+			zbud_free(zram->pool, handle);
+		goto store_huge;
+	}
+
+	/* the allocation made while sleeping must still fit */
+	if (handle && clen != alloced) {
+		zbud_free(zram->pool, handle);
+		handle = 0;
+	}
+
+	/*
+	 * Try to allocate without sleeping while the compressed data is in
+	 * this cpu's buffer.  If that fails, let go of the buffer, allocate
+	 * with reclaim and compress again into whichever cpu we run on then.
+	 */
+	if (!handle && zbud_alloc(zram->pool, clen,
+				  GFP_NOWAIT | __GFP_NOWARN, &handle))
+		handle = 0;
+	if (!handle) {
+		put_cpu_var(zram_dstmem);
+		ret = zbud_alloc(zram->pool, clen, GFP_NOIO | __GFP_NOWARN,
+				 &handle);
+		if (ret) {
+			handle = 0;
+			ret = -ENOMEM;
+			goto out_free;
+		}
+		alloced = clen;
+		goto compress_again;
+	}
+
+	dst = zbud_map(zram->pool, handle);
+	memcpy(dst, cmem, clen);
+	zbud_unmap(zram->pool, handle);
+	put_cpu_var(zram_dstmem);
+	goto store;
+
+store_huge:
+	huge = alloc_page(GFP_NOIO | __GFP_HIGHMEM | __GFP_NOWARN);
+	if (!huge) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	src = kmap_atomic(page, KM_USER0);
+	dst = kmap_atomic(huge, KM_USER1);
+	memcpy(dst, src, PAGE_SIZE);
+	kunmap_atomic(dst, KM_USER1);
+	kunmap_atomic(src, KM_USER0);
+	handle = (unsigned long)huge;
+	flags = 1UL << ZRAM_HUGE;
+	clen = PAGE_SIZE;
+
+store:
+	/* replace the old content, if any */
+	zram_slot_lock(zram, index);
+	zram_free_page(zram, index);
+	entry->handle = handle;
+	entry->size = clen;
+	entry->flags |= flags;
+	zram_slot_unlock(zram, index);
+
+	zram_stat_inc(zram, ZRAM_STAT_PAGES_STORED);
+	zram_stat_add(zram, ZRAM_STAT_COMPR_SIZE, clen);
+	if (flags & (1UL << ZRAM_SAME))
+		zram_stat_inc(zram, ZRAM_STAT_SAME_PAGES);
+	else if (flags & (1UL << ZRAM_HUGE))
+		zram_stat_inc(zram, ZRAM_STAT_HUGE_PAGES);
+	return 0;
+
+out_free:
+	if (handle)
+		zbud_free(zram->pool, handle);
+out:
+	return ret;
+}
+
+/*
+ * Process a part of a bvec that falls within page @index of the device,
+ * starting at byte @offset of that page.
+ */
+static int zram_bvec_rw(struct zram *zram, struct page *page,
+			unsigned int len, unsigned int off, int rw,
+			u32 index, unsigned int offset)
+{
+	struct page *tmp;
+	void *src, *dst;
+	int ret;
+
+	if (len == PAGE_SIZE) {
+		if (rw == READ)
+			return zram_read_page(zram, page, index);
+		flush_dcache_page(page);
+		return zram_write_page(zram, page, index);
+	}
+
+	/*
+	 * Partial page I/O, which only happens when the logical block size
+	 * is smaller than PAGE_SIZE: go through a bounce page holding the
+	 * full page of the device.
+	 */
+	tmp = alloc_page(GFP_NOIO);
+	if (!tmp)
+		return -ENOMEM;
+
+	ret = zram_read_page(zram, tmp, index);
+	if (ret)
+		goto out;
+
+	if (rw == READ) {
+		dst = kmap_atomic(page, KM_USER0);
+		memcpy(dst + off, page_address(tmp) + offset, len);
+		kunmap_atomic(dst, KM_USER0);
+		flush_dcache_page(page);
+	} else {
+		flush_dcache_page(page);
+		src = kmap_atomic(page, KM_USER0);
+		memcpy(page_address(tmp) + offset, src + off, len);
+		kunmap_atomic(src, KM_USER0);
+		ret = zram_write_page(zram, tmp, index);
+	}
+out:
+	__free_page(tmp);
+	return ret;
+}
+
+/*
+ * Free the pages of the device that are entirely covered by a discard.
+ */
+static void zram_bio_discard(struct zram *zram, struct bio *bio)
+{
+	u32 index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+	unsigned int offset = (bio->bi_sector & (SECTORS_PER_PAGE - 1)) <<
+				SECTOR_SHIFT;
+	unsigned int n = bio->bi_size;
+
+	if (offset) {
+		if (n <= PAGE_SIZE - offset)
+			return;
+		n -= PAGE_SIZE - offset;
+		index++;
+	}
+
+	while (n >= PAGE_SIZE) {
+		zram_slot_lock(zram, index);
+		zram_free_page(zram, index);
+		zram_slot_unlock(zram, index);
+		zram_stat_inc(zram, ZRAM_STAT_DISCARDED);
+		index++;
+		n -= PAGE_SIZE;
+	}
+}
+
+static int zram_valid_io_request(struct zram *zram, struct bio *bio)
+{
+	u64 start = bio->bi_sector;
+	u64 end = start + (bio->bi_size >> SECTOR_SHIFT);
+
+	if (unlikely(start & (ZRAM_SECTOR_PER_LOGICAL_BLOCK - 1)))
+		return 0;
+	if (unlikely(bio->bi_size & (ZRAM_LOGICAL_BLOCK_SIZE - 1)))
+		return 0;
+	if (unlikely(end > (zram->disksize >> SECTOR_SHIFT)))
+		return 0;
+	return 1;
+}
+
+static int zram_make_request(struct request_queue *q, struct bio *bio)
+{
+	struct zram *zram = q->queuedata;
+	struct bio_vec *bvec;
+	unsigned int offset;
+	u32 index;
+	int rw, i;
+	int err = -EIO;
+
+	down_read(&zram->init_lock);
+	if (unlikely(!zram->init_done))
+		goto out;
+
+	if (!zram_valid_io_request(zram, bio)) {
+		zram_stat_inc(zram, ZRAM_STAT_INVALID_IO);
+		goto out;
+	}
+
+	if (unlikely(bio_rw_flagged(bio, BIO_RW_DISCARD))) {
+		zram_bio_discard(zram, bio);
+		err = 0;
+		goto out;
+	}
+
+	rw = bio_rw(bio);
+	if (rw == READA)
+		rw = READ;
+
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+	offset = (bio->bi_sector & (SECTORS_PER_PAGE - 1)) << SECTOR_SHIFT;
+	err = 0;
+
+	bio_for_each_segment(bvec, bio, i) {
+		unsigned int len = bvec->bv_len;
+		unsigned int off = bvec->bv_offset;
+
+		/* a bvec may straddle two pages of the device */
+		while (len) {
+			unsigned int n = min_t(unsigned int, len,
+					       PAGE_SIZE - offset);
+
+			if (rw == READ)
+				zram_stat_inc(zram, ZRAM_STAT_NUM_READS);
+			else
+				zram_stat_inc(zram, ZRAM_STAT_NUM_WRITES);
+
+			err = zram_bvec_rw(zram, bvec->bv_page, n, off, rw,
+					   index, offset);
+			if (err) {
+				zram_stat_inc(zram, rw == READ ?
+					      ZRAM_STAT_FAILED_READS :
+					      ZRAM_STAT_FAILED_WRITES);
+				goto out;
+			}
+
+			len -= n;
+			off += n;
+			offset += n;
+			if (offset == PAGE_SIZE) {
+				offset = 0;
+				index++;
+			}
+		}
+	}
+
+out:
+	up_read(&zram->init_lock);
+	bio_endio(bio, err);
+	return 0;
+}
+
+/*
+ * Allocate the table and pool for a device of @disksize bytes.
+ * Called with init_lock held for write.
+ */
+static int zram_init_device(struct zram *zram, u64 disksize)
+{
+	u64 num_pages = disksize >> PAGE_SHIFT;
+	size_t size;
+
+	if (num_pages > UINT_MAX ||
+	    num_pages > ULONG_MAX / sizeof(struct zram_table_entry))
+		return -EINVAL;
+
+	size = num_pages * sizeof(struct zram_table_entry);
+	zram->table = vmalloc(size);
+	if (!zram->table) {
+		printk(KERN_ERR "zram: error allocating zram table\n");
+		return -ENOMEM;
+	}
+	memset(zram->table, 0, size);
+
+	zram->pool = zbud_create_pool(GFP_KERNEL, NULL);
+	if (!zram->pool) {
+		printk(KERN_ERR "zram: error creating memory pool\n");
+		vfree(zram->table);
+		zram->table = NULL;
+		return -ENOMEM;
+	}
+
+	zram->disksize = disksize;
+	set_capacity(zram->disk, disksize >> SECTOR_SHIFT);
+	zram->init_done = 1;
+
+	printk(KERN_INFO "zram: %s initialized, %llu bytes\n",
+		zram->disk->disk_name, (unsigned long long)disksize);
+	return 0;
+}
+
+/*
+ * Free all memory of a device.  Called with init_lock held for write.
+ */
+static void zram_reset_device(struct zram *zram)
+{
+	u32 index;
+	int cpu;
+
+	if (!zram->init_done)
+		return;
+
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++)
+		zram_free_page(zram, index);
+
+	vfree(zram->table);
+	zram->table = NULL;
+	zbud_destroy_pool(zram->pool);
+	zram->pool = NULL;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(zram->stats, cpu), 0,
+		       sizeof(struct zram_stats_cpu));
+
+	zram->disksize = 0;
+	set_capacity(zram->disk, 0);
+	zram->init_done = 0;
+}
+
+/*
+ * sysfs interface, in /sys/block/zram<id>/
+ */
+static struct zram *dev_to_zram(struct device *dev)
+{
+	return dev_to_disk(dev)->private_data;
+}
+
+static ssize_t disksize_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n", (unsigned long long)zram->disksize);
+}
+
+static ssize_t disksize_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	u64 disksize;
+	int ret;
+
+	disksize = memparse(buf, NULL);
+	disksize &= ~(u64)(PAGE_SIZE - 1);
+	if (!disksize)
+		return -EINVAL;
+
+	down_write(&zram->init_lock);
+	if (zram->init_done)
+		ret = -EBUSY;
+	else
+		ret = zram_init_device(zram, disksize);
+	up_write(&zram->init_lock);
+	if (ret)
+		return ret;
+
+	revalidate_disk(zram->disk);
+	return len;
+}
+
+static ssize_t initstate_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%d\n", zram->init_done);
+}
+
+static ssize_t reset_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	struct block_device *bdev;
+	unsigned long do_reset;
+	int ret;
+
+	ret = strict_strtoul(buf, 10, &do_reset);
+	if (ret)
+		return ret;
+	if (!do_reset)
+		return -EINVAL;
+
+	bdev = bdget_disk(zram->disk, 0);
+	if (!bdev)
+		return -ENOMEM;
+
+	/* do not reset an active device */
+	mutex_lock(&bdev->bd_mutex);
+	if (bdev->bd_openers) {
+		mutex_unlock(&bdev->bd_mutex);
+		bdput(bdev);
+		return -EBUSY;
+	}
+
+	down_write(&zram->init_lock);
+	zram_reset_device(zram);
+	up_write(&zram->init_lock);
+	mutex_unlock(&bdev->bd_mutex);
+	bdput(bdev);
+
+	revalidate_disk(zram->disk);
+	return len;
+}
+
+#define ZRAM_STAT_ATTR_RO(name, item)					\
+static ssize_t name##_show(struct device *dev,				\
+		struct device_attribute *attr, char *buf)		\
+{									\
+	struct zram *zram = dev_to_zram(dev);				\
+									\
+	return sprintf(buf, "%lld\n",					\
+		(long long)zram_stat_read(zram, item));			\
+}									\
+static DEVICE_ATTR(name, S_IRUGO, name##_show, NULL)
+
+ZRAM_STAT_ATTR_RO(num_reads, ZRAM_STAT_NUM_READS);
+ZRAM_STAT_ATTR_RO(num_writes, ZRAM_STAT_NUM_WRITES);
+ZRAM_STAT_ATTR_RO(failed_reads, ZRAM_STAT_FAILED_READS);
+ZRAM_STAT_ATTR_RO(failed_writes, ZRAM_STAT_FAILED_WRITES);
+ZRAM_STAT_ATTR_RO(invalid_io, ZRAM_STAT_INVALID_IO);
+ZRAM_STAT_ATTR_RO(discarded_pages, ZRAM_STAT_DISCARDED);
+ZRAM_STAT_ATTR_RO(compr_data_size, ZRAM_STAT_COMPR_SIZE);
+ZRAM_STAT_ATTR_RO(same_pages, ZRAM_STAT_SAME_PAGES);
+ZRAM_STAT_ATTR_RO(huge_pages, ZRAM_STAT_HUGE_PAGES);
+
+static ssize_t orig_data_size_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%lld\n", (long long)zram_stat_read(zram,
+		ZRAM_STAT_PAGES_STORED) << PAGE_SHIFT);
+}
+
+static ssize_t mem_used_total_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	u64 pages = 0;
+
+	down_read(&zram->init_lock);
+	if (zram->init_done)
+		pages = zbud_get_pool_size(zram->pool) +
+			zram_stat_read(zram, ZRAM_STAT_HUGE_PAGES);
+	up_read(&zram->init_lock);
+
+	return sprintf(buf, "%llu\n", (unsigned long long)pages << PAGE_SHIFT);
+}
+
+static DEVICE_ATTR(disksize, S_IRUGO | S_IWUSR,
+		disksize_show, disksize_store);
+static DEVICE_ATTR(initstate, S_IRUGO, initstate_show, NULL);
+static DEVICE_ATTR(reset, S_IWUSR, NULL, reset_store);
+static DEVICE_ATTR(orig_data_size, S_IRUGO, orig_data_size_show, NULL);
+static DEVICE_ATTR(mem_used_total, S_IRUGO, mem_used_total_show, NULL);
+
+static struct attribute *zram_disk_attrs[] = {
+	&dev_attr_disksize.attr,
+	&dev_attr_initstate.attr,
+	&dev_attr_reset.attr,
+	&dev_attr_num_reads.attr,
+	&dev_attr_num_writes.attr,
+	&dev_attr_failed_reads.attr,
+	&dev_attr_failed_writes.attr,
+	&dev_attr_invalid_io.attr,
+	&dev_attr_discarded_pages.attr,
+	&dev_attr_orig_data_size.attr,
+	&dev_attr_compr_data_size.attr,
+	&dev_attr_same_pages.attr,
+	&dev_attr_huge_pages.attr,
+	&dev_attr_mem_used_total.attr,
+	NULL,
+};
+
+static struct attribute_group zram_disk_attr_group = {
+	.attrs = zram_disk_attrs,
+};
+
+static const struct block_device_operations zram_devops = {
+	.owner = THIS_MODULE,
+};
+
+static int create_device(struct zram *zram, int device_id)
+{
+	init_rwsem(&zram->init_lock);
+
+	zram->stats = alloc_percpu(struct zram_stats_cpu);
+	if (!zram->stats)
+		goto out;
+
+	zram->queue = blk_alloc_queue(GFP_KERNEL);
+	if (!zram->queue) {
+		printk(KERN_ERR "zram: error allocating disk queue for "
+			"device %d\n", device_id);
+		goto out_free_stats;
+	}
+	blk_queue_make_request(zram->queue, zram_make_request);
+	blk_queue_ordered(zram->queue, QUEUE_ORDERED_TAG, NULL);
+	blk_queue_bounce_limit(zram->queue, BLK_BOUNCE_ANY);
+	zram->queue->queuedata = zram;
+
+	/* gendisk structure */
+	zram->disk = alloc_disk(1);
+	if (!zram->disk) {
+		printk(KERN_ERR "zram: error allocating disk structure for "
+			"device %d\n", device_id);
+		goto out_free_queue;
+	}
+
+	zram->disk->major = zram_major;
+	zram->disk->first_minor = device_id;
+	zram->disk->fops = &zram_devops;
+	zram->disk->queue = zram->queue;
+	zram->disk->private_data = zram;
+	zram->disk->flags |= GENHD_FL_SUPPRESS_PARTITION_INFO;
+	snprintf(zram->disk->disk_name, 16, "zram%d", device_id);
+
+	/* actual capacity is set when disksize is written */
+	set_capacity(zram->disk, 0);
+
+	/*
+	 * I/O is done a page at a time, so only page sized requests avoid
+	 * a bounce page.  The logical block size cannot exceed 4K, though,
+	 * which matters only with larger pages.
+	 */
+	blk_queue_logical_block_size(zram->queue, ZRAM_LOGICAL_BLOCK_SIZE);
+	blk_queue_physical_block_size(zram->queue, PAGE_SIZE);
+	blk_queue_io_min(zram->queue, PAGE_SIZE);
+
+	/* discard frees whole pages, so keep every discard bio page aligned */
+	blk_queue_max_discard_sectors(zram->queue,
+			(UINT_MAX >> SECTOR_SHIFT) & ~(SECTORS_PER_PAGE - 1));
+	queue_flag_set_unlocked(QUEUE_FLAG_DISCARD, zram->queue);
+	/* no seeks: lets swap spread allocations over per cpu clusters */
+	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->queue);
+
+	add_disk(zram->disk);
+
+	if (sysfs_create_group(&disk_to_dev(zram->disk)->kobj,
+			       &zram_disk_attr_group)) {
+		printk(KERN_ERR "zram: error creating sysfs group for "
+			"device %d\n", device_id);
+		goto out_free_disk;
+	}
+
+	return 0;
+
+out_free_disk:
+	del_gendisk(zram->disk);
+	put_disk(zram->disk);
+out_free_queue:
+	blk_cleanup_queue(zram->queue);
+out_free_stats:
+	free_percpu(zram->stats);
+out:
+	return -ENOMEM;
+}
+
+static void destroy_device(struct zram *zram)
+{
+	sysfs_remove_group(&disk_to_dev(zram->disk)->kobj,
+			   &zram_disk_attr_group);
+
+	zram_reset_device(zram);
+
+	del_gendisk(zram->disk);
+	put_disk(zram->disk);
+	blk_cleanup_queue(zram->queue);
+	free_percpu(zram->stats);
+}
+
+static int __zram_cpu_notifier(unsigned long action, unsigned long cpu)
+{
+	void *wrkmem;
+	u8 *dst;
+
+	switch (action) {
+	case CPU_UP_PREPARE:
+	case CPU_UP_PREPARE_FROZEN:
+		wrkmem = kmalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
+		/* lzo can expand an incompressible page beyond PAGE_SIZE */
+		dst = kmalloc(PAGE_SIZE * 2, GFP_KERNEL);
+		if (!wrkmem || !dst) {
+			printk(KERN_ERR "zram: can't allocate compressor "
+				"buffers\n");
+			kfree(wrkmem);
+			kfree(dst);
+			return NOTIFY_BAD;
+		}
+		per_cpu(zram_wrkmem, cpu) = wrkmem;
+		per_cpu(zram_dstmem, cpu) = dst;
+		break;
+	case CPU_DEAD:
+	case CPU_DEAD_FROZEN:
+	case CPU_UP_CANCELED:
+	case CPU_UP_CANCELED_FROZEN:
+		kfree(per_cpu(zram_wrkmem, cpu));
+		per_cpu(zram_wrkmem, cpu) = NULL;
+		kfree(per_cpu(zram_dstmem, cpu));
+		per_cpu(zram_dstmem, cpu) = NULL;
+		break;
+	default:
+		break;
+	}
+	return NOTIFY_OK;
+}
+
+static int zram_cpu_notifier(struct notifier_block *nb,
+			     unsigned long action, void *pcpu)
+{
+	return __zram_cpu_notifier(action, (unsigned long)pcpu);
+}
+
+static struct notifier_block zram_cpu_notifier_block = {
+	.notifier_call = zram_cpu_notifier
+};
+
+static int zram_cpu_init(void)
+{
+	unsigned long cpu;
+
+	get_online_cpus();
+	for_each_online_cpu(cpu)
+		if (__zram_cpu_notifier(CPU_UP_PREPARE, cpu) != NOTIFY_OK)
+			goto cleanup;
+	register_cpu_notifier(&zram_cpu_notifier_block);
+	put_online_cpus();
+	return 0;
+
+cleanup:
+	for_each_online_cpu(cpu)
+		__zram_cpu_notifier(CPU_UP_CANCELED, cpu);
+	put_online_cpus();
+	return -ENOMEM;
+}
+
+static void zram_cpu_exit(void)
+{
+	unsigned long cpu;
+
+	get_online_cpus();
+	unregister_cpu_notifier(&zram_cpu_notifier_block);
+	for_each_online_cpu(cpu)
+		__zram_cpu_notifier(CPU_DEAD, cpu);
+	put_online_cpus();
+}
+
+static int __init zram_init(void)
+{
+	int ret, dev_id;
+
+	if (num_devices == 0 || num_devices > (1U << MINORBITS)) {
+		printk(KERN_ERR "zram: invalid value of num_devices: %u\n",
+			num_devices);
+		return -EINVAL;
+	}
+
+	ret = zram_cpu_init();
+	if (ret)
+		goto out;
+
+	zram_major = register_blkdev(0, "zram");
+	if (zram_major <= 0) {
+		printk(KERN_ERR "zram: unable to get major number\n");
+		ret = -EBUSY;
+		goto out_cpu;
+	}
+
+	/* allocate the device array and initialize each one */
+	zram_devices = kzalloc(num_devices * sizeof(struct zram), GFP_KERNEL);
+	if (!zram_devices) {
+		ret = -ENOMEM;
+		goto out_unregister;
+	}
+
+	for (dev_id = 0; dev_id < num_devices; dev_id++) {
+		ret = create_device(&zram_devices[dev_id], dev_id);
+		if (ret)
+			goto out_destroy;
+	}
+
+	printk(KERN_INFO "zram: created %u device(s)\n", num_devices);
+	return 0;
+
+out_destroy:
+	while (dev_id)
+		destroy_device(&zram_devices[--dev_id]);
+	kfree(zram_devices);
+out_unregister:
+	unregister_blkdev(zram_major, "zram");
+out_cpu:
+	zram_cpu_exit();
+out:
+	return ret;
+}
+
+static void __exit zram_exit(void)
+{
+	int i;
+
+	for (i = 0; i < num_devices; i++)
+		destroy_device(&zram_devices[i]);
+
+	kfree(zram_devices);
+	unregister_blkdev(zram_major, "zram");
+	zram_cpu_exit();
+}
+
+module_param(num_devices, uint, 0);
+MODULE_PARM_DESC(num_devices, "Number of zram devices");
+
+module_init(zram_init);
+module_exit(zram_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Compressed RAM Block Device");
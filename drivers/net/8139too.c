@@ -108,6 +108,7 @@
 #include <linux/crc32.h>
 #include <linux/io.h>
 #include <linux/uaccess.h>
+#include <net/busy_poll.h>
 #include <asm/irq.h>
 
 #define RTL8139_DRIVER_NAME   DRV_NAME " Fast Ethernet driver " DRV_VERSION
@@ -578,6 +579,7 @@ struct rtl8139_private {
 	unsigned long		cur_tx;
 	unsigned long		dirty_tx;
 	unsigned char		*tx_buf[NUM_TX_DESC];	/* Tx bounce buffers */
+	unsigned int		tx_len[NUM_TX_DESC];	/* bytes reported to BQL */
 	unsigned char		*tx_bufs;	/* Tx bounce buffer region. */
 	dma_addr_t		tx_bufs_dma;
 
@@ -1428,6 +1430,7 @@ static void rtl8139_init_ring (struct net_device *dev)
 	tp->cur_rx = 0;
 	tp->cur_tx = 0;
 	tp->dirty_tx = 0;
+	netdev_reset_queue(dev);
 
 	for (i = 0; i < NUM_TX_DESC; i++)
 		tp->tx_buf[i] = &tp->tx_bufs[i * TX_BUF_SIZE];
@@ -1627,6 +1630,7 @@ static inline void rtl8139_tx_clear (struct rtl8139_private *tp)
 {
 	tp->cur_tx = 0;
 	tp->dirty_tx = 0;
+	netdev_reset_queue(tp->mii.dev);
 
 	/* XXX account for unsent Tx packets in tp->stats.tx_dropped */
 }
@@ -1718,6 +1722,8 @@ static netdev_tx_t rtl8139_start_xmit (struct sk_buff *skb,
 	 * to make sure that the device sees the updated data.
 	 */
 	wmb();
+	tp->tx_len[entry] = len;
+	netdev_sent_queue(dev, len);
 	RTL_W32_F (TxStatus0 + (entry * sizeof (u32)),
 		   tp->tx_flag | max(len, (unsigned int)ETH_ZLEN));
 
@@ -1742,6 +1748,7 @@ static void rtl8139_tx_interrupt (struct net_device *dev,
 				  void __iomem *ioaddr)
 {
 	unsigned long dirty_tx, tx_left;
+	unsigned int bytes_compl = 0, pkts_compl = 0;
 
 	assert (dev != NULL);
 	assert (ioaddr != NULL);
@@ -1786,10 +1793,14 @@ static void rtl8139_tx_interrupt (struct net_device *dev,
 			dev->stats.tx_packets++;
 		}
 
+		bytes_compl += tp->tx_len[entry];
+		pkts_compl++;
 		dirty_tx++;
 		tx_left--;
 	}
 
+	netdev_completed_queue(dev, pkts_compl, bytes_compl);
+
 #ifndef RTL8139_NDEBUG
 	if (tp->cur_tx - dirty_tx > NUM_TX_DESC) {
 		pr_err("%s: Out-of-sync dirty pointer, %ld vs. %ld.\n",
@@ -2019,6 +2030,7 @@ no_early_rx:
 			dev->stats.rx_bytes += pkt_size;
 			dev->stats.rx_packets++;
 
+			skb_mark_napi_id(skb, &tp->napi);
 			netif_receive_skb (skb);
 		} else {
 			if (net_ratelimit())
@@ -25,6 +25,7 @@
 #include <linux/virtio_net.h>
 #include <linux/scatterlist.h>
 #include <linux/if_vlan.h>
+#include <net/busy_poll.h>
 
 static int napi_weight = 128;
 module_param(napi_weight, int, 0444);
@@ -63,6 +64,9 @@ struct virtnet_info
 	/* Work struct for refilling if we run low on memory. */
 	struct delayed_work refill;
 
+	/* Reaps transmitted skbs when the stack has stopped feeding us. */
+	struct tasklet_struct tx_reap;
+
 	/* Chain pages by the private ptr. */
 	struct page *pages;
 };
@@ -115,7 +119,7 @@ static void skb_xmit_done(struct virtqueue *svq)
 	svq->vq_ops->disable_cb(svq);
 
 	/* We were probably waiting for more output buffers. */
-	netif_wake_queue(vi->dev);
+	tasklet_schedule(&vi->tx_reap);
 }
 
 static void receive_skb(struct net_device *dev, struct sk_buff *skb,
@@ -262,6 +266,7 @@ static void receive_skb(struct net_device *dev, struct sk_buff *skb,
 		skb_shinfo(skb)->gso_segs = 0;
 	}
 
+	skb_mark_napi_id(skb, &vi->napi);
 	netif_receive_skb(skb);
 	return;
 
@@ -459,18 +464,44 @@ static unsigned int free_old_xmit_skbs(struct virtnet_info *vi)
 {
 	struct sk_buff *skb;
 	unsigned int len, tot_sgs = 0;
+	unsigned int bytes = 0, pkts = 0;
 
 	while ((skb = vi->svq->vq_ops->get_buf(vi->svq, &len)) != NULL) {
 		pr_debug("Sent skb %p\n", skb);
 		__skb_unlink(skb, &vi->send);
 		vi->dev->stats.tx_bytes += skb->len;
 		vi->dev->stats.tx_packets++;
+		bytes += skb->len;
+		pkts++;
 		tot_sgs += skb_vnet_hdr(skb)->num_sg;
 		dev_kfree_skb_any(skb);
 	}
+	netdev_completed_queue(vi->dev, pkts, bytes);
 	return tot_sgs;
 }
 
+/*
+ * Once byte queue limits stop the queue, start_xmit() is no longer called
+ * to free old buffers, so completions have to be reaped from here.
+ */
+static void xmit_reap(unsigned long data)
+{
+	struct virtnet_info *vi = (struct virtnet_info *)data;
+	struct netdev_queue *txq = netdev_get_tx_queue(vi->dev, 0);
+
+	__netif_tx_lock(txq, smp_processor_id());
+	free_old_xmit_skbs(vi);
+	/* Still stopped: wait for the next batch of completions. */
+	if (netif_xmit_stopped(txq) &&
+	    unlikely(!vi->svq->vq_ops->enable_cb(vi->svq))) {
+		vi->svq->vq_ops->disable_cb(vi->svq);
+		tasklet_schedule(&vi->tx_reap);
+	}
+	__netif_tx_unlock(txq);
+
+	netif_wake_queue(vi->dev);
+}
+
 static int xmit_skb(struct virtnet_info *vi, struct sk_buff *skb)
 {
 	struct scatterlist sg[2+MAX_SKB_FRAGS];
@@ -548,6 +579,7 @@ static netdev_tx_t start_xmit(struct sk_buff *skb, struct net_device *dev)
 		kfree_skb(skb);
 		return NETDEV_TX_OK;
 	}
+	netdev_sent_queue(dev, skb->len);
 	vi->svq->vq_ops->kick(vi->svq);
 
 	/*
@@ -575,6 +607,12 @@ static netdev_tx_t start_xmit(struct sk_buff *skb, struct net_device *dev)
 				vi->svq->vq_ops->disable_cb(vi->svq);
 			}
 		}
+	} else if (netif_xmit_stopped(netdev_get_tx_queue(dev, 0))) {
+		/* Byte queue limit reached: ask to be told about completions. */
+		if (unlikely(!vi->svq->vq_ops->enable_cb(vi->svq))) {
+			vi->svq->vq_ops->disable_cb(vi->svq);
+			tasklet_schedule(&vi->tx_reap);
+		}
 	}
 
 	return NETDEV_TX_OK;
@@ -900,6 +938,7 @@ static int virtnet_probe(struct virtio_device *vdev)
 	vdev->priv = vi;
 	vi->pages = NULL;
 	INIT_DELAYED_WORK(&vi->refill, refill_work);
+	tasklet_init(&vi->tx_reap, xmit_reap, (unsigned long)vi);
 
 	/* If we can receive ANY GSO packets, we must allocate large ones. */
 	if (virtio_has_feature(vdev, VIRTIO_NET_F_GUEST_TSO4)
@@ -983,6 +1022,7 @@ static void __devexit virtnet_remove(struct virtio_device *vdev)
 
 	unregister_netdev(vi->dev);
 	cancel_delayed_work_sync(&vi->refill);
+	tasklet_kill(&vi->tx_reap);
 
 	vdev->config->del_vqs(vi->vdev);
 
@@ -425,6 +425,9 @@ repeat:
 		} else {
 			struct page *page2;
 
+			/* drop the shadow entry an evicted page may have left */
+			invalidate_inode_pages2_range(dmap, offset, offset);
+
 			/* move the page to the destination cache */
 			spin_lock_irq(&smap->tree_lock);
 			page2 = radix_tree_delete(&smap->page_tree, offset);
@@ -176,7 +176,7 @@ extern struct cred init_cred;
 		[PIDTYPE_PGID] = INIT_PID_LINK(PIDTYPE_PGID),		\
 		[PIDTYPE_SID]  = INIT_PID_LINK(PIDTYPE_SID),		\
 	},								\
-	.dirties = INIT_PROP_LOCAL_SINGLE(dirties),			\
+	.nr_dirtied_pause = 128 >> (PAGE_SHIFT - 10),			\
 	INIT_IDS							\
 	INIT_PERF_EVENTS(tsk)						\
 	INIT_TRACE_IRQFLAGS						\
@@ -0,0 +1,368 @@
+#ifndef _IP_SET_AHASH_H
+#define _IP_SET_AHASH_H
+
+/*
+ * Hash table of fixed size keys, shared by the hash:* set types.
+ *
+ * Each element is chained into the bucket selected by jhash of its key.
+ * Lookups from the packet path run under the read side of set->lock,
+ * additions and deletions under the write side.  Once the average chain
+ * is longer than AHASH_MAX_LOAD, a work item doubles the table: the new
+ * buckets are allocated outside of the lock and the elements are only
+ * relinked while it is held, so neither path ever sleeps or allocates
+ * large areas with the set locked.
+ */
+
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/workqueue.h>
+#include <linux/netfilter/ipset/ip_set.h>
+#include <linux/netfilter/ipset/ip_set_hash.h>
+
+#define jhash_size(n)		((u32)1 << (n))
+#define jhash_mask(n)		(jhash_size(n) - 1)
+
+/* Average chain length at which the table is grown */
+#define AHASH_MAX_LOAD		2
+/* Largest table we grow to */
+#define AHASH_MAX_BITS		24
+
+/* An element: the key follows the chain link */
+struct ahash_elem {
+	struct hlist_node node;
+	u32 key[0];
+};
+
+/* The hash table: the table size stored here in order to make resizing easy */
+struct htable {
+	u8 htable_bits;		/* size of hash table == 2^htable_bits */
+	struct hlist_head bucket[0]; /* hashtable buckets */
+};
+
+/* The generic ip_set hash structure */
+struct ip_set_hash {
+	struct htable *table;	/* the hash table */
+	struct ip_set *set;	/* the set, for the resize work */
+	struct work_struct resize_work;
+	u32 maxelem;		/* max elements in the hash */
+	u32 elements;		/* current element count */
+	u32 initval;		/* random jhash init value */
+	u8 key_len;		/* key length in u32 words */
+	u32 nets[33];		/* elements per prefix length, hash:net */
+};
+
+static inline u8
+htable_bits(u32 hashsize)
+{
+	/* Assume that hashsize == 2^htable_bits */
+	u8 bits = fls(hashsize - 1);
+
+	if (jhash_size(bits) != hashsize)
+		/* Round up to the first 2^n value */
+		bits = fls(hashsize);
+
+	return bits;
+}
+
+static inline size_t
+htable_size(u8 hbits)
+{
+	return sizeof(struct htable) +
+	       jhash_size(hbits) * sizeof(struct hlist_head);
+}
+
+static inline u32
+ahash_bucket(const struct ip_set_hash *h, u8 hbits, const u32 *key)
+{
+	return jhash2(key, h->key_len, h->initval) & jhash_mask(hbits);
+}
+
+static struct ahash_elem *
+ahash_find(const struct ip_set_hash *h, const u32 *key)
+{
+	const struct htable *t = h->table;
+	struct ahash_elem *e;
+	struct hlist_node *n;
+
+	hlist_for_each_entry(e, n, &t->bucket[ahash_bucket(h, t->htable_bits,
+							    key)], node)
+		if (!memcmp(e->key, key, h->key_len * sizeof(u32)))
+			return e;
+	return NULL;
+}
+
+/* Memory used by the set, for listing */
+static inline size_t
+ahash_memsize(const struct ip_set_hash *h)
+{
+	return sizeof(*h) + htable_size(h->table->htable_bits) +
+	       h->elements * (sizeof(struct ahash_elem) +
+			      h->key_len * sizeof(u32));
+}
+
+/* Double the hash table, called from keventd */
+static void
+ahash_resize(struct work_struct *work)
+{
+	struct ip_set_hash *h = container_of(work, struct ip_set_hash,
+					     resize_work);
+	struct ip_set *set = h->set;
+	struct htable *orig, *t;
+	struct ahash_elem *e;
+	struct hlist_node *n, *tmp;
+	u8 hbits;
+	u32 i;
+
+	/* Nobody else replaces the table, it can be read unlocked */
+	orig = h->table;
+	hbits = orig->htable_bits + 1;
+	if (hbits > AHASH_MAX_BITS)
+		return;
+
+	t = ip_set_alloc(htable_size(hbits));
+	if (!t)
+		return;
+	t->htable_bits = hbits;
+
+	write_lock_bh(&set->lock);
+	for (i = 0; i < jhash_size(orig->htable_bits); i++)
+		hlist_for_each_entry_safe(e, n, tmp, &orig->bucket[i], node) {
+			hlist_del(&e->node);
+			hlist_add_head(&e->node,
+				       &t->bucket[ahash_bucket(h, hbits,
+							       e->key)]);
+		}
+	h->table = t;
+	write_unlock_bh(&set->lock);
+
+	pr_debug("set %s resized from %u to %u buckets\n", set->name,
+		 jhash_size(orig->htable_bits), jhash_size(hbits));
+	ip_set_free(orig);
+}
+
+/* Add an element, the key is in value */
+static int
+ahash_add(struct ip_set *set, void *value, u32 flags)
+{
+	struct ip_set_hash *h = set->data;
+	struct htable *t = h->table;
+	struct ahash_elem *e;
+
+	if (ahash_find(h, value))
+		return -IPSET_ERR_EXIST;
+	if (h->elements >= h->maxelem)
+		return -IPSET_ERR_HASH_FULL;
+
+	/* Called with the set write locked, from softirq or netlink */
+	e = kmalloc(sizeof(*e) + h->key_len * sizeof(u32), GFP_ATOMIC);
+	if (!e)
+		return -ENOMEM;
+	memcpy(e->key, value, h->key_len * sizeof(u32));
+	hlist_add_head(&e->node,
+		       &t->bucket[ahash_bucket(h, t->htable_bits, e->key)]);
+	h->elements++;
+
+	if (h->elements > AHASH_MAX_LOAD * jhash_size(t->htable_bits) &&
+	    t->htable_bits < AHASH_MAX_BITS)
+		schedule_work(&h->resize_work);
+	return 0;
+}
+
+/* Delete an element, the key is in value */
+static int
+ahash_del(struct ip_set *set, void *value, u32 flags)
+{
+	struct ip_set_hash *h = set->data;
+	struct ahash_elem *e;
+
+	e = ahash_find(h, value);
+	if (!e)
+		return -IPSET_ERR_EXIST;
+	hlist_del(&e->node);
+	kfree(e);
+	h->elements--;
+	return 0;
+}
+
+/* Test whether the element is in the set */
+static int
+ahash_test(struct ip_set *set, void *value, u32 flags)
+{
+	return ahash_find(set->data, value) != NULL;
+}
+
+/* Remove all elements, the table is kept */
+static void
+ahash_flush(struct ip_set *set)
+{
+	struct ip_set_hash *h = set->data;
+	struct htable *t = h->table;
+	struct ahash_elem *e;
+	struct hlist_node *n, *tmp;
+	u32 i;
+
+	for (i = 0; i < jhash_size(t->htable_bits); i++)
+		hlist_for_each_entry_safe(e, n, tmp, &t->bucket[i], node) {
+			hlist_del(&e->node);
+			kfree(e);
+		}
+	h->elements = 0;
+	memset(h->nets, 0, sizeof(h->nets));
+}
+
+static void
+ahash_destroy(struct ip_set *set)
+{
+	struct ip_set_hash *h = set->data;
+
+	cancel_work_sync(&h->resize_work);
+	ahash_flush(set);
+	ip_set_free(h->table);
+	kfree(h);
+
+	set->data = NULL;
+}
+
+/* Allocate the hash structure of a new set */
+static int
+ahash_create(struct ip_set *set, struct nlattr *tb[], u8 key_len,
+	     const struct ip_set_type_variant *variant)
+{
+	u32 hashsize = IPSET_DEFAULT_HASHSIZE, maxelem = IPSET_DEFAULT_MAXELEM;
+	struct ip_set_hash *h;
+	u8 hbits;
+
+	if (!(set->family == AF_INET))
+		return -IPSET_ERR_INVALID_FAMILY;
+
+	if (unlikely(!ip_set_optattr_netorder(tb, IPSET_ATTR_HASHSIZE) ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_MAXELEM)))
+		return -IPSET_ERR_PROTOCOL;
+
+	if (tb[IPSET_ATTR_HASHSIZE]) {
+		hashsize = ip_set_get_h32(tb[IPSET_ATTR_HASHSIZE]);
+		if (hashsize < IPSET_MIMINAL_HASHSIZE)
+			hashsize = IPSET_MIMINAL_HASHSIZE;
+	}
+
+	if (tb[IPSET_ATTR_MAXELEM])
+		maxelem = ip_set_get_h32(tb[IPSET_ATTR_MAXELEM]);
+
+	h = kzalloc(sizeof(*h), GFP_KERNEL);
+	if (!h)
+		return -ENOMEM;
+
+	hbits = htable_bits(hashsize);
+	if (hbits > AHASH_MAX_BITS)
+		hbits = AHASH_MAX_BITS;
+	h->table = ip_set_alloc(htable_size(hbits));
+	if (!h->table) {
+		kfree(h);
+		return -ENOMEM;
+	}
+	h->table->htable_bits = hbits;
+	h->set = set;
+	INIT_WORK(&h->resize_work, ahash_resize);
+	h->maxelem = maxelem;
+	h->key_len = key_len;
+	get_random_bytes(&h->initval, sizeof(h->initval));
+
+	set->data = h;
+	set->variant = variant;
+
+	pr_debug("create %s hashsize %u (%u) maxelem %u: %p(%p)\n",
+		 set->name, jhash_size(hbits), hbits, h->maxelem, set->data,
+		 h->table);
+
+	return 0;
+}
+
+/* Reply a HEADER request: fill out the header part of the set */
+static int
+ahash_head(struct ip_set *set, struct sk_buff *skb)
+{
+	const struct ip_set_hash *h = set->data;
+	struct nlattr *nested;
+
+	nested = ipset_nest_start(skb, IPSET_ATTR_DATA);
+	if (!nested)
+		goto nla_put_failure;
+	NLA_PUT_NET32(skb, IPSET_ATTR_HASHSIZE,
+		      htonl(jhash_size(h->table->htable_bits)));
+	NLA_PUT_NET32(skb, IPSET_ATTR_MAXELEM, htonl(h->maxelem));
+	NLA_PUT_NET32(skb, IPSET_ATTR_ELEMENTS, htonl(h->elements));
+	NLA_PUT_NET32(skb, IPSET_ATTR_REFERENCES, htonl(set->ref));
+	NLA_PUT_NET32(skb, IPSET_ATTR_MEMSIZE, htonl(ahash_memsize(h)));
+	ipset_nest_end(skb, nested);
+
+	return 0;
+nla_put_failure:
+	return -EMSGSIZE;
+}
+
+/* Reply a LIST/SAVE request: dump the elements of the specified set,
+ * bucket by bucket, restarting from cb->args[2] */
+static int
+ahash_list(const struct ip_set *set, struct sk_buff *skb,
+	   struct netlink_callback *cb,
+	   int (*data_list)(struct sk_buff *skb, const u32 *key))
+{
+	const struct ip_set_hash *h = set->data;
+	const struct htable *t = h->table;
+	struct nlattr *atd, *nested;
+	const struct ahash_elem *e;
+	struct hlist_node *n;
+	u32 first = cb->args[2];
+	/* We assume that one hash bucket fills into one page */
+	void *incomplete;
+
+	atd = ipset_nest_start(skb, IPSET_ATTR_ADT);
+	if (!atd)
+		return -EMSGSIZE;
+	pr_debug("list hash set %s\n", set->name);
+	for (; cb->args[2] < jhash_size(t->htable_bits); cb->args[2]++) {
+		incomplete = skb_tail_pointer(skb);
+		hlist_for_each_entry(e, n, &t->bucket[cb->args[2]], node) {
+			nested = ipset_nest_start(skb, IPSET_ATTR_DATA);
+			if (!nested) {
+				if (cb->args[2] == first) {
+					nla_nest_cancel(skb, atd);
+					return -EMSGSIZE;
+				} else
+					goto nla_put_failure;
+			}
+			if (data_list(skb, e->key))
+				goto nla_put_failure;
+			ipset_nest_end(skb, nested);
+		}
+	}
+	ipset_nest_end(skb, atd);
+	/* Set listing finished */
+	cb->args[2] = 0;
+
+	return 0;
+
+nla_put_failure:
+	nlmsg_trim(skb, incomplete);
+	ipset_nest_end(skb, atd);
+	if (unlikely(first == cb->args[2])) {
+		pr_warning("Can't list set %s: one bucket does not fit into "
+			   "a message. Please report it!\n", set->name);
+		cb->args[2] = 0;
+		return -EMSGSIZE;
+	}
+	return 0;
+}
+
+/* Two sets were created with the same parameters */
+static bool
+ahash_same_set(const struct ip_set *a, const struct ip_set *b)
+{
+	const struct ip_set_hash *x = a->data;
+	const struct ip_set_hash *y = b->data;
+
+	/* Resizing changes htable_bits, so we ignore it */
+	return x->maxelem == y->maxelem;
+}
+
+#endif /* _IP_SET_AHASH_H */
@@ -384,6 +384,11 @@ struct xt_table_info
 	unsigned int hook_entry[NF_INET_NUMHOOKS];
 	unsigned int underflow[NF_INET_NUMHOOKS];
 
+	/* Rule index built by the family when the table is translated,
+	 * shared by all CPUs.  Freed along with the table. */
+	void *classify;
+	unsigned int classify_size;
+
 	/* ipt_entry tables: one per CPU */
 	/* Note : this field MUST be the last one, see XT_TABLE_INFO_SZ */
 	void *entries[1];
@@ -35,9 +35,39 @@ struct anon_vma {
 	 * mm_take_all_locks() (mm_all_locks_mutex).
 	 */
 	struct list_head head;	/* List of private "related" vmas */
+#ifdef CONFIG_MIGRATION
+	/*
+	 * Page migration holds a reference while the page it migrates is
+	 * unmapped, so that the migration ptes can still be found and
+	 * removed if the last vma is unlinked in the meantime.
+	 */
+	atomic_t migrate_refcount;
+#endif
 };
 
 #ifdef CONFIG_MMU
+#ifdef CONFIG_MIGRATION
+static inline void migrate_refcount_init(struct anon_vma *anon_vma)
+{
+	atomic_set(&anon_vma->migrate_refcount, 0);
+}
+
+static inline int migrate_refcount(struct anon_vma *anon_vma)
+{
+	return atomic_read(&anon_vma->migrate_refcount);
+}
+
+void drop_migrate_anon_vma(struct anon_vma *anon_vma);
+#else
+static inline void migrate_refcount_init(struct anon_vma *anon_vma)
+{
+}
+
+static inline int migrate_refcount(struct anon_vma *anon_vma)
+{
+	return 0;
+}
+#endif /* CONFIG_MIGRATION */
 
 static inline void anon_vma_lock(struct vm_area_struct *vma)
 {
@@ -169,6 +169,8 @@ struct skb_shared_hwtstamps {
  * @software:		generate software time stamp
  * @in_progress:	device driver is going to provide
  *			hardware time stamp
+ * @dev_zerocopy:	frags reference user pages, destructor_arg
+ *			points to the &struct ubuf_info to complete
  * @flags:		all shared_tx flags
  *
  * These flags are attached to packets as part of the
@@ -178,11 +180,31 @@ union skb_shared_tx {
 	struct {
 		__u8	hardware:1,
 			software:1,
-			in_progress:1;
+			in_progress:1,
+			dev_zerocopy:1;
 	};
 	__u8 flags;
 };
 
+/**
+ * struct ubuf_info - completion context of a zerocopy transmit
+ * @callback:	called once the last skb referencing the user pages is freed
+ * @id:		first notification id covered by this context
+ * @len:	number of notification ids covered
+ * @zerocopy:	pages were pinned, rather than copied, into the skbs
+ * @refcnt:	one reference per skb plus one held by the sender
+ *
+ * The context lives in the control buffer of the notification skb that
+ * is eventually queued on the socket error queue, see sock_zerocopy_alloc().
+ */
+struct ubuf_info {
+	void		(*callback)(struct ubuf_info *);
+	u32		id;
+	u16		len;
+	u16		zerocopy:1;
+	atomic_t	refcnt;
+};
+
 /* This data is invariant across clones and lives at
  * the end of the header data, ie. at skb->end.
  */
@@ -243,6 +265,9 @@ enum {
 	SKB_GSO_TCPV6 = 1 << 4,
 
 	SKB_GSO_FCOE = 1 << 5,
+
+	/* Equal sized UDP datagrams, gso_size is the payload of each. */
+	SKB_GSO_UDP_L4 = 1 << 6,
 };
 
 #if BITS_PER_LONG > 32
@@ -304,9 +329,11 @@ typedef unsigned char *sk_buff_data_t;
  *	@tc_index: Traffic control index
  *	@tc_verd: traffic control verdict
  *	@ndisc_nodetype: router type (from link layer)
+ *	@head_frag: skb->head is a page fragment, not a kmalloc() buffer
  *	@dma_cookie: a cookie to one of several possible DMA operations
  *		done by skb DMA functions
  *	@secmark: security marking
+ *	@napi_id: id of the napi context this skb was received on
  *	@vlan_tci: vlan tag control information
  */
 
@@ -354,8 +381,8 @@ struct sk_buff {
 				ipvs_property:1,
 				peeked:1,
 				nf_trace:1;
-	__be16			protocol:16;
 	kmemcheck_bitfield_end(flags1);
+	__be16			protocol;
 
 	void			(*destructor)(struct sk_buff *skb);
 #if defined(CONFIG_NF_CONNTRACK) || defined(CONFIG_NF_CONNTRACK_MODULE)
@@ -379,9 +406,10 @@ struct sk_buff {
 #ifdef CONFIG_IPV6_NDISC_NODETYPE
 	__u8			ndisc_nodetype:2;
 #endif
+	__u8			head_frag:1;
 	kmemcheck_bitfield_end(flags2);
 
-	/* 0/14 bit hole */
+	/* 0/13 bit hole */
 
 #ifdef CONFIG_NET_DMA
 	dma_cookie_t		dma_cookie;
@@ -389,6 +417,9 @@ struct sk_buff {
 #ifdef CONFIG_NETWORK_SECMARK
 	__u32			secmark;
 #endif
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	unsigned int		napi_id;
+#endif
 
 	__u32			mark;
 
@@ -442,6 +473,7 @@ extern void consume_skb(struct sk_buff *skb);
 extern void	       __kfree_skb(struct sk_buff *skb);
 extern struct sk_buff *__alloc_skb(unsigned int size,
 				   gfp_t priority, int fclone, int node);
+extern struct sk_buff *build_skb(void *data, unsigned int frag_size);
 static inline struct sk_buff *alloc_skb(unsigned int size,
 					gfp_t priority)
 {
@@ -536,6 +568,26 @@ static inline union skb_shared_tx *skb_tx(struct sk_buff *skb)
 	return &skb_shinfo(skb)->tx_flags;
 }
 
+static inline struct ubuf_info *skb_zcopy(struct sk_buff *skb)
+{
+	if (skb && skb_shinfo(skb)->tx_flags.dev_zerocopy)
+		return skb_shinfo(skb)->destructor_arg;
+	return NULL;
+}
+
+static inline void skb_zcopy_set(struct sk_buff *skb, struct ubuf_info *uarg)
+{
+	if (uarg) {
+		atomic_inc(&uarg->refcnt);
+		skb_shinfo(skb)->destructor_arg = uarg;
+		skb_shinfo(skb)->tx_flags.dev_zerocopy = 1;
+	}
+}
+
+extern struct ubuf_info *sock_zerocopy_alloc(struct sock *sk);
+extern void sock_zerocopy_put(struct ubuf_info *uarg);
+extern void sock_zerocopy_put_abort(struct ubuf_info *uarg);
+
 /**
  *	skb_queue_empty - check if a queue is empty
  *	@list: queue head
@@ -1467,6 +1519,8 @@ static inline struct sk_buff *__dev_alloc_skb(unsigned int length,
 
 extern struct sk_buff *dev_alloc_skb(unsigned int length);
 
+extern void *netdev_alloc_frag(unsigned int fragsz);
+
 extern struct sk_buff *__netdev_alloc_skb(struct net_device *dev,
 		unsigned int length, gfp_t gfp_mask);
 
@@ -32,18 +32,29 @@ enum stat_item {
 	DEACTIVATE_TO_TAIL,	/* Cpu slab was moved to the tail of partials */
 	DEACTIVATE_REMOTE_FREES,/* Slab contained remotely freed objects */
 	ORDER_FALLBACK,		/* Number of times fallback was necessary */
+	CMPXCHG_DOUBLE_CPU_FAIL,/* Failure of cmpxchg_double on cpu freelist */
+	CPU_PARTIAL_ALLOC,	/* Cpu slab acquired from cpu partial list */
+	CPU_PARTIAL_FREE,	/* Slab put on cpu partial list by a free */
+	CPU_PARTIAL_DRAIN,	/* Cpu partial list moved to node partial list */
 	NR_SLUB_STAT_ITEMS };
 
+/*
+ * freelist and tid must be adjacent and double word aligned: the fast
+ * paths replace both with one cmpxchg_double_local() if the arch has it.
+ */
 struct kmem_cache_cpu {
 	void **freelist;	/* Pointer to first free per cpu object */
+	unsigned long tid;	/* Changes with every update of the cpu slab */
 	struct page *page;	/* The slab from which we are allocating */
 	int node;		/* The node of the page (or -1 for debug) */
 	unsigned int offset;	/* Freepointer offset (in word units) */
 	unsigned int objsize;	/* Size of an object (from kmem_cache) */
+	struct list_head partial;	/* Frozen partial slabs of this cpu */
+	int nr_partial;		/* Number of slabs on partial */
 #ifdef CONFIG_SLUB_STATS
 	unsigned stat[NR_SLUB_STAT_ITEMS];
 #endif
-};
+} __aligned(2 * sizeof(void *));
 
 struct kmem_cache_node {
 	spinlock_t list_lock;	/* Protect partial list and nr_partial */
@@ -91,6 +102,7 @@ struct kmem_cache {
 	int inuse;		/* Offset to metadata */
 	int align;		/* Alignment */
 	unsigned long min_partial;
+	int cpu_partial;	/* Max number of slabs on a cpu partial list */
 	const char *name;	/* Name (only for display!) */
 	struct list_head list;	/* List of slab caches */
 #ifdef CONFIG_SLUB_DEBUG
@@ -142,6 +142,13 @@ struct ucred {
 	__u32	gid;
 };
 
+/* SO_BUSY_POLL_STATS */
+struct so_busy_poll_stats {
+	__u64	loops;		/* busy poll loops run for the socket */
+	__u64	packets;	/* packets the device delivered meanwhile */
+	__u64	hits;		/* loops that ended with data queued */
+};
+
 /* Supported address families. */
 #define AF_UNSPEC	0
 #define AF_UNIX		1	/* Unix domain sockets 		*/
@@ -246,6 +253,7 @@ struct ucred {
 #define MSG_ERRQUEUE	0x2000	/* Fetch message from error queue */
 #define MSG_NOSIGNAL	0x4000	/* Do not generate SIGPIPE */
 #define MSG_MORE	0x8000	/* Sender will send more */
+#define MSG_ZEROCOPY	0x4000000	/* Use user data in kernel path */
 
 #define MSG_EOF         MSG_FIN
 
@@ -8,6 +8,7 @@
 #include <linux/memcontrol.h>
 #include <linux/sched.h>
 #include <linux/node.h>
+#include <linux/workqueue.h>
 
 #include <asm/atomic.h>
 #include <asm/page.h>
@@ -16,6 +17,8 @@ struct notifier_block;
 
 struct bio;
 
+struct radix_tree_node;
+
 #define SWAP_FLAG_PREFER	0x8000	/* set if swap priority specified */
 #define SWAP_FLAG_PRIO_MASK	0x7fff
 #define SWAP_FLAG_PRIO_SHIFT	0
@@ -155,6 +158,39 @@ enum {
 #define SWAP_MAP_BAD	0x7fff
 #define SWAP_HAS_CACHE  0x8000		/* There is a swap cache of entry. */
 #define SWAP_COUNT_MASK (~SWAP_HAS_CACHE)
+
+/*
+ * On solid state swap the map is divided into SWAPFILE_CLUSTER sized,
+ * naturally aligned clusters.  Each has a lock for the swap_map[] counts
+ * inside it, so that dropping a reference does not need swap_lock.
+ *
+ * data is the number of allocated slots while the cluster is in use,
+ * or the index of the next cluster while it is on the free or discard
+ * list; those lists, data and flags are protected by swap_lock.
+ */
+struct swap_cluster_info {
+	spinlock_t lock;	/* protects swap_map[] of this cluster */
+	unsigned int data:24;
+	unsigned int flags:8;
+};
+#define CLUSTER_FLAG_FREE	1	/* cluster is on the free list */
+
+struct swap_cluster_list {
+	unsigned int head;		/* first cluster, if !empty */
+	unsigned int tail;
+	bool empty;
+};
+
+/*
+ * Each cpu allocates from a cluster of its own, so that concurrent
+ * swapout from several cpus still writes sequentially to the device.
+ */
+struct percpu_cluster {
+	unsigned int index;		/* current cluster, if !empty */
+	unsigned int next;		/* likely next allocation offset */
+	bool empty;
+};
+
 /*
  * The in-memory structure used to track swap areas.
  */
@@ -177,6 +213,11 @@ struct swap_info_struct {
 	unsigned int max;
 	unsigned int inuse_pages;
 	unsigned int old_block_size;
+	struct swap_cluster_info *cluster_info;	/* only for SSD */
+	struct swap_cluster_list free_clusters;	/* free clusters list */
+	struct swap_cluster_list discard_clusters; /* clusters to discard */
+	struct percpu_cluster *percpu_cluster;	/* per cpu allocation point */
+	struct work_struct discard_work;	/* discard free clusters */
 };
 
 struct swap_list_t {
@@ -187,6 +228,14 @@ struct swap_list_t {
 /* Swap 50% full? Release swapcache more aggressively.. */
 #define vm_swap_full() (nr_swap_pages*2 < total_swap_pages)
 
+/* linux/mm/workingset.c */
+void *workingset_eviction(struct address_space *mapping, struct page *page);
+bool workingset_refault(void *shadow);
+void workingset_activation(struct page *page);
+void workingset_update_node(struct address_space *mapping,
+			    struct radix_tree_node *node);
+void workingset_forget_node(struct radix_tree_node *node);
+
 /* linux/mm/page_alloc.c */
 extern unsigned long totalram_pages;
 extern unsigned long totalreserve_pages;
@@ -205,6 +254,7 @@ extern void mark_page_accessed(struct page *);
 extern void lru_add_drain(void);
 extern int lru_add_drain_all(void);
 extern void rotate_reclaimable_page(struct page *page);
+extern void mark_page_lazyfree(struct page *page);
 extern void swap_setup(void);
 
 extern void add_page_to_unevictable_list(struct page *page);
@@ -223,6 +273,11 @@ static inline void lru_cache_add_file(struct page *page)
 	__lru_cache_add(page, LRU_INACTIVE_FILE);
 }
 
+static inline void lru_cache_add_active_file(struct page *page)
+{
+	__lru_cache_add(page, LRU_ACTIVE_FILE);
+}
+
 /* linux/mm/vmscan.c */
 extern unsigned long try_to_free_pages(struct zonelist *zonelist, int order,
 					gfp_t gfp_mask, nodemask_t *mask);
@@ -234,6 +289,12 @@ extern unsigned long mem_cgroup_shrink_node_zone(struct mem_cgroup *mem,
 						unsigned int swappiness,
 						struct zone *zone,
 						int nid);
+
+/* LRU Isolation modes. */
+#define ISOLATE_INACTIVE 0	/* Isolate inactive pages. */
+#define ISOLATE_ACTIVE 1	/* Isolate active pages. */
+#define ISOLATE_BOTH 2		/* Isolate both active and inactive pages. */
+
 extern int __isolate_lru_page(struct page *page, int mode, int file);
 extern unsigned long shrink_all_memory(unsigned long nr_pages);
 extern int vm_swappiness;
@@ -275,6 +336,7 @@ extern void swap_unplug_io_fn(struct backing_dev_info *, struct page *);
 /* linux/mm/page_io.c */
 extern int swap_readpage(struct page *);
 extern int swap_writepage(struct page *page, struct writeback_control *wbc);
+extern int __swap_writepage(struct page *page, struct writeback_control *wbc);
 extern void end_swap_bio_read(struct bio *bio, int err);
 
 /* linux/mm/swap_state.c */
@@ -290,20 +352,28 @@ extern void free_pages_and_swap_cache(struct page **, int);
 extern struct page *lookup_swap_cache(swp_entry_t);
 extern struct page *read_swap_cache_async(swp_entry_t, gfp_t,
 			struct vm_area_struct *vma, unsigned long addr);
+extern struct page *__read_swap_cache_async(swp_entry_t, gfp_t,
+			struct vm_area_struct *vma, unsigned long addr,
+			bool *new_page_allocated);
 extern struct page *swapin_readahead(swp_entry_t, gfp_t,
 			struct vm_area_struct *vma, unsigned long addr);
 
+/* linux/mm/swap_slots.c */
+extern swp_entry_t get_swap_page(void);
+
 /* linux/mm/swapfile.c */
 extern long nr_swap_pages;
 extern long total_swap_pages;
 extern void si_swapinfo(struct sysinfo *);
-extern swp_entry_t get_swap_page(void);
+extern int get_swap_pages(int n, swp_entry_t swp_entries[]);
 extern swp_entry_t get_swap_page_of_type(int);
 extern void swap_duplicate(swp_entry_t);
 extern int swapcache_prepare(swp_entry_t);
 extern int valid_swaphandles(swp_entry_t, unsigned long *);
 extern void swap_free(swp_entry_t);
 extern void swapcache_free(swp_entry_t, struct page *page);
+extern void swapcache_free_entries(swp_entry_t *entries, int n);
+extern int __swap_count(swp_entry_t entry);
 extern int free_swap_and_cache(swp_entry_t);
 extern int swap_type_of(dev_t, sector_t, struct block_device **);
 extern unsigned int count_swap_pages(int, int);
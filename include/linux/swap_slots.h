@@ -0,0 +1,31 @@
+#ifndef _LINUX_SWAP_SLOTS_H
+#define _LINUX_SWAP_SLOTS_H
+
+#include <linux/swap.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+
+#define SWAP_SLOTS_CACHE_SIZE	64
+
+/*
+ * Per cpu caches of swap slots: slots[] holds slots already allocated
+ * for swapout, slots_ret[] holds freed slots (still marked SWAP_HAS_CACHE
+ * in the swap_map) waiting to be returned in one batch under swap_lock.
+ */
+struct swap_slots_cache {
+	struct mutex	alloc_lock;	/* protects slots, nr, cur */
+	swp_entry_t	slots[SWAP_SLOTS_CACHE_SIZE];
+	int		nr;
+	int		cur;
+	spinlock_t	free_lock;	/* protects slots_ret, n_ret */
+	swp_entry_t	slots_ret[SWAP_SLOTS_CACHE_SIZE];
+	int		n_ret;
+};
+
+extern bool swap_slot_cache_active;
+
+extern void free_swap_slot(swp_entry_t entry);
+extern void disable_swap_slots_cache_lock(void);
+extern void reenable_swap_slots_cache_unlock(void);
+
+#endif /* _LINUX_SWAP_SLOTS_H */
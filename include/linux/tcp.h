@@ -157,6 +157,10 @@ struct tcp_info
 	__u32	tcpi_rcv_space;
 
 	__u32	tcpi_total_retrans;
+
+	__u64	tcpi_pacing_rate;	/* bytes/s, ~0ULL if not paced */
+	__u32	tcpi_tx_queued;		/* bytes in qdisc/device queues */
+	__u32	tcpi_tsq_throttled;	/* times stopped by TSQ */
 };
 
 /* for TCP_MD5SIG socket option */
@@ -174,6 +178,7 @@ struct tcp_md5sig {
 
 #include <linux/skbuff.h>
 #include <linux/dmaengine.h>
+#include <linux/hrtimer.h>
 #include <net/sock.h>
 #include <net/inet_connection_sock.h>
 #include <net/inet_timewait_sock.h>
@@ -399,6 +404,13 @@ struct tcp_sock {
 		u32		  probe_seq_end;
 	} mtu_probe;
 
+/* TCP Small Queues and pacing */
+	unsigned long	tsq_flags;
+	struct list_head tsq_node;	/* anchor in tsq_tasklet.head list */
+	u32	tsq_throttled;	/* times the TSQ limit stopped tcp_write_xmit */
+	u32	pacing_rate;	/* bytes per second, ~0U if not paced */
+	struct hrtimer	pacing_timer;
+
 #ifdef CONFIG_TCP_MD5SIG
 /* TCP AF-Specific parts; only used by MD5 Signature support so far */
 	const struct tcp_sock_af_ops	*af_specific;
@@ -408,6 +420,12 @@ struct tcp_sock {
 #endif
 };
 
+enum tsq_flags {
+	TSQ_THROTTLED,		/* stopped by the small queue limit */
+	TSQ_QUEUED,		/* on the per cpu tsq_tasklet list */
+	TCP_TSQ_DEFERRED,	/* tcp_tasklet_func() found socket was owned */
+};
+
 static inline struct tcp_sock *tcp_sk(const struct sock *sk)
 {
 	return (struct tcp_sock *)sk;
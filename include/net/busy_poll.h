@@ -0,0 +1,138 @@
+/*
+ * net/busy_poll.h: Low latency receive by busy polling the device
+ *
+ * Instead of sleeping until the interrupt and softirq deliver data, a
+ * socket reader may spin calling the ->poll() routine of the napi
+ * context that last delivered to the socket, for a bounded amount of
+ * time.  Opt in per socket with SO_BUSY_POLL, or globally through
+ * /proc/sys/net/core/busy_read and busy_poll.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#ifndef _LINUX_NET_BUSY_POLL_H
+#define _LINUX_NET_BUSY_POLL_H
+
+#include <linux/netdevice.h>
+#include <linux/sched.h>
+#include <net/sock.h>
+
+/*
+ * Returned by sock_poll() for sockets that can busy poll, and set in
+ * poll_table->key by select/poll to ask for one busy poll pass.
+ */
+#define POLL_BUSY_LOOP		0x8000
+
+#define BUSY_POLL_BUDGET	8
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+
+extern unsigned int sysctl_net_busy_read __read_mostly;
+extern unsigned int sysctl_net_busy_poll __read_mostly;
+
+static inline bool net_busy_loop_on(void)
+{
+	return sysctl_net_busy_poll;
+}
+
+static inline bool sk_can_busy_loop(struct sock *sk)
+{
+	return sk->sk_ll_usec && sk->sk_napi_id && !signal_pending(current);
+}
+
+/* a wrapper to make debug_smp_processor_id() happy,
+ * we can use either clock as the time is only compared
+ * against itself, in microseconds
+ */
+static inline unsigned long busy_loop_current_time(void)
+{
+	return (unsigned long)(cpu_clock(raw_smp_processor_id()) >> 10);
+}
+
+/* in poll/select we use the global sysctl_net_busy_poll value */
+static inline bool busy_loop_timeout(unsigned long start_time)
+{
+	unsigned long bp_usec = ACCESS_ONCE(sysctl_net_busy_poll);
+
+	if (bp_usec) {
+		unsigned long end_time = start_time + bp_usec;
+		unsigned long now = busy_loop_current_time();
+
+		return time_after(now, end_time);
+	}
+	return true;
+}
+
+static inline bool sk_busy_loop_timeout(struct sock *sk,
+					unsigned long start_time)
+{
+	unsigned long bp_usec = ACCESS_ONCE(sk->sk_ll_usec);
+
+	if (bp_usec) {
+		unsigned long end_time = start_time + bp_usec;
+		unsigned long now = busy_loop_current_time();
+
+		return time_after(now, end_time);
+	}
+	return true;
+}
+
+extern int napi_busy_loop(unsigned int napi_id,
+			  bool (*loop_end)(void *, unsigned long),
+			  void *loop_end_arg);
+
+extern bool sk_busy_loop(struct sock *sk, int nonblock);
+
+/* used in the NIC receive handler to mark the skb */
+static inline void skb_mark_napi_id(struct sk_buff *skb,
+				    struct napi_struct *napi)
+{
+	skb->napi_id = napi->napi_id;
+}
+
+/* used in the protocol handler to propagate the napi_id to the socket */
+static inline void sk_mark_napi_id(struct sock *sk, const struct sk_buff *skb)
+{
+	sk->sk_napi_id = skb->napi_id;
+}
+
+#else /* CONFIG_NET_RX_BUSY_POLL */
+
+static inline bool net_busy_loop_on(void)
+{
+	return false;
+}
+
+static inline bool sk_can_busy_loop(struct sock *sk)
+{
+	return false;
+}
+
+static inline unsigned long busy_loop_current_time(void)
+{
+	return 0;
+}
+
+static inline bool busy_loop_timeout(unsigned long start_time)
+{
+	return true;
+}
+
+static inline bool sk_busy_loop(struct sock *sk, int nonblock)
+{
+	return false;
+}
+
+static inline void skb_mark_napi_id(struct sk_buff *skb,
+				    struct napi_struct *napi)
+{
+}
+
+static inline void sk_mark_napi_id(struct sock *sk, const struct sk_buff *skb)
+{
+}
+
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+#endif /* _LINUX_NET_BUSY_POLL_H */
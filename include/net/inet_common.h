@@ -45,6 +45,11 @@ extern int			inet_ctl_sock_create(struct sock **sk,
 						     unsigned char protocol,
 						     struct net *net);
 
+struct sk_buff;
+extern struct sk_buff		**inet_gro_receive(struct sk_buff **head,
+						   struct sk_buff *skb);
+extern int			inet_gro_complete(struct sk_buff *skb);
+
 static inline void inet_ctl_sock_destroy(struct sock *sk)
 {
 	sk_release_kernel(sk);
@@ -146,6 +146,7 @@ struct inet_sock {
 		int			length; /* Total length of all frames */
 		__be32			addr;
 		struct flowi		fl;
+		__u16			gso_size; /* UDP segment payload */
 	} cork;
 };
 
@@ -45,6 +45,29 @@ struct fib_config {
 
 struct fib_info;
 
+/*
+ * Path MTU and redirect state learned for a destination behind a nexthop,
+ * kept while routes are not cached (see rt_cache_rebuild_count).
+ */
+struct fib_nh_exception {
+	struct fib_nh_exception	*fnhe_next;
+	__be32			fnhe_daddr;
+	u32			fnhe_pmtu;
+	__be32			fnhe_gw;
+	unsigned long		fnhe_expires;
+	unsigned long		fnhe_stamp;
+};
+
+struct fnhe_hash_bucket {
+	struct fib_nh_exception	*chain;
+};
+
+#define FNHE_HASH_SHIFT		8
+#define FNHE_HASH_SIZE		(1 << FNHE_HASH_SHIFT)
+#define FNHE_RECLAIM_DEPTH	5
+
+struct rtable;
+
 struct fib_nh {
 	struct net_device	*nh_dev;
 	struct hlist_node	nh_hash;
@@ -60,6 +83,9 @@ struct fib_nh {
 #endif
 	int			nh_oif;
 	__be32			nh_gw;
+	struct fnhe_hash_bucket	*nh_exceptions;
+	struct rtable		**nh_pcpu_rth_output;
+	struct rtable		**nh_pcpu_rth_input;
 };
 
 /*
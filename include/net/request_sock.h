@@ -19,6 +19,7 @@
 #include <linux/spinlock.h>
 #include <linux/types.h>
 #include <linux/bug.h>
+#include <linux/workqueue.h>
 
 #include <net/sock.h>
 
@@ -57,6 +58,7 @@ struct request_sock {
 	struct sock			*sk;
 	u32				secid;
 	u32				peer_secid;
+	u32				hash;	/* unmasked syn_table hash */
 };
 
 static inline struct request_sock *reqsk_alloc(const struct request_sock_ops *ops)
@@ -85,16 +87,25 @@ extern int sysctl_max_syn_backlog;
 /** struct listen_sock - listen state
  *
  * @max_qlen_log - log_2 of maximal queued SYNs/REQUESTs
+ * @nr_table_entries - current size of @syn_table, grows with @qlen
+ * @max_table_entries - size @syn_table may grow to
+ * @lock_mask - @syn_table[i] is protected by @syn_locks[i & @lock_mask]
+ * @grow_work - doubles @syn_table when it gets crowded
  */
 struct listen_sock {
 	u8			max_qlen_log;
 	/* 3 bytes hole, try to use */
-	int			qlen;
-	int			qlen_young;
+	atomic_t		qlen;
+	atomic_t		qlen_young;
 	int			clock_hand;
 	u32			hash_rnd;
 	u32			nr_table_entries;
-	struct request_sock	*syn_table[0];
+	u32			max_table_entries;
+	u32			lock_mask;
+	spinlock_t		*syn_locks;
+	struct request_sock	**syn_table;
+	struct request_sock_queue *queue;
+	struct work_struct	grow_work;
 };
 
 /** struct request_sock_queue - queue of request_socks
@@ -104,14 +115,20 @@ struct listen_sock {
  * @rskq_defer_accept - User waits for some data after accept()
  * @syn_wait_lock - serializer
  *
- * %syn_wait_lock is necessary only to avoid proc interface having to grab the main
- * lock sock while browsing the listening hash (otherwise it's deadlock prone).
+ * The accept queue is protected by the main sock lock.
  *
- * This lock is acquired in read mode only from listening_get_next() seq_file
- * op and it's acquired in write mode _only_ from code that is actively
- * changing rskq_accept_head. All readers that are holding the master sock lock
- * don't need to grab this lock in read mode too as rskq_accept_head. writes
- * are always protected from the main sock lock.
+ * The SYN queue is not: new connection requests are added to it without
+ * holding the listener lock, so that SYNs to one listener can be processed
+ * on all cpus at once.  Its hash chains are protected by the bucket locks
+ * in struct listen_sock, taken with %syn_wait_lock held in read mode.
+ * %syn_wait_lock is acquired in write mode only to resize the hash table
+ * and to take listen_opt away when the socket stops listening, hence
+ * holding it in read mode also keeps listen_opt alive.  So does holding
+ * the master sock lock, or an RCU read lock taken while the socket was
+ * in LISTEN state: such code may look at listen_opt and its counters
+ * without %syn_wait_lock.  Request_socks it found in the SYN queue stay valid
+ * after dropping the bucket lock: they are only freed under the master
+ * sock lock.
  */
 struct request_sock_queue {
 	struct request_sock	*rskq_accept_head;
@@ -142,13 +159,35 @@ static inline int reqsk_queue_empty(struct request_sock_queue *queue)
 	return queue->rskq_accept_head == NULL;
 }
 
+static inline spinlock_t *reqsk_queue_lockp(const struct listen_sock *lopt,
+					    u32 hash)
+{
+	return &lopt->syn_locks[hash & lopt->lock_mask];
+}
+
+static inline struct request_sock **
+	reqsk_queue_bucket(const struct listen_sock *lopt, u32 hash)
+{
+	return &lopt->syn_table[hash & (lopt->nr_table_entries - 1)];
+}
+
 static inline void reqsk_queue_unlink(struct request_sock_queue *queue,
-				      struct request_sock *req,
-				      struct request_sock **prev_req)
+				      struct request_sock *req)
 {
-	write_lock(&queue->syn_wait_lock);
-	*prev_req = req->dl_next;
-	write_unlock(&queue->syn_wait_lock);
+	struct listen_sock *lopt;
+	struct request_sock **prev;
+	spinlock_t *lock;
+
+	read_lock(&queue->syn_wait_lock);
+	lopt = queue->listen_opt;
+	lock = reqsk_queue_lockp(lopt, req->hash);
+	spin_lock(lock);
+	for (prev = reqsk_queue_bucket(lopt, req->hash); *prev != req;
+	     prev = &(*prev)->dl_next)
+		;
+	*prev = req->dl_next;
+	spin_unlock(lock);
+	read_unlock(&queue->syn_wait_lock);
 }
 
 static inline void reqsk_queue_add(struct request_sock_queue *queue,
@@ -200,50 +239,62 @@ static inline int reqsk_queue_removed(struct request_sock_queue *queue,
 	struct listen_sock *lopt = queue->listen_opt;
 
 	if (req->retrans == 0)
-		--lopt->qlen_young;
+		atomic_dec(&lopt->qlen_young);
 
-	return --lopt->qlen;
+	return atomic_dec_return(&lopt->qlen);
 }
 
 static inline int reqsk_queue_added(struct request_sock_queue *queue)
 {
 	struct listen_sock *lopt = queue->listen_opt;
-	const int prev_qlen = lopt->qlen;
 
-	lopt->qlen_young++;
-	lopt->qlen++;
-	return prev_qlen;
+	atomic_inc(&lopt->qlen_young);
+	return atomic_inc_return(&lopt->qlen) - 1;
 }
 
 static inline int reqsk_queue_len(const struct request_sock_queue *queue)
 {
-	return queue->listen_opt != NULL ? queue->listen_opt->qlen : 0;
+	return queue->listen_opt != NULL ?
+	       atomic_read(&queue->listen_opt->qlen) : 0;
 }
 
 static inline int reqsk_queue_len_young(const struct request_sock_queue *queue)
 {
-	return queue->listen_opt->qlen_young;
+	return atomic_read(&queue->listen_opt->qlen_young);
 }
 
 static inline int reqsk_queue_is_full(const struct request_sock_queue *queue)
 {
-	return queue->listen_opt->qlen >> queue->listen_opt->max_qlen_log;
+	return atomic_read(&queue->listen_opt->qlen) >>
+	       queue->listen_opt->max_qlen_log;
 }
 
 static inline void reqsk_queue_hash_req(struct request_sock_queue *queue,
 					u32 hash, struct request_sock *req,
 					unsigned long timeout)
 {
-	struct listen_sock *lopt = queue->listen_opt;
+	struct listen_sock *lopt;
+	struct request_sock **head;
+	spinlock_t *lock;
 
 	req->expires = jiffies + timeout;
 	req->retrans = 0;
 	req->sk = NULL;
-	req->dl_next = lopt->syn_table[hash];
-
-	write_lock(&queue->syn_wait_lock);
-	lopt->syn_table[hash] = req;
-	write_unlock(&queue->syn_wait_lock);
+	req->hash = hash;
+
+	read_lock(&queue->syn_wait_lock);
+	lopt = queue->listen_opt;
+	lock = reqsk_queue_lockp(lopt, hash);
+	spin_lock(lock);
+	head = reqsk_queue_bucket(lopt, hash);
+	req->dl_next = *head;
+	*head = req;
+	spin_unlock(lock);
+
+	if (atomic_read(&lopt->qlen) >= lopt->nr_table_entries &&
+	    lopt->nr_table_entries < lopt->max_table_entries)
+		schedule_work(&lopt->grow_work);
+	read_unlock(&queue->syn_wait_lock);
 }
 
 #endif /* _REQUEST_SOCK_H */
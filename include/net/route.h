@@ -49,6 +49,7 @@
 
 struct fib_nh;
 struct inet_peer;
+struct uncached_list;
 struct rtable
 {
 	union
@@ -75,6 +76,10 @@ struct rtable
 	/* Miscellaneous cached information */
 	__be32			rt_spec_dst; /* RFC1122 specific destination */
 	struct inet_peer	*peer; /* long-living peer info */
+
+	/* Routes not in the cache, for device unregistration */
+	struct list_head	rt_uncached;
+	struct uncached_list	*rt_uncached_list;
 };
 
 struct ip_rt_acct
@@ -112,6 +117,7 @@ extern int		ip_rt_init(void);
 extern void		ip_rt_redirect(__be32 old_gw, __be32 dst, __be32 new_gw,
 				       __be32 src, struct net_device *dev);
 extern void		rt_cache_flush(struct net *net, int how);
+extern void		rt_flush_dev(struct net_device *dev);
 extern int		__ip_route_output_key(struct net *, struct rtable **, const struct flowi *flp);
 extern int		ip_route_output_key(struct net *, struct rtable **, struct flowi *flp);
 extern int		ip_route_output_flow(struct net *, struct rtable **rp, struct flowi *flp, struct sock *sk, int flags);
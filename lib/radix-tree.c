@@ -34,26 +34,6 @@
 #include <linux/rcupdate.h>
 
 
-#ifdef __KERNEL__
-#define RADIX_TREE_MAP_SHIFT	(CONFIG_BASE_SMALL ? 4 : 6)
-#else
-#define RADIX_TREE_MAP_SHIFT	3	/* For more stressful testing */
-#endif
-
-#define RADIX_TREE_MAP_SIZE	(1UL << RADIX_TREE_MAP_SHIFT)
-#define RADIX_TREE_MAP_MASK	(RADIX_TREE_MAP_SIZE-1)
-
-#define RADIX_TREE_TAG_LONGS	\
-	((RADIX_TREE_MAP_SIZE + BITS_PER_LONG - 1) / BITS_PER_LONG)
-
-struct radix_tree_node {
-	unsigned int	height;		/* Height from the bottom */
-	unsigned int	count;
-	struct rcu_head	rcu_head;
-	void		*slots[RADIX_TREE_MAP_SIZE];
-	unsigned long	tags[RADIX_TREE_MAX_TAGS][RADIX_TREE_TAG_LONGS];
-};
-
 struct radix_tree_path {
 	struct radix_tree_node *node;
 	int offset;
@@ -185,6 +165,7 @@ static void radix_tree_node_rcu_free(struct rcu_head *head)
 	tag_clear(node, 1, 0);
 	node->slots[0] = NULL;
 	node->count = 0;
+	node->exceptional = 0;
 
 	kmem_cache_free(radix_tree_node_cachep, node);
 }
@@ -275,6 +256,11 @@ static int radix_tree_extend(struct radix_tree_root *root, unsigned long index)
 		newheight = root->height+1;
 		node->height = newheight;
 		node->count = 1;
+		if (newheight == 1) {
+			node->index = 0;
+			if (radix_tree_exceptional_entry(node->slots[0]))
+				node->exceptional = 1;
+		}
 		node = radix_tree_ptr_to_indirect(node);
 		rcu_assign_pointer(root->rnode, node);
 		root->height = newheight;
@@ -320,6 +306,8 @@ int radix_tree_insert(struct radix_tree_root *root,
 			if (!(slot = radix_tree_node_alloc(root)))
 				return -ENOMEM;
 			slot->height = height;
+			if (height == 1)
+				slot->index = index & ~RADIX_TREE_MAP_MASK;
 			if (node) {
 				rcu_assign_pointer(node->slots[offset], slot);
 				node->count++;
@@ -341,6 +329,8 @@ int radix_tree_insert(struct radix_tree_root *root,
 
 	if (node) {
 		node->count++;
+		if (radix_tree_exceptional_entry(item))
+			node->exceptional++;
 		rcu_assign_pointer(node->slots[offset], item);
 		BUG_ON(tag_get(node, 0, offset));
 		BUG_ON(tag_get(node, 1, offset));
@@ -354,6 +344,90 @@ int radix_tree_insert(struct radix_tree_root *root,
 }
 EXPORT_SYMBOL(radix_tree_insert);
 
+/**
+ *	__radix_tree_lookup	-	lookup an item in a radix tree
+ *	@root:		radix tree root
+ *	@index:		index key
+ *	@nodep:		returns the leaf node covering @index
+ *	@slotp:		returns the slot of @index
+ *
+ *	Like radix_tree_lookup(), but also returns where the item lives, for
+ *	users that keep track of the contents of leaf nodes.  *@nodep is set
+ *	whenever a leaf node covers @index, even if the slot is empty, and is
+ *	NULL if @index has no leaf node or is stored in the root itself.
+ *
+ *	The caller must hold the tree write locked.
+ */
+void *__radix_tree_lookup(struct radix_tree_root *root, unsigned long index,
+			  struct radix_tree_node **nodep, void ***slotp)
+{
+	struct radix_tree_node *node, *parent;
+	unsigned int height, shift;
+	void **slot;
+
+	*nodep = NULL;
+	*slotp = NULL;
+
+	node = root->rnode;
+	if (node == NULL)
+		return NULL;
+
+	if (!radix_tree_is_indirect_ptr(node)) {
+		if (index > 0)
+			return NULL;
+		*slotp = (void **)&root->rnode;
+		return node;
+	}
+	node = radix_tree_indirect_to_ptr(node);
+
+	height = node->height;
+	if (index > radix_tree_maxindex(height))
+		return NULL;
+
+	shift = (height-1) * RADIX_TREE_MAP_SHIFT;
+
+	do {
+		parent = node;
+		slot = parent->slots + ((index >> shift) & RADIX_TREE_MAP_MASK);
+		node = *slot;
+		if (node == NULL && height > 1)
+			return NULL;
+
+		shift -= RADIX_TREE_MAP_SHIFT;
+		height--;
+	} while (height > 0);
+
+	*nodep = parent;
+	*slotp = slot;
+	return node;
+}
+EXPORT_SYMBOL(__radix_tree_lookup);
+
+/**
+ *	__radix_tree_replace	-	replace item in a slot
+ *	@node:		leaf node of the slot, from __radix_tree_lookup()
+ *	@slot:		slot, from __radix_tree_lookup()
+ *	@item:		new item to store in the slot
+ *
+ *	Like radix_tree_replace_slot(), but also keeps the count of
+ *	exceptional entries in @node straight.  The slot must not be empty,
+ *	and neither must @item.
+ */
+void __radix_tree_replace(struct radix_tree_node *node, void **slot,
+			  void *item)
+{
+	BUG_ON(!item || !*slot);
+
+	if (node) {
+		if (radix_tree_exceptional_entry(*slot))
+			node->exceptional--;
+		if (radix_tree_exceptional_entry(item))
+			node->exceptional++;
+	}
+	radix_tree_replace_slot(slot, item);
+}
+EXPORT_SYMBOL(__radix_tree_replace);
+
 /*
  * is_slot == 1 : search for the slot.
  * is_slot == 0 : search for the node.
@@ -684,8 +758,8 @@ unsigned long radix_tree_prev_hole(struct radix_tree_root *root,
 EXPORT_SYMBOL(radix_tree_prev_hole);
 
 static unsigned int
-__lookup(struct radix_tree_node *slot, void ***results, unsigned long index,
-	unsigned int max_items, unsigned long *next_index)
+__lookup(struct radix_tree_node *slot, void ***results, unsigned long *indices,
+	unsigned long index, unsigned int max_items, unsigned long *next_index)
 {
 	unsigned int nr_found = 0;
 	unsigned int shift, height;
@@ -718,12 +792,16 @@ __lookup(struct radix_tree_node *slot, void ***results, unsigned long index,
 
 	/* Bottom level: grab some items */
 	for (i = index & RADIX_TREE_MAP_MASK; i < RADIX_TREE_MAP_SIZE; i++) {
-		index++;
 		if (slot->slots[i]) {
-			results[nr_found++] = &(slot->slots[i]);
-			if (nr_found == max_items)
+			results[nr_found] = &(slot->slots[i]);
+			if (indices)
+				indices[nr_found] = index;
+			if (++nr_found == max_items) {
+				index++;
 				goto out;
+			}
 		}
+		index++;
 	}
 out:
 	*next_index = index;
@@ -779,8 +857,8 @@ radix_tree_gang_lookup(struct radix_tree_root *root, void **results,
 
 		if (cur_index > max_index)
 			break;
-		slots_found = __lookup(node, (void ***)results + ret, cur_index,
-					max_items - ret, &next_index);
+		slots_found = __lookup(node, (void ***)results + ret, NULL,
+				cur_index, max_items - ret, &next_index);
 		nr_found = 0;
 		for (i = 0; i < slots_found; i++) {
 			struct radix_tree_node *slot;
@@ -804,6 +882,7 @@ EXPORT_SYMBOL(radix_tree_gang_lookup);
  *	radix_tree_gang_lookup_slot - perform multiple slot lookup on radix tree
  *	@root:		radix tree root
  *	@results:	where the results of the lookup are placed
+ *	@indices:	where their indices should be placed (but usually NULL)
  *	@first_index:	start the lookup from this key
  *	@max_items:	place up to this many items at *results
  *
@@ -819,7 +898,8 @@ EXPORT_SYMBOL(radix_tree_gang_lookup);
  */
 unsigned int
 radix_tree_gang_lookup_slot(struct radix_tree_root *root, void ***results,
-			unsigned long first_index, unsigned int max_items)
+			unsigned long *indices, unsigned long first_index,
+			unsigned int max_items)
 {
 	unsigned long max_index;
 	struct radix_tree_node *node;
@@ -834,6 +914,8 @@ radix_tree_gang_lookup_slot(struct radix_tree_root *root, void ***results,
 		if (first_index > 0)
 			return 0;
 		results[0] = (void **)&root->rnode;
+		if (indices)
+			indices[0] = 0;
 		return 1;
 	}
 	node = radix_tree_indirect_to_ptr(node);
@@ -847,8 +929,9 @@ radix_tree_gang_lookup_slot(struct radix_tree_root *root, void ***results,
 
 		if (cur_index > max_index)
 			break;
-		slots_found = __lookup(node, results + ret, cur_index,
-					max_items - ret, &next_index);
+		slots_found = __lookup(node, results + ret,
+				indices ? indices + ret : NULL,
+				cur_index, max_items - ret, &next_index);
 		ret += slots_found;
 		if (next_index == 0)
 			break;
@@ -1076,6 +1159,9 @@ static inline void radix_tree_shrink(struct radix_tree_root *root)
 			break;
 		if (!to_free->slots[0])
 			break;
+		/* Nor if the tree user still tracks the node. */
+		if (!list_empty(&to_free->private_list))
+			break;
 
 		/*
 		 * We don't need rcu_assign_pointer(), since we are simply
@@ -1154,6 +1240,9 @@ void *radix_tree_delete(struct radix_tree_root *root, unsigned long index)
 			radix_tree_tag_clear(root, index, tag);
 	}
 
+	if (radix_tree_exceptional_entry(slot))
+		pathp->node->exceptional--;
+
 	to_free = NULL;
 	/* Now free the nodes we do not need anymore */
 	while (pathp->node) {
@@ -1201,9 +1290,12 @@ int radix_tree_tagged(struct radix_tree_root *root, unsigned int tag)
 EXPORT_SYMBOL(radix_tree_tagged);
 
 static void
-radix_tree_node_ctor(void *node)
+radix_tree_node_ctor(void *arg)
 {
-	memset(node, 0, sizeof(struct radix_tree_node));
+	struct radix_tree_node *node = arg;
+
+	memset(node, 0, sizeof(*node));
+	INIT_LIST_HEAD(&node->private_list);
 }
 
 static __init unsigned long __maxindex(unsigned int height)
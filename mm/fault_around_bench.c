@@ -0,0 +1,141 @@
+/*
+ * mm/fault_around_bench.c	file mapping fault microbenchmark
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * Maps a file into the loading process and reads one byte of each page,
+ * the way a program touches its text and data at startup, once with
+ * fault-around as set in vm.fault_around_bytes and once with one page per
+ * fault.  The file is read through once beforehand so that every pass
+ * finds it in the page cache.
+ *
+ * Results are printed to the kernel log on module load, e.g.
+ *	modprobe fault_around_bench file=/usr/bin/python iterations=10
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/mman.h>
+#include <linux/err.h>
+#include <asm/uaccess.h>
+
+static char *file;
+module_param(file, charp, 0);
+MODULE_PARM_DESC(file, "File to map");
+
+static unsigned int iterations = 10;
+module_param(iterations, uint, 0);
+MODULE_PARM_DESC(iterations, "Number of passes over the file per test");
+
+static int bench_pass(struct file *filp, unsigned long size,
+		      s64 *ns, unsigned long *faults, unsigned long *sum)
+{
+	struct mm_struct *mm = current->mm;
+	unsigned long addr, off, flt;
+	ktime_t start;
+	int ret = 0;
+	char c;
+
+	down_write(&mm->mmap_sem);
+	addr = do_mmap(filp, 0, size, PROT_READ, MAP_PRIVATE, 0);
+	up_write(&mm->mmap_sem);
+	if (IS_ERR_VALUE(addr))
+		return addr;
+
+	flt = current->min_flt + current->maj_flt;
+	start = ktime_get();
+	for (off = 0; off < size; off += PAGE_SIZE) {
+		if (get_user(c, (char __user *)(addr + off))) {
+			ret = -EFAULT;
+			break;
+		}
+		*sum += (unsigned char)c;
+	}
+	*ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	*faults += current->min_flt + current->maj_flt - flt;
+
+	down_write(&mm->mmap_sem);
+	do_munmap(mm, addr, size);
+	up_write(&mm->mmap_sem);
+	return ret;
+}
+
+static void bench_run(const char *name, struct file *filp, unsigned long size)
+{
+	unsigned long faults = 0, sum = 0;
+	unsigned int done;
+	s64 ns = 0;
+	int ret;
+
+	for (done = 0; done < iterations; done++) {
+		ret = bench_pass(filp, size, &ns, &faults, &sum);
+		if (ret) {
+			printk(KERN_INFO "fault_around_bench: %-8s failed (%d)\n",
+			       name, ret);
+			return;
+		}
+		cond_resched();
+	}
+
+	/* the sum of the bytes read keeps the reads from being optimised away */
+	printk(KERN_INFO "fault_around_bench: %-8s %lu faults/pass, "
+	       "%llu ns/pass (sum %lu)\n", name, faults / iterations,
+	       (unsigned long long)div_s64(ns, iterations), sum);
+}
+
+static int __init fault_around_bench_init(void)
+{
+	unsigned long saved = fault_around_bytes;
+	struct file *filp;
+	unsigned long size;
+	unsigned long faults = 0, sum = 0;
+	s64 ns = 0;
+	int ret;
+
+	if (!file || !iterations || !current->mm)
+		return -EINVAL;
+
+	filp = filp_open(file, O_RDONLY, 0);
+	if (IS_ERR(filp))
+		return PTR_ERR(filp);
+
+	size = PAGE_ALIGN(i_size_read(filp->f_mapping->host));
+	if (!size) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	printk(KERN_INFO "fault_around_bench: %s, %lu pages, "
+	       "fault_around_bytes %lu\n", file, size >> PAGE_SHIFT, saved);
+
+	/* bring the whole file into the page cache */
+	ret = bench_pass(filp, size, &ns, &faults, &sum);
+	if (ret)
+		goto out;
+
+	bench_run("around", filp, size);
+
+	fault_around_bytes = PAGE_SIZE;
+	bench_run("single", filp, size);
+	fault_around_bytes = saved;
+out:
+	filp_close(filp, NULL);
+	return ret;
+}
+
+static void __exit fault_around_bench_exit(void)
+{
+}
+
+module_init(fault_around_bench_init);
+module_exit(fault_around_bench_exit);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("file mapping fault microbenchmark");
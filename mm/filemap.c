@@ -110,16 +110,89 @@
  *    ->i_mmap_lock
  */
 
+/*
+ * The page cache radix tree holds pages and the shadow entries left by
+ * evicted ones (see mm/workingset.c).  Leaf nodes holding nothing but
+ * shadow entries are handed to workingset_update_node(), so that they
+ * can be reclaimed when there are too many of them.
+ */
+static int page_cache_tree_insert(struct address_space *mapping,
+				  struct page *page, void **shadowp)
+{
+	struct radix_tree_node *node;
+	void **slot;
+	void *p;
+	int error;
+
+	p = __radix_tree_lookup(&mapping->page_tree, page->index, &node, &slot);
+	if (p) {
+		if (!radix_tree_exceptional_entry(p))
+			return -EEXIST;
+		if (shadowp)
+			*shadowp = p;
+		__radix_tree_replace(node, slot, page);
+		mapping->nrshadows--;
+		if (node)
+			workingset_update_node(mapping, node);
+		return 0;
+	}
+	error = radix_tree_insert(&mapping->page_tree, page->index, page);
+	/* leaf nodes created by the insertion hold no shadow entries */
+	if (!error && node)
+		workingset_update_node(mapping, node);
+	return error;
+}
+
+static void page_cache_tree_delete(struct address_space *mapping,
+				   struct page *page, void *shadow)
+{
+	struct radix_tree_node *node;
+	unsigned int offset;
+	void **slot;
+	int tag;
+
+	if (!shadow) {
+		radix_tree_delete(&mapping->page_tree, page->index);
+		if (!mapping->nrshadows)
+			return;
+		/* the node may be left with shadow entries only */
+		__radix_tree_lookup(&mapping->page_tree, page->index,
+				    &node, &slot);
+		if (node)
+			workingset_update_node(mapping, node);
+		return;
+	}
+
+	__radix_tree_lookup(&mapping->page_tree, page->index, &node, &slot);
+	VM_BUG_ON(*slot != page);
+
+	/* Shadow entries carry no tags: clear the ones the page left. */
+	offset = page->index & RADIX_TREE_MAP_MASK;
+	for (tag = 0; tag < RADIX_TREE_MAX_TAGS; tag++) {
+		if (!node || test_bit(offset, node->tags[tag]))
+			radix_tree_tag_clear(&mapping->page_tree,
+					     page->index, tag);
+	}
+
+	__radix_tree_replace(node, slot, shadow);
+	mapping->nrshadows++;
+	if (node)
+		workingset_update_node(mapping, node);
+}
+
 /*
  * Remove a page from the page cache and free it. Caller has to make
  * sure the page is locked and that nobody else uses it - or that usage
  * is safe.  The caller must hold the mapping's tree_lock.
+ *
+ * If @shadow is not NULL, it is left in the page's slot to tell a later
+ * refault of the page how long ago it was evicted.
  */
-void __remove_from_page_cache(struct page *page)
+void __remove_from_page_cache(struct page *page, void *shadow)
 {
 	struct address_space *mapping = page->mapping;
 
-	radix_tree_delete(&mapping->page_tree, page->index);
+	page_cache_tree_delete(mapping, page, shadow);
 	page->mapping = NULL;
 	mapping->nrpages--;
 	__dec_zone_page_state(page, NR_FILE_PAGES);
@@ -147,7 +220,7 @@ void remove_from_page_cache(struct page *page)
 	BUG_ON(!PageLocked(page));
 
 	spin_lock_irq(&mapping->tree_lock);
-	__remove_from_page_cache(page);
+	__remove_from_page_cache(page, NULL);
 	spin_unlock_irq(&mapping->tree_lock);
 	mem_cgroup_uncharge_cache_page(page);
 }
@@ -404,18 +477,10 @@ int filemap_write_and_wait_range(struct address_space *mapping,
 }
 EXPORT_SYMBOL(filemap_write_and_wait_range);
 
-/**
- * add_to_page_cache_locked - add a locked page to the pagecache
- * @page:	page to add
- * @mapping:	the page's address_space
- * @offset:	page index
- * @gfp_mask:	page allocation mode
- *
- * This function is used to add a page to the pagecache. It must be locked.
- * This function does not add the page to the LRU.  The caller must do that.
- */
-int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
-		pgoff_t offset, gfp_t gfp_mask)
+static int __add_to_page_cache_locked(struct page *page,
+				      struct address_space *mapping,
+				      pgoff_t offset, gfp_t gfp_mask,
+				      void **shadowp)
 {
 	int error;
 
@@ -433,7 +498,7 @@ int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
 		page->index = offset;
 
 		spin_lock_irq(&mapping->tree_lock);
-		error = radix_tree_insert(&mapping->page_tree, offset, page);
+		error = page_cache_tree_insert(mapping, page, shadowp);
 		if (likely(!error)) {
 			mapping->nrpages++;
 			__inc_zone_page_state(page, NR_FILE_PAGES);
@@ -452,11 +517,29 @@ int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
 out:
 	return error;
 }
+
+/**
+ * add_to_page_cache_locked - add a locked page to the pagecache
+ * @page:	page to add
+ * @mapping:	the page's address_space
+ * @offset:	page index
+ * @gfp_mask:	page allocation mode
+ *
+ * This function is used to add a page to the pagecache. It must be locked.
+ * This function does not add the page to the LRU.  The caller must do that.
+ */
+int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
+		pgoff_t offset, gfp_t gfp_mask)
+{
+	return __add_to_page_cache_locked(page, mapping, offset,
+					  gfp_mask, NULL);
+}
 EXPORT_SYMBOL(add_to_page_cache_locked);
 
 int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 				pgoff_t offset, gfp_t gfp_mask)
 {
+	void *shadow = NULL;
 	int ret;
 
 	/*
@@ -468,14 +551,27 @@ int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 	if (mapping_cap_swap_backed(mapping))
 		SetPageSwapBacked(page);
 
-	ret = add_to_page_cache(page, mapping, offset, gfp_mask);
-	if (ret == 0) {
-		if (page_is_file_cache(page))
-			lru_cache_add_file(page);
-		else
-			lru_cache_add_anon(page);
+	__set_page_locked(page);
+	ret = __add_to_page_cache_locked(page, mapping, offset,
+					 gfp_mask, &shadow);
+	if (unlikely(ret)) {
+		__clear_page_locked(page);
+		return ret;
 	}
-	return ret;
+
+	if (!page_is_file_cache(page))
+		lru_cache_add_anon(page);
+	else if (shadow && workingset_refault(shadow)) {
+		/*
+		 * The page was evicted recently enough that it would
+		 * have stayed resident with a bigger active list: it
+		 * is part of the working set, so start it out active.
+		 */
+		workingset_activation(page);
+		lru_cache_add_active_file(page);
+	} else
+		lru_cache_add_file(page);
+	return 0;
 }
 EXPORT_SYMBOL_GPL(add_to_page_cache_lru);
 
@@ -626,6 +722,64 @@ void __lock_page_nosync(struct page *page)
 							TASK_UNINTERRUPTIBLE);
 }
 
+/**
+ * page_cache_next_hole - find the next hole (not-present entry)
+ * @mapping: mapping
+ * @index: index
+ * @max_scan: maximum range to search
+ *
+ * Like radix_tree_next_hole(), but the shadow entries of evicted pages
+ * count as holes.
+ */
+pgoff_t page_cache_next_hole(struct address_space *mapping,
+			     pgoff_t index, unsigned long max_scan)
+{
+	unsigned long i;
+
+	for (i = 0; i < max_scan; i++) {
+		struct page *page;
+
+		page = radix_tree_lookup(&mapping->page_tree, index);
+		if (!page || radix_tree_exceptional_entry(page))
+			break;
+		index++;
+		if (index == 0)
+			break;
+	}
+
+	return index;
+}
+EXPORT_SYMBOL(page_cache_next_hole);
+
+/**
+ * page_cache_prev_hole - find the prev hole (not-present entry)
+ * @mapping: mapping
+ * @index: index
+ * @max_scan: maximum range to search
+ *
+ * Like radix_tree_prev_hole(), but the shadow entries of evicted pages
+ * count as holes.
+ */
+pgoff_t page_cache_prev_hole(struct address_space *mapping,
+			     pgoff_t index, unsigned long max_scan)
+{
+	unsigned long i;
+
+	for (i = 0; i < max_scan; i++) {
+		struct page *page;
+
+		page = radix_tree_lookup(&mapping->page_tree, index);
+		if (!page || radix_tree_exceptional_entry(page))
+			break;
+		index--;
+		if (index == ULONG_MAX)
+			break;
+	}
+
+	return index;
+}
+EXPORT_SYMBOL(page_cache_prev_hole);
+
 /**
  * find_get_page - find and get a page reference
  * @mapping: the address_space to search
@@ -648,6 +802,12 @@ repeat:
 		if (unlikely(!page || page == RADIX_TREE_RETRY))
 			goto repeat;
 
+		/* A shadow entry: the page was evicted. */
+		if (radix_tree_exceptional_entry(page)) {
+			page = NULL;
+			goto out;
+		}
+
 		if (!page_cache_get_speculative(page))
 			goto repeat;
 
@@ -661,6 +821,7 @@ repeat:
 			goto repeat;
 		}
 	}
+out:
 	rcu_read_unlock();
 
 	return page;
@@ -758,44 +919,65 @@ EXPORT_SYMBOL(find_or_create_page);
  * The search returns a group of mapping-contiguous pages with ascending
  * indexes.  There may be holes in the indices due to not-present pages.
  *
- * find_get_pages() returns the number of pages which were found.
+ * find_get_pages() returns the number of pages which were found.  It
+ * only returns 0 when there are no more pages from @start on: the lookup
+ * goes on past the shadow entries of evicted pages.
  */
 unsigned find_get_pages(struct address_space *mapping, pgoff_t start,
 			    unsigned int nr_pages, struct page **pages)
 {
+	unsigned long indices[PAGEVEC_SIZE];
 	unsigned int i;
 	unsigned int ret;
 	unsigned int nr_found;
+	unsigned int nr_lookup;
+	void ***slots;
+	pgoff_t index;
 
 	rcu_read_lock();
 restart:
-	nr_found = radix_tree_gang_lookup_slot(&mapping->page_tree,
-				(void ***)pages, start, nr_pages);
+	index = start;
 	ret = 0;
-	for (i = 0; i < nr_found; i++) {
-		struct page *page;
+	while (ret < nr_pages) {
+		/* the slots are looked up into the unused part of pages[] */
+		slots = (void ***)pages + ret;
+		nr_lookup = min_t(unsigned int, nr_pages - ret, PAGEVEC_SIZE);
+		nr_found = radix_tree_gang_lookup_slot(&mapping->page_tree,
+					slots, indices, index, nr_lookup);
+		for (i = 0; i < nr_found; i++) {
+			struct page *page;
 repeat:
-		page = radix_tree_deref_slot((void **)pages[i]);
-		if (unlikely(!page))
-			continue;
-		/*
-		 * this can only trigger if nr_found == 1, making livelock
-		 * a non issue.
-		 */
-		if (unlikely(page == RADIX_TREE_RETRY))
-			goto restart;
+			page = radix_tree_deref_slot(slots[i]);
+			if (unlikely(!page))
+				continue;
+			/*
+			 * this can only trigger if nr_found == 1, making
+			 * livelock a non issue.
+			 */
+			if (unlikely(page == RADIX_TREE_RETRY))
+				goto restart;
 
-		if (!page_cache_get_speculative(page))
-			goto repeat;
+			/* Skip the shadow entries of evicted pages. */
+			if (radix_tree_exceptional_entry(page))
+				continue;
 
-		/* Has the page moved? */
-		if (unlikely(page != *((void **)pages[i]))) {
-			page_cache_release(page);
-			goto repeat;
-		}
+			if (!page_cache_get_speculative(page))
+				goto repeat;
 
-		pages[ret] = page;
-		ret++;
+			/* Has the page moved? */
+			if (unlikely(page != *slots[i])) {
+				page_cache_release(page);
+				goto repeat;
+			}
+
+			pages[ret] = page;
+			ret++;
+		}
+		if (nr_found < nr_lookup)
+			break;
+		index = indices[nr_found - 1] + 1;
+		if (index == 0)
+			break;
 	}
 	rcu_read_unlock();
 	return ret;
@@ -823,7 +1005,7 @@ unsigned find_get_pages_contig(struct address_space *mapping, pgoff_t index,
 	rcu_read_lock();
 restart:
 	nr_found = radix_tree_gang_lookup_slot(&mapping->page_tree,
-				(void ***)pages, index, nr_pages);
+				(void ***)pages, NULL, index, nr_pages);
 	ret = 0;
 	for (i = 0; i < nr_found; i++) {
 		struct page *page;
@@ -838,6 +1020,10 @@ repeat:
 		if (unlikely(page == RADIX_TREE_RETRY))
 			goto restart;
 
+		/* A shadow entry of an evicted page is a hole too. */
+		if (radix_tree_exceptional_entry(page))
+			break;
+
 		if (page->mapping == NULL || page->index != index)
 			break;
 
@@ -1620,8 +1806,102 @@ page_not_uptodate:
 }
 EXPORT_SYMBOL(filemap_fault);
 
+/**
+ * filemap_map_pages - map the cached pages around a read fault
+ * @vma:	vma in which the fault was taken
+ * @vmf:	window of pages to map, see struct vm_fault
+ *
+ * Maps every page of the window that is in the page cache, up to date and
+ * not locked, into the empty ptes of the page table, which the caller has
+ * locked.  Anything that would need the page lock, IO or readahead is
+ * left to ->fault().
+ */
+void filemap_map_pages(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+	struct file *file = vma->vm_file;
+	struct address_space *mapping = file->f_mapping;
+	unsigned long address = (unsigned long) vmf->virtual_address;
+	unsigned long indices[PAGEVEC_SIZE];
+	void **slots[PAGEVEC_SIZE];
+	unsigned int nr_found;
+	unsigned int i;
+	pgoff_t index = vmf->pgoff;
+	pgoff_t size;
+	struct page *page;
+	unsigned long addr;
+	pte_t *pte;
+
+	rcu_read_lock();
+	while (index <= vmf->max_pgoff) {
+		nr_found = radix_tree_gang_lookup_slot(&mapping->page_tree,
+				slots, indices, index,
+				min_t(unsigned long, PAGEVEC_SIZE,
+				      vmf->max_pgoff - index + 1));
+		for (i = 0; i < nr_found; i++) {
+			if (indices[i] > vmf->max_pgoff)
+				goto out;
+repeat:
+			page = radix_tree_deref_slot(slots[i]);
+			if (unlikely(!page))
+				continue;
+			/* the tree is being rearranged: leave it to ->fault() */
+			if (unlikely(page == RADIX_TREE_RETRY))
+				goto out;
+			if (radix_tree_exceptional_entry(page))
+				continue;
+
+			if (!page_cache_get_speculative(page))
+				goto repeat;
+
+			/* Has the page moved? */
+			if (unlikely(page != *slots[i])) {
+				page_cache_release(page);
+				goto repeat;
+			}
+
+			if (!PageUptodate(page) || PageReadahead(page) ||
+			    PageHWPoison(page))
+				goto skip;
+			if (!trylock_page(page))
+				goto skip;
+
+			if (page->mapping != mapping || !PageUptodate(page))
+				goto unlock;
+
+			size = (i_size_read(mapping->host) + PAGE_CACHE_SIZE - 1)
+							>> PAGE_CACHE_SHIFT;
+			if (page->index >= size)
+				goto unlock;
+
+			pte = vmf->pte + page->index - vmf->pgoff;
+			if (!pte_none(*pte))
+				goto unlock;
+
+			if (file->f_ra.mmap_miss > 0)
+				file->f_ra.mmap_miss--;
+			addr = address + (page->index - vmf->pgoff) * PAGE_SIZE;
+			do_set_pte(vma, addr, page, pte, false, false);
+			unlock_page(page);
+			continue;
+unlock:
+			unlock_page(page);
+skip:
+			page_cache_release(page);
+		}
+		if (nr_found < PAGEVEC_SIZE)
+			break;
+		index = indices[nr_found - 1] + 1;
+		if (index == 0)
+			break;
+	}
+out:
+	rcu_read_unlock();
+}
+EXPORT_SYMBOL(filemap_map_pages);
+
 const struct vm_operations_struct generic_file_vm_ops = {
 	.fault		= filemap_fault,
+	.map_pages	= filemap_map_pages,
 };
 
 /* This is used for a general mmap of a disk file */
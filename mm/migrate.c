@@ -166,7 +166,8 @@ static void remove_file_migration_ptes(struct page *old, struct page *new)
 
 /*
  * Must hold mmap_sem lock on at least one of the vmas containing
- * the page so that the anon_vma cannot vanish.
+ * the page, or a migrate_refcount on its anon_vma, so that the anon_vma
+ * cannot vanish.
  */
 static void remove_anon_migration_ptes(struct page *old, struct page *new)
 {
@@ -180,7 +181,8 @@ static void remove_anon_migration_ptes(struct page *old, struct page *new)
 		return;
 
 	/*
-	 * We hold the mmap_sem lock. So no need to call page_lock_anon_vma.
+	 * We hold the mmap_sem lock or a reference on the anon_vma. So no
+	 * need to call page_lock_anon_vma.
 	 */
 	anon_vma = (struct anon_vma *) (mapping - PAGE_MAPPING_ANON);
 	spin_lock(&anon_vma->lock);
@@ -600,6 +602,7 @@ static int unmap_and_move(new_page_t get_new_page, unsigned long private,
 	int rc = 0;
 	int *result = NULL;
 	struct page *newpage = get_new_page(page, private, &result);
+	struct anon_vma *anon_vma = NULL;
 	int rcu_locked = 0;
 	int charge = 0;
 	struct mem_cgroup *mem = NULL;
@@ -645,6 +648,18 @@ static int unmap_and_move(new_page_t get_new_page, unsigned long private,
 	if (PageAnon(page)) {
 		rcu_read_lock();
 		rcu_locked = 1;
+
+		/*
+		 * The rcu_read_lock() only keeps the anon_vma type stable: a
+		 * caller that does not hold mmap_sem, such as compaction,
+		 * could see it freed and reused once try_to_unmap() dropped
+		 * the last mapping.  Pin it while the page is still mapped.
+		 */
+		anon_vma = page_lock_anon_vma(page);
+		if (anon_vma) {
+			atomic_inc(&anon_vma->migrate_refcount);
+			page_unlock_anon_vma(anon_vma);
+		}
 	}
 
 	/*
@@ -684,6 +699,8 @@ skip_unmap:
 	if (rc)
 		remove_migration_ptes(page, page);
 rcu_unlock:
+	if (anon_vma)
+		drop_migrate_anon_vma(anon_vma);
 	if (rcu_locked)
 		rcu_read_unlock();
 uncharge:
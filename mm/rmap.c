@@ -171,18 +171,39 @@ void anon_vma_unlink(struct vm_area_struct *vma)
 	list_del(&vma->anon_vma_node);
 
 	/* We must garbage collect the anon_vma if it's empty */
+	empty = list_empty(&anon_vma->head) && !migrate_refcount(anon_vma);
+	spin_unlock(&anon_vma->lock);
+
+	if (empty)
+		anon_vma_free(anon_vma);
+}
+
+#ifdef CONFIG_MIGRATION
+/*
+ * Drop the reference page migration took in unmap_and_move(), freeing
+ * the anon_vma if its last vma was unlinked while the page was migrated.
+ */
+void drop_migrate_anon_vma(struct anon_vma *anon_vma)
+{
+	int empty;
+
+	if (!atomic_dec_and_lock(&anon_vma->migrate_refcount, &anon_vma->lock))
+		return;
+
 	empty = list_empty(&anon_vma->head);
 	spin_unlock(&anon_vma->lock);
 
 	if (empty)
 		anon_vma_free(anon_vma);
 }
+#endif
 
 static void anon_vma_ctor(void *data)
 {
 	struct anon_vma *anon_vma = data;
 
 	spin_lock_init(&anon_vma->lock);
+	migrate_refcount_init(anon_vma);
 	INIT_LIST_HEAD(&anon_vma->head);
 }
 
@@ -817,6 +838,21 @@ static int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 	} else if (PageAnon(page)) {
 		swp_entry_t entry = { .val = page_private(page) };
 
+		if (!PageSwapBacked(page) && TTU_ACTION(flags) == TTU_UNMAP) {
+			/*
+			 * A page freed by MADV_FREE is dropped without
+			 * swap, unless it was written to again since.
+			 */
+			if (PageDirty(page)) {
+				set_pte_at(mm, address, pte, pteval);
+				SetPageSwapBacked(page);
+				ret = SWAP_FAIL;
+				goto out_unmap;
+			}
+			dec_mm_counter(mm, anon_rss);
+			goto discard;
+		}
+
 		if (PageSwapCache(page)) {
 			/*
 			 * Store the swap location in the pte.
@@ -849,7 +885,7 @@ static int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 	} else
 		dec_mm_counter(mm, file_rss);
 
-
+discard:
 	page_remove_rmap(page);
 	page_cache_release(page);
 
@@ -28,6 +28,7 @@
 #include <linux/memory.h>
 #include <linux/math64.h>
 #include <linux/fault-inject.h>
+#include <linux/uaccess.h>
 
 /*
  * Lock order:
@@ -71,6 +72,18 @@
  *   interrupts are disabled to ensure that the processor does not change
  *   while handling per_cpu slabs, due to kernel preemption.
  *
+ *   If the arch provides cmpxchg_double_local() the fast paths instead
+ *   only disable preemption and update the per cpu freelist together with
+ *   a transaction id (tid) with a single cmpxchg_double_local(). Every
+ *   change of the cpu slab, including those done by an interrupt on the
+ *   same cpu, advances the tid, so the cmpxchg fails and is retried if
+ *   the freelist changed under it. The slow paths still run with
+ *   interrupts disabled.
+ *
+ *   Each cpu also keeps a short list of frozen partial slabs, filled by
+ *   frees to full slabs and used before the node partial lists, so that
+ *   the list_lock is only taken when that list overflows or runs dry.
+ *
  * SLUB assigns one slab for allocation to each processor.
  * Allocations only occur from these slabs called cpu slabs.
  *
@@ -171,6 +184,7 @@
 /* Internal SLUB flags */
 #define __OBJECT_POISON		0x80000000 /* Poison object */
 #define __SYSFS_ADD_DEFERRED	0x40000000 /* Not yet visible via sysfs */
+#define __CMPXCHG_DOUBLE	0x20000000 /* Lockless cpu freelist updates */
 
 static int kmem_size = sizeof(struct kmem_cache);
 
@@ -251,6 +265,41 @@ static inline struct kmem_cache_cpu *get_cpu_slab(struct kmem_cache *s, int cpu)
 #endif
 }
 
+static inline unsigned long next_tid(unsigned long tid)
+{
+	return tid + 1;
+}
+
+/*
+ * Whether the fast paths may update the cpu freelist with
+ * cmpxchg_double_local() instead of disabling interrupts.
+ */
+static inline int cpu_freelist_cmpxchg(struct kmem_cache *s)
+{
+#ifdef CONFIG_HAVE_CMPXCHG_DOUBLE
+	return s->flags & __CMPXCHG_DOUBLE;
+#else
+	return 0;
+#endif
+}
+
+/*
+ * Replace the freelist of cpu slab c if neither it nor the tid changed.
+ * Called with preemption disabled.
+ */
+static inline int cpu_freelist_update(struct kmem_cache_cpu *c,
+		void *freelist_old, unsigned long tid,
+		void *freelist_new)
+{
+#ifdef CONFIG_HAVE_CMPXCHG_DOUBLE
+	return cmpxchg_double_local(&c->freelist, &c->tid,
+			freelist_old, tid, freelist_new, next_tid(tid));
+#else
+	BUG();
+	return 0;
+#endif
+}
+
 /* Verify that a pointer has an address that is valid within a slab page */
 static inline int check_valid_pointer(struct kmem_cache *s,
 				struct page *page, const void *object)
@@ -1490,9 +1539,71 @@ static void deactivate_slab(struct kmem_cache *s, struct kmem_cache_cpu *c)
 		page->inuse--;
 	}
 	c->page = NULL;
+	c->tid = next_tid(c->tid);
 	unfreeze_slab(s, page, tail);
 }
 
+/*
+ * Move the slabs on the cpu partial list to the node partial lists, or
+ * free them if they are empty.
+ *
+ * Interrupts are disabled.
+ */
+static void unfreeze_partials(struct kmem_cache *s, struct kmem_cache_cpu *c)
+{
+	struct page *page;
+
+	if (!c->nr_partial)
+		return;
+
+	stat(c, CPU_PARTIAL_DRAIN);
+	while (!list_empty(&c->partial)) {
+		page = list_first_entry(&c->partial, struct page, lru);
+		list_del(&page->lru);
+		c->nr_partial--;
+		slab_lock(page);
+		unfreeze_slab(s, page, 1);
+	}
+}
+
+/*
+ * Put a slab that a free just turned from full into partial on the cpu
+ * partial list instead of the node partial list. The slab has been
+ * frozen by the caller.
+ *
+ * Interrupts are disabled.
+ */
+static void put_cpu_partial(struct kmem_cache *s, struct kmem_cache_cpu *c,
+			    struct page *page)
+{
+	if (c->nr_partial >= s->cpu_partial)
+		unfreeze_partials(s, c);
+
+	list_add(&page->lru, &c->partial);
+	c->nr_partial++;
+	stat(c, CPU_PARTIAL_FREE);
+}
+
+/*
+ * Take a slab from the cpu partial list for an allocation on node.
+ *
+ * Interrupts are disabled.
+ */
+static struct page *get_cpu_partial(struct kmem_cache_cpu *c, int node)
+{
+	struct page *page;
+
+	list_for_each_entry(page, &c->partial, lru) {
+		if (node != -1 && page_to_nid(page) != node)
+			continue;
+		list_del(&page->lru);
+		c->nr_partial--;
+		slab_lock(page);
+		return page;
+	}
+	return NULL;
+}
+
 static inline void flush_slab(struct kmem_cache *s, struct kmem_cache_cpu *c)
 {
 	stat(c, CPUSLAB_FLUSH);
@@ -1509,8 +1620,11 @@ static inline void __flush_cpu_slab(struct kmem_cache *s, int cpu)
 {
 	struct kmem_cache_cpu *c = get_cpu_slab(s, cpu);
 
-	if (likely(c && c->page))
+	if (!c)
+		return;
+	if (likely(c->page))
 		flush_slab(s, c);
+	unfreeze_partials(s, c);
 }
 
 static void flush_cpu_slab(void *d)
@@ -1649,6 +1763,7 @@ load_freelist:
 	c->page->freelist = NULL;
 	c->node = page_to_nid(c->page);
 unlock_out:
+	c->tid = next_tid(c->tid);
 	slab_unlock(c->page);
 	stat(c, ALLOC_SLOWPATH);
 	return object;
@@ -1657,6 +1772,13 @@ another_slab:
 	deactivate_slab(s, c);
 
 new_slab:
+	new = get_cpu_partial(c, node);
+	if (new) {
+		c->page = new;
+		stat(c, CPU_PARTIAL_ALLOC);
+		goto load_freelist;
+	}
+
 	new = get_partial(s, gfpflags, node);
 	if (new) {
 		c->page = new;
@@ -1695,6 +1817,68 @@ debug:
 	goto unlock_out;
 }
 
+/*
+ * Read the free pointer of the first object on a cpu freelist without
+ * interrupts disabled. An interrupt may have allocated the object and
+ * freed its slab since the freelist was read. The cmpxchg will fail
+ * then, but the read must not fault either.
+ */
+static inline void *get_freepointer_safe(struct kmem_cache_cpu *c,
+					 void **object)
+{
+#ifdef CONFIG_DEBUG_PAGEALLOC
+	void *p;
+
+	probe_kernel_read(&p, object + c->offset, sizeof(p));
+	return p;
+#else
+	return object[c->offset];
+#endif
+}
+
+/*
+ * Allocation fastpath without disabling interrupts, see the comment on
+ * locking at the top of this file.
+ */
+static __always_inline void *slab_alloc_cmpxchg(struct kmem_cache *s,
+		gfp_t gfpflags, int node, unsigned long addr)
+{
+	void **object;
+	struct kmem_cache_cpu *c;
+	unsigned long flags;
+	unsigned long tid;
+
+redo:
+	preempt_disable();
+	c = get_cpu_slab(s, smp_processor_id());
+	/*
+	 * The tid must be read before the freelist: an interrupt that
+	 * changes the freelist in between also advances the tid.
+	 */
+	tid = c->tid;
+	barrier();
+	object = c->freelist;
+	if (unlikely(!object || !node_match(c, node))) {
+		/* __slab_alloc() may sleep */
+		preempt_enable();
+		local_irq_save(flags);
+		c = get_cpu_slab(s, smp_processor_id());
+		object = __slab_alloc(s, gfpflags, node, addr, c);
+		local_irq_restore(flags);
+		return object;
+	}
+
+	if (unlikely(!cpu_freelist_update(c, object, tid,
+				get_freepointer_safe(c, object)))) {
+		stat(c, CMPXCHG_DOUBLE_CPU_FAIL);
+		preempt_enable();
+		goto redo;
+	}
+	stat(c, ALLOC_FASTPATH);
+	preempt_enable();
+	return object;
+}
+
 /*
  * Inlined fastpath so that allocation functions (kmalloc, kmem_cache_alloc)
  * have the fastpath folded into their functions. So no function call
@@ -1711,7 +1895,7 @@ static __always_inline void *slab_alloc(struct kmem_cache *s,
 	void **object;
 	struct kmem_cache_cpu *c;
 	unsigned long flags;
-	unsigned int objsize;
+	unsigned int objsize = s->objsize;
 
 	gfpflags &= gfp_allowed_mask;
 
@@ -1721,9 +1905,13 @@ static __always_inline void *slab_alloc(struct kmem_cache *s,
 	if (should_failslab(s->objsize, gfpflags))
 		return NULL;
 
+	if (cpu_freelist_cmpxchg(s)) {
+		object = slab_alloc_cmpxchg(s, gfpflags, node, addr);
+		goto out;
+	}
+
 	local_irq_save(flags);
 	c = get_cpu_slab(s, smp_processor_id());
-	objsize = c->objsize;
 	if (unlikely(!c->freelist || !node_match(c, node)))
 
 		object = __slab_alloc(s, gfpflags, node, addr, c);
@@ -1731,14 +1919,17 @@ static __always_inline void *slab_alloc(struct kmem_cache *s,
 	else {
 		object = c->freelist;
 		c->freelist = object[c->offset];
+		/* keep a concurrent cmpxchg fastpath on this cpu honest */
+		c->tid = next_tid(c->tid);
 		stat(c, ALLOC_FASTPATH);
 	}
 	local_irq_restore(flags);
 
+out:
 	if (unlikely((gfpflags & __GFP_ZERO) && object))
 		memset(object, 0, objsize);
 
-	kmemcheck_slab_alloc(s, gfpflags, object, c->objsize);
+	kmemcheck_slab_alloc(s, gfpflags, object, objsize);
 	kmemleak_alloc_recursive(object, objsize, 1, s->flags, gfpflags);
 
 	return object;
@@ -1822,9 +2013,15 @@ checks_ok:
 
 	/*
 	 * Objects left in the slab. If it was not on the partial list before
-	 * then add it.
+	 * then add it, to the partial list of this cpu if there is one.
 	 */
 	if (unlikely(!prior)) {
+		if (s->cpu_partial && !(SLABDEBUG && PageSlubDebug(page))) {
+			__SetPageSlubFrozen(page);
+			slab_unlock(page);
+			put_cpu_partial(s, c, page);
+			return;
+		}
 		add_partial(get_node(s, page_to_nid(page)), page, 1);
 		stat(c, FREE_ADD_PARTIAL);
 	}
@@ -1869,17 +2066,46 @@ static __always_inline void slab_free(struct kmem_cache *s,
 	void **object = (void *)x;
 	struct kmem_cache_cpu *c;
 	unsigned long flags;
+	unsigned long tid;
+	void **freelist;
 
 	kmemleak_free_recursive(x, s->flags);
+	kmemcheck_slab_free(s, object, s->objsize);
+	debug_check_no_locks_freed(object, s->objsize);
+	if (!(s->flags & SLAB_DEBUG_OBJECTS))
+		debug_check_no_obj_freed(object, s->objsize);
+
+	if (!cpu_freelist_cmpxchg(s))
+		goto irq_off;
+
+redo:
+	preempt_disable();
+	c = get_cpu_slab(s, smp_processor_id());
+	tid = c->tid;
+	barrier();
+	if (unlikely(page != c->page || c->node < 0)) {
+		preempt_enable();
+		goto irq_off;
+	}
+
+	freelist = c->freelist;
+	object[c->offset] = freelist;
+	if (unlikely(!cpu_freelist_update(c, freelist, tid, object))) {
+		stat(c, CMPXCHG_DOUBLE_CPU_FAIL);
+		preempt_enable();
+		goto redo;
+	}
+	stat(c, FREE_FASTPATH);
+	preempt_enable();
+	return;
+
+irq_off:
 	local_irq_save(flags);
 	c = get_cpu_slab(s, smp_processor_id());
-	kmemcheck_slab_free(s, object, c->objsize);
-	debug_check_no_locks_freed(object, c->objsize);
-	if (!(s->flags & SLAB_DEBUG_OBJECTS))
-		debug_check_no_obj_freed(object, c->objsize);
 	if (likely(page == c->page && c->node >= 0)) {
 		object[c->offset] = c->freelist;
 		c->freelist = object;
+		c->tid = next_tid(c->tid);
 		stat(c, FREE_FASTPATH);
 	} else
 		__slab_free(s, page, x, addr, c->offset);
@@ -2074,9 +2300,18 @@ static void init_kmem_cache_cpu(struct kmem_cache *s,
 {
 	c->page = NULL;
 	c->freelist = NULL;
+	c->tid = 0;
 	c->node = 0;
 	c->offset = s->offset / sizeof(void *);
 	c->objsize = s->objsize;
+	INIT_LIST_HEAD(&c->partial);
+	c->nr_partial = 0;
+	/*
+	 * A kmalloc()ed kmem_cache_cpu may not be double word aligned if
+	 * the kmalloc caches are debugged. Mixing both fastpaths is safe.
+	 */
+	if (!IS_ALIGNED((unsigned long)&c->freelist, 2 * sizeof(void *)))
+		s->flags &= ~__CMPXCHG_DOUBLE;
 #ifdef CONFIG_SLUB_STATS
 	memset(c->stat, 0, NR_SLUB_STAT_ITEMS * sizeof(unsigned));
 #endif
@@ -2493,6 +2728,25 @@ static int kmem_cache_open(struct kmem_cache *s, gfp_t gfpflags,
 	 * list to avoid pounding the page allocator excessively.
 	 */
 	set_min_partial(s, ilog2(s->size));
+
+	/*
+	 * Number of slabs that a cpu may keep on its partial list. Larger
+	 * objects mean fewer objects per slab, so keep fewer slabs: with
+	 * big objects the memory held back adds up quickly.
+	 */
+	if (s->size >= PAGE_SIZE)
+		s->cpu_partial = 2;
+	else if (s->size >= 1024)
+		s->cpu_partial = 4;
+	else if (s->size >= 256)
+		s->cpu_partial = 8;
+	else
+		s->cpu_partial = 16;
+
+#ifdef CONFIG_HAVE_CMPXCHG_DOUBLE
+	if (system_has_cmpxchg_double())
+		s->flags |= __CMPXCHG_DOUBLE;
+#endif
 	s->refcount = 1;
 #ifdef CONFIG_NUMA
 	s->remote_node_defrag_ratio = 1000;
@@ -4088,6 +4342,29 @@ static ssize_t min_partial_store(struct kmem_cache *s, const char *buf,
 }
 SLAB_ATTR(min_partial);
 
+static ssize_t cpu_partial_show(struct kmem_cache *s, char *buf)
+{
+	return sprintf(buf, "%d\n", s->cpu_partial);
+}
+
+static ssize_t cpu_partial_store(struct kmem_cache *s, const char *buf,
+				 size_t length)
+{
+	unsigned long nr;
+	int err;
+
+	err = strict_strtoul(buf, 10, &nr);
+	if (err)
+		return err;
+	if (nr > INT_MAX)
+		return -EINVAL;
+
+	s->cpu_partial = nr;
+	/* the cpu partial lists shrink as slabs are added to them */
+	return length;
+}
+SLAB_ATTR(cpu_partial);
+
 static ssize_t ctor_show(struct kmem_cache *s, char *buf)
 {
 	if (s->ctor) {
@@ -4396,6 +4673,10 @@ STAT_ATTR(DEACTIVATE_TO_HEAD, deactivate_to_head);
 STAT_ATTR(DEACTIVATE_TO_TAIL, deactivate_to_tail);
 STAT_ATTR(DEACTIVATE_REMOTE_FREES, deactivate_remote_frees);
 STAT_ATTR(ORDER_FALLBACK, order_fallback);
+STAT_ATTR(CMPXCHG_DOUBLE_CPU_FAIL, cmpxchg_double_cpu_fail);
+STAT_ATTR(CPU_PARTIAL_ALLOC, cpu_partial_alloc);
+STAT_ATTR(CPU_PARTIAL_FREE, cpu_partial_free);
+STAT_ATTR(CPU_PARTIAL_DRAIN, cpu_partial_drain);
 #endif
 
 static struct attribute *slab_attrs[] = {
@@ -4404,6 +4685,7 @@ static struct attribute *slab_attrs[] = {
 	&objs_per_slab_attr.attr,
 	&order_attr.attr,
 	&min_partial_attr.attr,
+	&cpu_partial_attr.attr,
 	&objects_attr.attr,
 	&objects_partial_attr.attr,
 	&total_objects_attr.attr,
@@ -4450,6 +4732,10 @@ static struct attribute *slab_attrs[] = {
 	&deactivate_to_tail_attr.attr,
 	&deactivate_remote_frees_attr.attr,
 	&order_fallback_attr.attr,
+	&cmpxchg_double_cpu_fail_attr.attr,
+	&cpu_partial_alloc_attr.attr,
+	&cpu_partial_free_attr.attr,
+	&cpu_partial_drain_attr.attr,
 #endif
 	NULL
 };
@@ -0,0 +1,155 @@
+/*
+ * mm/slub_bench.c	kmalloc/kfree microbenchmark
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * Times the slab allocator fast and slow paths with three patterns:
+ *  - single: kmalloc() and immediately kfree() one object, which stays
+ *    on the cpu freelist;
+ *  - batch:  kmalloc() a batch of objects, then kfree() them all, which
+ *    goes through several slabs and the partial lists;
+ *  - remote: kmalloc() a batch here and kfree() it on another cpu, the
+ *    pattern of objects handed between cpus.
+ *
+ * Results are printed to the kernel log on module load, e.g.
+ *	modprobe slub_bench iterations=1000000 size=64 batch=256
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/smp.h>
+#include <linux/cpumask.h>
+#include <linux/vmalloc.h>
+
+static unsigned int iterations = 100000;
+module_param(iterations, uint, 0);
+MODULE_PARM_DESC(iterations, "Number of objects allocated per test");
+
+static unsigned int size = 64;
+module_param(size, uint, 0);
+MODULE_PARM_DESC(size, "Object size in bytes");
+
+static unsigned int batch = 256;
+module_param(batch, uint, 0);
+MODULE_PARM_DESC(batch, "Objects allocated before freeing in batch tests");
+
+static void **objs;
+
+static s64 bench_single(void)
+{
+	unsigned int done;
+	ktime_t start;
+	void *p;
+
+	start = ktime_get();
+	for (done = 0; done < iterations; done++) {
+		p = kmalloc(size, GFP_KERNEL);
+		if (!p)
+			return -ENOMEM;
+		kfree(p);
+
+		if (!(done & 1023))
+			cond_resched();
+	}
+	return ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+static int bench_alloc_batch(void)
+{
+	int i;
+
+	for (i = 0; i < batch; i++) {
+		objs[i] = kmalloc(size, GFP_KERNEL);
+		if (!objs[i])
+			break;
+	}
+	return i;
+}
+
+static void bench_free_batch(void *info)
+{
+	int i, n = *(int *)info;
+
+	for (i = 0; i < n; i++)
+		kfree(objs[i]);
+}
+
+static s64 bench_batch(int cpu)
+{
+	unsigned int done = 0;
+	ktime_t start;
+	int n;
+
+	start = ktime_get();
+	while (done < iterations) {
+		n = bench_alloc_batch();
+		if (cpu < 0)
+			bench_free_batch(&n);
+		else
+			smp_call_function_single(cpu, bench_free_batch, &n, 1);
+
+		if (n < batch)
+			return -ENOMEM;
+		done += n;
+		cond_resched();
+	}
+	return ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+static void bench_report(const char *name, s64 ns)
+{
+	if (ns < 0)
+		printk(KERN_INFO "slub_bench: %-8s failed (%lld)\n", name, ns);
+	else
+		printk(KERN_INFO "slub_bench: %-8s %llu ns/object\n",
+		       name, (unsigned long long)div_s64(ns, iterations));
+}
+
+static int __init slub_bench_init(void)
+{
+	int cpu, other = -1;
+
+	if (!iterations || !size || !batch)
+		return -EINVAL;
+
+	objs = vmalloc(batch * sizeof(void *));
+	if (!objs)
+		return -ENOMEM;
+
+	printk(KERN_INFO "slub_bench: %u objects of %u bytes, batch %u\n",
+	       iterations, size, batch);
+
+	bench_report("single", bench_single());
+	bench_report("batch", bench_batch(-1));
+
+	/* stay on this cpu while the batch is freed on another one */
+	cpu = get_cpu();
+	for_each_online_cpu(other)
+		if (other != cpu)
+			break;
+	put_cpu();
+	if (other < nr_cpu_ids) {
+		set_cpus_allowed_ptr(current, cpumask_of(cpu));
+		bench_report("remote", bench_batch(other));
+		set_cpus_allowed_ptr(current, cpu_all_mask);
+	}
+
+	vfree(objs);
+	return 0;
+}
+
+static void __exit slub_bench_exit(void)
+{
+}
+
+module_init(slub_bench_init);
+module_exit(slub_bench_exit);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("kmalloc/kfree microbenchmark");
@@ -38,6 +38,7 @@ int page_cluster;
 
 static DEFINE_PER_CPU(struct pagevec[NR_LRU_LISTS], lru_add_pvecs);
 static DEFINE_PER_CPU(struct pagevec, lru_rotate_pvecs);
+static DEFINE_PER_CPU(struct pagevec, lru_lazyfree_pvecs);
 
 /*
  * This path almost never happens for VM activity - pages are normally
@@ -194,6 +195,68 @@ void activate_page(struct page *page)
 	spin_unlock_irq(&zone->lru_lock);
 }
 
+static int page_can_lazyfree(struct page *page)
+{
+	return PageLRU(page) && PageAnon(page) && PageSwapBacked(page) &&
+		!PageSwapCache(page) && !PageUnevictable(page);
+}
+
+/*
+ * Move lazily freed anonymous pages to the inactive file list: reclaim
+ * does not scan the anon lists without swap, and clean pages there are
+ * dropped instead of being written out.  Clearing PG_swapbacked is what
+ * tells reclaim to discard the page, page_lru() follows from it.
+ */
+static void pagevec_lazyfree(struct pagevec *pvec)
+{
+	int i;
+	int pgmoved = 0;
+	struct zone *zone = NULL;
+
+	for (i = 0; i < pagevec_count(pvec); i++) {
+		struct page *page = pvec->pages[i];
+		struct zone *pagezone = page_zone(page);
+
+		if (pagezone != zone) {
+			if (zone)
+				spin_unlock_irq(&zone->lru_lock);
+			zone = pagezone;
+			spin_lock_irq(&zone->lru_lock);
+		}
+		if (page_can_lazyfree(page)) {
+			del_page_from_lru_list(zone, page, page_lru(page));
+			ClearPageActive(page);
+			ClearPageReferenced(page);
+			ClearPageSwapBacked(page);
+			add_page_to_lru_list(zone, page, LRU_INACTIVE_FILE);
+			pgmoved++;
+		}
+	}
+	if (zone)
+		spin_unlock_irq(&zone->lru_lock);
+	count_vm_events(PGLAZYFREE, pgmoved);
+	release_pages(pvec->pages, pvec->nr, pvec->cold);
+	pagevec_reinit(pvec);
+}
+
+/**
+ * mark_page_lazyfree - make an anonymous page freeable without swap
+ * @page: page to deactivate
+ *
+ * Called by MADV_FREE on clean, exclusively mapped anonymous pages.
+ */
+void mark_page_lazyfree(struct page *page)
+{
+	if (page_can_lazyfree(page)) {
+		struct pagevec *pvec = &get_cpu_var(lru_lazyfree_pvecs);
+
+		page_cache_get(page);
+		if (!pagevec_add(pvec, page))
+			pagevec_lazyfree(pvec);
+		put_cpu_var(lru_lazyfree_pvecs);
+	}
+}
+
 /*
  * Mark a page as having seen activity.
  *
@@ -207,6 +270,8 @@ void mark_page_accessed(struct page *page)
 			PageReferenced(page) && PageLRU(page)) {
 		activate_page(page);
 		ClearPageReferenced(page);
+		if (page_is_file_cache(page))
+			workingset_activation(page);
 	} else if (!PageReferenced(page)) {
 		SetPageReferenced(page);
 	}
@@ -290,6 +355,10 @@ static void drain_cpu_pagevecs(int cpu)
 		pagevec_move_tail(pvec);
 		local_irq_restore(flags);
 	}
+
+	pvec = &per_cpu(lru_lazyfree_pvecs, cpu);
+	if (pagevec_count(pvec))
+		pagevec_lazyfree(pvec);
 }
 
 void lru_add_drain(void)
@@ -0,0 +1,175 @@
+/*
+ * linux/mm/swap_slots.c
+ *
+ * Per cpu caches of swap slots.
+ *
+ * Allocating a swap slot used to take swap_lock for every page swapped
+ * out, and freeing one took it again, so parallel reclaim serialised on
+ * it.  Instead each cpu keeps a cache of slots allocated in one batch by
+ * get_swap_pages(), which get_swap_page() hands out under a per cpu
+ * mutex, and a cache of freed slots, returned in one batch by
+ * swapcache_free_entries().
+ *
+ * Slots in either cache are still marked SWAP_HAS_CACHE in the swap_map,
+ * so they look in use: swapoff disables the caches and drains them
+ * before it looks for slots to unuse.
+ */
+
+#include <linux/swap_slots.h>
+#include <linux/cpu.h>
+#include <linux/cpumask.h>
+#include <linux/init.h>
+#include <linux/notifier.h>
+#include <linux/percpu.h>
+#include <linux/smp.h>
+
+static DEFINE_PER_CPU(struct swap_slots_cache, swp_slots);
+static DEFINE_MUTEX(swap_slots_cache_enable_mutex);
+bool swap_slot_cache_active;
+
+/*
+ * Don't keep slots in the caches when swap is nearly full: other cpus
+ * would fail to allocate while they sit there unused.
+ */
+static inline bool swap_slots_cache_usable(void)
+{
+	return swap_slot_cache_active &&
+		nr_swap_pages > num_online_cpus() * SWAP_SLOTS_CACHE_SIZE * 2;
+}
+
+static void drain_slots_cache_cpu(unsigned int cpu)
+{
+	struct swap_slots_cache *cache = &per_cpu(swp_slots, cpu);
+
+	mutex_lock(&cache->alloc_lock);
+	if (cache->nr) {
+		swapcache_free_entries(cache->slots + cache->cur, cache->nr);
+		cache->cur = 0;
+		cache->nr = 0;
+	}
+	mutex_unlock(&cache->alloc_lock);
+
+	spin_lock(&cache->free_lock);
+	if (cache->n_ret) {
+		swapcache_free_entries(cache->slots_ret, cache->n_ret);
+		cache->n_ret = 0;
+	}
+	spin_unlock(&cache->free_lock);
+}
+
+/*
+ * Called by swapoff: empty all the caches and keep them off until
+ * reenable_swap_slots_cache_unlock().  Also serialises swapoffs, which
+ * must not see the caches come back on under them.
+ */
+void disable_swap_slots_cache_lock(void)
+{
+	unsigned int cpu;
+
+	mutex_lock(&swap_slots_cache_enable_mutex);
+	swap_slot_cache_active = false;
+	for_each_possible_cpu(cpu)
+		drain_slots_cache_cpu(cpu);
+}
+
+void reenable_swap_slots_cache_unlock(void)
+{
+	swap_slot_cache_active = true;
+	mutex_unlock(&swap_slots_cache_enable_mutex);
+}
+
+/*
+ * Allocate a swap slot for swap cache.  The cache is only stable under
+ * its mutex, which may be held across a refill: it does not matter if
+ * we have moved to another cpu meanwhile.
+ */
+swp_entry_t get_swap_page(void)
+{
+	struct swap_slots_cache *cache;
+	swp_entry_t entry;
+
+	entry.val = 0;
+	if (swap_slot_cache_active) {
+		cache = &per_cpu(swp_slots, raw_smp_processor_id());
+		mutex_lock(&cache->alloc_lock);
+		/* recheck: swapoff may have disabled the cache meanwhile */
+		if (swap_slot_cache_active) {
+			if (!cache->nr && swap_slots_cache_usable()) {
+				cache->cur = 0;
+				cache->nr = get_swap_pages(SWAP_SLOTS_CACHE_SIZE,
+							   cache->slots);
+			}
+			if (cache->nr) {
+				entry = cache->slots[cache->cur++];
+				cache->nr--;
+				mutex_unlock(&cache->alloc_lock);
+				return entry;
+			}
+		}
+		mutex_unlock(&cache->alloc_lock);
+	}
+
+	get_swap_pages(1, &entry);
+	return entry;
+}
+
+/*
+ * Free a slot released by swap_free() or swapcache_free(): it is put in
+ * the cache and returned to the swap area with the rest of the batch,
+ * at once if swap is nearly full.
+ */
+void free_swap_slot(swp_entry_t entry)
+{
+	struct swap_slots_cache *cache;
+
+	if (swap_slot_cache_active) {
+		cache = &per_cpu(swp_slots, raw_smp_processor_id());
+		spin_lock(&cache->free_lock);
+		if (swap_slot_cache_active) {
+			cache->slots_ret[cache->n_ret++] = entry;
+			if (cache->n_ret == SWAP_SLOTS_CACHE_SIZE ||
+			    !swap_slots_cache_usable()) {
+				swapcache_free_entries(cache->slots_ret,
+						       cache->n_ret);
+				cache->n_ret = 0;
+			}
+			spin_unlock(&cache->free_lock);
+			return;
+		}
+		spin_unlock(&cache->free_lock);
+	}
+
+	swapcache_free_entries(&entry, 1);
+}
+
+static int __cpuinit swap_slots_cpu_callback(struct notifier_block *nb,
+					     unsigned long action, void *hcpu)
+{
+	int cpu = (unsigned long)hcpu;
+
+	switch (action) {
+	case CPU_DEAD:
+	case CPU_DEAD_FROZEN:
+		drain_slots_cache_cpu(cpu);
+		break;
+	default:
+		break;
+	}
+	return NOTIFY_OK;
+}
+
+static int __init swap_slots_init(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct swap_slots_cache *cache = &per_cpu(swp_slots, cpu);
+
+		mutex_init(&cache->alloc_lock);
+		spin_lock_init(&cache->free_lock);
+	}
+	hotcpu_notifier(swap_slots_cpu_callback, 0);
+	swap_slot_cache_active = true;
+	return 0;
+}
+__initcall(swap_slots_init);
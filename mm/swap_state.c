@@ -18,6 +18,7 @@
 #include <linux/pagevec.h>
 #include <linux/migrate.h>
 #include <linux/page_cgroup.h>
+#include <linux/swap_slots.h>
 
 #include <asm/pgtable.h>
 
@@ -277,10 +278,30 @@ struct page * lookup_swap_cache(swp_entry_t entry)
  */
 struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 			struct vm_area_struct *vma, unsigned long addr)
+{
+	bool page_was_allocated;
+	struct page *page;
+
+	page = __read_swap_cache_async(entry, gfp_mask, vma, addr,
+				       &page_was_allocated);
+	if (page_was_allocated)
+		swap_readpage(page);
+	return page;
+}
+
+/*
+ * Find the page for a swap entry in the swap cache, or add a new one to
+ * it.  A new page is returned locked and not uptodate, with
+ * *new_page_allocated set, and it is up to the caller to fill it.
+ */
+struct page *__read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr,
+			bool *new_page_allocated)
 {
 	struct page *found_page, *new_page = NULL;
 	int err;
 
+	*new_page_allocated = false;
 	do {
 		/*
 		 * First check the swap cache.  Since this is normally
@@ -313,6 +334,15 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 		err = swapcache_prepare(entry);
 		if (err == -EEXIST) {	/* seems racy */
 			radix_tree_preload_end();
+			/*
+			 * A slot without users is either sitting in a per
+			 * cpu slot cache or about to be added to swap cache
+			 * by whoever just allocated it: readahead need not
+			 * wait for that, only swapoff (with the slot caches
+			 * off) must.
+			 */
+			if (swap_slot_cache_active && !__swap_count(entry))
+				break;
 			continue;
 		}
 		if (err) {		/* swp entry is obsolete ? */
@@ -327,10 +357,10 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 		if (likely(!err)) {
 			radix_tree_preload_end();
 			/*
-			 * Initiate read into locked page and return.
+			 * Return the locked page for the caller to fill.
 			 */
 			lru_cache_add_anon(new_page);
-			swap_readpage(new_page);
+			*new_page_allocated = true;
 			return new_page;
 		}
 		radix_tree_preload_end();
@@ -34,6 +34,8 @@
 #include <asm/tlbflush.h>
 #include <linux/swapops.h>
 #include <linux/page_cgroup.h>
+#include <linux/zswap.h>
+#include <linux/swap_slots.h>
 
 static DEFINE_SPINLOCK(swap_lock);
 static unsigned int nr_swapfiles;
@@ -222,9 +224,251 @@ static int wait_for_discard(void *word)
 #define SWAPFILE_CLUSTER	256
 #define LATENCY_LIMIT		256
 
+/*
+ * swap_map[] of a solid state swap area is protected by the per cluster
+ * locks, otherwise by swap_lock.  Allocating a slot and freeing a slot
+ * that nobody references also need swap_lock, so the zero/non-zero state
+ * of a slot is stable under swap_lock alone.
+ */
+static inline struct swap_cluster_info *lock_cluster(struct swap_info_struct *si,
+						     unsigned long offset)
+{
+	struct swap_cluster_info *ci = si->cluster_info;
+
+	if (ci) {
+		ci += offset / SWAPFILE_CLUSTER;
+		spin_lock(&ci->lock);
+	}
+	return ci;
+}
+
+static inline void unlock_cluster(struct swap_cluster_info *ci)
+{
+	if (ci)
+		spin_unlock(&ci->lock);
+}
+
+static inline struct swap_cluster_info *lock_cluster_or_swap_lock(
+		struct swap_info_struct *si, unsigned long offset)
+{
+	struct swap_cluster_info *ci = lock_cluster(si, offset);
+
+	if (!ci)
+		spin_lock(&swap_lock);
+	return ci;
+}
+
+static inline void unlock_cluster_or_swap_lock(struct swap_cluster_info *ci)
+{
+	if (ci)
+		spin_unlock(&ci->lock);
+	else
+		spin_unlock(&swap_lock);
+}
+
+static void cluster_list_add_tail(struct swap_cluster_list *list,
+				  struct swap_cluster_info *ci,
+				  unsigned int idx)
+{
+	if (list->empty) {
+		list->head = idx;
+		list->empty = false;
+	} else
+		ci[list->tail].data = idx;
+	list->tail = idx;
+}
+
+static unsigned int cluster_list_del_first(struct swap_cluster_list *list,
+					   struct swap_cluster_info *ci)
+{
+	unsigned int idx = list->head;
+
+	if (idx == list->tail)
+		list->empty = true;
+	else
+		list->head = ci[idx].data;
+	return idx;
+}
+
+/*
+ * Discard the clusters queued by swap_cluster_schedule_discard(), then
+ * make them available for allocation.  Called with swap_lock held, drops
+ * it while discarding.
+ */
+static void swap_do_scheduled_discard(struct swap_info_struct *si)
+{
+	struct swap_cluster_info *ci = si->cluster_info;
+	unsigned long offset;
+	unsigned int idx;
+	int i;
+
+	while (!si->discard_clusters.empty) {
+		idx = cluster_list_del_first(&si->discard_clusters, ci);
+		offset = idx * SWAPFILE_CLUSTER;
+		spin_unlock(&swap_lock);
+
+		discard_swap_cluster(si, offset, SWAPFILE_CLUSTER);
+
+		spin_lock(&swap_lock);
+		for (i = 0; i < SWAPFILE_CLUSTER; i++)
+			si->swap_map[offset + i] = 0;
+		ci[idx].flags = CLUSTER_FLAG_FREE;
+		cluster_list_add_tail(&si->free_clusters, ci, idx);
+	}
+}
+
+static void swap_discard_work(struct work_struct *work)
+{
+	struct swap_info_struct *si;
+
+	si = container_of(work, struct swap_info_struct, discard_work);
+
+	spin_lock(&swap_lock);
+	swap_do_scheduled_discard(si);
+	spin_unlock(&swap_lock);
+}
+
+/*
+ * A cluster just became free on a discardable device: discard its old
+ * contents before it is reused, to help the device's wear-levelling.
+ * Until then its slots are marked bad, so that scan_swap_map() and
+ * swapoff leave them alone.
+ */
+static void swap_cluster_schedule_discard(struct swap_info_struct *si,
+					  unsigned int idx)
+{
+	unsigned long offset = idx * SWAPFILE_CLUSTER;
+	int i;
+
+	for (i = 0; i < SWAPFILE_CLUSTER; i++)
+		si->swap_map[offset + i] = SWAP_MAP_BAD;
+	cluster_list_add_tail(&si->discard_clusters, si->cluster_info, idx);
+	schedule_work(&si->discard_work);
+}
+
+/*
+ * Account a slot allocated at @offset to its cluster, taking the cluster
+ * off the free list if it was free.  Called with swap_lock held.
+ */
+static void inc_cluster_info_page(struct swap_info_struct *si,
+				  unsigned long offset)
+{
+	struct swap_cluster_info *ci = si->cluster_info;
+	unsigned long idx = offset / SWAPFILE_CLUSTER;
+
+	if (!ci)
+		return;
+	if (ci[idx].flags & CLUSTER_FLAG_FREE) {
+		/* scan_swap_map() only allocates from the first free one */
+		VM_BUG_ON(si->free_clusters.head != idx);
+		cluster_list_del_first(&si->free_clusters, ci);
+		ci[idx].flags = 0;
+		ci[idx].data = 0;
+	}
+	VM_BUG_ON(ci[idx].data >= SWAPFILE_CLUSTER);
+	ci[idx].data++;
+}
+
+/*
+ * The slot at @offset has been freed: when that empties its cluster,
+ * put the cluster on the free list, or on the discard list first if
+ * the device supports discard.  Called with swap_lock held.
+ */
+static void dec_cluster_info_page(struct swap_info_struct *si,
+				  unsigned long offset)
+{
+	struct swap_cluster_info *ci = si->cluster_info;
+	unsigned long idx = offset / SWAPFILE_CLUSTER;
+
+	if (!ci)
+		return;
+	VM_BUG_ON(ci[idx].data == 0);
+	if (--ci[idx].data)
+		return;
+
+	/* no discard once swapoff has started: it flushes discard_work */
+	if ((si->flags & (SWP_DISCARDABLE | SWP_WRITEOK)) ==
+				(SWP_DISCARDABLE | SWP_WRITEOK)) {
+		swap_cluster_schedule_discard(si, idx);
+		return;
+	}
+	ci[idx].flags = CLUSTER_FLAG_FREE;
+	cluster_list_add_tail(&si->free_clusters, ci, idx);
+}
+
+/*
+ * If @offset lies in a free cluster other than the first one, allocating
+ * there would break the free list: have this cpu pick a new cluster.
+ */
+static bool scan_swap_map_ssd_cluster_conflict(struct swap_info_struct *si,
+					       unsigned long offset)
+{
+	struct percpu_cluster *percpu_cluster;
+	unsigned long idx = offset / SWAPFILE_CLUSTER;
+
+	if (si->free_clusters.empty || idx == si->free_clusters.head ||
+	    !(si->cluster_info[idx].flags & CLUSTER_FLAG_FREE))
+		return false;
+
+	percpu_cluster = per_cpu_ptr(si->percpu_cluster, smp_processor_id());
+	percpu_cluster->empty = true;
+	return true;
+}
+
+/*
+ * Find the next free slot in this cpu's cluster, or take the first free
+ * cluster when that is used up.  Returns false, leaving *offset alone,
+ * when there is no free cluster left.  Called with swap_lock held.
+ */
+static bool scan_swap_map_try_ssd_cluster(struct swap_info_struct *si,
+					  unsigned long *offset,
+					  unsigned long *scan_base)
+{
+	struct percpu_cluster *cluster;
+	unsigned long tmp, max;
+
+new_cluster:
+	cluster = per_cpu_ptr(si->percpu_cluster, smp_processor_id());
+	if (cluster->empty) {
+		if (!si->free_clusters.empty) {
+			cluster->index = si->free_clusters.head;
+			cluster->next = cluster->index * SWAPFILE_CLUSTER;
+			cluster->empty = false;
+		} else if (!si->discard_clusters.empty) {
+			/*
+			 * Every free cluster is waiting for its discard:
+			 * do that now rather than scatter the allocation.
+			 */
+			swap_do_scheduled_discard(si);
+			*scan_base = *offset = si->cluster_next;
+			goto new_cluster;
+		} else
+			return false;
+	}
+
+	/*
+	 * Other cpus may have allocated from our cluster when they found
+	 * no free one: check that there is still a free slot in it.
+	 */
+	tmp = cluster->next;
+	max = min_t(unsigned long, si->max,
+		    (cluster->index + 1) * SWAPFILE_CLUSTER);
+	while (tmp < max && si->swap_map[tmp])
+		tmp++;
+	if (tmp >= max) {
+		cluster->empty = true;
+		goto new_cluster;
+	}
+	cluster->next = tmp + 1;
+	*offset = tmp;
+	*scan_base = tmp;
+	return true;
+}
+
 static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 					  int cache)
 {
+	struct swap_cluster_info *ci;
 	unsigned long offset;
 	unsigned long scan_base;
 	unsigned long last_in_cluster = 0;
@@ -240,11 +484,18 @@ static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 	 * overall disk seek times between swap pages.  -- sct
 	 * But we do now try to find an empty cluster.  -Andrea
 	 * And we let swap pages go all over an SSD partition.  Hugh
+	 * On an SSD each cpu takes its own free cluster, so that swapout
+	 * from several cpus is not interleaved.
 	 */
 
 	si->flags += SWP_SCANNING;
 	scan_base = offset = si->cluster_next;
 
+	if (si->cluster_info) {
+		scan_swap_map_try_ssd_cluster(si, &offset, &scan_base);
+		goto checks;
+	}
+
 	if (unlikely(!si->cluster_nr--)) {
 		if (si->pages - si->inuse_pages < SWAPFILE_CLUSTER) {
 			si->cluster_nr = SWAPFILE_CLUSTER - 1;
@@ -329,6 +580,10 @@ checks:
 		goto no_page;
 	if (offset > si->highest_bit)
 		scan_base = offset = si->lowest_bit;
+	if (si->cluster_info) {
+		while (scan_swap_map_ssd_cluster_conflict(si, offset))
+			scan_swap_map_try_ssd_cluster(si, &offset, &scan_base);
+	}
 
 	/* reuse swap entry of cache-only swap if not hibernation. */
 	if (vm_swap_full()
@@ -356,10 +611,13 @@ checks:
 		si->lowest_bit = si->max;
 		si->highest_bit = 0;
 	}
+	ci = lock_cluster(si, offset);
 	if (cache == SWAP_CACHE) /* at usual swap-out via vmscan.c */
 		si->swap_map[offset] = encode_swapmap(0, true);
 	else /* at suspend */
 		si->swap_map[offset] = encode_swapmap(1, false);
+	unlock_cluster(ci);
+	inc_cluster_info_page(si, offset);
 	si->cluster_next = offset + 1;
 	si->flags -= SWP_SCANNING;
 
@@ -456,17 +714,25 @@ no_page:
 	return 0;
 }
 
-swp_entry_t get_swap_page(void)
+/*
+ * Allocate up to @n swap slots for swap cache, filling @swp_entries[]:
+ * returns the number allocated.  get_swap_page() takes them from here
+ * in batches, so that swap_lock is taken once per batch.
+ */
+int get_swap_pages(int n, swp_entry_t swp_entries[])
 {
 	struct swap_info_struct *si;
 	pgoff_t offset;
 	int type, next;
 	int wrapped = 0;
+	int n_ret = 0;
+	long n_goal;
 
 	spin_lock(&swap_lock);
-	if (nr_swap_pages <= 0)
+	n_goal = min_t(long, n, nr_swap_pages);
+	if (n_goal <= 0)
 		goto noswap;
-	nr_swap_pages--;
+	nr_swap_pages -= n_goal;
 
 	for (type = swap_list.next; type >= 0 && wrapped < 2; type = next) {
 		si = swap_info + type;
@@ -484,18 +750,21 @@ swp_entry_t get_swap_page(void)
 
 		swap_list.next = next;
 		/* This is called for allocating swap entry for cache */
-		offset = scan_swap_map(si, SWAP_CACHE);
-		if (offset) {
-			spin_unlock(&swap_lock);
-			return swp_entry(type, offset);
+		while (n_ret < n_goal) {
+			offset = scan_swap_map(si, SWAP_CACHE);
+			if (!offset)
+				break;
+			swp_entries[n_ret++] = swp_entry(type, offset);
 		}
+		if (n_ret == n_goal)
+			break;
 		next = swap_list.next;
 	}
 
-	nr_swap_pages++;
+	nr_swap_pages += n_goal - n_ret;
 noswap:
 	spin_unlock(&swap_lock);
-	return (swp_entry_t) {0};
+	return n_ret;
 }
 
 /* The only caller of this function is now susupend routine */
@@ -520,6 +789,11 @@ swp_entry_t get_swap_page_of_type(int type)
 	return (swp_entry_t) {0};
 }
 
+/*
+ * Check that @entry is a valid swap entry in use.  The caller must make
+ * sure that its swap area cannot go away meanwhile, and then lock its
+ * swap_map with lock_cluster_or_swap_lock().
+ */
 static struct swap_info_struct * swap_info_get(swp_entry_t entry)
 {
 	struct swap_info_struct * p;
@@ -538,7 +812,6 @@ static struct swap_info_struct * swap_info_get(swp_entry_t entry)
 		goto bad_offset;
 	if (!p->swap_map[offset])
 		goto bad_free;
-	spin_lock(&swap_lock);
 	return p;
 
 bad_free:
@@ -556,41 +829,76 @@ out:
 	return NULL;
 }
 
-static int swap_entry_free(struct swap_info_struct *p,
-			   swp_entry_t ent, int cache)
+/*
+ * Drop a swap user (SWAP_MAP) or the swap cache (SWAP_CACHE) reference
+ * to a slot, with its cluster lock or swap_lock held.  Returns what is
+ * left of the usage: when that is nothing, the slot stays marked as
+ * SWAP_HAS_CACHE so that it is not reused, and the caller must pass it
+ * on to free_swap_slot().
+ */
+static int swap_entry_put(struct swap_info_struct *p,
+			  swp_entry_t ent, int cache)
 {
 	unsigned long offset = swp_offset(ent);
 	int count = swap_count(p->swap_map[offset]);
 	bool has_cache;
+	unsigned short usage;
 
 	has_cache = swap_has_cache(p->swap_map[offset]);
 
 	if (cache == SWAP_MAP) { /* dropping usage count of swap */
-		if (count < SWAP_MAP_MAX) {
+		if (count < SWAP_MAP_MAX)
 			count--;
-			p->swap_map[offset] = encode_swapmap(count, has_cache);
-		}
 	} else { /* dropping swap cache flag */
 		VM_BUG_ON(!has_cache);
-		p->swap_map[offset] = encode_swapmap(count, false);
-
-	}
-	/* return code. */
-	count = p->swap_map[offset];
-	/* free if no reference */
-	if (!count) {
-		if (offset < p->lowest_bit)
-			p->lowest_bit = offset;
-		if (offset > p->highest_bit)
-			p->highest_bit = offset;
-		if (p->prio > swap_info[swap_list.next].prio)
-			swap_list.next = p - swap_info;
-		nr_swap_pages++;
-		p->inuse_pages--;
+		has_cache = false;
 	}
-	if (!swap_count(count))
+	usage = encode_swapmap(count, has_cache);
+	p->swap_map[offset] = usage ? usage : SWAP_HAS_CACHE;
+
+	if (!swap_count(usage))
 		mem_cgroup_uncharge_swap(ent);
-	return count;
+	return usage;
+}
+
+/*
+ * Return a slot that swap_entry_put() left without users to the free
+ * pool.  Called with swap_lock held.
+ */
+static void swap_entry_free(struct swap_info_struct *p, swp_entry_t ent)
+{
+	unsigned long offset = swp_offset(ent);
+	struct swap_cluster_info *ci;
+
+	ci = lock_cluster(p, offset);
+	VM_BUG_ON(p->swap_map[offset] != SWAP_HAS_CACHE);
+	p->swap_map[offset] = 0;
+	unlock_cluster(ci);
+	dec_cluster_info_page(p, offset);
+
+	if (offset < p->lowest_bit)
+		p->lowest_bit = offset;
+	if (offset > p->highest_bit)
+		p->highest_bit = offset;
+	if (p->prio > swap_info[swap_list.next].prio)
+		swap_list.next = p - swap_info;
+	nr_swap_pages++;
+	p->inuse_pages--;
+	zswap_invalidate_page(p - swap_info, offset);
+}
+
+/*
+ * Free a batch of slots from a per cpu slot cache: either unused slots
+ * allocated by get_swap_pages(), or slots released by swap_entry_put().
+ */
+void swapcache_free_entries(swp_entry_t *entries, int n)
+{
+	int i;
+
+	spin_lock(&swap_lock);
+	for (i = 0; i < n; i++)
+		swap_entry_free(swap_info + swp_type(entries[i]), entries[i]);
+	spin_unlock(&swap_lock);
 }
 
 /*
@@ -600,11 +908,16 @@ static int swap_entry_free(struct swap_info_struct *p,
 void swap_free(swp_entry_t entry)
 {
 	struct swap_info_struct * p;
+	struct swap_cluster_info *ci;
+	int usage;
 
 	p = swap_info_get(entry);
 	if (p) {
-		swap_entry_free(p, entry, SWAP_MAP);
-		spin_unlock(&swap_lock);
+		ci = lock_cluster_or_swap_lock(p, swp_offset(entry));
+		usage = swap_entry_put(p, entry, SWAP_MAP);
+		unlock_cluster_or_swap_lock(ci);
+		if (!usage)
+			free_swap_slot(entry);
 	}
 }
 
@@ -614,11 +927,13 @@ void swap_free(swp_entry_t entry)
 void swapcache_free(swp_entry_t entry, struct page *page)
 {
 	struct swap_info_struct *p;
+	struct swap_cluster_info *ci;
 	int ret;
 
 	p = swap_info_get(entry);
 	if (p) {
-		ret = swap_entry_free(p, entry, SWAP_CACHE);
+		ci = lock_cluster_or_swap_lock(p, swp_offset(entry));
+		ret = swap_entry_put(p, entry, SWAP_CACHE);
 		if (page) {
 			bool swapout;
 			if (ret)
@@ -627,11 +942,31 @@ void swapcache_free(swp_entry_t entry, struct page *page)
 				swapout = false; /* no more swap users! */
 			mem_cgroup_uncharge_swapcache(page, entry, swapout);
 		}
-		spin_unlock(&swap_lock);
+		unlock_cluster_or_swap_lock(ci);
+		if (!ret)
+			free_swap_slot(entry);
 	}
 	return;
 }
 
+/*
+ * How many swap users does @entry have?  Used by swapin readahead to
+ * skip slots without users instead of waiting for them, see
+ * __read_swap_cache_async().
+ */
+int __swap_count(swp_entry_t entry)
+{
+	struct swap_info_struct *p = swap_info + swp_type(entry);
+	unsigned long offset = swp_offset(entry);
+	int count = 0;
+
+	spin_lock(&swap_lock);
+	if (offset < p->max)
+		count = swap_count(p->swap_map[offset]);
+	spin_unlock(&swap_lock);
+	return count;
+}
+
 /*
  * How many references to page are currently swapped out?
  */
@@ -639,13 +974,15 @@ static inline int page_swapcount(struct page *page)
 {
 	int count = 0;
 	struct swap_info_struct *p;
+	struct swap_cluster_info *ci;
 	swp_entry_t entry;
 
 	entry.val = page_private(page);
 	p = swap_info_get(entry);
 	if (p) {
+		ci = lock_cluster_or_swap_lock(p, swp_offset(entry));
 		count = swap_count(p->swap_map[swp_offset(entry)]);
-		spin_unlock(&swap_lock);
+		unlock_cluster_or_swap_lock(ci);
 	}
 	return count;
 }
@@ -699,21 +1036,27 @@ int try_to_free_swap(struct page *page)
 int free_swap_and_cache(swp_entry_t entry)
 {
 	struct swap_info_struct *p;
+	struct swap_cluster_info *ci;
 	struct page *page = NULL;
+	int usage;
 
 	if (non_swap_entry(entry))
 		return 1;
 
 	p = swap_info_get(entry);
 	if (p) {
-		if (swap_entry_free(p, entry, SWAP_MAP) == SWAP_HAS_CACHE) {
+		ci = lock_cluster_or_swap_lock(p, swp_offset(entry));
+		usage = swap_entry_put(p, entry, SWAP_MAP);
+		if (usage == SWAP_HAS_CACHE) {
 			page = find_get_page(&swapper_space, entry.val);
 			if (page && !trylock_page(page)) {
 				page_cache_release(page);
 				page = NULL;
 			}
 		}
-		spin_unlock(&swap_lock);
+		unlock_cluster_or_swap_lock(ci);
+		if (!usage)
+			free_swap_slot(entry);
 	}
 	if (page) {
 		/*
@@ -1197,9 +1540,11 @@ static int try_to_unuse(unsigned int type)
 			goto retry;
 
 		if (swap_count(*swap_map) == SWAP_MAP_MAX) {
-			spin_lock(&swap_lock);
+			struct swap_cluster_info *ci;
+
+			ci = lock_cluster_or_swap_lock(si, i);
 			*swap_map = encode_swapmap(0, true);
-			spin_unlock(&swap_lock);
+			unlock_cluster_or_swap_lock(ci);
 			reset_overflow = 1;
 		}
 
@@ -1513,6 +1858,8 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 {
 	struct swap_info_struct * p = NULL;
 	unsigned short *swap_map;
+	struct swap_cluster_info *cluster_info;
+	struct percpu_cluster *percpu_cluster;
 	struct file *swap_file, *victim;
 	struct address_space *mapping;
 	struct inode *inode;
@@ -1576,9 +1923,15 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	p->flags &= ~SWP_WRITEOK;
 	spin_unlock(&swap_lock);
 
+	/*
+	 * Slots sitting in the per cpu caches look in use: return them
+	 * first, and keep the caches off until try_to_unuse() is done.
+	 */
+	disable_swap_slots_cache_lock();
 	current->flags |= PF_OOM_ORIGIN;
 	err = try_to_unuse(type);
 	current->flags &= ~PF_OOM_ORIGIN;
+	reenable_swap_slots_cache_unlock();
 
 	if (err) {
 		/* re-insert swap space back into swap_list */
@@ -1607,6 +1960,9 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	down_write(&swap_unplug_sem);
 	up_write(&swap_unplug_sem);
 
+	if (p->cluster_info)
+		flush_work(&p->discard_work);
+
 	destroy_swap_extents(p);
 	mutex_lock(&swapon_mutex);
 	spin_lock(&swap_lock);
@@ -1625,10 +1981,17 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	p->max = 0;
 	swap_map = p->swap_map;
 	p->swap_map = NULL;
+	cluster_info = p->cluster_info;
+	p->cluster_info = NULL;
+	percpu_cluster = p->percpu_cluster;
+	p->percpu_cluster = NULL;
 	p->flags = 0;
 	spin_unlock(&swap_lock);
 	mutex_unlock(&swapon_mutex);
+	free_percpu(percpu_cluster);
+	vfree(cluster_info);
 	vfree(swap_map);
+	zswap_invalidate_area(type);
 	/* Destroy swap account informatin */
 	swap_cgroup_swapoff(type);
 
@@ -1760,6 +2123,52 @@ static int __init max_swapfiles_check(void)
 late_initcall(max_swapfiles_check);
 #endif
 
+/*
+ * Set up the clusters of a solid state swap area: those holding the
+ * header, bad pages or the end of the map are never free, all others go
+ * on the free cluster list.
+ */
+static int setup_swap_clusters(struct swap_info_struct *p,
+			       unsigned short *swap_map)
+{
+	unsigned long nr_clusters = DIV_ROUND_UP(p->max, SWAPFILE_CLUSTER);
+	struct swap_cluster_info *ci;
+	unsigned long i;
+	int cpu;
+
+	ci = vmalloc(nr_clusters * sizeof(*ci));
+	if (!ci)
+		return -ENOMEM;
+	p->percpu_cluster = alloc_percpu(struct percpu_cluster);
+	if (!p->percpu_cluster) {
+		vfree(ci);
+		return -ENOMEM;
+	}
+	for_each_possible_cpu(cpu)
+		per_cpu_ptr(p->percpu_cluster, cpu)->empty = true;
+
+	for (i = 0; i < nr_clusters; i++) {
+		spin_lock_init(&ci[i].lock);
+		ci[i].data = 0;
+		ci[i].flags = 0;
+	}
+	for (i = 0; i < nr_clusters * SWAPFILE_CLUSTER; i++)
+		if (i >= p->max || swap_map[i])
+			ci[i / SWAPFILE_CLUSTER].data++;
+
+	p->free_clusters.empty = true;
+	p->discard_clusters.empty = true;
+	for (i = 0; i < nr_clusters; i++) {
+		if (ci[i].data)
+			continue;
+		ci[i].flags = CLUSTER_FLAG_FREE;
+		cluster_list_add_tail(&p->free_clusters, ci, i);
+	}
+	INIT_WORK(&p->discard_work, swap_discard_work);
+	p->cluster_info = ci;
+	return 0;
+}
+
 /*
  * Written 01/25/92 by Simmule Turner, heavily changed by Linus.
  *
@@ -1984,6 +2393,14 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 			p->flags |= SWP_DISCARDABLE;
 	}
 
+	if (p->flags & SWP_SOLIDSTATE) {
+		error = setup_swap_clusters(p, swap_map);
+		if (error)
+			goto bad_swap;
+	}
+
+	zswap_init_area(type);
+
 	mutex_lock(&swapon_mutex);
 	spin_lock(&swap_lock);
 	if (swap_flags & SWAP_FLAG_PREFER)
@@ -2028,6 +2445,10 @@ bad_swap:
 	}
 	destroy_swap_extents(p);
 	swap_cgroup_swapoff(type);
+	free_percpu(p->percpu_cluster);
+	p->percpu_cluster = NULL;
+	vfree(p->cluster_info);
+	p->cluster_info = NULL;
 bad_swap_2:
 	spin_lock(&swap_lock);
 	p->swap_file = NULL;
@@ -2083,6 +2504,7 @@ void si_swapinfo(struct sysinfo *val)
 static int __swap_duplicate(swp_entry_t entry, bool cache)
 {
 	struct swap_info_struct * p;
+	struct swap_cluster_info *ci;
 	unsigned long offset, type;
 	int result = -EINVAL;
 	int count;
@@ -2102,6 +2524,7 @@ static int __swap_duplicate(swp_entry_t entry, bool cache)
 	if (unlikely(offset >= p->max))
 		goto unlock_out;
 
+	ci = lock_cluster(p, offset);
 	count = swap_count(p->swap_map[offset]);
 	has_cache = swap_has_cache(p->swap_map[offset]);
 
@@ -2131,6 +2554,7 @@ static int __swap_duplicate(swp_entry_t entry, bool cache)
 		}
 	} else
 		result = -ENOENT; /* unused swap entry */
+	unlock_cluster(ci);
 unlock_out:
 	spin_unlock(&swap_lock);
 out:
@@ -181,6 +181,69 @@ int invalidate_inode_page(struct page *page)
 	return invalidate_complete_page(mapping, page);
 }
 
+/*
+ * Delete the shadow entry at @index, keeping track of the leaf nodes
+ * that hold only shadow entries.  Caller holds the tree_lock.
+ */
+static void __clear_shadow_entry(struct address_space *mapping, pgoff_t index)
+{
+	struct radix_tree_node *node;
+	void **slot;
+
+	__radix_tree_lookup(&mapping->page_tree, index, &node, &slot);
+	if (node)
+		workingset_forget_node(node);
+	radix_tree_delete(&mapping->page_tree, index);
+	mapping->nrshadows--;
+	if (!node)
+		return;
+	/* The node may have gone, or may hold shadow entries only. */
+	__radix_tree_lookup(&mapping->page_tree, index, &node, &slot);
+	if (node)
+		workingset_update_node(mapping, node);
+}
+
+/*
+ * Drop the shadow entries that evicted pages left in [start, end] (see
+ * mm/workingset.c): no refault is coming for pages that are truncated
+ * or invalidated, and an inode must not go with shadow entries left.
+ */
+static void clear_shadow_entries(struct address_space *mapping,
+				 pgoff_t start, pgoff_t end)
+{
+	unsigned long indices[PAGEVEC_SIZE];
+	void **slots[PAGEVEC_SIZE];
+	unsigned int i, nr, nr_shadows;
+	pgoff_t index = start;
+	pgoff_t last;
+
+	while (index <= end && mapping->nrshadows) {
+		spin_lock_irq(&mapping->tree_lock);
+		nr = radix_tree_gang_lookup_slot(&mapping->page_tree, slots,
+						 indices, index, PAGEVEC_SIZE);
+		if (!nr) {
+			spin_unlock_irq(&mapping->tree_lock);
+			break;
+		}
+		last = indices[nr - 1];
+
+		/* deleting entries may move slots: collect indices first */
+		nr_shadows = 0;
+		for (i = 0; i < nr && indices[i] <= end; i++) {
+			if (radix_tree_exceptional_entry(*slots[i]))
+				indices[nr_shadows++] = indices[i];
+		}
+		for (i = 0; i < nr_shadows; i++)
+			__clear_shadow_entry(mapping, indices[i]);
+		spin_unlock_irq(&mapping->tree_lock);
+
+		if (last >= end)
+			break;
+		index = last + 1;
+		cond_resched();
+	}
+}
+
 /**
  * truncate_inode_pages - truncate range of pages specified by start & end byte offsets
  * @mapping: mapping to truncate
@@ -214,7 +277,7 @@ void truncate_inode_pages_range(struct address_space *mapping,
 	pgoff_t next;
 	int i;
 
-	if (mapping->nrpages == 0)
+	if (mapping->nrpages == 0 && mapping->nrshadows == 0)
 		return;
 
 	BUG_ON((lend & (PAGE_CACHE_SIZE - 1)) != (PAGE_CACHE_SIZE - 1));
@@ -224,6 +287,7 @@ void truncate_inode_pages_range(struct address_space *mapping,
 	next = start;
 	while (next <= end &&
 	       pagevec_lookup(&pvec, mapping, next, PAGEVEC_SIZE)) {
+		mem_cgroup_uncharge_start();
 		for (i = 0; i < pagevec_count(&pvec); i++) {
 			struct page *page = pvec.pages[i];
 			pgoff_t page_index = page->index;
@@ -246,6 +310,7 @@ void truncate_inode_pages_range(struct address_space *mapping,
 			unlock_page(page);
 		}
 		pagevec_release(&pvec);
+		mem_cgroup_uncharge_end();
 		cond_resched();
 	}
 
@@ -272,6 +337,7 @@ void truncate_inode_pages_range(struct address_space *mapping,
 			pagevec_release(&pvec);
 			break;
 		}
+		mem_cgroup_uncharge_start();
 		for (i = 0; i < pagevec_count(&pvec); i++) {
 			struct page *page = pvec.pages[i];
 
@@ -286,7 +352,14 @@ void truncate_inode_pages_range(struct address_space *mapping,
 			unlock_page(page);
 		}
 		pagevec_release(&pvec);
+		mem_cgroup_uncharge_end();
 	}
+
+	/*
+	 * Reclaim may have replaced pages with shadow entries until the
+	 * pages were all gone: nothing is left to evict now.
+	 */
+	clear_shadow_entries(mapping, start, end);
 }
 EXPORT_SYMBOL(truncate_inode_pages_range);
 
@@ -327,6 +400,7 @@ unsigned long invalidate_mapping_pages(struct address_space *mapping,
 	pagevec_init(&pvec, 0);
 	while (next <= end &&
 			pagevec_lookup(&pvec, mapping, next, PAGEVEC_SIZE)) {
+		mem_cgroup_uncharge_start();
 		for (i = 0; i < pagevec_count(&pvec); i++) {
 			struct page *page = pvec.pages[i];
 			pgoff_t index;
@@ -354,8 +428,10 @@ unsigned long invalidate_mapping_pages(struct address_space *mapping,
 				break;
 		}
 		pagevec_release(&pvec);
+		mem_cgroup_uncharge_end();
 		cond_resched();
 	}
+	clear_shadow_entries(mapping, start, end);
 	return ret;
 }
 EXPORT_SYMBOL(invalidate_mapping_pages);
@@ -382,7 +458,7 @@ invalidate_complete_page2(struct address_space *mapping, struct page *page)
 
 	clear_page_mlock(page);
 	BUG_ON(page_has_private(page));
-	__remove_from_page_cache(page);
+	__remove_from_page_cache(page, NULL);
 	spin_unlock_irq(&mapping->tree_lock);
 	mem_cgroup_uncharge_cache_page(page);
 	page_cache_release(page);	/* pagecache ref */
@@ -479,6 +555,7 @@ int invalidate_inode_pages2_range(struct address_space *mapping,
 		pagevec_release(&pvec);
 		cond_resched();
 	}
+	clear_shadow_entries(mapping, start, end);
 	return ret;
 }
 EXPORT_SYMBOL_GPL(invalidate_inode_pages2_range);
@@ -0,0 +1,262 @@
+/*
+ * linux/mm/workingset.c
+ *
+ * Workingset detection for the page cache.
+ *
+ * Reclaim balances the file LRU lists on reference bits alone: a page is
+ * activated when it is referenced again while on the inactive list, and
+ * evicted from its tail otherwise.  Read-once data streaming through a
+ * list bigger than the inactive list evicts everything that is not used
+ * fast enough, and pages of the working set read back in start over on
+ * the inactive list to be evicted again, while the active list keeps
+ * pages that may no longer be used at all.  Nothing tells the VM that
+ * the working set does not fit.
+ *
+ * So each zone counts, in inactive_age, the events that move a page down
+ * the inactive list: evictions and activations.  A page evicted by
+ * reclaim leaves a shadow entry with the counter in its page cache slot.
+ * When the page is faulted back in, the difference between the counter
+ * and the shadow entry - the refault distance - is how many more slots
+ * the inactive list would have needed to keep the page resident.  If it
+ * is not bigger than the active list, the page would have stayed with
+ * the active list given over to the inactive one: it is part of the
+ * working set, and is activated directly to compete with the active
+ * pages instead of being evicted again.
+ *
+ * Shadow entries of pages that never come back stay in the radix tree.
+ * Leaf nodes holding only shadow entries are tracked here, and reclaimed
+ * by a shrinker when there are many more of them than the file LRU pages
+ * could meaningfully refault against.
+ */
+
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/pagemap.h>
+#include <linux/radix-tree.h>
+#include <linux/spinlock.h>
+#include <linux/swap.h>
+#include <linux/vmstat.h>
+
+/*
+ * A shadow entry is the eviction counter followed by the node and zone
+ * of the page, tagged as an exceptional radix tree entry.  The counter
+ * loses its top bits, so the refault distance is computed modulo them.
+ */
+#define EVICTION_SHIFT	(RADIX_TREE_EXCEPTIONAL_SHIFT + \
+			 ZONES_SHIFT + NODES_SHIFT)
+#define EVICTION_MASK	(~0UL >> EVICTION_SHIFT)
+
+static void *pack_shadow(unsigned long eviction, struct zone *zone)
+{
+	eviction = (eviction << NODES_SHIFT) | zone_to_nid(zone);
+	eviction = (eviction << ZONES_SHIFT) | zone_idx(zone);
+	eviction = (eviction << RADIX_TREE_EXCEPTIONAL_SHIFT);
+
+	return (void *)(eviction | RADIX_TREE_EXCEPTIONAL_ENTRY);
+}
+
+static void unpack_shadow(void *shadow, struct zone **zone,
+			  unsigned long *distance)
+{
+	unsigned long entry = (unsigned long)shadow;
+	unsigned long eviction;
+	unsigned long refault;
+	int zid, nid;
+
+	entry >>= RADIX_TREE_EXCEPTIONAL_SHIFT;
+	zid = entry & ((1UL << ZONES_SHIFT) - 1);
+	entry >>= ZONES_SHIFT;
+	nid = entry & ((1UL << NODES_SHIFT) - 1);
+	entry >>= NODES_SHIFT;
+	eviction = entry;
+
+	*zone = NODE_DATA(nid)->node_zones + zid;
+
+	refault = atomic_long_read(&(*zone)->inactive_age);
+	*distance = (refault - eviction) & EVICTION_MASK;
+}
+
+/**
+ * workingset_eviction - note the eviction of a page from memory
+ * @mapping: address space the page was backing
+ * @page: the page being evicted
+ *
+ * Returns a shadow entry to be stored in @mapping->page_tree in place
+ * of the evicted @page so that a later refault can be detected.  Called
+ * under the tree_lock.
+ */
+void *workingset_eviction(struct address_space *mapping, struct page *page)
+{
+	struct zone *zone = page_zone(page);
+	unsigned long eviction;
+
+	eviction = atomic_long_inc_return(&zone->inactive_age);
+	return pack_shadow(eviction, zone);
+}
+
+/**
+ * workingset_refault - evaluate the refault of a previously evicted page
+ * @shadow: shadow entry of the evicted page
+ *
+ * Returns %true if the page should be activated, %false otherwise.
+ */
+bool workingset_refault(void *shadow)
+{
+	unsigned long refault_distance;
+	struct zone *zone;
+
+	unpack_shadow(shadow, &zone, &refault_distance);
+	inc_zone_state(zone, WORKINGSET_REFAULT);
+
+	if (refault_distance <= zone_page_state(zone, NR_ACTIVE_FILE)) {
+		inc_zone_state(zone, WORKINGSET_ACTIVATE);
+		return true;
+	}
+	return false;
+}
+
+/**
+ * workingset_activation - note a page activation
+ * @page: page that is being activated
+ */
+void workingset_activation(struct page *page)
+{
+	atomic_long_inc(&page_zone(page)->inactive_age);
+}
+
+/*
+ * Leaf nodes of page cache radix trees that hold only shadow entries,
+ * oldest at the tail.  shadow_nodes_lock nests inside the tree_lock of
+ * the node's mapping, which is kept in node->private_data.
+ */
+static LIST_HEAD(shadow_nodes);
+static DEFINE_SPINLOCK(shadow_nodes_lock);
+static unsigned long nr_shadow_nodes;
+
+/**
+ * workingset_update_node - track a page cache radix tree node
+ * @mapping: the node's address space
+ * @node: leaf node whose entries changed
+ *
+ * Called under the tree_lock, with interrupts disabled, after the
+ * entries of @node changed: start or stop tracking it for reclaim
+ * depending on whether it now holds shadow entries only.
+ */
+void workingset_update_node(struct address_space *mapping,
+			    struct radix_tree_node *node)
+{
+	if (!node->count || node->count != node->exceptional) {
+		workingset_forget_node(node);
+		return;
+	}
+
+	if (list_empty(&node->private_list)) {
+		node->private_data = mapping;
+		spin_lock(&shadow_nodes_lock);
+		list_add(&node->private_list, &shadow_nodes);
+		nr_shadow_nodes++;
+		spin_unlock(&shadow_nodes_lock);
+	}
+}
+
+/**
+ * workingset_forget_node - stop tracking a page cache radix tree node
+ * @node: leaf node about to lose its shadow entries
+ *
+ * Called under the tree_lock, with interrupts disabled.
+ */
+void workingset_forget_node(struct radix_tree_node *node)
+{
+	if (!list_empty(&node->private_list)) {
+		spin_lock(&shadow_nodes_lock);
+		list_del_init(&node->private_list);
+		nr_shadow_nodes--;
+		spin_unlock(&shadow_nodes_lock);
+	}
+}
+
+/*
+ * Delete the shadow entries of an untracked node, which frees it.
+ * Called under the mapping's tree_lock.
+ */
+static void prune_shadow_node(struct address_space *mapping,
+			      struct radix_tree_node *node)
+{
+	DECLARE_BITMAP(shadows, RADIX_TREE_MAP_SIZE);
+	unsigned long index = node->index;
+	unsigned int i;
+
+	/* Pages were inserted behind our back: leave it alone. */
+	if (node->count != node->exceptional)
+		return;
+
+	/* The node goes away with its last entry: look at it first. */
+	bitmap_zero(shadows, RADIX_TREE_MAP_SIZE);
+	for (i = 0; i < RADIX_TREE_MAP_SIZE; i++) {
+		if (node->slots[i])
+			__set_bit(i, shadows);
+	}
+	__inc_zone_page_state(virt_to_page(node), WORKINGSET_NODERECLAIM);
+
+	for (i = 0; i < RADIX_TREE_MAP_SIZE; i++) {
+		if (!test_bit(i, shadows))
+			continue;
+		radix_tree_delete(&mapping->page_tree, index + i);
+		mapping->nrshadows--;
+	}
+}
+
+static int shrink_shadow_nodes(int nr_to_scan, gfp_t gfp_mask)
+{
+	unsigned long max_nodes;
+
+	spin_lock_irq(&shadow_nodes_lock);
+	while (nr_to_scan-- > 0 && !list_empty(&shadow_nodes)) {
+		struct address_space *mapping;
+		struct radix_tree_node *node;
+
+		node = list_entry(shadow_nodes.prev, struct radix_tree_node,
+				  private_list);
+		mapping = node->private_data;
+
+		/* We are taking the locks backwards: do not wait. */
+		if (!spin_trylock(&mapping->tree_lock)) {
+			list_move(&node->private_list, &shadow_nodes);
+			continue;
+		}
+		list_del_init(&node->private_list);
+		nr_shadow_nodes--;
+		spin_unlock(&shadow_nodes_lock);
+
+		prune_shadow_node(mapping, node);
+
+		spin_unlock_irq(&mapping->tree_lock);
+		spin_lock_irq(&shadow_nodes_lock);
+	}
+	spin_unlock_irq(&shadow_nodes_lock);
+
+	/*
+	 * A shadow entry is of use only while its refault distance can
+	 * be smaller than the active list, so there is no point in more
+	 * of them than file LRU pages.  Assume nodes 1/8th full on average.
+	 */
+	max_nodes = global_page_state(NR_ACTIVE_FILE) +
+		    global_page_state(NR_INACTIVE_FILE);
+	max_nodes >>= RADIX_TREE_MAP_SHIFT - 3;
+
+	if (nr_shadow_nodes <= max_nodes)
+		return 0;
+	return min_t(unsigned long, nr_shadow_nodes - max_nodes, INT_MAX);
+}
+
+static struct shrinker workingset_shadow_shrinker = {
+	.shrink = shrink_shadow_nodes,
+	.seeks = DEFAULT_SEEKS,
+};
+
+static int __init workingset_init(void)
+{
+	register_shrinker(&workingset_shadow_shrinker);
+	return 0;
+}
+module_init(workingset_init);
@@ -0,0 +1,339 @@
+/*
+ * net/core/bpf_jit_test.c	Socket filter JIT self test
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * Runs a set of socket filters, in the form tcpdump -dd emits them, over
+ * sample frames through sk_run_filter() and through the code generated
+ * by the BPF JIT.  Any result that differs is reported and makes the
+ * module load fail; otherwise the time per filter run of both is
+ * printed to the kernel log, e.g.
+ *	echo 1 > /proc/sys/net/core/bpf_jit_enable
+ *	modprobe bpf_jit_test iterations=1000000
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/filter.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/if_ether.h>
+#include <linux/if_arp.h>
+#include <linux/ip.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <net/net_namespace.h>
+
+static unsigned int iterations = 100000;
+module_param(iterations, uint, 0);
+MODULE_PARM_DESC(iterations, "Number of runs timed per filter and frame");
+
+struct jit_test_filter {
+	const char *name;
+	unsigned int len;
+	struct sock_filter insns[24];
+};
+
+#define SKF_AD(x)	(SKF_AD_OFF + SKF_AD_##x)
+
+static struct jit_test_filter tests[] = {
+	{
+		.name = "ip",
+		.len = 4,
+		.insns = {
+			{ 0x28, 0, 0, 0x0000000c },
+			{ 0x15, 0, 1, ETH_P_IP },
+			{ 0x06, 0, 0, 0x0000ffff },
+			{ 0x06, 0, 0, 0x00000000 },
+		},
+	}, {
+		.name = "arp",
+		.len = 4,
+		.insns = {
+			{ 0x28, 0, 0, 0x0000000c },
+			{ 0x15, 0, 1, ETH_P_ARP },
+			{ 0x06, 0, 0, 0x0000ffff },
+			{ 0x06, 0, 0, 0x00000000 },
+		},
+	}, {
+		/* tcp dst port 80 */
+		.name = "tcp port",
+		.len = 11,
+		.insns = {
+			{ 0x28, 0, 0, 0x0000000c },
+			{ 0x15, 0, 8, ETH_P_IP },
+			{ 0x30, 0, 0, 0x00000017 },
+			{ 0x15, 0, 6, IPPROTO_TCP },
+			{ 0x28, 0, 0, 0x00000014 },
+			{ 0x45, 4, 0, 0x00001fff },
+			{ 0xb1, 0, 0, 0x0000000e },
+			{ 0x48, 0, 0, 0x00000010 },
+			{ 0x15, 0, 1, 0x00000050 },
+			{ 0x06, 0, 0, 0x0000ffff },
+			{ 0x06, 0, 0, 0x00000000 },
+		},
+	}, {
+		/* udp port 53 */
+		.name = "udp port",
+		.len = 13,
+		.insns = {
+			{ 0x28, 0, 0, 0x0000000c },
+			{ 0x15, 0, 10, ETH_P_IP },
+			{ 0x30, 0, 0, 0x00000017 },
+			{ 0x15, 0, 8, IPPROTO_UDP },
+			{ 0x28, 0, 0, 0x00000014 },
+			{ 0x45, 6, 0, 0x00001fff },
+			{ 0xb1, 0, 0, 0x0000000e },
+			{ 0x48, 0, 0, 0x0000000e },
+			{ 0x15, 2, 0, 0x00000035 },
+			{ 0x48, 0, 0, 0x00000010 },
+			{ 0x15, 0, 1, 0x00000035 },
+			{ 0x06, 0, 0, 0x0000ffff },
+			{ 0x06, 0, 0, 0x00000000 },
+		},
+	}, {
+		/* the last word of the frame, from the paged part if any */
+		.name = "tail",
+		.len = 6,
+		.insns = {
+			{ 0x80, 0, 0, 0x00000000 },	/* A = len */
+			{ 0x14, 0, 0, 0x00000004 },	/* A -= 4 */
+			{ 0x07, 0, 0, 0x00000000 },	/* X = A */
+			{ 0x40, 0, 0, 0x00000000 },	/* A = P[X:4] */
+			{ 0x54, 0, 0, 0x7fffffff },	/* A &= 0x7fffffff */
+			{ 0x16, 0, 0, 0x00000000 },	/* ret A */
+		},
+	}, {
+		/* ancillary data and network header relative loads */
+		.name = "ancillary",
+		.len = 12,
+		.insns = {
+			{ 0x20, 0, 0, SKF_AD(PROTOCOL) },
+			{ 0x02, 0, 0, 0x00000000 },	/* mem[0] = A */
+			{ 0x20, 0, 0, SKF_AD(IFINDEX) },
+			{ 0x07, 0, 0, 0x00000000 },	/* X = A */
+			{ 0x20, 0, 0, SKF_AD(PKTTYPE) },
+			{ 0x0c, 0, 0, 0x00000000 },	/* A += X */
+			{ 0x61, 0, 0, 0x00000000 },	/* X = mem[0] */
+			{ 0x0c, 0, 0, 0x00000000 },	/* A += X */
+			{ 0x07, 0, 0, 0x00000000 },	/* X = A */
+			{ 0x30, 0, 0, SKF_NET_OFF + 9 },
+			{ 0x0c, 0, 0, 0x00000000 },	/* A += X */
+			{ 0x16, 0, 0, 0x00000000 },
+		},
+	}, {
+		/* arithmetic on the IPv4 total length, X is 0 for ARP */
+		.name = "alu",
+		.len = 12,
+		.insns = {
+			{ 0x28, 0, 0, 0x00000010 },
+			{ 0x24, 0, 0, 0x00000003 },	/* A *= 3 */
+			{ 0x34, 0, 0, 0x00000007 },	/* A /= 7 */
+			{ 0x64, 0, 0, 0x00000004 },	/* A <<= 4 */
+			{ 0xb1, 0, 0, 0x0000000e },	/* X = 4 * (P[14] & 0xf) */
+			{ 0x3c, 0, 0, 0x00000000 },	/* A /= X */
+			{ 0x74, 0, 0, 0x00000002 },	/* A >>= 2 */
+			{ 0x44, 0, 0, 0x00010000 },	/* A |= 0x10000 */
+			{ 0x84, 0, 0, 0x00000000 },	/* A = -A */
+			{ 0x25, 0, 1, 0xfffe0000 },	/* A > 0xfffe0000 ? */
+			{ 0x06, 0, 0, 0x00000001 },
+			{ 0x16, 0, 0, 0x00000000 },
+		},
+	},
+};
+
+#define FRAME_LEN	(ETH_HLEN + sizeof(struct iphdr) + sizeof(struct tcphdr) + 64)
+
+/*
+ * An Ethernet frame carrying ARP, or IPv4 with @proto.  With @paged the
+ * transport payload lives in a page fragment, as on most NIC rx paths.
+ */
+static struct sk_buff *jit_test_skb(struct net_device *dev, u16 type,
+				    u8 proto, int paged)
+{
+	unsigned int hlen = paged ? FRAME_LEN - 64 : FRAME_LEN;
+	struct sk_buff *skb;
+	struct ethhdr *eth;
+	struct iphdr *iph;
+	struct page *page;
+	u8 *data;
+
+	skb = alloc_skb(FRAME_LEN + NET_IP_ALIGN, GFP_KERNEL);
+	if (!skb)
+		return NULL;
+	skb_reserve(skb, NET_IP_ALIGN);
+	data = skb_put(skb, hlen);
+	memset(data, 0, hlen);
+	skb_reset_mac_header(skb);
+	skb_set_network_header(skb, ETH_HLEN);
+	skb->dev = dev;
+	skb->protocol = htons(type);
+	skb->pkt_type = PACKET_HOST;
+
+	eth = (struct ethhdr *)data;
+	eth->h_proto = htons(type);
+	if (type != ETH_P_IP)
+		goto out;
+
+	iph = (struct iphdr *)(data + ETH_HLEN);
+	iph->version = 4;
+	iph->ihl = 5;
+	iph->tot_len = htons(FRAME_LEN - ETH_HLEN);
+	iph->ttl = 64;
+	iph->protocol = proto;
+	if (proto == IPPROTO_TCP) {
+		struct tcphdr *th = (struct tcphdr *)(iph + 1);
+
+		th->source = htons(34567);
+		th->dest = htons(80);
+		th->doff = 5;
+	} else {
+		struct udphdr *uh = (struct udphdr *)(iph + 1);
+
+		uh->source = htons(53);
+		uh->dest = htons(34567);
+	}
+out:
+	if (paged) {
+		page = alloc_page(GFP_KERNEL);
+		if (!page) {
+			kfree_skb(skb);
+			return NULL;
+		}
+		memset(page_address(page), 0xa5, 64);
+		skb_fill_page_desc(skb, 0, page, 0, 64);
+		skb->len += 64;
+		skb->data_len += 64;
+		skb->truesize += PAGE_SIZE;
+	}
+	return skb;
+}
+
+static s64 jit_test_time(struct sk_filter *fp, struct sk_buff *skb, int jit)
+{
+	unsigned int i;
+	ktime_t start;
+
+	start = ktime_get();
+	for (i = 0; i < iterations; i++) {
+		if (jit)
+			fp->bpf_func(skb, fp->insns);
+		else
+			sk_run_filter(skb, fp->insns, fp->len);
+		if (!(i & 0xffff))
+			cond_resched();
+	}
+	return ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+static int jit_test_run(struct jit_test_filter *t, struct sk_buff **skbs,
+			int nr_skbs)
+{
+	unsigned int fsize = sizeof(struct sock_filter) * t->len;
+	unsigned int interp, native;
+	struct sk_filter *fp;
+	s64 ns_interp = 0, ns_jit = 0;
+	int i, err;
+
+	fp = kmalloc(sizeof(*fp) + fsize, GFP_KERNEL);
+	if (!fp)
+		return -ENOMEM;
+	memcpy(fp->insns, t->insns, fsize);
+	atomic_set(&fp->refcnt, 1);
+	fp->len = t->len;
+	fp->bpf_func = NULL;
+
+	err = sk_chk_filter(fp->insns, fp->len);
+	if (err) {
+		printk(KERN_ERR "bpf_jit_test: %s: rejected by sk_chk_filter\n",
+		       t->name);
+		goto out;
+	}
+	bpf_jit_compile(fp);
+	if (!fp->bpf_func) {
+		printk(KERN_ERR "bpf_jit_test: %s: not compiled\n", t->name);
+		err = -EINVAL;
+		goto out;
+	}
+
+	for (i = 0; i < nr_skbs; i++) {
+		interp = sk_run_filter(skbs[i], fp->insns, fp->len);
+		native = fp->bpf_func(skbs[i], fp->insns);
+		if (interp != native) {
+			printk(KERN_ERR "bpf_jit_test: %s: frame %d: "
+			       "sk_run_filter %#x, jit %#x\n",
+			       t->name, i, interp, native);
+			err = -EINVAL;
+		}
+		ns_interp += jit_test_time(fp, skbs[i], 0);
+		ns_jit += jit_test_time(fp, skbs[i], 1);
+	}
+	if (!err)
+		printk(KERN_INFO "bpf_jit_test: %-10s interpreter %llu ns, "
+		       "jit %llu ns\n", t->name,
+		       (unsigned long long)div_s64(ns_interp,
+						   iterations * nr_skbs),
+		       (unsigned long long)div_s64(ns_jit,
+						   iterations * nr_skbs));
+out:
+	bpf_jit_free(fp);
+	kfree(fp);
+	return err;
+}
+
+static int __init bpf_jit_test_init(void)
+{
+	struct net_device *dev = init_net.loopback_dev;
+	struct sk_buff *skbs[6];
+	int i, err = 0, nr_skbs = 0;
+
+	if (!bpf_jit_enable) {
+		printk(KERN_ERR "bpf_jit_test: "
+		       "/proc/sys/net/core/bpf_jit_enable is 0\n");
+		return -EINVAL;
+	}
+	if (!iterations)
+		return -EINVAL;
+
+	skbs[nr_skbs++] = jit_test_skb(dev, ETH_P_IP, IPPROTO_TCP, 0);
+	skbs[nr_skbs++] = jit_test_skb(dev, ETH_P_IP, IPPROTO_TCP, 1);
+	skbs[nr_skbs++] = jit_test_skb(dev, ETH_P_IP, IPPROTO_UDP, 0);
+	skbs[nr_skbs++] = jit_test_skb(dev, ETH_P_IP, IPPROTO_UDP, 1);
+	skbs[nr_skbs++] = jit_test_skb(dev, ETH_P_ARP, 0, 0);
+	skbs[nr_skbs++] = jit_test_skb(dev, ETH_P_ARP, 0, 1);
+	for (i = 0; i < nr_skbs; i++) {
+		if (!skbs[i]) {
+			err = -ENOMEM;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < ARRAY_SIZE(tests); i++) {
+		int ret = jit_test_run(&tests[i], skbs, nr_skbs);
+
+		if (ret)
+			err = ret;
+	}
+out:
+	for (i = 0; i < nr_skbs; i++)
+		kfree_skb(skbs[i]);
+	/* the images are freed from a work item */
+	flush_scheduled_work();
+	return err;
+}
+
+static void __exit bpf_jit_test_exit(void)
+{
+}
+
+module_init(bpf_jit_test_init);
+module_exit(bpf_jit_test_exit);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Socket filter JIT self test");
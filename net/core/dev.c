@@ -127,6 +127,7 @@
 #include <linux/jhash.h>
 #include <linux/random.h>
 #include <trace/events/napi.h>
+#include <net/busy_poll.h>
 
 #include "net-sysfs.h"
 
@@ -1770,7 +1771,7 @@ gso:
 			return rc;
 		}
 		txq_trans_update(txq);
-		if (unlikely(netif_tx_queue_stopped(txq) && skb->next))
+		if (unlikely(netif_xmit_stopped(txq) && skb->next))
 			return NETDEV_TX_BUSY;
 	} while (skb->next);
 
@@ -1950,7 +1951,7 @@ gso:
 
 			HARD_TX_LOCK(dev, txq, cpu);
 
-			if (!netif_tx_queue_stopped(txq)) {
+			if (!netif_xmit_stopped(txq)) {
 				rc = NET_XMIT_SUCCESS;
 				if (!dev_hard_start_xmit(skb, dev, txq)) {
 					HARD_TX_UNLOCK(dev, txq);
@@ -2466,6 +2467,8 @@ int dev_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 	int mac_len;
 	int ret;
 
+	skb_mark_napi_id(skb, napi);
+
 	if (!(skb->dev->features & NETIF_F_GRO))
 		goto normal;
 
@@ -2765,7 +2768,8 @@ void __napi_complete(struct napi_struct *n)
 	BUG_ON(!test_bit(NAPI_STATE_SCHED, &n->state));
 	BUG_ON(n->gro_list);
 
-	list_del(&n->poll_list);
+	/* A busy polled context was never put on a poll list */
+	list_del_init(&n->poll_list);
 	smp_mb__before_clear_bit();
 	clear_bit(NAPI_STATE_SCHED, &n->state);
 }
@@ -2777,9 +2781,11 @@ void napi_complete(struct napi_struct *n)
 
 	/*
 	 * don't let napi dequeue from the cpu poll list
-	 * just in case its running on a different cpu
+	 * just in case its running on a different cpu,
+	 * and keep a socket busy polling it in charge
 	 */
-	if (unlikely(test_bit(NAPI_STATE_NPSVC, &n->state)))
+	if (unlikely(test_bit(NAPI_STATE_NPSVC, &n->state) ||
+		     test_bit(NAPI_STATE_IN_BUSY_POLL, &n->state)))
 		return;
 
 	napi_gro_flush(n);
@@ -2789,6 +2795,173 @@ void napi_complete(struct napi_struct *n)
 }
 EXPORT_SYMBOL(napi_complete);
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/*
+ * Every napi context gets a non zero id that receive paths stamp into
+ * skbs and sockets remember, so a busy polling reader can find the
+ * context again without holding a reference to it.
+ */
+#define NAPI_HASH_BITS	8
+
+static DEFINE_SPINLOCK(napi_hash_lock);
+static unsigned int napi_gen_id;
+static struct hlist_head napi_hash[1 << NAPI_HASH_BITS];
+
+/* must be called under rcu_read_lock(), as we dont take a reference */
+static struct napi_struct *napi_by_id(unsigned int napi_id)
+{
+	unsigned int hash = napi_id & ((1 << NAPI_HASH_BITS) - 1);
+	struct napi_struct *napi;
+	struct hlist_node *node;
+
+	hlist_for_each_entry_rcu(napi, node, &napi_hash[hash], napi_hash_node)
+		if (napi->napi_id == napi_id)
+			return napi;
+
+	return NULL;
+}
+
+static void napi_hash_add(struct napi_struct *napi)
+{
+	spin_lock(&napi_hash_lock);
+
+	/* 0 is reserved for "not a napi context", skip ids in use */
+	do {
+		if (unlikely(++napi_gen_id == 0))
+			napi_gen_id = 1;
+	} while (napi_by_id(napi_gen_id));
+	napi->napi_id = napi_gen_id;
+
+	hlist_add_head_rcu(&napi->napi_hash_node,
+			   &napi_hash[napi->napi_id & ((1 << NAPI_HASH_BITS) - 1)]);
+
+	spin_unlock(&napi_hash_lock);
+}
+
+static void napi_hash_del(struct napi_struct *napi)
+{
+	spin_lock(&napi_hash_lock);
+	hlist_del_init_rcu(&napi->napi_hash_node);
+	spin_unlock(&napi_hash_lock);
+}
+
+static void busy_poll_stop(struct napi_struct *napi, void *have_poll_lock)
+{
+	int rc;
+
+	clear_bit(NAPI_STATE_IN_BUSY_POLL, &napi->state);
+
+	local_bh_disable();
+
+	/* Poll once more so that the driver completes the context the
+	 * usual way and turns its interrupts back on.
+	 */
+	rc = napi->poll(napi, BUSY_POLL_BUDGET);
+	netpoll_poll_unlock(have_poll_lock);
+	if (rc == BUSY_POLL_BUDGET) {
+		napi_gro_flush(napi);
+		__napi_schedule(napi);
+	}
+	local_bh_enable();
+}
+
+/**
+ * napi_busy_loop - poll a napi context from process context
+ * @napi_id: id of the context to poll
+ * @loop_end: returns true once the caller has what it is waiting for,
+ *	or its time is up; %NULL to poll once
+ * @loop_end_arg: argument for @loop_end
+ *
+ * Takes ownership of the context the way the softirq does, by setting
+ * %NAPI_STATE_SCHED, and calls its ->poll() routine until @loop_end says
+ * stop.  Returns the number of packets the driver processed.
+ */
+int napi_busy_loop(unsigned int napi_id,
+		   bool (*loop_end)(void *, unsigned long),
+		   void *loop_end_arg)
+{
+	unsigned long start_time = loop_end ? busy_loop_current_time() : 0;
+	int (*napi_poll)(struct napi_struct *napi, int budget);
+	void *have_poll_lock = NULL;
+	struct napi_struct *napi;
+	int packets = 0;
+
+restart:
+	napi_poll = NULL;
+
+	rcu_read_lock();
+
+	napi = napi_by_id(napi_id);
+	if (!napi)
+		goto out;
+
+	preempt_disable();
+	for (;;) {
+		int work = 0;
+
+		local_bh_disable();
+		if (!napi_poll) {
+			unsigned long val = ACCESS_ONCE(napi->state);
+
+			/* If multiple threads are competing for this napi,
+			 * we avoid dirtying napi->state as much as we can.
+			 */
+			if (val & ((1UL << NAPI_STATE_DISABLE) |
+				   (1UL << NAPI_STATE_SCHED) |
+				   (1UL << NAPI_STATE_IN_BUSY_POLL)))
+				goto count;
+			if (cmpxchg(&napi->state, val,
+				    val | (1UL << NAPI_STATE_IN_BUSY_POLL) |
+					  (1UL << NAPI_STATE_SCHED)) != val)
+				goto count;
+			have_poll_lock = netpoll_poll_lock(napi);
+			napi_poll = napi->poll;
+		}
+		work = napi_poll(napi, BUSY_POLL_BUDGET);
+		trace_napi_poll(napi);
+		/* Do not let GRO hold back what the reader is waiting for */
+		napi_gro_flush(napi);
+count:
+		if (work > 0) {
+			NET_ADD_STATS_BH(dev_net(napi->dev),
+					 LINUX_MIB_BUSYPOLLRXPACKETS, work);
+			packets += work;
+		}
+		local_bh_enable();
+
+		if (!loop_end || loop_end(loop_end_arg, start_time))
+			break;
+
+		if (unlikely(need_resched())) {
+			if (napi_poll)
+				busy_poll_stop(napi, have_poll_lock);
+			preempt_enable();
+			rcu_read_unlock();
+			cond_resched();
+			if (loop_end(loop_end_arg, start_time))
+				return packets;
+			goto restart;
+		}
+		cpu_relax();
+	}
+	if (napi_poll)
+		busy_poll_stop(napi, have_poll_lock);
+	preempt_enable();
+out:
+	rcu_read_unlock();
+	return packets;
+}
+EXPORT_SYMBOL(napi_busy_loop);
+#else
+static inline void napi_hash_add(struct napi_struct *napi)
+{
+}
+
+static inline void napi_hash_del(struct napi_struct *napi)
+{
+}
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+
 void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
 		    int (*poll)(struct napi_struct *, int), int weight)
 {
@@ -2805,6 +2978,7 @@ void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
 	napi->poll_owner = -1;
 #endif
 	set_bit(NAPI_STATE_SCHED, &napi->state);
+	napi_hash_add(napi);
 }
 EXPORT_SYMBOL(netif_napi_add);
 
@@ -2813,6 +2987,7 @@ void netif_napi_del(struct napi_struct *napi)
 	struct sk_buff *skb, *next;
 
 	list_del_init(&napi->dev_list);
+	napi_hash_del(napi);
 	napi_free_frags(napi);
 
 	for (skb = napi->gro_list; skb; skb = next) {
@@ -2823,6 +2998,11 @@ void netif_napi_del(struct napi_struct *napi)
 
 	napi->gro_list = NULL;
 	napi->gro_count = 0;
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	/* busy pollers may still be looking at it */
+	synchronize_net();
+#endif
 }
 EXPORT_SYMBOL(netif_napi_del);
 
@@ -5127,6 +5307,9 @@ static void netdev_init_one_queue(struct net_device *dev,
 				  void *_unused)
 {
 	queue->dev = dev;
+#ifdef CONFIG_BQL
+	dql_init(&queue->dql, HZ);
+#endif
 }
 
 static void netdev_init_queues(struct net_device *dev)
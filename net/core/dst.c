@@ -248,6 +248,11 @@ again:
 	if (dst) {
 		int nohash = dst->flags & DST_NOHASH;
 
+		if (dst->flags & DST_NOCACHE) {
+			/* Never hashed, the last reference frees it */
+			dst_release(dst);
+			return NULL;
+		}
 		if (atomic_dec_and_test(&dst->__refcnt)) {
 			/* We were real parent of this dst, so kill child. */
 			if (nohash)
@@ -262,6 +267,15 @@ again:
 	return NULL;
 }
 
+static void dst_destroy_rcu(struct rcu_head *head)
+{
+	struct dst_entry *dst = container_of(head, struct dst_entry, rcu_head);
+
+	dst = dst_destroy(dst);
+	if (dst)
+		__dst_free(dst);
+}
+
 void dst_release(struct dst_entry *dst)
 {
 	if (dst) {
@@ -270,6 +284,10 @@ void dst_release(struct dst_entry *dst)
 		smp_mb__before_atomic_dec();
                newrefcnt = atomic_dec_return(&dst->__refcnt);
                WARN_ON(newrefcnt < 0);
+		/* Entries nobody can look up any more are not put on the
+		 * garbage list, they go away with their last reference. */
+		if (!newrefcnt && unlikely(dst->flags & DST_NOCACHE))
+			call_rcu_bh(&dst->rcu_head, dst_destroy_rcu);
 	}
 }
 EXPORT_SYMBOL(dst_release);
@@ -282,8 +300,7 @@ EXPORT_SYMBOL(dst_release);
  *
  * Commented and originally written by Alexey.
  */
-static inline void dst_ifdown(struct dst_entry *dst, struct net_device *dev,
-			      int unregister)
+void dst_ifdown(struct dst_entry *dst, struct net_device *dev, int unregister)
 {
 	if (dst->ops->ifdown)
 		dst->ops->ifdown(dst, dev, unregister);
@@ -349,3 +366,4 @@ void __init dst_init(void)
 EXPORT_SYMBOL(__dst_free);
 EXPORT_SYMBOL(dst_alloc);
 EXPORT_SYMBOL(dst_destroy);
+EXPORT_SYMBOL(dst_ifdown);
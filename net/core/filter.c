@@ -64,6 +64,65 @@ static inline void *load_pointer(struct sk_buff *skb, int k,
 	}
 }
 
+/*
+ * Handle ancillary data, which are impossible
+ * (or very difficult) to get parsing packet contents.
+ * Returns 0 with the value in *res, or -EINVAL if the
+ * filter must return 0.
+ */
+static int load_ancillary(const struct sk_buff *skb, int k, u32 A, u32 X,
+			  u32 *res)
+{
+	switch (k-SKF_AD_OFF) {
+	case SKF_AD_PROTOCOL:
+		*res = ntohs(skb->protocol);
+		return 0;
+	case SKF_AD_PKTTYPE:
+		*res = skb->pkt_type;
+		return 0;
+	case SKF_AD_IFINDEX:
+		*res = skb->dev->ifindex;
+		return 0;
+	case SKF_AD_NLATTR: {
+		struct nlattr *nla;
+
+		if (skb_is_nonlinear(skb))
+			return -EINVAL;
+		if (A > skb->len - sizeof(struct nlattr))
+			return -EINVAL;
+
+		nla = nla_find((struct nlattr *)&skb->data[A],
+			       skb->len - A, X);
+		if (nla)
+			*res = (void *)nla - (void *)skb->data;
+		else
+			*res = 0;
+		return 0;
+	}
+	case SKF_AD_NLATTR_NEST: {
+		struct nlattr *nla;
+
+		if (skb_is_nonlinear(skb))
+			return -EINVAL;
+		if (A > skb->len - sizeof(struct nlattr))
+			return -EINVAL;
+
+		nla = (struct nlattr *)&skb->data[A];
+		if (nla->nla_len > A - skb->len)
+			return -EINVAL;
+
+		nla = nla_find_nested(nla, X);
+		if (nla)
+			*res = (void *)nla - (void *)skb->data;
+		else
+			*res = 0;
+		return 0;
+	}
+	default:
+		return -EINVAL;
+	}
+}
+
 /**
  *	sk_filter - run a packet through a socket filter
  *	@sk: sock associated with &sk_buff
@@ -88,8 +147,7 @@ int sk_filter(struct sock *sk, struct sk_buff *skb)
 	rcu_read_lock_bh();
 	filter = rcu_dereference(sk->sk_filter);
 	if (filter) {
-		unsigned int pkt_len = sk_run_filter(skb, filter->insns,
-				filter->len);
+		unsigned int pkt_len = SK_RUN_FILTER(filter, skb);
 		err = pkt_len ? pskb_trim(skb, pkt_len) : -EPERM;
 	}
 	rcu_read_unlock_bh();
@@ -297,63 +355,53 @@ load_b:
 			return 0;
 		}
 
-		/*
-		 * Handle ancillary data, which are impossible
-		 * (or very difficult) to get parsing packet contents.
-		 */
-		switch (k-SKF_AD_OFF) {
-		case SKF_AD_PROTOCOL:
-			A = ntohs(skb->protocol);
-			continue;
-		case SKF_AD_PKTTYPE:
-			A = skb->pkt_type;
-			continue;
-		case SKF_AD_IFINDEX:
-			A = skb->dev->ifindex;
-			continue;
-		case SKF_AD_NLATTR: {
-			struct nlattr *nla;
-
-			if (skb_is_nonlinear(skb))
-				return 0;
-			if (A > skb->len - sizeof(struct nlattr))
-				return 0;
-
-			nla = nla_find((struct nlattr *)&skb->data[A],
-				       skb->len - A, X);
-			if (nla)
-				A = (void *)nla - (void *)skb->data;
-			else
-				A = 0;
-			continue;
-		}
-		case SKF_AD_NLATTR_NEST: {
-			struct nlattr *nla;
+		if (load_ancillary(skb, k, A, X, &A))
+			return 0;
+	}
 
-			if (skb_is_nonlinear(skb))
-				return 0;
-			if (A > skb->len - sizeof(struct nlattr))
-				return 0;
+	return 0;
+}
+EXPORT_SYMBOL(sk_run_filter);
 
-			nla = (struct nlattr *)&skb->data[A];
-			if (nla->nla_len > A - skb->len)
-				return 0;
+#ifdef CONFIG_BPF_JIT
+/**
+ *	bpf_jit_load_slow - packet load slow path of JIT compiled filters
+ *	@skb: buffer the filter runs on
+ *	@k: offset of the load, may be negative
+ *	@size: 1, 2 or 4 bytes
+ *	@regs: A and X of the filter in regs[0] and regs[1]; the loaded
+ *	value is stored in regs[2]
+ *
+ * JIT compilers read the linear head of the skb inline and call this
+ * for everything else: paged data, SKF_NET_OFF/SKF_LL_OFF offsets and
+ * ancillary data, with the same semantics as sk_run_filter().  Returns
+ * 1 on success, or 0 when the filter must return 0.
+ */
+int bpf_jit_load_slow(const struct sk_buff *skb, int k, unsigned int size,
+		      u32 *regs)
+{
+	void *ptr;
+	u32 tmp;
 
-			nla = nla_find_nested(nla, X);
-			if (nla)
-				A = (void *)nla - (void *)skb->data;
-			else
-				A = 0;
-			continue;
-		}
+	ptr = load_pointer((struct sk_buff *)skb, k, size, &tmp);
+	if (ptr != NULL) {
+		switch (size) {
+		case 4:
+			regs[2] = get_unaligned_be32(ptr);
+			break;
+		case 2:
+			regs[2] = get_unaligned_be16(ptr);
+			break;
 		default:
-			return 0;
+			regs[2] = *(u8 *)ptr;
+			break;
 		}
+		return 1;
 	}
 
-	return 0;
+	return load_ancillary(skb, k, regs[0], regs[1], &regs[2]) == 0;
 }
-EXPORT_SYMBOL(sk_run_filter);
+#endif /* CONFIG_BPF_JIT */
 
 /**
  *	sk_chk_filter - verify socket filter code
@@ -515,6 +563,7 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 
 	atomic_set(&fp->refcnt, 1);
 	fp->len = fprog->len;
+	fp->bpf_func = NULL;
 
 	err = sk_chk_filter(fp->insns, fp->len);
 	if (err) {
@@ -522,6 +571,8 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 		return err;
 	}
 
+	bpf_jit_compile(fp);
+
 	rcu_read_lock_bh();
 	old_fp = rcu_dereference(sk->sk_filter);
 	rcu_assign_pointer(sk->sk_filter, fp);
@@ -12,6 +12,7 @@
  */
 
 #include <linux/module.h>
+#include <linux/netdevice.h>
 #include <linux/random.h>
 #include <linux/slab.h>
 #include <linux/string.h>
@@ -34,33 +35,132 @@
  */
 int sysctl_max_syn_backlog = 256;
 
+/*
+ * The SYN queue hash table starts small and is doubled whenever it holds
+ * more requests than buckets, up to the size the SYN backlog limit calls
+ * for.  Listeners with a large backlog then no longer pay for a table
+ * sized for a SYN flood up front, and sysctl_max_syn_backlog can be set
+ * high without wasting memory on every listening socket.
+ */
+#define SYNQ_MIN_TABLE_ENTRIES	16
+
+static struct request_sock **reqsk_table_alloc(u32 nr_table_entries)
+{
+	size_t size = nr_table_entries * sizeof(struct request_sock *);
+
+	if (size > PAGE_SIZE)
+		return __vmalloc(size, GFP_KERNEL | __GFP_HIGHMEM | __GFP_ZERO,
+				 PAGE_KERNEL);
+	return kzalloc(size, GFP_KERNEL);
+}
+
+static void reqsk_table_free(struct request_sock **table,
+			     u32 nr_table_entries)
+{
+	if (nr_table_entries * sizeof(struct request_sock *) > PAGE_SIZE)
+		vfree(table);
+	else
+		kfree(table);
+}
+
+static void reqsk_queue_grow(struct work_struct *work)
+{
+	struct listen_sock *lopt = container_of(work, struct listen_sock,
+						grow_work);
+	struct request_sock_queue *queue = lopt->queue;
+	struct request_sock **table, **old, *req;
+	u32 i, nr, old_nr;
+
+	old_nr = lopt->nr_table_entries;
+	nr = old_nr * 2;
+	if (nr > lopt->max_table_entries)
+		return;
+
+	table = reqsk_table_alloc(nr);
+	if (table == NULL)
+		return;
+
+	/*
+	 * The work may run again on another cpu while we sleep in the
+	 * allocation: whoever gets here second finds the table resized.
+	 */
+	write_lock_bh(&queue->syn_wait_lock);
+	if (queue->listen_opt != lopt || lopt->nr_table_entries != old_nr) {
+		write_unlock_bh(&queue->syn_wait_lock);
+		reqsk_table_free(table, nr);
+		return;
+	}
+
+	for (i = 0; i < old_nr; i++) {
+		while ((req = lopt->syn_table[i]) != NULL) {
+			lopt->syn_table[i] = req->dl_next;
+			req->dl_next = table[req->hash & (nr - 1)];
+			table[req->hash & (nr - 1)] = req;
+		}
+	}
+	old = lopt->syn_table;
+	lopt->syn_table = table;
+	lopt->nr_table_entries = nr;
+	write_unlock_bh(&queue->syn_wait_lock);
+
+	reqsk_table_free(old, old_nr);
+}
+
+static void reqsk_listen_free(struct listen_sock *lopt)
+{
+	reqsk_table_free(lopt->syn_table, lopt->nr_table_entries);
+	kfree(lopt->syn_locks);
+	kfree(lopt);
+}
+
 int reqsk_queue_alloc(struct request_sock_queue *queue,
 		      unsigned int nr_table_entries)
 {
-	size_t lopt_size = sizeof(struct listen_sock);
 	struct listen_sock *lopt;
+	u32 i, nr_locks;
 
 	nr_table_entries = min_t(u32, nr_table_entries, sysctl_max_syn_backlog);
 	nr_table_entries = max_t(u32, nr_table_entries, 8);
 	nr_table_entries = roundup_pow_of_two(nr_table_entries + 1);
-	lopt_size += nr_table_entries * sizeof(struct request_sock *);
-	if (lopt_size > PAGE_SIZE)
-		lopt = __vmalloc(lopt_size,
-			GFP_KERNEL | __GFP_HIGHMEM | __GFP_ZERO,
-			PAGE_KERNEL);
-	else
-		lopt = kzalloc(lopt_size, GFP_KERNEL);
+
+	/* The bucket of a request is picked by the low bits of its hash, so
+	 * using no more locks than the smallest table has buckets keeps the
+	 * lock of a request the same when the table grows.
+	 */
+	nr_locks = roundup_pow_of_two(num_possible_cpus() * 2);
+	nr_locks = min_t(u32, nr_locks, nr_table_entries);
+
+	lopt = kzalloc(sizeof(*lopt), GFP_KERNEL);
 	if (lopt == NULL)
 		return -ENOMEM;
 
+	lopt->max_table_entries = nr_table_entries;
+	lopt->nr_table_entries = min_t(u32, nr_table_entries,
+				       max_t(u32, nr_locks,
+					     SYNQ_MIN_TABLE_ENTRIES));
+	lopt->syn_table = reqsk_table_alloc(lopt->nr_table_entries);
+	lopt->syn_locks = kmalloc(nr_locks * sizeof(spinlock_t), GFP_KERNEL);
+	if (lopt->syn_table == NULL || lopt->syn_locks == NULL) {
+		if (lopt->syn_table != NULL)
+			reqsk_table_free(lopt->syn_table,
+					 lopt->nr_table_entries);
+		kfree(lopt->syn_locks);
+		kfree(lopt);
+		return -ENOMEM;
+	}
+	for (i = 0; i < nr_locks; i++)
+		spin_lock_init(&lopt->syn_locks[i]);
+	lopt->lock_mask = nr_locks - 1;
+
 	for (lopt->max_qlen_log = 3;
 	     (1 << lopt->max_qlen_log) < nr_table_entries;
 	     lopt->max_qlen_log++);
 
 	get_random_bytes(&lopt->hash_rnd, sizeof(lopt->hash_rnd));
+	lopt->queue = queue;
+	INIT_WORK(&lopt->grow_work, reqsk_queue_grow);
 	rwlock_init(&queue->syn_wait_lock);
 	queue->rskq_accept_head = NULL;
-	lopt->nr_table_entries = nr_table_entries;
 
 	write_lock_bh(&queue->syn_wait_lock);
 	queue->listen_opt = lopt;
@@ -71,22 +171,11 @@ int reqsk_queue_alloc(struct request_sock_queue *queue,
 
 void __reqsk_queue_destroy(struct request_sock_queue *queue)
 {
-	struct listen_sock *lopt;
-	size_t lopt_size;
-
 	/*
 	 * this is an error recovery path only
 	 * no locking needed and the lopt is not NULL
 	 */
-
-	lopt = queue->listen_opt;
-	lopt_size = sizeof(struct listen_sock) +
-		lopt->nr_table_entries * sizeof(struct request_sock *);
-
-	if (lopt_size > PAGE_SIZE)
-		vfree(lopt);
-	else
-		kfree(lopt);
+	reqsk_listen_free(queue->listen_opt);
 }
 
 static inline struct listen_sock *reqsk_queue_yank_listen_sk(
@@ -104,12 +193,22 @@ static inline struct listen_sock *reqsk_queue_yank_listen_sk(
 
 void reqsk_queue_destroy(struct request_sock_queue *queue)
 {
+	struct listen_sock *lopt;
+
+	/*
+	 * SYNs are processed without the listener lock, under RCU, and only
+	 * while the socket is in LISTEN state, which the caller left: wait
+	 * for those still in flight before listen_opt goes away.
+	 */
+	synchronize_net();
+
 	/* make all the listen_opt local to us */
-	struct listen_sock *lopt = reqsk_queue_yank_listen_sk(queue);
-	size_t lopt_size = sizeof(struct listen_sock) +
-		lopt->nr_table_entries * sizeof(struct request_sock *);
+	lopt = reqsk_queue_yank_listen_sk(queue);
+
+	/* nobody can find lopt anymore, wait for a resize in progress */
+	cancel_work_sync(&lopt->grow_work);
 
-	if (lopt->qlen != 0) {
+	if (atomic_read(&lopt->qlen) != 0) {
 		unsigned int i;
 
 		for (i = 0; i < lopt->nr_table_entries; i++) {
@@ -117,16 +216,12 @@ void reqsk_queue_destroy(struct request_sock_queue *queue)
 
 			while ((req = lopt->syn_table[i]) != NULL) {
 				lopt->syn_table[i] = req->dl_next;
-				lopt->qlen--;
+				atomic_dec(&lopt->qlen);
 				reqsk_free(req);
 			}
 		}
 	}
 
-	WARN_ON(lopt->qlen != 0);
-	if (lopt_size > PAGE_SIZE)
-		vfree(lopt);
-	else
-		kfree(lopt);
+	WARN_ON(atomic_read(&lopt->qlen) != 0);
+	reqsk_listen_free(lopt);
 }
-
@@ -0,0 +1,147 @@
+/*
+ * net/core/skb_alloc_bench.c	Receive buffer allocation benchmark
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * Compares skbs whose head comes from the per-cpu page fragment cache
+ * (netdev_alloc_skb) with skbs whose head is kmalloc()ed (alloc_skb).
+ *
+ * Two patterns are timed for each allocator:
+ *  - ring: allocate a batch of buffers the way a driver refills its rx
+ *    ring, then free them all;
+ *  - lo:   allocate a frame and push it through netif_receive_skb() on
+ *    the loopback device, where it is dropped as an unknown protocol.
+ *
+ * Results are printed to the kernel log on module load, e.g.
+ *	modprobe skb_alloc_bench iterations=1000000 size=1500
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+#include <linux/netdevice.h>
+#include <linux/etherdevice.h>
+#include <linux/skbuff.h>
+#include <net/net_namespace.h>
+
+static unsigned int iterations = 100000;
+module_param(iterations, uint, 0);
+MODULE_PARM_DESC(iterations, "Number of buffers allocated per test");
+
+static unsigned int size = 1500;
+module_param(size, uint, 0);
+MODULE_PARM_DESC(size, "Buffer size in bytes");
+
+#define RING_BATCH	64
+
+static struct sk_buff *bench_alloc(struct net_device *dev, int frag)
+{
+	struct sk_buff *skb;
+
+	if (frag)
+		return __netdev_alloc_skb(dev, size, GFP_ATOMIC);
+
+	skb = alloc_skb(size + NET_SKB_PAD, GFP_ATOMIC);
+	if (skb) {
+		skb_reserve(skb, NET_SKB_PAD);
+		skb->dev = dev;
+	}
+	return skb;
+}
+
+static s64 bench_ring(struct net_device *dev, int frag)
+{
+	struct sk_buff *ring[RING_BATCH];
+	unsigned int done = 0;
+	ktime_t start;
+	int i, n;
+
+	start = ktime_get();
+	while (done < iterations) {
+		local_bh_disable();
+		for (n = 0; n < RING_BATCH; n++) {
+			ring[n] = bench_alloc(dev, frag);
+			if (!ring[n])
+				break;
+		}
+		for (i = 0; i < n; i++)
+			kfree_skb(ring[i]);
+		local_bh_enable();
+
+		if (!n)
+			return -ENOMEM;
+		done += n;
+		cond_resched();
+	}
+	return ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+static s64 bench_lo(struct net_device *dev, int frag)
+{
+	struct sk_buff *skb;
+	struct ethhdr *eth;
+	unsigned int done;
+	ktime_t start;
+
+	start = ktime_get();
+	for (done = 0; done < iterations; done++) {
+		local_bh_disable();
+		skb = bench_alloc(dev, frag);
+		if (!skb) {
+			local_bh_enable();
+			return -ENOMEM;
+		}
+		eth = (struct ethhdr *)skb_put(skb, size);
+		memset(eth, 0, ETH_HLEN);
+		eth->h_proto = htons(ETH_P_LOOP);
+		skb->protocol = eth_type_trans(skb, dev);
+		netif_receive_skb(skb);
+		local_bh_enable();
+
+		if (!(done & 1023))
+			cond_resched();
+	}
+	return ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+static void bench_report(const char *name, s64 ns)
+{
+	if (ns < 0)
+		printk(KERN_INFO "skb_alloc_bench: %-12s failed (%lld)\n",
+		       name, ns);
+	else
+		printk(KERN_INFO "skb_alloc_bench: %-12s %llu ns/skb\n",
+		       name, (unsigned long long)div_s64(ns, iterations));
+}
+
+static int __init skb_alloc_bench_init(void)
+{
+	struct net_device *dev = init_net.loopback_dev;
+
+	if (!iterations || size < ETH_HLEN)
+		return -EINVAL;
+
+	printk(KERN_INFO "skb_alloc_bench: %u buffers of %u bytes\n",
+	       iterations, size);
+
+	bench_report("ring/frag", bench_ring(dev, 1));
+	bench_report("ring/kmalloc", bench_ring(dev, 0));
+	bench_report("lo/frag", bench_lo(dev, 1));
+	bench_report("lo/kmalloc", bench_lo(dev, 0));
+
+	return 0;
+}
+
+static void __exit skb_alloc_bench_exit(void)
+{
+}
+
+module_init(skb_alloc_bench_init);
+module_exit(skb_alloc_bench_exit);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Receive buffer allocation benchmark");
@@ -240,6 +240,146 @@ nodata:
 }
 EXPORT_SYMBOL(__alloc_skb);
 
+/**
+ *	build_skb - build a network buffer around already allocated data
+ *	@data: data buffer provided by caller
+ *	@frag_size: size of the page fragment holding @data, or 0 if
+ *		@data was obtained with kmalloc()
+ *
+ *	Allocate a new &sk_buff whose head is @data instead of a freshly
+ *	allocated buffer.  The end of @data is used for the shared info,
+ *	so the caller must have reserved SKB_DATA_ALIGN(sizeof(struct
+ *	skb_shared_info)) bytes there.  The returned buffer has no
+ *	headroom and a tail room covering the rest of @data.
+ *
+ *	When @frag_size is not 0, @data is released with put_page() on
+ *	the page it belongs to, see netdev_alloc_frag().
+ *
+ *	%NULL is returned if there is no free memory, in which case
+ *	@data is still owned by the caller.
+ */
+struct sk_buff *build_skb(void *data, unsigned int frag_size)
+{
+	struct skb_shared_info *shinfo;
+	struct sk_buff *skb;
+	unsigned int size = frag_size ? : ksize(data);
+
+	skb = kmem_cache_alloc(skbuff_head_cache, GFP_ATOMIC);
+	if (!skb)
+		return NULL;
+
+	size -= SKB_DATA_ALIGN(sizeof(struct skb_shared_info));
+
+	memset(skb, 0, offsetof(struct sk_buff, tail));
+	skb->truesize = size + sizeof(struct sk_buff);
+	skb->head_frag = frag_size != 0;
+	atomic_set(&skb->users, 1);
+	skb->head = data;
+	skb->data = data;
+	skb_reset_tail_pointer(skb);
+	skb->end = skb->tail + size;
+	kmemcheck_annotate_bitfield(skb, flags1);
+	kmemcheck_annotate_bitfield(skb, flags2);
+#ifdef NET_SKBUFF_DATA_USES_OFFSET
+	skb->mac_header = ~0U;
+#endif
+
+	shinfo = skb_shinfo(skb);
+	atomic_set(&shinfo->dataref, 1);
+	shinfo->nr_frags  = 0;
+	shinfo->gso_size = 0;
+	shinfo->gso_segs = 0;
+	shinfo->gso_type = 0;
+	shinfo->ip6_frag_id = 0;
+	shinfo->tx_flags.flags = 0;
+	skb_frag_list_init(skb);
+	memset(&shinfo->hwtstamps, 0, sizeof(shinfo->hwtstamps));
+
+	return skb;
+}
+EXPORT_SYMBOL(build_skb);
+
+/*
+ * Per-cpu cache of pages receive buffers are carved from.  The page
+ * refcount is biased up front so handing out a fragment is a plain
+ * decrement of pagecnt_bias.  Once the page is used up and every
+ * fragment has been freed again, its count is back to the bias and
+ * the page is recycled in place instead of going back to the page
+ * allocator.
+ */
+struct netdev_alloc_cache {
+	struct page	*page;
+	unsigned int	size;
+	unsigned int	offset;
+	unsigned int	pagecnt_bias;
+};
+static DEFINE_PER_CPU(struct netdev_alloc_cache, netdev_alloc_cache);
+
+#define NETDEV_FRAG_PAGE_MAX_ORDER get_order(32768)
+#define NETDEV_FRAG_PAGE_MAX_SIZE  (PAGE_SIZE << NETDEV_FRAG_PAGE_MAX_ORDER)
+#define NETDEV_PAGECNT_MAX_BIAS	   NETDEV_FRAG_PAGE_MAX_SIZE
+
+static void *__netdev_alloc_frag(unsigned int fragsz, gfp_t gfp_mask)
+{
+	struct netdev_alloc_cache *nc;
+	void *data = NULL;
+	unsigned long flags;
+	int order;
+
+	local_irq_save(flags);
+	nc = &__get_cpu_var(netdev_alloc_cache);
+	if (unlikely(!nc->page)) {
+refill:
+		for (order = NETDEV_FRAG_PAGE_MAX_ORDER; ;) {
+			gfp_t gfp = gfp_mask;
+
+			if (order)
+				gfp |= __GFP_COMP | __GFP_NOWARN;
+			nc->page = alloc_pages(gfp, order);
+			if (likely(nc->page))
+				break;
+			if (--order < 0)
+				goto end;
+		}
+		nc->size = PAGE_SIZE << order;
+recycle:
+		atomic_set(&nc->page->_count, NETDEV_PAGECNT_MAX_BIAS);
+		nc->pagecnt_bias = NETDEV_PAGECNT_MAX_BIAS;
+		nc->offset = 0;
+	}
+
+	if (nc->offset + fragsz > nc->size) {
+		/* All fragments freed already, no atomic op needed */
+		if (atomic_read(&nc->page->_count) == nc->pagecnt_bias ||
+		    atomic_sub_and_test(nc->pagecnt_bias, &nc->page->_count))
+			goto recycle;
+		goto refill;
+	}
+
+	data = page_address(nc->page) + nc->offset;
+	nc->offset += fragsz;
+	nc->pagecnt_bias--;
+end:
+	local_irq_restore(flags);
+	return data;
+}
+
+/**
+ *	netdev_alloc_frag - allocate a page fragment
+ *	@fragsz: fragment size
+ *
+ *	Allocates a fragment from a per-cpu page cache, suitable for
+ *	build_skb().  The fragment is released with put_page() on
+ *	virt_to_head_page() of the returned address.
+ *
+ *	%NULL is returned if there is no free memory.
+ */
+void *netdev_alloc_frag(unsigned int fragsz)
+{
+	return __netdev_alloc_frag(fragsz, GFP_ATOMIC | __GFP_COLD);
+}
+EXPORT_SYMBOL(netdev_alloc_frag);
+
 /**
  *	__netdev_alloc_skb - allocate an skbuff for rx on a specific device
  *	@dev: network device to receive on
@@ -257,9 +397,24 @@ struct sk_buff *__netdev_alloc_skb(struct net_device *dev,
 		unsigned int length, gfp_t gfp_mask)
 {
 	int node = dev->dev.parent ? dev_to_node(dev->dev.parent) : -1;
-	struct sk_buff *skb;
+	unsigned int fragsz = SKB_DATA_ALIGN(length + NET_SKB_PAD) +
+			      SKB_DATA_ALIGN(sizeof(struct skb_shared_info));
+	struct sk_buff *skb = NULL;
+
+	/* Small buffers for atomic callers are carved from the per-cpu
+	 * page cache rather than taking a kmalloc() slab for each frame.
+	 */
+	if (fragsz <= PAGE_SIZE && !(gfp_mask & (__GFP_WAIT | GFP_DMA))) {
+		void *data = __netdev_alloc_frag(fragsz, gfp_mask);
 
-	skb = __alloc_skb(length + NET_SKB_PAD, gfp_mask, 0, node);
+		if (likely(data)) {
+			skb = build_skb(data, fragsz);
+			if (unlikely(!skb))
+				put_page(virt_to_head_page(data));
+		}
+	} else {
+		skb = __alloc_skb(length + NET_SKB_PAD, gfp_mask, 0, node);
+	}
 	if (likely(skb)) {
 		skb_reserve(skb, NET_SKB_PAD);
 		skb->dev = dev;
@@ -336,6 +491,14 @@ static void skb_clone_fraglist(struct sk_buff *skb)
 		skb_get(list);
 }
 
+static void skb_free_head(struct sk_buff *skb)
+{
+	if (skb->head_frag)
+		put_page(virt_to_head_page(skb->head));
+	else
+		kfree(skb->head);
+}
+
 static void skb_release_data(struct sk_buff *skb)
 {
 	if (!skb->cloned ||
@@ -347,10 +510,12 @@ static void skb_release_data(struct sk_buff *skb)
 				put_page(skb_shinfo(skb)->frags[i].page);
 		}
 
+		sock_zerocopy_put(skb_zcopy(skb));
+
 		if (skb_has_frags(skb))
 			skb_drop_fraglist(skb);
 
-		kfree(skb->head);
+		skb_free_head(skb);
 	}
 }
 
@@ -493,7 +658,8 @@ int skb_recycle_check(struct sk_buff *skb, int skb_size)
 {
 	struct skb_shared_info *shinfo;
 
-	if (skb_is_nonlinear(skb) || skb->fclone != SKB_FCLONE_UNAVAILABLE)
+	if (skb_is_nonlinear(skb) || skb->fclone != SKB_FCLONE_UNAVAILABLE ||
+	    skb_zcopy(skb) || skb->head_frag)
 		return 0;
 
 	skb_size = SKB_DATA_ALIGN(skb_size + NET_SKB_PAD);
@@ -559,6 +725,9 @@ static void __copy_skb_header(struct sk_buff *new, const struct sk_buff *old)
 #endif
 #endif
 	new->vlan_tci		= old->vlan_tci;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	new->napi_id		= old->napi_id;
+#endif
 
 	skb_copy_secmark(new, old);
 }
@@ -585,6 +754,7 @@ static struct sk_buff *__skb_clone(struct sk_buff *n, struct sk_buff *skb)
 	C(tail);
 	C(end);
 	C(head);
+	C(head_frag);
 	C(data);
 	C(truesize);
 	atomic_set(&n->users, 1);
@@ -766,6 +936,7 @@ struct sk_buff *pskb_copy(struct sk_buff *skb, gfp_t gfp_mask)
 		}
 		skb_shinfo(n)->nr_frags = i;
 	}
+	skb_zcopy_set(n, skb_zcopy(skb));
 
 	if (skb_has_frags(skb)) {
 		skb_shinfo(n)->frag_list = skb_shinfo(skb)->frag_list;
@@ -830,6 +1001,10 @@ int pskb_expand_head(struct sk_buff *skb, int nhead, int ntail,
 	for (i = 0; i < skb_shinfo(skb)->nr_frags; i++)
 		get_page(skb_shinfo(skb)->frags[i].page);
 
+	/* The copied shared info keeps pointing at the zerocopy context */
+	if (skb_zcopy(skb))
+		atomic_inc(&skb_zcopy(skb)->refcnt);
+
 	if (skb_has_frags(skb))
 		skb_clone_fraglist(skb);
 
@@ -838,6 +1013,7 @@ int pskb_expand_head(struct sk_buff *skb, int nhead, int ntail,
 	off = (data + nhead) - skb->head;
 
 	skb->head     = data;
+	skb->head_frag = 0;
 	skb->data    += off;
 #ifdef NET_SKBUFF_DATA_USES_OFFSET
 	skb->end      = size;
@@ -2081,6 +2257,7 @@ void skb_split(struct sk_buff *skb, struct sk_buff *skb1, const u32 len)
 {
 	int pos = skb_headlen(skb);
 
+	skb_zcopy_set(skb1, skb_zcopy(skb));
 	if (len < pos)	/* Split line is inside header. */
 		skb_split_inside_header(skb, skb1, len, pos);
 	else		/* Second chunk has no header, nothing to copy. */
@@ -2123,6 +2300,10 @@ int skb_shift(struct sk_buff *tgt, struct sk_buff *skb, int shiftlen)
 	BUG_ON(shiftlen > skb->len);
 	BUG_ON(skb_headlen(skb));	/* Would corrupt stream */
 
+	/* User pages must stay with their own completion context */
+	if (skb_zcopy(tgt) != skb_zcopy(skb))
+		return 0;
+
 	todo = shiftlen;
 	from = 0;
 	to = skb_shinfo(tgt)->nr_frags;
@@ -2597,6 +2778,7 @@ struct sk_buff *skb_segment(struct sk_buff *skb, int features)
 		}
 
 		frag = skb_shinfo(nskb)->frags;
+		skb_zcopy_set(nskb, skb_zcopy(skb));
 
 		skb_copy_from_linear_data_offset(skb, offset,
 						 skb_put(nskb, hsize), hsize);
@@ -3044,6 +3226,146 @@ void skb_tstamp_tx(struct sk_buff *orig_skb,
 }
 EXPORT_SYMBOL_GPL(skb_tstamp_tx);
 
+/*
+ * MSG_ZEROCOPY completion contexts.
+ *
+ * A context lives in the control buffer of a small skb charged to the
+ * socket option memory.  When the last skb holding the user pages is
+ * freed, that very skb is turned into a notification and queued on the
+ * socket error queue, so completing never has to allocate.  Consecutive
+ * notifications are merged into a single [ee_info, ee_data] id range.
+ */
+static inline struct sk_buff *skb_from_uarg(struct ubuf_info *uarg)
+{
+	return container_of((void *)uarg, struct sk_buff, cb);
+}
+
+static void sock_ofree(struct sk_buff *skb)
+{
+	atomic_sub(skb->truesize, &skb->sk->sk_omem_alloc);
+}
+
+static int sock_zerocopy_notify_extend(struct sk_buff *skb, u32 lo, u16 len)
+{
+	struct sock_exterr_skb *serr = SKB_EXT_ERR(skb);
+	u32 old_lo = serr->ee.ee_info, old_hi = serr->ee.ee_data;
+
+	if (lo != old_hi + 1)
+		return 0;
+	/* ee_data - ee_info must not wrap */
+	if ((u64)old_hi - old_lo + 1 + len >= (1ULL << 32))
+		return 0;
+
+	serr->ee.ee_data += len;
+	return 1;
+}
+
+static void sock_zerocopy_callback(struct ubuf_info *uarg)
+{
+	struct sk_buff *tail, *skb = skb_from_uarg(uarg);
+	struct sock_exterr_skb *serr;
+	struct sock *sk = skb->sk;
+	struct sk_buff_head *q;
+	unsigned long flags;
+	u32 lo, hi;
+	u16 len;
+	u8 code;
+
+	/* An aborted send that never reached the wire reports nothing */
+	if (!uarg->len || sock_flag(sk, SOCK_DEAD))
+		goto release;
+
+	len = uarg->len;
+	lo = uarg->id;
+	hi = uarg->id + len - 1;
+	code = uarg->zerocopy ? 0 : SO_EE_CODE_ZEROCOPY_COPIED;
+
+	/* uarg shares skb->cb with serr, it is dead past this point */
+	serr = SKB_EXT_ERR(skb);
+	memset(serr, 0, sizeof(*serr));
+	serr->ee.ee_errno = 0;
+	serr->ee.ee_origin = SO_EE_ORIGIN_ZEROCOPY;
+	serr->ee.ee_code = code;
+	serr->ee.ee_info = lo;
+	serr->ee.ee_data = hi;
+
+	q = &sk->sk_error_queue;
+	spin_lock_irqsave(&q->lock, flags);
+	tail = skb_peek_tail(q);
+	if (!tail || SKB_EXT_ERR(tail)->ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY ||
+	    SKB_EXT_ERR(tail)->ee.ee_code != code ||
+	    !sock_zerocopy_notify_extend(tail, lo, len)) {
+		__skb_queue_tail(q, skb);
+		skb = NULL;
+	}
+	spin_unlock_irqrestore(&q->lock, flags);
+
+	sk->sk_error_report(sk);
+
+release:
+	consume_skb(skb);
+	sock_put(sk);
+}
+
+/**
+ * sock_zerocopy_alloc - allocate a MSG_ZEROCOPY completion context
+ * @sk: sending socket
+ *
+ * Returns a context holding one reference for the caller, which must
+ * drop it with sock_zerocopy_put() or sock_zerocopy_put_abort() once
+ * the send is done.  Each skb the user pages get attached to holds an
+ * additional reference, see skb_zcopy_set().
+ */
+struct ubuf_info *sock_zerocopy_alloc(struct sock *sk)
+{
+	struct ubuf_info *uarg;
+	struct sk_buff *skb;
+
+	BUILD_BUG_ON(sizeof(*uarg) > sizeof(skb->cb));
+
+	if (atomic_read(&sk->sk_omem_alloc) >= sysctl_optmem_max)
+		return NULL;
+
+	skb = alloc_skb(0, sk->sk_allocation);
+	if (!skb)
+		return NULL;
+
+	skb->sk = sk;
+	skb->destructor = sock_ofree;
+	atomic_add(skb->truesize, &sk->sk_omem_alloc);
+	sock_hold(sk);
+
+	uarg = (struct ubuf_info *)skb->cb;
+	uarg->callback = sock_zerocopy_callback;
+	uarg->id = sk->sk_zckey++;
+	uarg->len = 1;
+	uarg->zerocopy = 1;
+	atomic_set(&uarg->refcnt, 1);
+
+	return uarg;
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_alloc);
+
+void sock_zerocopy_put(struct ubuf_info *uarg)
+{
+	if (uarg && atomic_dec_and_test(&uarg->refcnt))
+		uarg->callback(uarg);
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_put);
+
+/* Give back the notification id of a send that queued no data */
+void sock_zerocopy_put_abort(struct ubuf_info *uarg)
+{
+	if (uarg) {
+		struct sock *sk = skb_from_uarg(uarg)->sk;
+
+		sk->sk_zckey--;
+		uarg->len--;
+		sock_zerocopy_put(uarg);
+	}
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_put_abort);
+
 
 /**
  * skb_partial_csum_set - set up and verify partial csum values for packet
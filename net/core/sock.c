@@ -125,6 +125,7 @@
 #include <linux/ipsec.h>
 
 #include <linux/filter.h>
+#include <net/busy_poll.h>
 
 #ifdef CONFIG_INET
 #include <net/tcp.h>
@@ -217,6 +218,11 @@ __u32 sysctl_rmem_default __read_mostly = SK_RMEM_MAX;
 int sysctl_optmem_max __read_mostly = sizeof(unsigned long)*(2*UIO_MAXIOV+512);
 EXPORT_SYMBOL(sysctl_optmem_max);
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+unsigned int sysctl_net_busy_read __read_mostly;
+unsigned int sysctl_net_busy_poll __read_mostly;
+#endif
+
 static int sock_set_timeout(long *timeo_p, char __user *optval, int optlen)
 {
 	struct timeval tv;
@@ -700,6 +706,30 @@ set_rcvbuf:
 			sk->sk_mark = val;
 		break;
 
+	case SO_ZEROCOPY:
+		if ((sk->sk_family != PF_INET && sk->sk_family != PF_INET6) ||
+		    sk->sk_protocol != IPPROTO_TCP)
+			ret = -EOPNOTSUPP;
+		else if (sk->sk_state != TCP_CLOSE)
+			ret = -EBUSY;
+		else if (val < 0 || val > 1)
+			ret = -EINVAL;
+		else
+			sock_valbool_flag(sk, SOCK_ZEROCOPY, valbool);
+		break;
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	case SO_BUSY_POLL:
+		/* allow unprivileged users to decrease the value */
+		if ((val > sk->sk_ll_usec) && !capable(CAP_NET_ADMIN))
+			ret = -EPERM;
+		else if (val < 0)
+			ret = -EINVAL;
+		else
+			sk->sk_ll_usec = val;
+		break;
+#endif
+
 		/* We implement the SO_SNDLOWAT etc to
 		   not be settable (1003.1g 5.3) */
 	default:
@@ -901,6 +931,27 @@ int sock_getsockopt(struct socket *sock, int level, int optname,
 		v.val = sk->sk_mark;
 		break;
 
+	case SO_ZEROCOPY:
+		v.val = sock_flag(sk, SOCK_ZEROCOPY);
+		break;
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	case SO_BUSY_POLL:
+		v.val = sk->sk_ll_usec;
+		break;
+
+	case SO_BUSY_POLL_STATS:
+	{
+		struct so_busy_poll_stats stats = sk->sk_ll_stats;
+
+		if (len > sizeof(stats))
+			len = sizeof(stats);
+		if (copy_to_user(optval, &stats, len))
+			return -EFAULT;
+		goto lenout;
+	}
+#endif
+
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -1157,6 +1208,10 @@ struct sock *sk_clone(const struct sock *sk, const gfp_t priority)
 
 		newsk->sk_err	   = 0;
 		newsk->sk_priority = 0;
+		newsk->sk_zckey	   = 0;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+		memset(&newsk->sk_ll_stats, 0, sizeof(newsk->sk_ll_stats));
+#endif
 		/*
 		 * Before updating sk_refcnt, we must commit prior changes to memory
 		 * (Documentation/RCU/rculist_nulls.txt for details)
@@ -1543,6 +1598,47 @@ int sk_wait_data(struct sock *sk, long *timeo)
 }
 EXPORT_SYMBOL(sk_wait_data);
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+static bool sk_busy_loop_end(void *p, unsigned long start_time)
+{
+	struct sock *sk = p;
+
+	return !skb_queue_empty(&sk->sk_receive_queue) ||
+	       sk_busy_loop_timeout(sk, start_time);
+}
+
+/**
+ * sk_busy_loop - busy poll the device feeding a socket
+ * @sk: socket to wait for data on
+ * @nonblock: poll the device once instead of until data or timeout
+ *
+ * Must not be called with the socket owned by the user, or the data
+ * would land on the backlog instead of the receive queue.  Returns
+ * true if the receive queue is no longer empty.
+ */
+bool sk_busy_loop(struct sock *sk, int nonblock)
+{
+	unsigned int napi_id = ACCESS_ONCE(sk->sk_napi_id);
+	int packets;
+	bool rc;
+
+	if (!napi_id)
+		return false;
+
+	packets = napi_busy_loop(napi_id, nonblock ? NULL : sk_busy_loop_end,
+				 sk);
+	rc = !skb_queue_empty(&sk->sk_receive_queue);
+
+	/* best effort, concurrent readers may lose an update */
+	sk->sk_ll_stats.loops++;
+	sk->sk_ll_stats.packets += packets;
+	sk->sk_ll_stats.hits += rc;
+
+	return rc;
+}
+EXPORT_SYMBOL(sk_busy_loop);
+#endif
+
 /**
  *	__sk_mem_schedule - increase sk_forward_alloc and memory_allocated
  *	@sk: socket
@@ -1886,6 +1982,11 @@ void sock_init_data(struct socket *sock, struct sock *sk)
 
 	sk->sk_stamp = ktime_set(-1L, 0);
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	sk->sk_napi_id		=	0;
+	sk->sk_ll_usec		=	sysctl_net_busy_read;
+#endif
+
 	/*
 	 * Before updating sk_refcnt, we must commit prior changes to memory
 	 * (Documentation/RCU/rculist_nulls.txt for details)
@@ -1922,6 +2023,8 @@ void release_sock(struct sock *sk)
 	spin_lock_bh(&sk->sk_lock.slock);
 	if (sk->sk_backlog.tail)
 		__release_sock(sk);
+	if (sk->sk_prot->release_cb)
+		sk->sk_prot->release_cb(sk);
 	sk->sk_lock.owned = 0;
 	if (waitqueue_active(&sk->sk_lock.wq))
 		wake_up(&sk->sk_lock.wq);
@@ -138,6 +138,44 @@ static const struct
 
 /* Release a nexthop info record */
 
+static void free_nh_exceptions(struct fib_nh *nh)
+{
+	struct fnhe_hash_bucket *hash = nh->nh_exceptions;
+	int i;
+
+	if (!hash)
+		return;
+
+	for (i = 0; i < FNHE_HASH_SIZE; i++) {
+		struct fib_nh_exception *fnhe = hash[i].chain;
+
+		while (fnhe) {
+			struct fib_nh_exception *next = fnhe->fnhe_next;
+
+			kfree(fnhe);
+			fnhe = next;
+		}
+	}
+	kfree(hash);
+	nh->nh_exceptions = NULL;
+}
+
+static void free_nh_rth_cache(struct rtable **rtp)
+{
+	int cpu;
+
+	if (!rtp)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct rtable *rt = *per_cpu_ptr(rtp, cpu);
+
+		if (rt)
+			dst_release(&rt->u.dst);
+	}
+	free_percpu(rtp);
+}
+
 void free_fib_info(struct fib_info *fi)
 {
 	if (fi->fib_dead == 0) {
@@ -148,6 +186,9 @@ void free_fib_info(struct fib_info *fi)
 		if (nh->nh_dev)
 			dev_put(nh->nh_dev);
 		nh->nh_dev = NULL;
+		free_nh_rth_cache(nh->nh_pcpu_rth_output);
+		free_nh_rth_cache(nh->nh_pcpu_rth_input);
+		free_nh_exceptions(nh);
 	} endfor_nexthops(fi);
 	fib_info_cnt--;
 	release_net(fi->fib_net);
@@ -828,6 +869,15 @@ link_it:
 		return ofi;
 	}
 
+	/* Routes built through each nexthop while the cache is disabled */
+	err = -ENOBUFS;
+	change_nexthops(fi) {
+		nh->nh_pcpu_rth_output = alloc_percpu(struct rtable *);
+		nh->nh_pcpu_rth_input = alloc_percpu(struct rtable *);
+		if (!nh->nh_pcpu_rth_output || !nh->nh_pcpu_rth_input)
+			goto failure;
+	} endfor_nexthops(fi)
+
 	fi->fib_treeref++;
 	atomic_inc(&fi->fib_clntref);
 	spin_lock_bh(&fib_info_lock);
@@ -388,9 +388,9 @@ no_route:
 EXPORT_SYMBOL_GPL(inet_csk_route_req);
 
 static inline u32 inet_synq_hash(const __be32 raddr, const __be16 rport,
-				 const u32 rnd, const u32 synq_hsize)
+				 const u32 rnd)
 {
-	return jhash_2words((__force u32)raddr, (__force u32)rport, rnd) & (synq_hsize - 1);
+	return jhash_2words((__force u32)raddr, (__force u32)rport, rnd);
 }
 
 #if defined(CONFIG_IPV6) || defined(CONFIG_IPV6_MODULE)
@@ -399,19 +399,24 @@ static inline u32 inet_synq_hash(const __be32 raddr, const __be16 rport,
 #define AF_INET_FAMILY(fam) 1
 #endif
 
+/* The result may only be dereferenced by callers holding the listener lock */
 struct request_sock *inet_csk_search_req(const struct sock *sk,
-					 struct request_sock ***prevp,
 					 const __be16 rport, const __be32 raddr,
 					 const __be32 laddr)
 {
-	const struct inet_connection_sock *icsk = inet_csk(sk);
-	struct listen_sock *lopt = icsk->icsk_accept_queue.listen_opt;
-	struct request_sock *req, **prev;
-
-	for (prev = &lopt->syn_table[inet_synq_hash(raddr, rport, lopt->hash_rnd,
-						    lopt->nr_table_entries)];
-	     (req = *prev) != NULL;
-	     prev = &req->dl_next) {
+	struct request_sock_queue *queue = &inet_csk(sk)->icsk_accept_queue;
+	struct listen_sock *lopt;
+	struct request_sock *req;
+	spinlock_t *lock;
+	u32 hash;
+
+	read_lock(&queue->syn_wait_lock);
+	lopt = queue->listen_opt;
+	hash = inet_synq_hash(raddr, rport, lopt->hash_rnd);
+	lock = reqsk_queue_lockp(lopt, hash);
+	spin_lock(lock);
+	for (req = *reqsk_queue_bucket(lopt, hash); req != NULL;
+	     req = req->dl_next) {
 		const struct inet_request_sock *ireq = inet_rsk(req);
 
 		if (ireq->rmt_port == rport &&
@@ -419,10 +424,11 @@ struct request_sock *inet_csk_search_req(const struct sock *sk,
 		    ireq->loc_addr == laddr &&
 		    AF_INET_FAMILY(req->rsk_ops->family)) {
 			WARN_ON(req->sk);
-			*prevp = prev;
 			break;
 		}
 	}
+	spin_unlock(lock);
+	read_unlock(&queue->syn_wait_lock);
 
 	return req;
 }
@@ -435,7 +441,7 @@ void inet_csk_reqsk_queue_hash_add(struct sock *sk, struct request_sock *req,
 	struct inet_connection_sock *icsk = inet_csk(sk);
 	struct listen_sock *lopt = icsk->icsk_accept_queue.listen_opt;
 	const u32 h = inet_synq_hash(inet_rsk(req)->rmt_addr, inet_rsk(req)->rmt_port,
-				     lopt->hash_rnd, lopt->nr_table_entries);
+				     lopt->hash_rnd);
 
 	reqsk_queue_hash_req(&icsk->icsk_accept_queue, h, req, timeout);
 	inet_csk_reqsk_queue_added(sk, timeout);
@@ -480,9 +486,12 @@ void inet_csk_reqsk_queue_prune(struct sock *parent,
 	int thresh = max_retries;
 	unsigned long now = jiffies;
 	struct request_sock **reqp, *req;
-	int i, budget;
+	int i, budget, qlen;
 
-	if (lopt == NULL || lopt->qlen == 0)
+	if (lopt == NULL)
+		return;
+	qlen = atomic_read(&lopt->qlen);
+	if (qlen == 0)
 		return;
 
 	/* Normally all the openreqs are young and become mature
@@ -502,11 +511,11 @@ void inet_csk_reqsk_queue_prune(struct sock *parent,
 	 * embrions; and abort old ones without pity, if old
 	 * ones are about to clog our table.
 	 */
-	if (lopt->qlen>>(lopt->max_qlen_log-1)) {
-		int young = (lopt->qlen_young<<1);
+	if (qlen>>(lopt->max_qlen_log-1)) {
+		int young = (atomic_read(&lopt->qlen_young)<<1);
 
 		while (thresh > 2) {
-			if (lopt->qlen < young)
+			if (qlen < young)
 				break;
 			thresh--;
 			young <<= 1;
@@ -516,10 +525,14 @@ void inet_csk_reqsk_queue_prune(struct sock *parent,
 	if (queue->rskq_defer_accept)
 		max_retries = queue->rskq_defer_accept;
 
+	read_lock(&queue->syn_wait_lock);
 	budget = 2 * (lopt->nr_table_entries / (timeout / interval));
-	i = lopt->clock_hand;
+	i = lopt->clock_hand & (lopt->nr_table_entries - 1);
 
 	do {
+		spinlock_t *lock = reqsk_queue_lockp(lopt, i);
+
+		spin_lock(lock);
 		reqp=&lopt->syn_table[i];
 		while ((req = *reqp) != NULL) {
 			if (time_after_eq(now, req->expires)) {
@@ -535,7 +548,7 @@ void inet_csk_reqsk_queue_prune(struct sock *parent,
 					unsigned long timeo;
 
 					if (req->retrans++ == 0)
-						lopt->qlen_young--;
+						atomic_dec(&lopt->qlen_young);
 					timeo = min((timeout << req->retrans), max_rto);
 					req->expires = now + timeo;
 					reqp = &req->dl_next;
@@ -543,21 +556,23 @@ void inet_csk_reqsk_queue_prune(struct sock *parent,
 				}
 
 				/* Drop this request */
-				inet_csk_reqsk_queue_unlink(parent, req, reqp);
+				*reqp = req->dl_next;
 				reqsk_queue_removed(queue, req);
 				reqsk_free(req);
 				continue;
 			}
 			reqp = &req->dl_next;
 		}
+		spin_unlock(lock);
 
 		i = (i + 1) & (lopt->nr_table_entries - 1);
 
 	} while (--budget > 0);
+	read_unlock(&queue->syn_wait_lock);
 
 	lopt->clock_hand = i;
 
-	if (lopt->qlen)
+	if (atomic_read(&lopt->qlen))
 		inet_csk_reset_keepalive_timer(parent, interval);
 }
 
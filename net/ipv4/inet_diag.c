@@ -636,7 +636,7 @@ static int inet_diag_dump_reqs(struct sk_buff *skb, struct sock *sk,
 	read_lock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
 
 	lopt = icsk->icsk_accept_queue.listen_opt;
-	if (!lopt || !lopt->qlen)
+	if (!lopt || !atomic_read(&lopt->qlen))
 		goto out;
 
 	if (nlmsg_attrlen(cb->nlh, sizeof(*r))) {
@@ -647,8 +647,11 @@ static int inet_diag_dump_reqs(struct sk_buff *skb, struct sock *sk,
 	}
 
 	for (j = s_j; j < lopt->nr_table_entries; j++) {
-		struct request_sock *req, *head = lopt->syn_table[j];
+		spinlock_t *lock = reqsk_queue_lockp(lopt, j);
+		struct request_sock *req, *head;
 
+		spin_lock(lock);
+		head = lopt->syn_table[j];
 		reqnum = 0;
 		for (req = head; req; reqnum++, req = req->dl_next) {
 			struct inet_request_sock *ireq = inet_rsk(req);
@@ -683,11 +686,13 @@ static int inet_diag_dump_reqs(struct sk_buff *skb, struct sock *sk,
 					       NETLINK_CB(cb->skb).pid,
 					       cb->nlh->nlmsg_seq, cb->nlh);
 			if (err < 0) {
+				spin_unlock(lock);
 				cb->args[3] = j + 1;
 				cb->args[4] = reqnum;
 				goto out;
 			}
 		}
+		spin_unlock(lock);
 
 		s_reqnum = 0;
 	}
@@ -34,6 +34,7 @@
 #include <net/ip.h>
 #include <net/icmp.h>
 #include <net/protocol.h>
+#include <net/inet_common.h>
 #include <net/ipip.h>
 #include <net/arp.h>
 #include <net/checksum.h>
@@ -1277,9 +1278,111 @@ static void ipgre_fb_tunnel_init(struct net_device *dev)
 }
 
 
+/* Merge the flows inside a tunnel that ends here.  Only plain GRE with
+ * IPv4 inside is handled, with or without a key; anything with checksums
+ * or sequence numbers goes through ipgre_rcv() one packet at a time. */
+static struct sk_buff **ipgre_gro_receive(struct sk_buff **head,
+					  struct sk_buff *skb)
+{
+	struct sk_buff **pp = NULL;
+	struct sk_buff *p;
+	const struct iphdr *iph;
+	struct ip_tunnel *t;
+	__be16 *greh;
+	unsigned int hlen, grehlen, off, nhoff;
+	__be32 key = 0;
+	__wsum csum;
+	int flush = 1;
+
+	off = skb_gro_offset(skb);
+	grehlen = 4;
+	hlen = off + grehlen;
+	greh = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, hlen)) {
+		greh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!greh))
+			goto out;
+	}
+
+	if ((greh[0] & ~GRE_KEY) || greh[1] != htons(ETH_P_IP))
+		goto out;
+
+	if (greh[0] & GRE_KEY) {
+		grehlen += 4;
+		hlen = off + grehlen;
+		if (skb_gro_header_hard(skb, hlen)) {
+			greh = skb_gro_header_slow(skb, hlen, off);
+			if (unlikely(!greh))
+				goto out;
+		}
+		key = *(__be32 *)(greh + 2);
+	}
+
+	/* Forwarded GRE must leave as it came in */
+	iph = skb_gro_network_header(skb);
+	if (skb->pkt_type != PACKET_HOST ||
+	    inet_addr_type(dev_net(skb->dev), iph->daddr) != RTN_LOCAL)
+		goto out;
+
+	read_lock(&ipgre_lock);
+	t = ipgre_tunnel_lookup(skb->dev, iph->saddr, iph->daddr, key,
+				greh[1]);
+	if (t && (t->parms.i_flags & (GRE_CSUM | GRE_SEQ)))
+		t = NULL;
+	read_unlock(&ipgre_lock);
+	if (!t)
+		goto out;
+
+	for (p = *head; p; p = p->next) {
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		if (memcmp(p->data + off, greh, grehlen))
+			NAPI_GRO_CB(p)->same_flow = 0;
+	}
+
+	skb_gro_pull(skb, grehlen);
+	nhoff = skb_network_offset(skb);
+
+	/* The inner checksum is checked against what the device summed
+	 * up, which includes the GRE header. */
+	csum = skb->csum;
+	if (skb->ip_summed == CHECKSUM_COMPLETE)
+		skb->csum = csum_sub(csum, csum_partial(greh, grehlen, 0));
+
+	flush = 0;
+	pp = inet_gro_receive(head, skb);
+
+	if (skb->ip_summed == CHECKSUM_COMPLETE)
+		skb->csum = csum;
+	skb_set_network_header(skb, nhoff);
+
+out:
+	NAPI_GRO_CB(skb)->flush |= flush;
+
+	return pp;
+}
+
+static int ipgre_gro_complete(struct sk_buff *skb)
+{
+	const struct iphdr *iph = ip_hdr(skb);
+	__be16 *greh = (__be16 *)(skb_network_header(skb) + iph->ihl * 4);
+	int nhoff = skb_network_offset(skb);
+	int err;
+
+	skb_set_network_header(skb, nhoff + iph->ihl * 4 +
+				    (greh[0] & GRE_KEY ? 8 : 4));
+	err = inet_gro_complete(skb);
+	skb_set_network_header(skb, nhoff);
+
+	return err;
+}
+
 static const struct net_protocol ipgre_protocol = {
 	.handler	=	ipgre_rcv,
 	.err_handler	=	ipgre_err,
+	.gro_receive	=	ipgre_gro_receive,
+	.gro_complete	=	ipgre_gro_complete,
 	.netns_ok	=	1,
 };
 
@@ -733,7 +733,8 @@ static inline int ip_ufo_append_data(struct sock *sk,
 	int err;
 
 	/* There is support for UDP fragmentation offload by network
-	 * device, so create one single skb packet containing complete
+	 * device, or the data is to be cut into datagrams of cork.gso_size
+	 * late, so create one single skb packet containing complete
 	 * udp datagram
 	 */
 	if ((skb = skb_peek_tail(&sk->sk_write_queue)) == NULL) {
@@ -761,8 +762,13 @@ static inline int ip_ufo_append_data(struct sock *sk,
 		sk->sk_sndmsg_off = 0;
 
 		/* specify the length of each IP datagram fragment */
-		skb_shinfo(skb)->gso_size = mtu - fragheaderlen;
-		skb_shinfo(skb)->gso_type = SKB_GSO_UDP;
+		if (inet_sk(sk)->cork.gso_size) {
+			skb_shinfo(skb)->gso_size = inet_sk(sk)->cork.gso_size;
+			skb_shinfo(skb)->gso_type = SKB_GSO_UDP_L4;
+		} else {
+			skb_shinfo(skb)->gso_size = mtu - fragheaderlen;
+			skb_shinfo(skb)->gso_type = SKB_GSO_UDP;
+		}
 		__skb_queue_tail(&sk->sk_write_queue, skb);
 	}
 
@@ -832,6 +838,8 @@ int ip_append_data(struct sock *sk,
 					    dst_mtu(rt->u.dst.path);
 		inet->cork.dst = &rt->u.dst;
 		inet->cork.length = 0;
+		inet->cork.gso_size = sk->sk_protocol == IPPROTO_UDP ?
+				      ipc->gso_size : 0;
 		sk->sk_sndmsg_page = NULL;
 		sk->sk_sndmsg_off = 0;
 		if ((exthdrlen = rt->u.dst.header_len) != 0) {
@@ -870,9 +878,10 @@ int ip_append_data(struct sock *sk,
 	skb = skb_peek_tail(&sk->sk_write_queue);
 
 	inet->cork.length += length;
-	if (((length > mtu) || (skb && skb_is_gso(skb))) &&
-	    (sk->sk_protocol == IPPROTO_UDP) &&
-	    (rt->u.dst.dev->features & NETIF_F_UFO)) {
+	if (inet->cork.gso_size ||
+	    (((length > mtu) || (skb && skb_is_gso(skb))) &&
+	     (sk->sk_protocol == IPPROTO_UDP) &&
+	     (rt->u.dst.dev->features & NETIF_F_UFO))) {
 		err = ip_ufo_append_data(sk, getfrag, from, length, hh_len,
 					 fragheaderlen, transhdrlen, mtu,
 					 flags);
@@ -1117,7 +1126,7 @@ ssize_t	ip_append_page(struct sock *sk, struct page *page,
 		return -EINVAL;
 
 	inet->cork.length += size;
-	if ((size + skb->len > mtu) &&
+	if ((size + skb->len > mtu) && !skb_is_gso(skb) &&
 	    (sk->sk_protocol == IPPROTO_UDP) &&
 	    (rt->u.dst.dev->features & NETIF_F_UFO)) {
 		skb_shinfo(skb)->gso_size = mtu - fragheaderlen;
@@ -1271,7 +1280,8 @@ int ip_push_pending_frames(struct sock *sk)
 	 * If local_df is set too, we still allow to fragment this frame
 	 * locally. */
 	if (inet->pmtudisc >= IP_PMTUDISC_DO ||
-	    (skb->len <= dst_mtu(&rt->u.dst) &&
+	    ((skb->len <= dst_mtu(&rt->u.dst) ||
+	      (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4)) &&
 	     ip_dont_fragment(sk, &rt->u.dst)))
 		df = htons(IP_DF);
 
@@ -1292,7 +1302,8 @@ int ip_push_pending_frames(struct sock *sk)
 	}
 	iph->tos = inet->tos;
 	iph->frag_off = df;
-	ip_select_ident(iph, &rt->u.dst, sk);
+	ip_select_ident_more(iph, &rt->u.dst, sk,
+			     (skb_shinfo(skb)->gso_segs ?: 1) - 1);
 	iph->ttl = ttl;
 	iph->protocol = sk->sk_protocol;
 	iph->saddr = rt->rt_src;
@@ -0,0 +1,185 @@
+/*
+ * net/ipv4/ip_route_bench.c	Route lookup benchmark
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * Resolves routes to a set of random unicast destinations, picked at
+ * random again for every lookup, once with the routing cache and once
+ * without it (rt_cache_rebuild_count = -1).  Output lookups always run,
+ * input lookups as for forwarded packets when a receiving device is given.
+ * The number of distinct destinations is what the cache grows with, so
+ * run it with a few different "flows" values, e.g.
+ *	modprobe ip_route_bench flows=1000000 dev=eth0
+ *
+ * The same paths are exercised on a router by pktgen with "flag IPDST_RND"
+ * on the sending side.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+#include <linux/random.h>
+#include <linux/vmalloc.h>
+#include <linux/netdevice.h>
+#include <linux/skbuff.h>
+#include <linux/inetdevice.h>
+#include <net/ip.h>
+#include <net/route.h>
+#include <net/net_namespace.h>
+
+static unsigned int lookups = 1000000;
+module_param(lookups, uint, 0);
+MODULE_PARM_DESC(lookups, "Lookups per run");
+
+static unsigned int flows = 65536;
+module_param(flows, uint, 0);
+MODULE_PARM_DESC(flows, "Distinct destinations");
+
+static char *dev;
+module_param(dev, charp, 0);
+MODULE_PARM_DESC(dev, "Device to run input lookups on (default: none)");
+
+static char *src = "198.51.100.1";
+module_param(src, charp, 0);
+MODULE_PARM_DESC(src, "Source address of input lookups");
+
+/* Random unicast address outside of 0/8, 127/8 and 224/3 */
+static __be32 bench_daddr(void)
+{
+	u32 addr;
+
+	do {
+		addr = random32();
+	} while ((addr >> 24) == 0 || (addr >> 24) == 127 ||
+		 (addr >> 29) == 7);
+	return htonl(addr);
+}
+
+/* Returns the elapsed time, *fail counts unroutable destinations */
+static s64 bench_output(const __be32 *daddr, unsigned int *fail)
+{
+	struct flowi fl = { .nl_u = { .ip4_u = { .tos = 0 } } };
+	struct rtable *rt;
+	ktime_t start;
+	unsigned int i;
+
+	*fail = 0;
+	start = ktime_get();
+	for (i = 0; i < lookups; i++) {
+		fl.fl4_dst = daddr[random32() % flows];
+		if (ip_route_output_key(&init_net, &rt, &fl))
+			(*fail)++;
+		else
+			ip_rt_put(rt);
+
+		if (!(i & 1023))
+			cond_resched();
+	}
+	return ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+static s64 bench_input(const __be32 *daddr, struct net_device *in,
+		       __be32 saddr, unsigned int *fail)
+{
+	struct sk_buff *skb;
+	ktime_t start;
+	unsigned int i;
+
+	*fail = 0;
+	skb = alloc_skb(0, GFP_KERNEL);
+	if (!skb)
+		return -ENOMEM;
+	skb->protocol = htons(ETH_P_IP);
+
+	start = ktime_get();
+	for (i = 0; i < lookups; i++) {
+		local_bh_disable();
+		if (ip_route_input(skb, daddr[random32() % flows], saddr, 0,
+				   in))
+			(*fail)++;
+		else
+			skb_dst_drop(skb);
+		local_bh_enable();
+
+		if (!(i & 1023))
+			cond_resched();
+	}
+	kfree_skb(skb);
+	return ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+static void bench_report(const char *what, int caching, s64 ns,
+			 unsigned int fail)
+{
+	if (ns < 0)
+		printk(KERN_INFO "ip_route_bench: %s %s failed (%lld)\n",
+		       what, caching ? "cache  " : "nocache", ns);
+	else
+		printk(KERN_INFO "ip_route_bench: %s %s %llu ns/lookup, "
+		       "%u unroutable\n", what, caching ? "cache  " : "nocache",
+		       div64_u64((u64)ns, lookups), fail);
+}
+
+static int __init ip_route_bench_init(void)
+{
+	struct net_device *in = NULL;
+	__be32 *daddr, saddr = 0;
+	int saved, cached, caching;
+	unsigned int i, fail;
+	s64 ns;
+
+	if (!lookups || !flows)
+		return -EINVAL;
+
+	if (dev) {
+		in = dev_get_by_name(&init_net, dev);
+		if (!in)
+			return -ENODEV;
+		saddr = in_aton(src);
+	}
+
+	daddr = vmalloc(flows * sizeof(*daddr));
+	if (!daddr) {
+		if (in)
+			dev_put(in);
+		return -ENOMEM;
+	}
+	for (i = 0; i < flows; i++)
+		daddr[i] = bench_daddr();
+
+	printk(KERN_INFO "ip_route_bench: %u lookups over %u destinations\n",
+	       lookups, flows);
+
+	saved = init_net.ipv4.sysctl_rt_cache_rebuild_count;
+	cached = max(saved, init_net.ipv4.current_rt_cache_rebuild_count);
+	for (caching = 1; caching >= 0; caching--) {
+		init_net.ipv4.sysctl_rt_cache_rebuild_count =
+			caching ? cached : -1;
+		ns = bench_output(daddr, &fail);
+		bench_report("output", caching, ns, fail);
+		if (in) {
+			ns = bench_input(daddr, in, saddr, &fail);
+			bench_report("input ", caching, ns, fail);
+		}
+	}
+	init_net.ipv4.sysctl_rt_cache_rebuild_count = saved;
+
+	vfree(daddr);
+	if (in)
+		dev_put(in);
+	return 0;
+}
+
+static void __exit ip_route_bench_exit(void)
+{
+}
+
+module_init(ip_route_bench_init);
+module_exit(ip_route_bench_exit);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Route lookup benchmark");
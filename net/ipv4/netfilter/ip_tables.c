@@ -24,9 +24,17 @@
 #include <linux/proc_fs.h>
 #include <linux/err.h>
 #include <linux/cpumask.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/sort.h>
+#include <linux/log2.h>
+#include <linux/seq_file.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
 
 #include <linux/netfilter/x_tables.h>
 #include <linux/netfilter_ipv4/ip_tables.h>
+#include <linux/netfilter/xt_tcpudp.h>
 #include <net/netfilter/nf_log.h>
 
 MODULE_LICENSE("GPL");
@@ -299,6 +307,405 @@ struct ipt_entry *ipt_next_entry(const struct ipt_entry *entry)
 	return (void *)entry + entry->next_offset;
 }
 
+/* Rule evaluation statistics, reported in /proc/net/stat/ip_tables */
+struct ipt_eval_stat {
+	unsigned int packets;	/* packets through ipt_do_table() */
+	unsigned int rules;	/* rules evaluated for them */
+	unsigned int indexed;	/* packets which walked the rule index */
+};
+
+static DEFINE_PER_CPU(struct ipt_eval_stat, ipt_eval_stat);
+
+#ifdef CONFIG_IP_NF_IPTABLES_CLASSIFY
+/*
+ * Rule index.
+ *
+ * The rules of large rule sets mostly differ by the interfaces, the
+ * protocol and the destination port they match.  When a table is
+ * translated, each rule is filed under the fields of these it matches
+ * exactly (its pattern) and their values (its key).  A rule whose key
+ * differs from the packet's fails ip_packet_match() or its leading
+ * tcp/udp match without side effects, so it does not need to be
+ * evaluated.  For each key the index holds the sorted offsets of its
+ * rules; a packet looks up its key once per pattern in use, and the
+ * next rule it evaluates is the lowest offset, not below the current
+ * one, of these lists.  Rules are still evaluated in table order, so
+ * the first match and the counters are the same as with a full walk.
+ */
+
+static int classify __read_mostly = 1;
+module_param(classify, bool, 0644);
+MODULE_PARM_DESC(classify, "Index the rules of tables loaded from now on");
+
+/* Below this, the lookups cost more than walking the rules */
+#define IPT_CLS_MIN_RULES	32
+
+/* Fields a pattern is made of */
+#define IPT_CLS_IN		0x1
+#define IPT_CLS_OUT		0x2
+#define IPT_CLS_PROTO		0x4
+#define IPT_CLS_DPORT		0x8	/* only along with IPT_CLS_PROTO */
+#define IPT_CLS_MAX_PATTERNS	12
+
+#define IPT_CLS_NONE		0xFFFFFFFF
+
+struct ipt_cls_key {
+	char		iniface[IFNAMSIZ];
+	char		outiface[IFNAMSIZ];
+	u_int8_t	pattern;
+	u_int8_t	proto;
+	__be16		dport;
+} __aligned(sizeof(u32));
+
+/* Rules filed under one key */
+struct ipt_cls_node {
+	struct ipt_cls_key	key;
+	u_int32_t		next;	/* next node in the hash chain */
+	u_int32_t		first;	/* first offset of the rules */
+	u_int32_t		count;
+};
+
+/* Allocated in one piece, the arrays follow the header */
+struct ipt_classify {
+	u_int32_t		hmask;
+	u_int32_t		initval;
+	unsigned int		npatterns;
+	u_int8_t		pattern[IPT_CLS_MAX_PATTERNS];
+	u_int32_t		*bucket;
+	struct ipt_cls_node	*node;
+	u_int32_t		*offset;
+};
+
+/* The lists of rules a packet can match, one per pattern */
+struct ipt_cls_walk {
+	unsigned int		n;
+	struct {
+		const u_int32_t	*offset;
+		u_int32_t	count;
+		u_int32_t	cur;
+	} list[IPT_CLS_MAX_PATTERNS];
+};
+
+/* Used while building the index */
+struct ipt_cls_rule {
+	struct ipt_cls_key	key;
+	u_int32_t		offset;
+};
+
+static inline u_int32_t
+ipt_cls_hash(const struct ipt_classify *cls, const struct ipt_cls_key *key)
+{
+	return jhash2((const u32 *)key, sizeof(*key) / sizeof(u32),
+		      cls->initval) & cls->hmask;
+}
+
+/* Does the rule match a single interface name?  "eth+" and masks
+ * covering the bytes after the name do not. */
+static bool
+ipt_cls_iface(const char *name, const unsigned char *mask)
+{
+	unsigned int i, len = strnlen(name, IFNAMSIZ);
+
+	if (len == IFNAMSIZ)
+		return false;
+	for (i = 0; i < IFNAMSIZ; i++)
+		if (mask[i] != (i <= len ? 0xFF : 0))
+			return false;
+	return true;
+}
+
+/* Destination port of the rule, if its first match is a tcp or udp
+ * match for a single port: a match ahead of it could have side effects
+ * (limit, quota, ...) even when the port does not match. */
+static int
+ipt_cls_dport(const struct ipt_entry *e)
+{
+	const struct ipt_entry_match *m = (void *)e->elems;
+	const char *name;
+
+	if (e->target_offset == sizeof(struct ipt_entry))
+		return -1;
+	name = m->u.kernel.match->name;
+
+	if (e->ip.proto == IPPROTO_TCP && strcmp(name, "tcp") == 0) {
+		const struct xt_tcp *tcpinfo = (const void *)m->data;
+
+		if (tcpinfo->dpts[0] == tcpinfo->dpts[1] &&
+		    !(tcpinfo->invflags & XT_TCP_INV_DSTPT))
+			return tcpinfo->dpts[0];
+	} else if (e->ip.proto == IPPROTO_UDP && strcmp(name, "udp") == 0) {
+		const struct xt_udp *udpinfo = (const void *)m->data;
+
+		if (udpinfo->dpts[0] == udpinfo->dpts[1] &&
+		    !(udpinfo->invflags & XT_UDP_INV_DSTPT))
+			return udpinfo->dpts[0];
+	}
+	return -1;
+}
+
+static int
+ipt_cls_fill(struct ipt_entry *e, void *base, struct ipt_cls_rule *rule,
+	     unsigned int *i)
+{
+	const struct ipt_ip *ip = &e->ip;
+	struct ipt_cls_key *key = &rule[*i].key;
+	int port;
+
+	memset(key, 0, sizeof(*key));
+	if (!(ip->invflags & IPT_INV_VIA_IN) &&
+	    ipt_cls_iface(ip->iniface, ip->iniface_mask)) {
+		key->pattern |= IPT_CLS_IN;
+		strncpy(key->iniface, ip->iniface, IFNAMSIZ);
+	}
+	if (!(ip->invflags & IPT_INV_VIA_OUT) &&
+	    ipt_cls_iface(ip->outiface, ip->outiface_mask)) {
+		key->pattern |= IPT_CLS_OUT;
+		strncpy(key->outiface, ip->outiface, IFNAMSIZ);
+	}
+	if (ip->proto && !(ip->invflags & IPT_INV_PROTO)) {
+		key->pattern |= IPT_CLS_PROTO;
+		key->proto = ip->proto;
+
+		port = ipt_cls_dport(e);
+		if (port >= 0) {
+			key->pattern |= IPT_CLS_DPORT;
+			key->dport = htons(port);
+		}
+	}
+	rule[*i].offset = (void *)e - base;
+
+	(*i)++;
+	return 0;
+}
+
+static int ipt_cls_rule_cmp(const void *a, const void *b)
+{
+	const struct ipt_cls_rule *x = a, *y = b;
+	int diff;
+
+	diff = memcmp(&x->key, &y->key, sizeof(x->key));
+	if (diff)
+		return diff;
+	return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+/* Builds the index of a translated table.  If the table is small or
+ * memory is short, newinfo->classify stays NULL and packets walk all
+ * the rules. */
+static void
+ipt_classify_build(struct xt_table_info *newinfo, void *entry0)
+{
+	struct ipt_cls_rule *rule;
+	struct ipt_classify *cls;
+	struct ipt_cls_node *node = NULL;
+	unsigned int i, j, nnodes, hsize;
+	u_int16_t patterns = 0;
+	size_t size;
+	u_int32_t h;
+
+	if (!classify || newinfo->number < IPT_CLS_MIN_RULES)
+		return;
+
+	rule = vmalloc(newinfo->number * sizeof(*rule));
+	if (rule == NULL)
+		return;
+
+	i = 0;
+	IPT_ENTRY_ITERATE(entry0, newinfo->size, ipt_cls_fill, entry0,
+			  rule, &i);
+	sort(rule, i, sizeof(*rule), ipt_cls_rule_cmp, NULL);
+
+	nnodes = 0;
+	for (j = 0; j < i; j++) {
+		if (j == 0 || memcmp(&rule[j].key, &rule[j - 1].key,
+				     sizeof(rule[j].key)))
+			nnodes++;
+		patterns |= 1 << rule[j].key.pattern;
+	}
+	hsize = roundup_pow_of_two(nnodes);
+
+	size = sizeof(*cls) + hsize * sizeof(u_int32_t) +
+	       nnodes * sizeof(struct ipt_cls_node) + i * sizeof(u_int32_t);
+	if (size <= PAGE_SIZE)
+		cls = kzalloc(size, GFP_KERNEL);
+	else
+		cls = vmalloc(size);
+	if (cls == NULL)
+		goto out;
+
+	cls->hmask = hsize - 1;
+	get_random_bytes(&cls->initval, sizeof(cls->initval));
+	cls->npatterns = 0;
+	for (j = 0; j < 16; j++)
+		if (patterns & (1 << j))
+			cls->pattern[cls->npatterns++] = j;
+	cls->bucket = (void *)(cls + 1);
+	cls->node = (void *)(cls->bucket + hsize);
+	cls->offset = (void *)(cls->node + nnodes);
+	memset(cls->bucket, 0xFF, hsize * sizeof(u_int32_t));
+
+	nnodes = 0;
+	for (j = 0; j < i; j++) {
+		if (j == 0 || memcmp(&rule[j].key, &rule[j - 1].key,
+				     sizeof(rule[j].key))) {
+			node = &cls->node[nnodes];
+			node->key = rule[j].key;
+			node->first = j;
+			node->count = 0;
+			h = ipt_cls_hash(cls, &node->key);
+			node->next = cls->bucket[h];
+			cls->bucket[h] = nnodes++;
+		}
+		node->count++;
+		cls->offset[j] = rule[j].offset;
+	}
+
+	duprintf("ipt_classify_build: %u rules, %u keys, %u patterns\n",
+		 i, nnodes, cls->npatterns);
+	newinfo->classify = cls;
+	newinfo->classify_size = size;
+out:
+	vfree(rule);
+}
+
+/* Performance critical - called for every packet.
+ * Looks up the rules the packet can match.  Returns false if it has to
+ * walk all of them: a truncated TCP or UDP header and the TCP fragment
+ * at offset 8 make the tcp/udp matches drop the packet, which must
+ * happen at the same rule as without the index. */
+static bool
+ipt_cls_start(const struct xt_table_info *private, struct ipt_cls_walk *w,
+	      const struct sk_buff *skb, const struct iphdr *ip,
+	      const char *indev, const char *outdev,
+	      const struct xt_match_param *par)
+{
+	const struct ipt_classify *cls = private->classify;
+	const struct ipt_cls_node *node;
+	struct ipt_cls_key pkt, key;
+	bool ports = false;
+	unsigned int i;
+	__be16 _port;
+	u_int32_t h;
+
+	if (cls == NULL)
+		return false;
+
+	strncpy(pkt.iniface, indev, IFNAMSIZ);
+	strncpy(pkt.outiface, outdev, IFNAMSIZ);
+	pkt.proto = ip->protocol;
+	pkt.dport = 0;
+
+	if (ip->protocol == IPPROTO_TCP || ip->protocol == IPPROTO_UDP) {
+		unsigned int hdrlen = ip->protocol == IPPROTO_TCP ?
+				      sizeof(struct tcphdr) :
+				      sizeof(struct udphdr);
+
+		if (par->fragoff == 0) {
+			if (par->thoff + hdrlen > skb->len)
+				return false;
+			/* Both headers start with the source port */
+			pkt.dport = *(__be16 *)skb_header_pointer(skb,
+					par->thoff + sizeof(__be16),
+					sizeof(_port), &_port);
+			ports = true;
+		} else if (par->fragoff == 1 && ip->protocol == IPPROTO_TCP)
+			return false;
+	}
+
+	w->n = 0;
+	for (i = 0; i < cls->npatterns; i++) {
+		memset(&key, 0, sizeof(key));
+		key.pattern = cls->pattern[i];
+		/* Port rules never match fragments and other protocols */
+		if (key.pattern & IPT_CLS_DPORT) {
+			if (!ports)
+				continue;
+			key.dport = pkt.dport;
+		}
+		if (key.pattern & IPT_CLS_IN)
+			memcpy(key.iniface, pkt.iniface, IFNAMSIZ);
+		if (key.pattern & IPT_CLS_OUT)
+			memcpy(key.outiface, pkt.outiface, IFNAMSIZ);
+		if (key.pattern & IPT_CLS_PROTO)
+			key.proto = pkt.proto;
+
+		for (h = cls->bucket[ipt_cls_hash(cls, &key)];
+		     h != IPT_CLS_NONE; h = node->next) {
+			node = &cls->node[h];
+			if (memcmp(&node->key, &key, sizeof(key)) == 0) {
+				w->list[w->n].offset = cls->offset + node->first;
+				w->list[w->n].count = node->count;
+				w->list[w->n].cur = 0;
+				w->n++;
+				break;
+			}
+		}
+	}
+	return true;
+}
+
+/* Performance critical - called for every rule evaluated.
+ * Offset of the first rule at or after pos the packet can match. */
+static inline u_int32_t
+ipt_cls_next(struct ipt_cls_walk *w, u_int32_t pos)
+{
+	u_int32_t next = IPT_CLS_NONE;
+	unsigned int i;
+
+	for (i = 0; i < w->n; i++) {
+		const u_int32_t *offset = w->list[i].offset;
+		u_int32_t count = w->list[i].count;
+		u_int32_t cur = w->list[i].cur;
+		u_int32_t lo = 0, hi = count, mid;
+
+		/* Usually the cursor is still right or a bit behind, only
+		 * jumps to user chains and returns move it further. */
+		if (cur < count && offset[cur] < pos)
+			lo = cur + 1;
+		else if (cur > 0 && offset[cur - 1] >= pos)
+			hi = cur;
+		else
+			lo = hi = cur;
+		while (lo < hi) {
+			mid = (lo + hi) / 2;
+			if (offset[mid] < pos)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		w->list[i].cur = lo;
+		if (lo < count && offset[lo] < next)
+			next = offset[lo];
+	}
+	/* Nothing found in a valid table cannot happen, its last rule is
+	 * unconditional: just evaluate the current rule then. */
+	return next == IPT_CLS_NONE ? pos : next;
+}
+#else
+struct ipt_cls_walk {
+};
+
+static inline void
+ipt_classify_build(struct xt_table_info *newinfo, void *entry0)
+{
+}
+
+static inline bool
+ipt_cls_start(const struct xt_table_info *private, struct ipt_cls_walk *w,
+	      const struct sk_buff *skb, const struct iphdr *ip,
+	      const char *indev, const char *outdev,
+	      const struct xt_match_param *par)
+{
+	return false;
+}
+
+static inline u_int32_t
+ipt_cls_next(struct ipt_cls_walk *w, u_int32_t pos)
+{
+	return pos;
+}
+#endif /* CONFIG_IP_NF_IPTABLES_CLASSIFY */
+
 /* Returns one of the generic firewall policies, like NF_ACCEPT. */
 unsigned int
 ipt_do_table(struct sk_buff *skb,
@@ -320,6 +727,10 @@ ipt_do_table(struct sk_buff *skb,
 	struct xt_table_info *private;
 	struct xt_match_param mtpar;
 	struct xt_target_param tgpar;
+	struct ipt_cls_walk walk;
+	struct ipt_eval_stat *stat;
+	unsigned int evaluated = 0;
+	bool indexed;
 
 	/* Initialization */
 	ip = ip_hdr(skb);
@@ -349,11 +760,19 @@ ipt_do_table(struct sk_buff *skb,
 	/* For return from builtin chain */
 	back = get_entry(table_base, private->underflow[hook]);
 
+	indexed = ipt_cls_start(private, &walk, skb, ip, indev, outdev, &mtpar);
+
 	do {
 		struct ipt_entry_target *t;
 
+		/* Skip the rules the packet cannot match */
+		if (indexed)
+			e = get_entry(table_base,
+				      ipt_cls_next(&walk, (void *)e - table_base));
+
 		IP_NF_ASSERT(e);
 		IP_NF_ASSERT(back);
+		evaluated++;
 		if (!ip_packet_match(ip, indev, outdev,
 		    &e->ip, mtpar.fragoff) ||
 		    IPT_MATCH_ITERATE(e, do_match, skb, &mtpar) != 0) {
@@ -421,12 +840,21 @@ ipt_do_table(struct sk_buff *skb,
 #endif
 		/* Target might have changed stuff. */
 		ip = ip_hdr(skb);
-		if (verdict == IPT_CONTINUE)
+		if (verdict == IPT_CONTINUE) {
 			e = ipt_next_entry(e);
-		else
+			if (indexed)
+				indexed = ipt_cls_start(private, &walk, skb, ip,
+							indev, outdev, &mtpar);
+		} else
 			/* Verdict */
 			break;
 	} while (!hotdrop);
+
+	stat = &__get_cpu_var(ipt_eval_stat);
+	stat->packets++;
+	stat->rules += evaluated;
+	if (indexed)
+		stat->indexed++;
 	xt_info_rdunlock_bh();
 
 #ifdef DEBUG_ALLOW_ALL
@@ -874,6 +1302,7 @@ translate_table(const char *name,
 			memcpy(newinfo->entries[i], entry0, newinfo->size);
 	}
 
+	ipt_classify_build(newinfo, entry0);
 	return ret;
 }
 
@@ -1789,6 +2218,7 @@ translate_compat_table(const char *name,
 		if (newinfo->entries[i] && newinfo->entries[i] != entry1)
 			memcpy(newinfo->entries[i], entry1, newinfo->size);
 
+	ipt_classify_build(newinfo, entry1);
 	*pinfo = newinfo;
 	*pentry0 = entry1;
 	xt_free_table_info(info);
@@ -2075,7 +2505,7 @@ struct xt_table *ipt_register_table(struct net *net,
 	int ret;
 	struct xt_table_info *newinfo;
 	struct xt_table_info bootstrap
-		= { 0, 0, 0, { 0 }, { 0 }, { } };
+		= { 0, 0, 0, { 0 }, { 0 }, NULL, 0, { } };
 	void *loc_cpu_entry;
 	struct xt_table *new_table;
 
@@ -2219,13 +2649,97 @@ static struct xt_match icmp_matchstruct __read_mostly = {
 	.family		= NFPROTO_IPV4,
 };
 
+#ifdef CONFIG_PROC_FS
+static void *ipt_stat_seq_start(struct seq_file *seq, loff_t *pos)
+{
+	int cpu;
+
+	if (*pos == 0)
+		return SEQ_START_TOKEN;
+
+	for (cpu = *pos - 1; cpu < nr_cpu_ids; ++cpu) {
+		if (!cpu_possible(cpu))
+			continue;
+		*pos = cpu + 1;
+		return &per_cpu(ipt_eval_stat, cpu);
+	}
+	return NULL;
+}
+
+static void *ipt_stat_seq_next(struct seq_file *seq, void *v, loff_t *pos)
+{
+	int cpu;
+
+	for (cpu = *pos; cpu < nr_cpu_ids; ++cpu) {
+		if (!cpu_possible(cpu))
+			continue;
+		*pos = cpu + 1;
+		return &per_cpu(ipt_eval_stat, cpu);
+	}
+	return NULL;
+}
+
+static void ipt_stat_seq_stop(struct seq_file *seq, void *v)
+{
+}
+
+static int ipt_stat_seq_show(struct seq_file *seq, void *v)
+{
+	const struct ipt_eval_stat *st = v;
+
+	if (v == SEQ_START_TOKEN) {
+		seq_printf(seq, "packets  rules    indexed\n");
+		return 0;
+	}
+
+	seq_printf(seq, "%08x %08x %08x\n",
+		   st->packets, st->rules, st->indexed);
+	return 0;
+}
+
+static const struct seq_operations ipt_stat_seq_ops = {
+	.start	= ipt_stat_seq_start,
+	.next	= ipt_stat_seq_next,
+	.stop	= ipt_stat_seq_stop,
+	.show	= ipt_stat_seq_show,
+};
+
+static int ipt_stat_seq_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &ipt_stat_seq_ops);
+}
+
+static const struct file_operations ipt_stat_seq_fops = {
+	.owner	 = THIS_MODULE,
+	.open	 = ipt_stat_seq_open,
+	.read	 = seq_read,
+	.llseek	 = seq_lseek,
+	.release = seq_release,
+};
+#endif
+
 static int __net_init ip_tables_net_init(struct net *net)
 {
-	return xt_proto_init(net, NFPROTO_IPV4);
+	int ret;
+
+	ret = xt_proto_init(net, NFPROTO_IPV4);
+	if (ret < 0)
+		return ret;
+#ifdef CONFIG_PROC_FS
+	if (!proc_create("ip_tables", S_IRUGO, net->proc_net_stat,
+			 &ipt_stat_seq_fops)) {
+		xt_proto_fini(net, NFPROTO_IPV4);
+		return -ENOMEM;
+	}
+#endif
+	return 0;
 }
 
 static void __net_exit ip_tables_net_exit(struct net *net)
 {
+#ifdef CONFIG_PROC_FS
+	remove_proc_entry("ip_tables", net->proc_net_stat);
+#endif
 	xt_proto_fini(net, NFPROTO_IPV4);
 }
 
@@ -0,0 +1,371 @@
+/*
+ * net/ipv4/netfilter/ipt_classify_bench.c	iptables rule index benchmark
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * Loads tables of 1000 and 10000 rules of the form
+ *	[-i lo|bench0] -p tcp|udp --dport <port> -j ACCEPT
+ * with a DROP policy, and times packets through them with ipt_do_table().
+ * The packets are read from a pcap file (ethernet or raw IP link type)
+ * through the firmware loader, or generated with random ports in the
+ * range the rules use when no file is given, e.g.
+ *	modprobe ipt_classify_bench pcap=trace.pcap rounds=10
+ *
+ * Run it once with ip_tables.classify=1 and once with classify=0 to
+ * compare the rule index with the full walk; the verdict counts must be
+ * the same, /proc/net/stat/ip_tables has the rules evaluated.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+#include <linux/random.h>
+#include <linux/vmalloc.h>
+#include <linux/firmware.h>
+#include <linux/netdevice.h>
+#include <linux/skbuff.h>
+#include <linux/ip.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <linux/if_ether.h>
+#include <linux/netfilter_ipv4/ip_tables.h>
+#include <linux/netfilter/xt_tcpudp.h>
+#include <net/ip.h>
+#include <net/net_namespace.h>
+
+static unsigned int rules[2] = { 1000, 10000 };
+static unsigned int nr_rules = 2;
+module_param_array(rules, uint, &nr_rules, 0);
+MODULE_PARM_DESC(rules, "Rule counts of the tables to time");
+
+static char *pcap;
+module_param(pcap, charp, 0);
+MODULE_PARM_DESC(pcap, "pcap file to replay, loaded as firmware");
+
+static unsigned int packets = 10000;
+module_param(packets, uint, 0);
+MODULE_PARM_DESC(packets, "Packets generated, or at most read from the file");
+
+static unsigned int rounds = 10;
+module_param(rounds, uint, 0);
+MODULE_PARM_DESC(rounds, "Times each packet goes through a table");
+
+#define BENCH_PORT	1024
+
+struct pcap_hdr {
+	u32	magic;
+	u16	version_major;
+	u16	version_minor;
+	s32	thiszone;
+	u32	sigfigs;
+	u32	snaplen;
+	u32	linktype;
+};
+
+struct pcap_rec {
+	u32	ts_sec;
+	u32	ts_usec;
+	u32	incl_len;
+	u32	orig_len;
+};
+
+#define PCAP_MAGIC		0xa1b2c3d4
+#define PCAP_LINKTYPE_ETHERNET	1
+#define PCAP_LINKTYPE_RAW	101
+
+static struct xt_table bench_table = {
+	.name		= "cls_bench",
+	.valid_hooks	= 1 << NF_INET_LOCAL_IN,
+	.me		= THIS_MODULE,
+	.af		= NFPROTO_IPV4,
+};
+
+struct bench_rule {
+	struct ipt_entry		entry;
+	struct ipt_entry_match		match;
+	union {
+		struct xt_tcp		tcp;
+		struct xt_udp		udp;
+	} u;
+};
+
+#define BENCH_MATCH_SIZE \
+	XT_ALIGN(sizeof(struct ipt_entry_match) + sizeof(struct xt_tcp))
+#define BENCH_RULE_SIZE	(sizeof(struct ipt_entry) + BENCH_MATCH_SIZE + \
+			 XT_ALIGN(sizeof(struct ipt_standard_target)))
+
+/* Rule i matches port BENCH_PORT + i / 2, TCP for even i, UDP for odd;
+ * one rule in four only matches packets from lo, one in four from a
+ * device which does not exist. */
+static void bench_fill_rule(void *pos, unsigned int i)
+{
+	struct bench_rule *r = pos;
+	struct ipt_standard_target *t;
+	u16 port = BENCH_PORT + i / 2;
+	const char *dev = NULL;
+
+	memset(pos, 0, BENCH_RULE_SIZE);
+	if (i % 4 == 1)
+		dev = "lo";
+	else if (i % 4 == 3)
+		dev = "bench0";
+	if (dev) {
+		strcpy(r->entry.ip.iniface, dev);
+		memset(r->entry.ip.iniface_mask, 0xFF, strlen(dev) + 1);
+	}
+	r->entry.target_offset = sizeof(struct ipt_entry) + BENCH_MATCH_SIZE;
+	r->entry.next_offset = BENCH_RULE_SIZE;
+
+	r->match.u.user.match_size = BENCH_MATCH_SIZE;
+	if (i % 2 == 0) {
+		r->entry.ip.proto = IPPROTO_TCP;
+		strcpy(r->match.u.user.name, "tcp");
+		r->u.tcp.spts[1] = 0xFFFF;
+		r->u.tcp.dpts[0] = r->u.tcp.dpts[1] = port;
+	} else {
+		r->entry.ip.proto = IPPROTO_UDP;
+		strcpy(r->match.u.user.name, "udp");
+		r->u.udp.spts[1] = 0xFFFF;
+		r->u.udp.dpts[0] = r->u.udp.dpts[1] = port;
+	}
+
+	t = pos + r->entry.target_offset;
+	t->target.u.user.target_size = XT_ALIGN(sizeof(*t));
+	strcpy(t->target.u.user.name, IPT_STANDARD_TARGET);
+	t->verdict = -NF_ACCEPT - 1;
+}
+
+static struct ipt_replace *bench_build_table(unsigned int n)
+{
+	struct ipt_replace *repl;
+	struct ipt_standard policy = IPT_STANDARD_INIT(NF_DROP);
+	struct ipt_error term = IPT_ERROR_INIT;
+	unsigned int size, i;
+	void *pos;
+
+	size = n * BENCH_RULE_SIZE + sizeof(policy) + sizeof(term);
+	repl = vmalloc(sizeof(*repl) + size);
+	if (repl == NULL)
+		return NULL;
+
+	memset(repl, 0, sizeof(*repl));
+	strcpy(repl->name, bench_table.name);
+	repl->valid_hooks = bench_table.valid_hooks;
+	repl->num_entries = n + 2;
+	repl->size = size;
+	repl->hook_entry[NF_INET_LOCAL_IN] = 0;
+	repl->underflow[NF_INET_LOCAL_IN] = n * BENCH_RULE_SIZE;
+
+	pos = repl->entries;
+	for (i = 0; i < n; i++, pos += BENCH_RULE_SIZE)
+		bench_fill_rule(pos, i);
+	memcpy(pos, &policy, sizeof(policy));
+	memcpy(pos + sizeof(policy), &term, sizeof(term));
+	return repl;
+}
+
+static struct sk_buff *bench_skb(const void *data, unsigned int len)
+{
+	const struct iphdr *iph = data;
+	struct sk_buff *skb;
+
+	if (len < sizeof(*iph) || iph->version != 4 ||
+	    iph->ihl * 4 < sizeof(*iph) || iph->ihl * 4 > len)
+		return NULL;
+
+	skb = alloc_skb(len, GFP_KERNEL);
+	if (skb == NULL)
+		return NULL;
+	memcpy(skb_put(skb, len), data, len);
+	skb_reset_network_header(skb);
+	skb_set_transport_header(skb, iph->ihl * 4);
+	skb->protocol = htons(ETH_P_IP);
+	return skb;
+}
+
+/* Packets with random TCP or UDP ports around the ones of the rules */
+static unsigned int bench_generate(struct sk_buff **skbs, unsigned int max)
+{
+	unsigned int n, span = 1;
+	struct {
+		struct iphdr	ip;
+		struct tcphdr	th;
+	} pkt;
+	struct sk_buff *skb;
+
+	for (n = 0; n < nr_rules; n++)
+		span = max(span, rules[n] / 2 + rules[n] / 8);
+
+	for (n = 0; n < max; n++) {
+		memset(&pkt, 0, sizeof(pkt));
+		pkt.ip.version = 4;
+		pkt.ip.ihl = 5;
+		pkt.ip.ttl = 64;
+		pkt.ip.tot_len = htons(sizeof(pkt));
+		pkt.ip.protocol = random32() & 1 ? IPPROTO_UDP : IPPROTO_TCP;
+		pkt.ip.saddr = htonl(0x0a000000 | (random32() & 0xffffff));
+		pkt.ip.daddr = htonl(0x0a000001);
+		pkt.th.source = htons(32768 + (random32() & 0x7fff));
+		pkt.th.dest = htons(BENCH_PORT + random32() % span);
+		skb = bench_skb(&pkt, sizeof(pkt));
+		if (skb == NULL)
+			break;
+		skbs[n] = skb;
+	}
+	return n;
+}
+
+static unsigned int bench_read_pcap(struct sk_buff **skbs, unsigned int max)
+{
+	const struct firmware *fw;
+	const struct pcap_hdr *hdr;
+	const struct pcap_rec *rec;
+	unsigned int n = 0, hlen;
+	size_t pos;
+	bool swap;
+
+	if (request_firmware(&fw, pcap, &init_net.loopback_dev->dev)) {
+		printk(KERN_ERR "ipt_classify_bench: cannot load %s\n", pcap);
+		return 0;
+	}
+	if (fw->size < sizeof(*hdr))
+		goto out;
+	hdr = (const void *)fw->data;
+	if (hdr->magic == PCAP_MAGIC)
+		swap = false;
+	else if (hdr->magic == swab32(PCAP_MAGIC))
+		swap = true;
+	else
+		goto out;
+
+#define PCAP32(x)	(swap ? swab32(x) : (x))
+	switch (PCAP32(hdr->linktype)) {
+	case PCAP_LINKTYPE_ETHERNET:
+		hlen = ETH_HLEN;
+		break;
+	case PCAP_LINKTYPE_RAW:
+		hlen = 0;
+		break;
+	default:
+		printk(KERN_ERR "ipt_classify_bench: %s: link type %u "
+		       "not supported\n", pcap, PCAP32(hdr->linktype));
+		goto out;
+	}
+
+	pos = sizeof(*hdr);
+	while (n < max && pos + sizeof(*rec) <= fw->size) {
+		const u8 *data;
+		u32 len;
+
+		rec = (const void *)fw->data + pos;
+		len = PCAP32(rec->incl_len);
+		pos += sizeof(*rec);
+		if (len > fw->size - pos)
+			break;
+		data = fw->data + pos;
+		pos += len;
+
+		if (hlen) {
+			if (len < hlen ||
+			    ((struct ethhdr *)data)->h_proto != htons(ETH_P_IP))
+				continue;
+			data += hlen;
+			len -= hlen;
+		}
+		skbs[n] = bench_skb(data, len);
+		if (skbs[n])
+			n++;
+	}
+#undef PCAP32
+out:
+	if (n == 0)
+		printk(KERN_ERR "ipt_classify_bench: no IPv4 packets in %s\n",
+		       pcap);
+	release_firmware(fw);
+	return n;
+}
+
+static int bench_run(unsigned int nrules, struct sk_buff **skbs,
+		     unsigned int n)
+{
+	struct net_device *dev = init_net.loopback_dev;
+	unsigned int accepted = 0, dropped = 0, i, r;
+	struct ipt_replace *repl;
+	struct xt_table *table;
+	ktime_t start;
+	s64 ns;
+
+	repl = bench_build_table(nrules);
+	if (repl == NULL)
+		return -ENOMEM;
+	table = ipt_register_table(&init_net, &bench_table, repl);
+	vfree(repl);
+	if (IS_ERR(table))
+		return PTR_ERR(table);
+
+	start = ktime_get();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < n; i++) {
+			if (ipt_do_table(skbs[i], NF_INET_LOCAL_IN, dev, NULL,
+					 table) == NF_ACCEPT)
+				accepted++;
+			else
+				dropped++;
+		}
+		cond_resched();
+	}
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	printk(KERN_INFO "ipt_classify_bench: %u rules, %u packets x %u: "
+	       "%lld ns/packet, %u accepted, %u dropped\n",
+	       nrules, n, rounds, div_s64(ns, max(n * rounds, 1U)),
+	       accepted, dropped);
+
+	ipt_unregister_table(table);
+	return 0;
+}
+
+static int __init ipt_classify_bench_init(void)
+{
+	struct sk_buff **skbs;
+	unsigned int n, i;
+	int err = 0;
+
+	if (packets == 0 || rounds == 0)
+		return -EINVAL;
+	skbs = vmalloc(packets * sizeof(*skbs));
+	if (skbs == NULL)
+		return -ENOMEM;
+
+	if (pcap)
+		n = bench_read_pcap(skbs, packets);
+	else
+		n = bench_generate(skbs, packets);
+	if (n == 0) {
+		err = -EINVAL;
+		goto out;
+	}
+
+	for (i = 0; i < nr_rules && !err; i++)
+		err = bench_run(rules[i], skbs, n);
+
+	for (i = 0; i < n; i++)
+		kfree_skb(skbs[i]);
+out:
+	vfree(skbs);
+	return err;
+}
+
+static void __exit ipt_classify_bench_exit(void)
+{
+}
+
+module_init(ipt_classify_bench_init);
+module_exit(ipt_classify_bench_exit);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("iptables rule index benchmark");
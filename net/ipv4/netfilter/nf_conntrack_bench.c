@@ -0,0 +1,250 @@
+/*
+ * net/ipv4/netfilter/nf_conntrack_bench.c	Connection tracking churn benchmark
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * Sets up and tears down short lived UDP connections as fast as possible
+ * on one, two, four, ... cpus at the same time.  Every thread generates
+ * packets with tuples of its own, passes each one through nf_conntrack_in()
+ * and nf_conntrack_confirm() as PRE_ROUTING would, keeps the last "batch"
+ * connections alive so the hash table is populated, and kills the oldest
+ * one for every new one.
+ *
+ * Results are printed to the kernel log on module load, e.g.
+ *	modprobe nf_conntrack_bench conns=1000000 threads=8
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/slab.h>
+#include <linux/skbuff.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+#include <linux/netfilter.h>
+#include <net/ip.h>
+#include <net/net_namespace.h>
+#include <net/netfilter/nf_conntrack.h>
+#include <net/netfilter/nf_conntrack_core.h>
+#include <net/netfilter/ipv4/nf_conntrack_ipv4.h>
+
+static unsigned int conns = 100000;
+module_param(conns, uint, 0);
+MODULE_PARM_DESC(conns, "Connections set up and torn down per thread");
+
+static unsigned int threads;
+module_param(threads, uint, 0);
+MODULE_PARM_DESC(threads, "Largest number of threads (default: online cpus)");
+
+static unsigned int batch = 256;
+module_param(batch, uint, 0);
+MODULE_PARM_DESC(batch, "Connections kept alive per thread");
+
+#define BENCH_DADDR	0xc0000201	/* 192.0.2.1 */
+#define BENCH_DPORT	53
+
+struct churn_thread {
+	struct completion	done;
+	unsigned int		id;
+	int			err;
+};
+
+static DECLARE_COMPLETION(churn_start);
+
+/* Thread id in the second octet, the connection number spread over the
+ * rest of the source address and the source port: all tuples differ. */
+static struct sk_buff *churn_skb(unsigned int id, unsigned int i)
+{
+	struct sk_buff *skb;
+	struct iphdr *iph;
+	struct udphdr *uh;
+
+	skb = alloc_skb(LL_MAX_HEADER + sizeof(*iph) + sizeof(*uh), GFP_KERNEL);
+	if (!skb)
+		return NULL;
+	skb_reserve(skb, LL_MAX_HEADER);
+
+	skb_reset_network_header(skb);
+	iph = (struct iphdr *)skb_put(skb, sizeof(*iph));
+	memset(iph, 0, sizeof(*iph));
+	iph->version	= 4;
+	iph->ihl	= sizeof(*iph) >> 2;
+	iph->tot_len	= htons(sizeof(*iph) + sizeof(*uh));
+	iph->ttl	= 64;
+	iph->protocol	= IPPROTO_UDP;
+	iph->saddr	= htonl(0x0a000000 | (id & 0xff) << 16 | i >> 15);
+	iph->daddr	= htonl(BENCH_DADDR);
+	ip_send_check(iph);
+
+	skb_set_transport_header(skb, sizeof(*iph));
+	uh = (struct udphdr *)skb_put(skb, sizeof(*uh));
+	uh->source	= htons(0x8000 | (i & 0x7fff));
+	uh->dest	= htons(BENCH_DPORT);
+	uh->len		= htons(sizeof(*uh));
+	uh->check	= 0;
+
+	skb->protocol	= htons(ETH_P_IP);
+	skb->ip_summed	= CHECKSUM_UNNECESSARY;
+	return skb;
+}
+
+static void churn_release(struct sk_buff *skb)
+{
+	struct nf_conn *ct = (struct nf_conn *)skb->nfct;
+
+	local_bh_disable();
+	nf_ct_kill(ct);
+	kfree_skb(skb);
+	local_bh_enable();
+}
+
+static int churn(unsigned int id)
+{
+	struct sk_buff **ring, *skb;
+	unsigned int i, slot;
+	int err = 0;
+
+	ring = kcalloc(batch, sizeof(*ring), GFP_KERNEL);
+	if (!ring)
+		return -ENOMEM;
+
+	for (i = 0; i < conns; i++) {
+		slot = i % batch;
+		if (ring[slot]) {
+			churn_release(ring[slot]);
+			ring[slot] = NULL;
+		}
+
+		skb = churn_skb(id, i);
+		if (!skb) {
+			err = -ENOMEM;
+			break;
+		}
+
+		local_bh_disable();
+		if (nf_conntrack_in(&init_net, PF_INET, NF_INET_PRE_ROUTING,
+				    skb) != NF_ACCEPT || !skb->nfct ||
+		    nf_conntrack_confirm(skb) != NF_ACCEPT) {
+			local_bh_enable();
+			kfree_skb(skb);
+			err = -EBUSY;
+			break;
+		}
+		local_bh_enable();
+		ring[slot] = skb;
+
+		if (!(i & 1023))
+			cond_resched();
+	}
+
+	for (slot = 0; slot < batch; slot++)
+		if (ring[slot])
+			churn_release(ring[slot]);
+	kfree(ring);
+	return err;
+}
+
+static int churn_thread(void *data)
+{
+	struct churn_thread *t = data;
+
+	wait_for_completion(&churn_start);
+	t->err = churn(t->id);
+	complete(&t->done);
+	return 0;
+}
+
+/* Run n threads on the first n online cpus, returns the elapsed time */
+static s64 churn_run(unsigned int n)
+{
+	struct churn_thread *t;
+	struct task_struct *task;
+	unsigned int i, started = 0;
+	ktime_t start;
+	s64 ns;
+	int cpu;
+
+	t = kcalloc(n, sizeof(*t), GFP_KERNEL);
+	if (!t)
+		return -ENOMEM;
+
+	INIT_COMPLETION(churn_start);
+	for_each_online_cpu(cpu) {
+		if (started == n)
+			break;
+		t[started].id = started;
+		init_completion(&t[started].done);
+		task = kthread_create(churn_thread, &t[started],
+				      "ct_bench/%d", cpu);
+		if (IS_ERR(task))
+			break;
+		kthread_bind(task, cpu);
+		wake_up_process(task);
+		started++;
+	}
+
+	start = ktime_get();
+	complete_all(&churn_start);
+	for (i = 0; i < started; i++)
+		wait_for_completion(&t[i].done);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	if (started < n)
+		ns = -ENOMEM;
+	for (i = 0; i < started; i++)
+		if (t[i].err)
+			ns = t[i].err;
+	kfree(t);
+	return ns;
+}
+
+static void churn_report(unsigned int n, s64 ns)
+{
+	u64 total = (u64)n * conns;
+
+	if (ns < 0)
+		printk(KERN_INFO "nf_conntrack_bench: %3u threads failed (%lld)\n",
+		       n, ns);
+	else
+		printk(KERN_INFO "nf_conntrack_bench: %3u threads %llu conns/s, "
+		       "%llu ns/conn per thread\n", n,
+		       div64_u64(total * NSEC_PER_SEC, max_t(s64, ns, 1)),
+		       div64_u64((u64)ns * n, total));
+}
+
+static int __init nf_conntrack_bench_init(void)
+{
+	unsigned int n, max;
+
+	if (!conns || !batch)
+		return -EINVAL;
+
+	need_ipv4_conntrack();
+
+	max = threads ? min(threads, num_online_cpus()) : num_online_cpus();
+	printk(KERN_INFO "nf_conntrack_bench: %u conns per thread, %u alive, "
+	       "up to %u threads\n", conns, batch, max);
+
+	for (n = 1; n < max; n <<= 1)
+		churn_report(n, churn_run(n));
+	churn_report(max, churn_run(max));
+
+	return 0;
+}
+
+static void __exit nf_conntrack_bench_exit(void)
+{
+}
+
+module_init(nf_conntrack_bench_init);
+module_exit(nf_conntrack_bench_exit);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Connection tracking churn benchmark");
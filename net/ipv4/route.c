@@ -88,6 +88,7 @@
 #include <linux/netfilter_ipv4.h>
 #include <linux/random.h>
 #include <linux/jhash.h>
+#include <linux/hash.h>
 #include <linux/rcupdate.h>
 #include <linux/times.h>
 #include <net/dst.h>
@@ -691,13 +692,14 @@ static inline bool compare_hash_inputs(const struct flowi *fl1,
 		(fl1->iif ^ fl2->iif)) == 0);
 }
 
-static inline int compare_keys(struct flowi *fl1, struct flowi *fl2)
+static inline int compare_keys(const struct flowi *fl1,
+			       const struct flowi *fl2)
 {
 	return ((__force u32)((fl1->nl_u.ip4_u.daddr ^ fl2->nl_u.ip4_u.daddr) |
 		(fl1->nl_u.ip4_u.saddr ^ fl2->nl_u.ip4_u.saddr)) |
 		(fl1->mark ^ fl2->mark) |
-		(*(u16 *)&fl1->nl_u.ip4_u.tos ^
-		 *(u16 *)&fl2->nl_u.ip4_u.tos) |
+		(*(const u16 *)&fl1->nl_u.ip4_u.tos ^
+		 *(const u16 *)&fl2->nl_u.ip4_u.tos) |
 		(fl1->oif ^ fl2->oif) |
 		(fl1->iif ^ fl2->iif)) == 0;
 }
@@ -712,6 +714,208 @@ static inline int rt_is_expired(struct rtable *rth)
 	return rth->rt_genid != rt_genid(dev_net(rth->u.dst.dev));
 }
 
+/*
+ * While caching is disabled every lookup builds a route of its own.  They
+ * are kept on per cpu lists so that device unregistration can find the
+ * ones still held by sockets, and are freed with their last reference.
+ */
+struct uncached_list {
+	spinlock_t		lock;
+	struct list_head	head;
+};
+
+static DEFINE_PER_CPU(struct uncached_list, rt_uncached_list);
+
+static void rt_add_uncached_list(struct rtable *rt)
+{
+	struct uncached_list *ul = &get_cpu_var(rt_uncached_list);
+
+	rt->rt_uncached_list = ul;
+	spin_lock_bh(&ul->lock);
+	list_add_tail(&rt->rt_uncached, &ul->head);
+	spin_unlock_bh(&ul->lock);
+	put_cpu_var(rt_uncached_list);
+}
+
+void rt_flush_dev(struct net_device *dev)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct uncached_list *ul = &per_cpu(rt_uncached_list, cpu);
+		struct rtable *rt;
+
+		spin_lock_bh(&ul->lock);
+		list_for_each_entry(rt, &ul->head, rt_uncached)
+			dst_ifdown(&rt->u.dst, dev, 1);
+		spin_unlock_bh(&ul->lock);
+	}
+}
+
+/*
+ * Instead of a cache, each nexthop remembers on every cpu the last route
+ * that was built through it.  A lookup for the same flow takes it over,
+ * everything else builds a new route straight from the FIB result.
+ */
+static struct rtable *rt_nh_cache_get(struct rtable **slot,
+				      const struct flowi *key)
+{
+	struct rtable *rth;
+
+	rcu_read_lock_bh();
+	rth = rcu_dereference(*per_cpu_ptr(slot, smp_processor_id()));
+	if (rth && compare_keys(&rth->fl, key) && !rt_is_expired(rth) &&
+	    !(rth->u.dst.expires &&
+	      time_after_eq(jiffies, rth->u.dst.expires)) &&
+	    atomic_inc_not_zero(&rth->u.dst.__refcnt)) {
+		rth->u.dst.lastuse = jiffies;
+		rth->u.dst.__use++;
+	} else
+		rth = NULL;
+	rcu_read_unlock_bh();
+
+	return rth;
+}
+
+static void rt_nh_cache_set(struct rtable **slot, struct rtable *rt)
+{
+	struct rtable *old;
+
+	dst_hold(&rt->u.dst);
+	old = xchg(per_cpu_ptr(slot, get_cpu()), rt);
+	put_cpu();
+	if (old)
+		ip_rt_put(old);
+}
+
+static void rt_nh_cache_flush(struct rtable **slot)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct rtable *old = xchg(per_cpu_ptr(slot, cpu), NULL);
+
+		if (old)
+			ip_rt_put(old);
+	}
+}
+
+/*
+ * Learned path MTUs and redirects cannot live in cache entries when there
+ * is no cache, they are attached to the nexthop and applied to every route
+ * built through it for that destination.
+ */
+static DEFINE_SPINLOCK(fnhe_lock);
+
+static inline u32 fnhe_hashfun(__be32 daddr)
+{
+	return hash_32((__force u32)daddr, FNHE_HASH_SHIFT);
+}
+
+static struct fib_nh_exception *fnhe_oldest(struct fnhe_hash_bucket *hash)
+{
+	struct fib_nh_exception *fnhe, *oldest = hash->chain;
+
+	for (fnhe = oldest->fnhe_next; fnhe; fnhe = fnhe->fnhe_next)
+		if (time_before(fnhe->fnhe_stamp, oldest->fnhe_stamp))
+			oldest = fnhe;
+	return oldest;
+}
+
+static void rt_update_exception(struct fib_nh *nh, __be32 daddr, __be32 gw,
+				u32 pmtu, unsigned long expires)
+{
+	struct fnhe_hash_bucket *hash;
+	struct fib_nh_exception *fnhe;
+	int depth = 0;
+
+	spin_lock_bh(&fnhe_lock);
+
+	hash = nh->nh_exceptions;
+	if (!hash) {
+		hash = kzalloc(FNHE_HASH_SIZE * sizeof(*hash), GFP_ATOMIC);
+		if (!hash)
+			goto out_unlock;
+		rcu_assign_pointer(nh->nh_exceptions, hash);
+	}
+	hash += fnhe_hashfun(daddr);
+
+	for (fnhe = hash->chain; fnhe; fnhe = fnhe->fnhe_next) {
+		if (fnhe->fnhe_daddr == daddr)
+			break;
+		depth++;
+	}
+
+	if (fnhe) {
+		if (gw)
+			fnhe->fnhe_gw = gw;
+		if (pmtu)
+			fnhe->fnhe_pmtu = pmtu;
+	} else if (depth > FNHE_RECLAIM_DEPTH) {
+		fnhe = fnhe_oldest(hash);
+		fnhe->fnhe_daddr = daddr;
+		fnhe->fnhe_gw = gw;
+		fnhe->fnhe_pmtu = pmtu;
+	} else {
+		fnhe = kzalloc(sizeof(*fnhe), GFP_ATOMIC);
+		if (!fnhe)
+			goto out_unlock;
+		fnhe->fnhe_next = hash->chain;
+		fnhe->fnhe_daddr = daddr;
+		fnhe->fnhe_gw = gw;
+		fnhe->fnhe_pmtu = pmtu;
+		rcu_assign_pointer(hash->chain, fnhe);
+	}
+	fnhe->fnhe_expires = expires;
+	fnhe->fnhe_stamp = jiffies;
+
+	/*
+	 * The routes the nexthop remembers were built before the exception
+	 * and would keep being handed out without it.
+	 */
+	rt_nh_cache_flush(nh->nh_pcpu_rth_output);
+	rt_nh_cache_flush(nh->nh_pcpu_rth_input);
+
+out_unlock:
+	spin_unlock_bh(&fnhe_lock);
+}
+
+/* Apply what was learned about rt->rt_dst behind nh to a new route */
+static void rt_bind_exception(struct rtable *rt, struct fib_nh *nh)
+{
+	struct fnhe_hash_bucket *hash;
+	struct fib_nh_exception *fnhe;
+
+	rcu_read_lock();
+	hash = rcu_dereference(nh->nh_exceptions);
+	if (!hash)
+		goto out;
+
+	for (fnhe = rcu_dereference(hash[fnhe_hashfun(rt->rt_dst)].chain); fnhe;
+	     fnhe = rcu_dereference(fnhe->fnhe_next)) {
+		if (fnhe->fnhe_daddr != rt->rt_dst)
+			continue;
+		if (time_after_eq(jiffies, fnhe->fnhe_expires))
+			break;
+
+		if (fnhe->fnhe_pmtu && fnhe->fnhe_pmtu < dst_mtu(&rt->u.dst) &&
+		    !dst_metric_locked(&rt->u.dst, RTAX_MTU)) {
+			if (fnhe->fnhe_pmtu <= ip_rt_min_pmtu)
+				rt->u.dst.metrics[RTAX_LOCK-1] |= (1 << RTAX_MTU);
+			rt->u.dst.metrics[RTAX_MTU-1] = fnhe->fnhe_pmtu;
+			rt->u.dst.expires = fnhe->fnhe_expires;
+		}
+		if (fnhe->fnhe_gw && !rt->fl.iif) {
+			rt->rt_gateway = fnhe->fnhe_gw;
+			rt->rt_flags |= RTCF_REDIRECTED;
+			rt->u.dst.expires = fnhe->fnhe_expires;
+		}
+		break;
+	}
+out:
+	rcu_read_unlock();
+}
+
 /*
  * Perform a full scan of hash table and free all entries.
  * Can be called by a softirq or a process.
@@ -1094,12 +1298,10 @@ restart:
 		 * If we drop it here, the callers have no way to resolve routes
 		 * when we're not caching.  Instead, just point *rp at rt, so
 		 * the caller gets a single use out of the route
-		 * Note that we do rt_free on this new route entry, so that
-		 * once its refcount hits zero, we are still able to reap it
-		 * (Thanks Alexey)
-		 * Note also the rt_free uses call_rcu.  We don't actually
-		 * need rcu protection here, this is just our path to get
-		 * on the route gc list.
+		 * The route is marked DST_NOCACHE, so that it is freed as
+		 * soon as its refcount hits zero instead of waiting for the
+		 * dst garbage collector, and may be revalidated by sockets
+		 * holding it through ipv4_dst_check().
 		 */
 
 		if (rt->rt_type == RTN_UNICAST || rt->fl.iif == 0) {
@@ -1113,7 +1315,9 @@ restart:
 			}
 		}
 
-		rt_free(rt);
+		rt->u.dst.flags |= DST_NOCACHE;
+		rt->u.dst.obsolete = -1;
+		rt_add_uncached_list(rt);
 		goto skip_hashing;
 	}
 
@@ -1332,6 +1536,42 @@ static void rt_del(unsigned hash, struct rtable *rt)
 	spin_unlock_bh(rt_hash_lock_addr(hash));
 }
 
+static void rt_pmtu_exception(struct net *net, __be32 daddr, u32 mtu)
+{
+	struct flowi fl = { .nl_u = { .ip4_u = { .daddr = daddr } } };
+	struct fib_result res;
+
+	if (fib_lookup(net, &fl, &res))
+		return;
+	if (res.fi) {
+		if (mtu < ip_rt_min_pmtu)
+			mtu = ip_rt_min_pmtu;
+		rt_update_exception(&FIB_RES_NH(res), daddr, 0, mtu,
+				    jiffies + ip_rt_mtu_expires);
+	}
+	fib_res_put(&res);
+}
+
+static void rt_redirect_exception(struct net *net, __be32 old_gw,
+				  __be32 daddr, __be32 new_gw,
+				  struct net_device *dev)
+{
+	struct flowi fl = { .nl_u = { .ip4_u = { .daddr = daddr } } };
+	struct fib_result res;
+
+	if (fib_lookup(net, &fl, &res))
+		return;
+	/* Only believe the gateway we would have used */
+	if (res.fi && res.type == RTN_UNICAST &&
+	    FIB_RES_GW(res) == old_gw && FIB_RES_DEV(res) == dev) {
+		rt_update_exception(&FIB_RES_NH(res), daddr, new_gw, 0,
+				    jiffies + ip_rt_gc_timeout);
+		/* Routes handed out earlier still point to old_gw */
+		rt_cache_invalidate(net);
+	}
+	fib_res_put(&res);
+}
+
 void ip_rt_redirect(__be32 old_gw, __be32 daddr, __be32 new_gw,
 		    __be32 saddr, struct net_device *dev)
 {
@@ -1352,9 +1592,6 @@ void ip_rt_redirect(__be32 old_gw, __be32 daddr, __be32 new_gw,
 	    || ipv4_is_zeronet(new_gw))
 		goto reject_redirect;
 
-	if (!rt_caching(net))
-		goto reject_redirect;
-
 	if (!IN_DEV_SHARED_MEDIA(in_dev)) {
 		if (!inet_addr_onlink(in_dev, new_gw, old_gw))
 			goto reject_redirect;
@@ -1365,6 +1602,12 @@ void ip_rt_redirect(__be32 old_gw, __be32 daddr, __be32 new_gw,
 			goto reject_redirect;
 	}
 
+	if (!rt_caching(net)) {
+		rt_redirect_exception(net, old_gw, daddr, new_gw, dev);
+		in_dev_put(in_dev);
+		return;
+	}
+
 	for (i = 0; i < 2; i++) {
 		for (k = 0; k < 2; k++) {
 			unsigned hash = rt_hash(daddr, skeys[i], ikeys[k],
@@ -1632,6 +1875,19 @@ unsigned short ip_rt_frag_needed(struct net *net, struct iphdr *iph,
 	if (ipv4_config.no_pmtu_disc)
 		return 0;
 
+	if (!rt_caching(net)) {
+		unsigned short mtu = new_mtu;
+
+		if (new_mtu < 68 || new_mtu >= old_mtu) {
+			/* BSD 4.2 compatibility hack :-( */
+			if (mtu == 0 && old_mtu >= 68 + (iph->ihl << 2))
+				old_mtu -= iph->ihl << 2;
+			mtu = guess_mtu(old_mtu);
+		}
+		rt_pmtu_exception(net, daddr, mtu);
+		return mtu;
+	}
+
 	for (k = 0; k < 2; k++) {
 		for (i = 0; i < 2; i++) {
 			unsigned hash = rt_hash(daddr, skeys[i], ikeys[k],
@@ -1694,12 +1950,22 @@ static void ip_rt_update_pmtu(struct dst_entry *dst, u32 mtu)
 		}
 		dst->metrics[RTAX_MTU-1] = mtu;
 		dst_set_expires(dst, ip_rt_mtu_expires);
+		if (dst->flags & DST_NOCACHE)
+			rt_pmtu_exception(dev_net(dst->dev),
+					  ((struct rtable *)dst)->rt_dst, mtu);
 		call_netevent_notifiers(NETEVENT_PMTU_UPDATE, dst);
 	}
 }
 
 static struct dst_entry *ipv4_dst_check(struct dst_entry *dst, u32 cookie)
 {
+	struct rtable *rt = (struct rtable *) dst;
+
+	/* Uncached routes stay usable until the tables change or a learned
+	 * path MTU times out, cached ones are checked on removal only. */
+	if (dst->obsolete < 0 && !rt_is_expired(rt) &&
+	    !(dst->expires && time_after_eq(jiffies, dst->expires)))
+		return dst;
 	return NULL;
 }
 
@@ -1709,6 +1975,14 @@ static void ipv4_dst_destroy(struct dst_entry *dst)
 	struct inet_peer *peer = rt->peer;
 	struct in_device *idev = rt->idev;
 
+	if (rt->rt_uncached_list) {
+		struct uncached_list *ul = rt->rt_uncached_list;
+
+		spin_lock_bh(&ul->lock);
+		list_del(&rt->rt_uncached);
+		spin_unlock_bh(&ul->lock);
+	}
+
 	if (peer) {
 		rt->peer = NULL;
 		inet_putpeer(peer);
@@ -2046,6 +2320,7 @@ static int ip_mkroute_input(struct sk_buff *skb,
 			    __be32 daddr, __be32 saddr, u32 tos)
 {
 	struct rtable* rth = NULL;
+	struct rtable **slot = NULL;
 	int err;
 	unsigned hash;
 
@@ -2054,6 +2329,16 @@ static int ip_mkroute_input(struct sk_buff *skb,
 		fib_select_multipath(fl, res);
 #endif
 
+	if (res->fi && !rt_caching(dev_net(in_dev->dev))) {
+		slot = FIB_RES_NH(*res).nh_pcpu_rth_input;
+		rth = rt_nh_cache_get(slot, fl);
+		if (rth) {
+			RT_CACHE_STAT_INC(in_hit);
+			skb_dst_set(skb, &rth->u.dst);
+			return 0;
+		}
+	}
+
 	/* create a routing cache entry */
 	err = __mkroute_input(skb, res, in_dev, daddr, saddr, tos, &rth);
 	if (err)
@@ -2062,7 +2347,10 @@ static int ip_mkroute_input(struct sk_buff *skb,
 	/* put it into the cache */
 	hash = rt_hash(daddr, saddr, fl->iif,
 		       rt_genid(dev_net(rth->u.dst.dev)));
-	return rt_intern_hash(hash, rth, NULL, skb);
+	err = rt_intern_hash(hash, rth, NULL, skb);
+	if (!err && slot && (rth->u.dst.flags & DST_NOCACHE))
+		rt_nh_cache_set(slot, rth);
+	return err;
 }
 
 /*
@@ -2441,6 +2729,8 @@ static int __mkroute_output(struct rtable **result,
 	rt_set_nexthop(rth, res, 0);
 
 	rth->rt_flags = flags;
+	if (res->fi && !rt_caching(dev_net(dev_out)))
+		rt_bind_exception(rth, &FIB_RES_NH(*res));
 
 	*result = rth;
  cleanup:
@@ -2458,12 +2748,35 @@ static int ip_mkroute_output(struct rtable **rp,
 			     unsigned flags)
 {
 	struct rtable *rth = NULL;
-	int err = __mkroute_output(&rth, res, fl, oldflp, dev_out, flags);
+	struct rtable **slot = NULL;
+	int err;
 	unsigned hash;
+
+	if (res->fi && res->type == RTN_UNICAST &&
+	    !rt_caching(dev_net(dev_out))) {
+		struct flowi key = { .nl_u = { .ip4_u =
+					       { .daddr = oldflp->fl4_dst,
+						 .saddr = oldflp->fl4_src,
+						 .tos = RT_FL_TOS(oldflp) } },
+				     .mark = oldflp->mark,
+				     .oif = oldflp->oif };
+
+		slot = FIB_RES_NH(*res).nh_pcpu_rth_output;
+		rth = rt_nh_cache_get(slot, &key);
+		if (rth) {
+			RT_CACHE_STAT_INC(out_hit);
+			*rp = rth;
+			return 0;
+		}
+	}
+
+	err = __mkroute_output(&rth, res, fl, oldflp, dev_out, flags);
 	if (err == 0) {
 		hash = rt_hash(oldflp->fl4_dst, oldflp->fl4_src, oldflp->oif,
 			       rt_genid(dev_net(dev_out)));
 		err = rt_intern_hash(hash, rth, rp, NULL);
+		if (!err && slot && ((*rp)->u.dst.flags & DST_NOCACHE))
+			rt_nh_cache_set(slot, *rp);
 	}
 
 	return err;
@@ -3402,6 +3715,7 @@ __setup("rhash_entries=", set_rhash_entries);
 int __init ip_rt_init(void)
 {
 	int rc = 0;
+	int cpu;
 
 #ifdef CONFIG_NET_CLS_ROUTE
 	ip_rt_acct = __alloc_percpu(256 * sizeof(struct ip_rt_acct), __alignof__(struct ip_rt_acct));
@@ -3415,6 +3729,13 @@ int __init ip_rt_init(void)
 
 	ipv4_dst_blackhole_ops.kmem_cachep = ipv4_dst_ops.kmem_cachep;
 
+	for_each_possible_cpu(cpu) {
+		struct uncached_list *ul = &per_cpu(rt_uncached_list, cpu);
+
+		spin_lock_init(&ul->lock);
+		INIT_LIST_HEAD(&ul->head);
+	}
+
 	rt_hash_table = (struct rt_hash_bucket *)
 		alloc_large_system_hash("IP route cache",
 					sizeof(struct rt_hash_bucket),
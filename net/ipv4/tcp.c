@@ -271,6 +271,7 @@
 #include <net/ip.h>
 #include <net/netdma.h>
 #include <net/sock.h>
+#include <net/busy_poll.h>
 
 #include <asm/uaccess.h>
 #include <asm/ioctls.h>
@@ -457,7 +458,7 @@ unsigned int tcp_poll(struct file *file, struct socket *sock, poll_table *wait)
 	}
 	/* This barrier is coupled with smp_wmb() in tcp_reset() */
 	smp_rmb();
-	if (sk->sk_err)
+	if (sk->sk_err || !skb_queue_empty(&sk->sk_error_queue))
 		mask |= POLLERR;
 
 	return mask;
@@ -900,16 +901,58 @@ static inline int select_size(struct sock *sk)
 	return tmp;
 }
 
+/*
+ * Pin the user page backing @from and append up to @copy bytes of it to
+ * @skb as a page fragment.  Returns the number of bytes attached, 0 when
+ * @skb has no fragment slot left, or a negative error.
+ */
+static int tcp_zerocopy_add_frag(struct sock *sk, struct sk_buff *skb,
+				 unsigned char __user *from, int copy)
+{
+	unsigned long addr = (unsigned long)from;
+	int i = skb_shinfo(skb)->nr_frags;
+	int off = offset_in_page(addr);
+	struct page *page;
+
+	if (copy > PAGE_SIZE - off)
+		copy = PAGE_SIZE - off;
+
+	if (!sk_wmem_schedule(sk, copy))
+		return -ENOMEM;
+
+	if (get_user_pages_fast(addr & PAGE_MASK, 1, 0, &page) != 1)
+		return -EFAULT;
+
+	if (skb_can_coalesce(skb, i, page, off)) {
+		put_page(page);
+		skb_shinfo(skb)->frags[i - 1].size += copy;
+	} else if (i < MAX_SKB_FRAGS) {
+		skb_fill_page_desc(skb, i, page, off, copy);
+	} else {
+		put_page(page);
+		return 0;
+	}
+
+	skb->len += copy;
+	skb->data_len += copy;
+	skb->truesize += copy;
+	sk->sk_wmem_queued += copy;
+	sk_mem_charge(sk, copy);
+	return copy;
+}
+
 int tcp_sendmsg(struct kiocb *iocb, struct socket *sock, struct msghdr *msg,
 		size_t size)
 {
 	struct sock *sk = sock->sk;
 	struct iovec *iov;
 	struct tcp_sock *tp = tcp_sk(sk);
+	struct ubuf_info *uarg = NULL;
 	struct sk_buff *skb;
 	int iovlen, flags;
 	int mss_now, size_goal;
 	int err, copied;
+	int zc = 0;
 	long timeo;
 
 	lock_sock(sk);
@@ -923,6 +966,28 @@ int tcp_sendmsg(struct kiocb *iocb, struct socket *sock, struct msghdr *msg,
 		if ((err = sk_stream_wait_connect(sk, &timeo)) != 0)
 			goto out_err;
 
+	if ((flags & MSG_ZEROCOPY) && sock_flag(sk, SOCK_ZEROCOPY)) {
+		struct dst_entry *dst = __sk_dst_get(sk);
+
+		uarg = sock_zerocopy_alloc(sk);
+		if (!uarg) {
+			err = -ENOBUFS;
+			goto out_err;
+		}
+
+		/* User pages can only be handed to devices that gather
+		 * and checksum themselves.  Local peers would keep them
+		 * pinned for as long as the data sits unread, so copy for
+		 * those and tell userspace through the notification.
+		 */
+		if ((sk->sk_route_caps & NETIF_F_SG) &&
+		    (sk->sk_route_caps & NETIF_F_ALL_CSUM) &&
+		    !(dst && dst->dev && (dst->dev->flags & IFF_LOOPBACK)))
+			zc = 1;
+		else
+			uarg->zerocopy = 0;
+	}
+
 	/* This should be in poll */
 	clear_bit(SOCK_ASYNC_NOSPACE, &sk->sk_socket->flags);
 
@@ -983,7 +1048,26 @@ new_segment:
 				copy = seglen;
 
 			/* Where to copy to? */
-			if (skb_tailroom(skb) > 0) {
+			if (zc) {
+				if (skb_zcopy(skb) != uarg) {
+					if (skb_zcopy(skb)) {
+						tcp_mark_push(tp, skb);
+						goto new_segment;
+					}
+					skb_zcopy_set(skb, uarg);
+				}
+
+				err = tcp_zerocopy_add_frag(sk, skb, from, copy);
+				if (err == -ENOMEM)
+					goto wait_for_memory;
+				if (err < 0)
+					goto do_fault;
+				if (!err) {
+					tcp_mark_push(tp, skb);
+					goto new_segment;
+				}
+				copy = err;
+			} else if (skb_tailroom(skb) > 0) {
 				/* We have some space in skb head. Superb! */
 				if (copy > skb_tailroom(skb))
 					copy = skb_tailroom(skb);
@@ -1098,8 +1182,11 @@ wait_for_memory:
 	}
 
 out:
-	if (copied)
+	if (copied) {
 		tcp_push(sk, flags, mss_now, tp->nonagle);
+		sock_zerocopy_put(uarg);
+	} else
+		sock_zerocopy_put_abort(uarg);
 	TCP_CHECK_TIMER(sk);
 	release_sock(sk);
 	return copied;
@@ -1118,6 +1205,7 @@ do_error:
 	if (copied)
 		goto out;
 out_err:
+	sock_zerocopy_put_abort(uarg);
 	err = sk_stream_error(sk, flags, err);
 	TCP_CHECK_TIMER(sk);
 	release_sock(sk);
@@ -1374,6 +1462,13 @@ int tcp_recvmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 	struct sk_buff *skb;
 	u32 urg_hole = 0;
 
+	if (unlikely(flags & MSG_ERRQUEUE))
+		return ip_recv_error(sk, msg, len);
+
+	if (sk_can_busy_loop(sk) && skb_queue_empty(&sk->sk_receive_queue) &&
+	    (sk->sk_state == TCP_ESTABLISHED))
+		sk_busy_loop(sk, nonblock);
+
 	lock_sock(sk);
 
 	TCP_CHECK_TIMER(sk);
@@ -2344,6 +2439,11 @@ void tcp_get_info(struct sock *sk, struct tcp_info *info)
 	info->tcpi_rcv_space = tp->rcvq_space.space;
 
 	info->tcpi_total_retrans = tp->total_retrans;
+
+	info->tcpi_pacing_rate = sysctl_tcp_pacing && tp->pacing_rate != ~0U ?
+				 tp->pacing_rate : ~0ULL;
+	info->tcpi_tx_queued = atomic_read(&sk->sk_wmem_alloc) - 1;
+	info->tcpi_tsq_throttled = tp->tsq_throttled;
 }
 
 EXPORT_SYMBOL_GPL(tcp_get_info);
@@ -2969,6 +3069,8 @@ void __init tcp_init(void)
 	       tcp_hashinfo.ehash_size, tcp_hashinfo.bhash_size);
 
 	tcp_register_congestion_control(&tcp_reno);
+
+	tcp_tasklet_init();
 }
 
 EXPORT_SYMBOL(tcp_close);
@@ -3132,6 +3132,32 @@ static void tcp_cong_avoid(struct sock *sk, u32 ack, u32 in_flight)
 	tcp_sk(sk)->snd_cwnd_stamp = tcp_time_stamp;
 }
 
+/* Pacing rate for internal pacing: cwnd * mss per srtt, scaled by
+ * sysctl_tcp_pacing_ss_ratio percent in slow start so that cwnd can keep
+ * doubling every RTT, by sysctl_tcp_pacing_ca_ratio percent otherwise.
+ */
+static void tcp_update_pacing_rate(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	u64 rate;
+
+	/* srtt is stored as jiffies << 3 */
+	if (!tp->srtt) {
+		tp->pacing_rate = ~0U;
+		return;
+	}
+
+	rate = (u64)tp->mss_cache * max(tp->snd_cwnd, tp->packets_out);
+	if (tp->snd_cwnd < tp->snd_ssthresh / 2)
+		rate *= sysctl_tcp_pacing_ss_ratio;
+	else
+		rate *= sysctl_tcp_pacing_ca_ratio;
+	rate *= 8 * HZ;
+	do_div(rate, 100 * tp->srtt);
+
+	tp->pacing_rate = min_t(u64, rate, ~0U);
+}
+
 /* Restart timer after forward progress on connection.
  * RFC2988 recommends to restart timer to now+rto.
  */
@@ -3664,6 +3690,9 @@ static int tcp_ack(struct sock *sk, struct sk_buff *skb, int flag)
 			tcp_cong_avoid(sk, ack, prior_in_flight);
 	}
 
+	if (sysctl_tcp_pacing)
+		tcp_update_pacing_rate(sk);
+
 	if ((flag & FLAG_FORWARD_PROGRESS) || !(flag & FLAG_NOT_DUP))
 		dst_confirm(sk->sk_dst_cache);
 
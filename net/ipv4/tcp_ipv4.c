@@ -65,6 +65,7 @@
 #include <net/icmp.h>
 #include <net/inet_hashtables.h>
 #include <net/tcp.h>
+#include <net/busy_poll.h>
 #include <net/transp_v6.h>
 #include <net/ipv6.h>
 #include <net/inet_common.h>
@@ -440,12 +441,12 @@ void tcp_v4_err(struct sk_buff *icmp_skb, u32 info)
 	}
 
 	switch (sk->sk_state) {
-		struct request_sock *req, **prev;
+		struct request_sock *req;
 	case TCP_LISTEN:
 		if (sock_owned_by_user(sk))
 			goto out;
 
-		req = inet_csk_search_req(sk, &prev, th->dest,
+		req = inet_csk_search_req(sk, th->dest,
 					  iph->daddr, iph->saddr);
 		if (!req)
 			goto out;
@@ -466,7 +467,7 @@ void tcp_v4_err(struct sk_buff *icmp_skb, u32 info)
 		 * created socket, and POSIX does not want network
 		 * errors returned from accept().
 		 */
-		inet_csk_reqsk_queue_drop(sk, req, prev);
+		inet_csk_reqsk_queue_drop(sk, req);
 		goto out;
 
 	case TCP_SYN_SENT:
@@ -1437,12 +1438,11 @@ static struct sock *tcp_v4_hnd_req(struct sock *sk, struct sk_buff *skb)
 	struct tcphdr *th = tcp_hdr(skb);
 	const struct iphdr *iph = ip_hdr(skb);
 	struct sock *nsk;
-	struct request_sock **prev;
 	/* Find possible connection requests. */
-	struct request_sock *req = inet_csk_search_req(sk, &prev, th->source,
+	struct request_sock *req = inet_csk_search_req(sk, th->source,
 						       iph->saddr, iph->daddr);
 	if (req)
-		return tcp_check_req(sk, skb, req, prev);
+		return tcp_check_req(sk, skb, req);
 
 	nsk = inet_lookup_established(sock_net(sk), &tcp_hashinfo, iph->saddr,
 			th->source, iph->daddr, th->dest, inet_iif(skb));
@@ -1558,6 +1558,52 @@ csum_err:
 	goto discard;
 }
 
+/* A new connection request only touches the SYN queue, which has locks of
+ * its own, so it is answered without taking the listener lock: a busy
+ * listener would otherwise serialise connection setup over all cpus.
+ * Everything else, a retransmitted SYN matching a pending request
+ * included, goes through tcp_v4_do_rcv() under the lock as before.
+ * MD5 keys are only stable under the listener lock, listeners using them
+ * take the slow path too.
+ *
+ * Returns 1 if the skb was consumed.
+ */
+static int tcp_v4_listen_syn(struct sock *sk, struct sk_buff *skb)
+{
+	struct request_sock_queue *queue = &inet_csk(sk)->icsk_accept_queue;
+	const struct tcphdr *th = tcp_hdr(skb);
+	const struct iphdr *iph = ip_hdr(skb);
+	int handled = 0;
+
+#ifdef CONFIG_TCP_MD5SIG
+	if (tcp_sk(sk)->md5sig_info)
+		return 0;
+#endif
+
+	if (skb->len < tcp_hdrlen(skb) || tcp_checksum_complete(skb)) {
+		TCP_INC_STATS_BH(sock_net(sk), TCP_MIB_INERRS);
+		kfree_skb(skb);
+		return 1;
+	}
+
+	/*
+	 * listen_opt stays until an RCU grace period after the socket left
+	 * LISTEN state, see reqsk_queue_destroy().  The SYN queue helpers
+	 * take syn_wait_lock themselves, only around the table accesses.
+	 */
+	rcu_read_lock();
+	if (queue->listen_opt != NULL &&
+	    !inet_csk_search_req(sk, th->source, iph->saddr, iph->daddr)) {
+		tcp_v4_conn_request(sk, skb);
+		handled = 1;
+	}
+	rcu_read_unlock();
+
+	if (handled)
+		kfree_skb(skb);
+	return handled;
+}
+
 /*
  *	From tcp_input.c
  */
@@ -1618,8 +1664,15 @@ process:
 	if (sk_filter(sk, skb))
 		goto discard_and_relse;
 
+	sk_mark_napi_id(sk, skb);
 	skb->dev = NULL;
 
+	if (sk->sk_state == TCP_LISTEN && th->syn && !th->ack && !th->rst &&
+	    tcp_v4_listen_syn(sk, skb)) {
+		sock_put(sk);
+		return 0;
+	}
+
 	bh_lock_sock_nested(sk);
 	ret = 0;
 	if (!sock_owned_by_user(sk)) {
@@ -1903,6 +1956,7 @@ static inline struct inet_timewait_sock *tw_next(struct inet_timewait_sock *tw)
 static void *listening_get_next(struct seq_file *seq, void *cur)
 {
 	struct inet_connection_sock *icsk;
+	struct listen_sock *lopt;
 	struct hlist_nulls_node *node;
 	struct sock *sk = cur;
 	struct inet_listen_hashbucket *ilb;
@@ -1923,6 +1977,7 @@ static void *listening_get_next(struct seq_file *seq, void *cur)
 		struct request_sock *req = cur;
 
 		icsk = inet_csk(st->syn_wait_sk);
+		lopt = icsk->icsk_accept_queue.listen_opt;
 		req = req->dl_next;
 		while (1) {
 			while (req) {
@@ -1932,10 +1987,12 @@ static void *listening_get_next(struct seq_file *seq, void *cur)
 				}
 				req = req->dl_next;
 			}
-			if (++st->sbucket >= icsk->icsk_accept_queue.listen_opt->nr_table_entries)
+			spin_unlock(reqsk_queue_lockp(lopt, st->sbucket));
+			if (++st->sbucket >= lopt->nr_table_entries)
 				break;
 get_req:
-			req = icsk->icsk_accept_queue.listen_opt->syn_table[st->sbucket];
+			spin_lock(reqsk_queue_lockp(lopt, st->sbucket));
+			req = lopt->syn_table[st->sbucket];
 		}
 		sk	  = sk_next(st->syn_wait_sk);
 		st->state = TCP_SEQ_STATE_LISTENING;
@@ -1962,6 +2019,7 @@ start_req:
 			st->syn_wait_sk = sk;
 			st->state	= TCP_SEQ_STATE_OPENREQ;
 			st->sbucket	= 0;
+			lopt = icsk->icsk_accept_queue.listen_opt;
 			goto get_req;
 		}
 		read_unlock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
@@ -2160,6 +2218,9 @@ static void tcp_seq_stop(struct seq_file *seq, void *v)
 	case TCP_SEQ_STATE_OPENREQ:
 		if (v) {
 			struct inet_connection_sock *icsk = inet_csk(st->syn_wait_sk);
+			struct listen_sock *lopt = icsk->icsk_accept_queue.listen_opt;
+
+			spin_unlock(reqsk_queue_lockp(lopt, st->sbucket));
 			read_unlock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
 		}
 	case TCP_SEQ_STATE_LISTENING:
@@ -2431,6 +2492,7 @@ struct proto tcp_prot = {
 	.getsockopt		= tcp_getsockopt,
 	.recvmsg		= tcp_recvmsg,
 	.backlog_rcv		= tcp_v4_do_rcv,
+	.release_cb		= tcp_release_cb,
 	.hash			= inet_hash,
 	.unhash			= inet_unhash,
 	.get_port		= inet_csk_get_port,
@@ -59,6 +59,17 @@ int sysctl_tcp_base_mss __read_mostly = 512;
 /* By default, RFC2861 behavior.  */
 int sysctl_tcp_slow_start_after_idle __read_mostly = 1;
 
+/* Default TSQ limit of two TSO segments */
+int sysctl_tcp_limit_output_bytes __read_mostly = 131072;
+
+/* Spread the congestion window over the RTT instead of sending it in
+ * bursts.  The pacing rate is cwnd/srtt scaled by the ratio (in percent)
+ * for the current phase, slow start or congestion avoidance.
+ */
+int sysctl_tcp_pacing __read_mostly;
+int sysctl_tcp_pacing_ss_ratio __read_mostly = 200;
+int sysctl_tcp_pacing_ca_ratio __read_mostly = 120;
+
 /* Account for new data that has been sent to the network. */
 static void tcp_event_new_data_sent(struct sock *sk, struct sk_buff *skb)
 {
@@ -657,7 +668,11 @@ static int tcp_transmit_skb(struct sock *sk, struct sk_buff *skb, int clone_it,
 
 	skb_push(skb, tcp_header_size);
 	skb_reset_transport_header(skb);
-	skb_set_owner_w(skb, sk);
+	skb_orphan(skb);
+	skb->sk = sk;
+	skb->destructor = sysctl_tcp_limit_output_bytes > 0 ?
+			  tcp_wfree : sock_wfree;
+	atomic_add(skb->truesize, &sk->sk_wmem_alloc);
 
 	/* Build TCP header and checksum it. */
 	th = tcp_hdr(skb);
@@ -1532,6 +1547,66 @@ static int tcp_mtu_probe(struct sock *sk)
 	return -1;
 }
 
+/* TCP Small Queues:
+ * Limit the number of bytes a socket has in qdisc and device queues to
+ * sysctl_tcp_limit_output_bytes, less when pacing at a low rate.  A bulk
+ * sender then cannot fill the queues with megabytes of data, adding
+ * latency for every other flow on the host.  When the limit is hit, the
+ * socket is marked TSQ_THROTTLED and tcp_wfree() resumes transmission
+ * from a per cpu tasklet once one of its packets has left the host.
+ */
+static int tcp_small_queue_check(struct sock *sk, const struct sk_buff *skb)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	int limit = sysctl_tcp_limit_output_bytes;
+
+	if (limit <= 0)
+		return 0;
+
+	/* About 1 ms worth of data at the pacing rate, at least two packets */
+	if (sysctl_tcp_pacing && tp->pacing_rate != ~0U)
+		limit = min_t(u32, limit, max_t(u32, 2 * skb->truesize,
+						tp->pacing_rate >> 10));
+
+	if (atomic_read(&sk->sk_wmem_alloc) < limit)
+		return 0;
+
+	set_bit(TSQ_THROTTLED, &tp->tsq_flags);
+	/* TX completion may have happened before TSQ_THROTTLED was set,
+	 * in which case nobody would wake us up: test again.
+	 */
+	smp_mb__after_clear_bit();
+	if (atomic_read(&sk->sk_wmem_alloc) < limit)
+		return 0;
+
+	tp->tsq_throttled++;
+	return 1;
+}
+
+/* Internal pacing: after each packet, hold back the next one for the
+ * time the last one takes at the pacing rate.  tcp_pace_kick() resumes
+ * transmission when the timer expires.
+ */
+static inline int tcp_pacing_check(struct sock *sk)
+{
+	return sysctl_tcp_pacing &&
+	       hrtimer_active(&tcp_sk(sk)->pacing_timer);
+}
+
+static void tcp_internal_pacing(struct sock *sk, const struct sk_buff *skb)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	u64 len_ns;
+
+	if (!sysctl_tcp_pacing || !tp->pacing_rate || tp->pacing_rate == ~0U)
+		return;
+
+	len_ns = (u64)skb->len * NSEC_PER_SEC;
+	do_div(len_ns, tp->pacing_rate);
+	hrtimer_start(&tp->pacing_timer, ktime_add_ns(ktime_get(), len_ns),
+		      HRTIMER_MODE_ABS_PINNED);
+}
+
 /* This routine writes packets to the network.  It advances the
  * send_head.  This happens as incoming acks open up the remote
  * window for us.
@@ -1567,6 +1642,9 @@ static int tcp_write_xmit(struct sock *sk, unsigned int mss_now, int nonagle,
 	while ((skb = tcp_send_head(sk))) {
 		unsigned int limit;
 
+		if (tcp_pacing_check(sk))
+			break;
+
 		tso_segs = tcp_init_tso_segs(sk, skb, mss_now);
 		BUG_ON(!tso_segs);
 
@@ -1596,11 +1674,16 @@ static int tcp_write_xmit(struct sock *sk, unsigned int mss_now, int nonagle,
 		    unlikely(tso_fragment(sk, skb, limit, mss_now)))
 			break;
 
+		if (tcp_small_queue_check(sk, skb))
+			break;
+
 		TCP_SKB_CB(skb)->when = tcp_time_stamp;
 
 		if (unlikely(tcp_transmit_skb(sk, skb, 1, gfp)))
 			break;
 
+		tcp_internal_pacing(sk, skb);
+
 		/* Advance the send_head.  This one is sent out.
 		 * This call will increment packets_out.
 		 */
@@ -1620,6 +1703,136 @@ static int tcp_write_xmit(struct sock *sk, unsigned int mss_now, int nonagle,
 	return !tp->packets_out && tcp_send_head(sk);
 }
 
+struct tsq_tasklet {
+	struct tasklet_struct	tasklet;
+	struct list_head	head;	/* queue of tcp sockets */
+};
+static DEFINE_PER_CPU(struct tsq_tasklet, tsq_tasklet);
+
+static void tcp_tsq_handler(struct sock *sk)
+{
+	if ((1 << sk->sk_state) &
+	    (TCPF_ESTABLISHED | TCPF_FIN_WAIT1 | TCPF_CLOSING |
+	     TCPF_CLOSE_WAIT | TCPF_LAST_ACK))
+		tcp_write_xmit(sk, tcp_current_mss(sk), tcp_sk(sk)->nonagle,
+			       0, GFP_ATOMIC);
+}
+
+/* One tasklet per cpu tries to send more skbs for the sockets queued
+ * by tcp_wfree() and tcp_pace_kick().  If a socket is owned by the
+ * user, the work is deferred to tcp_release_cb().
+ */
+static void tcp_tasklet_func(unsigned long data)
+{
+	struct tsq_tasklet *tsq = (struct tsq_tasklet *)data;
+	LIST_HEAD(list);
+	unsigned long flags;
+	struct list_head *q, *n;
+	struct tcp_sock *tp;
+	struct sock *sk;
+
+	local_irq_save(flags);
+	list_splice_init(&tsq->head, &list);
+	local_irq_restore(flags);
+
+	list_for_each_safe(q, n, &list) {
+		tp = list_entry(q, struct tcp_sock, tsq_node);
+		list_del(&tp->tsq_node);
+
+		sk = (struct sock *)tp;
+		bh_lock_sock(sk);
+		if (!sock_owned_by_user(sk))
+			tcp_tsq_handler(sk);
+		else
+			set_bit(TCP_TSQ_DEFERRED, &tp->tsq_flags);
+		bh_unlock_sock(sk);
+
+		clear_bit(TSQ_QUEUED, &tp->tsq_flags);
+		/* Drop the reference taken when the socket was queued */
+		sk_free(sk);
+	}
+}
+
+/**
+ * tcp_release_cb - tcp release_sock() callback
+ * @sk: socket
+ *
+ * Called from release_sock() to perform protocol dependent actions
+ * deferred while the socket was owned by the user.
+ */
+void tcp_release_cb(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+
+	if (test_and_clear_bit(TCP_TSQ_DEFERRED, &tp->tsq_flags))
+		tcp_tsq_handler(sk);
+}
+EXPORT_SYMBOL(tcp_release_cb);
+
+void __init tcp_tasklet_init(void)
+{
+	int i;
+
+	for_each_possible_cpu(i) {
+		struct tsq_tasklet *tsq = &per_cpu(tsq_tasklet, i);
+
+		INIT_LIST_HEAD(&tsq->head);
+		tasklet_init(&tsq->tasklet, tcp_tasklet_func,
+			     (unsigned long)tsq);
+	}
+}
+
+/* The caller holds a reference on sk_wmem_alloc and has set TSQ_QUEUED */
+static void tcp_tsq_queue(struct tcp_sock *tp)
+{
+	struct tsq_tasklet *tsq;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	tsq = &__get_cpu_var(tsq_tasklet);
+	list_add(&tp->tsq_node, &tsq->head);
+	tasklet_schedule(&tsq->tasklet);
+	local_irq_restore(flags);
+}
+
+/*
+ * Write buffer destructor automatically called from kfree_skb.
+ * We can't xmit new skbs from this context, as we might already
+ * hold qdisc lock.
+ */
+void tcp_wfree(struct sk_buff *skb)
+{
+	struct sock *sk = skb->sk;
+	struct tcp_sock *tp = tcp_sk(sk);
+
+	if (test_and_clear_bit(TSQ_THROTTLED, &tp->tsq_flags) &&
+	    !test_and_set_bit(TSQ_QUEUED, &tp->tsq_flags)) {
+		/* Keep a reference on the socket, tcp_tasklet_func()
+		 * releases it.
+		 */
+		atomic_sub(skb->truesize - 1, &sk->sk_wmem_alloc);
+		tcp_tsq_queue(tp);
+	} else {
+		sock_wfree(skb);
+	}
+}
+
+/* Pacing timer, runs in hardirq context: let the tasklet send */
+enum hrtimer_restart tcp_pace_kick(struct hrtimer *timer)
+{
+	struct tcp_sock *tp = container_of(timer, struct tcp_sock,
+					   pacing_timer);
+	struct sock *sk = (struct sock *)tp;
+
+	if (!test_and_set_bit(TSQ_QUEUED, &tp->tsq_flags)) {
+		if (atomic_inc_not_zero(&sk->sk_wmem_alloc))
+			tcp_tsq_queue(tp);
+		else
+			clear_bit(TSQ_QUEUED, &tp->tsq_flags);
+	}
+	return HRTIMER_NORESTART;
+}
+
 /* Push out any pending frames which were held back due to
  * TCP_CORK or attempt at coalescing tiny packets.
  * The socket must be locked by the caller.
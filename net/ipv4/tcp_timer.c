@@ -36,8 +36,18 @@ static void tcp_keepalive_timer (unsigned long data);
 
 void tcp_init_xmit_timers(struct sock *sk)
 {
+	struct tcp_sock *tp = tcp_sk(sk);
+
 	inet_csk_init_xmit_timers(sk, &tcp_write_timer, &tcp_delack_timer,
 				  &tcp_keepalive_timer);
+
+	/* Children are cloned from the listener, start TSQ afresh */
+	tp->tsq_flags = 0;
+	tp->tsq_throttled = 0;
+	INIT_LIST_HEAD(&tp->tsq_node);
+	tp->pacing_rate = ~0U;
+	hrtimer_init(&tp->pacing_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	tp->pacing_timer.function = tcp_pace_kick;
 }
 
 EXPORT_SYMBOL(tcp_init_xmit_timers);
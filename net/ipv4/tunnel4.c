@@ -10,7 +10,9 @@
 #include <linux/skbuff.h>
 #include <net/icmp.h>
 #include <net/ip.h>
+#include <net/inet_common.h>
 #include <net/protocol.h>
+#include <net/route.h>
 #include <net/xfrm.h>
 
 static struct xfrm_tunnel *tunnel4_handlers;
@@ -132,9 +134,45 @@ static void tunnel64_err(struct sk_buff *skb, u32 info)
 }
 #endif
 
+/* IP in IP needs no headers of its own, the inner packet is merged with
+ * the same rules as the outer one when the tunnel ends here. */
+static struct sk_buff **tunnel4_gro_receive(struct sk_buff **head,
+					    struct sk_buff *skb)
+{
+	struct sk_buff **pp = NULL;
+	const struct iphdr *iph = skb_gro_network_header(skb);
+	unsigned int nhoff;
+
+	if (!tunnel4_handlers || skb->pkt_type != PACKET_HOST ||
+	    inet_addr_type(dev_net(skb->dev), iph->daddr) != RTN_LOCAL) {
+		NAPI_GRO_CB(skb)->flush = 1;
+		return NULL;
+	}
+
+	nhoff = skb_network_offset(skb);
+	pp = inet_gro_receive(head, skb);
+	skb_set_network_header(skb, nhoff);
+
+	return pp;
+}
+
+static int tunnel4_gro_complete(struct sk_buff *skb)
+{
+	int nhoff = skb_network_offset(skb);
+	int err;
+
+	skb_set_network_header(skb, nhoff + ip_hdrlen(skb));
+	err = inet_gro_complete(skb);
+	skb_set_network_header(skb, nhoff);
+
+	return err;
+}
+
 static const struct net_protocol tunnel4_protocol = {
 	.handler	=	tunnel4_rcv,
 	.err_handler	=	tunnel4_err,
+	.gro_receive	=	tunnel4_gro_receive,
+	.gro_complete	=	tunnel4_gro_complete,
 	.no_policy	=	1,
 	.netns_ok	=	1,
 };
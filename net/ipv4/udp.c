@@ -104,6 +104,7 @@
 #include <net/route.h>
 #include <net/checksum.h>
 #include <net/xfrm.h>
+#include <net/busy_poll.h>
 #include "udp_impl.h"
 
 struct udp_table udp_table;
@@ -121,6 +122,10 @@ EXPORT_SYMBOL(sysctl_udp_wmem_min);
 atomic_t udp_memory_allocated;
 EXPORT_SYMBOL(udp_memory_allocated);
 
+/* Set once any socket has asked for UDP_GRO, until then GRO stays out
+ * of the way of UDP entirely. */
+static int udp_gro_needed __read_mostly;
+
 #define PORTS_PER_CHAIN (65536 / UDP_HTABLE_SIZE)
 
 static int udp_lib_lport_inuse(struct net *net, __u16 num,
@@ -510,6 +515,37 @@ static void udp4_hwcsum_outgoing(struct sock *sk, struct sk_buff *skb,
 	}
 }
 
+/*
+ * Set up a buffer holding many datagrams of cork.gso_size payload each,
+ * to be cut apart by the device or by GSO on the way out.
+ */
+static int udp_gso_setup(struct sock *sk, struct sk_buff *skb)
+{
+	struct inet_sock *inet = inet_sk(sk);
+	unsigned int mss = inet->cork.gso_size;
+	unsigned int datalen = udp_sk(sk)->len - sizeof(struct udphdr);
+	unsigned int hlen = skb_transport_header(skb) - skb_network_header(skb) +
+			    sizeof(struct udphdr);
+
+	if (hlen + mss > inet->cork.fragsize)
+		return -EINVAL;
+	if (sk->sk_no_check == UDP_CSUM_NOXMIT)
+		return -EINVAL;
+	if (skb->ip_summed != CHECKSUM_PARTIAL ||
+	    inet->cork.dst->header_len)
+		return -EIO;
+
+	if (datalen <= mss) {
+		/* Fits in one datagram, send it as is */
+		skb_shinfo(skb)->gso_size = 0;
+		skb_shinfo(skb)->gso_type = 0;
+		return 0;
+	}
+
+	skb_shinfo(skb)->gso_segs = DIV_ROUND_UP(datalen, mss);
+	return 0;
+}
+
 /*
  * Push out all pending data as one UDP datagram. Socket is locked.
  */
@@ -528,6 +564,14 @@ static int udp_push_pending_frames(struct sock *sk)
 	if ((skb = skb_peek(&sk->sk_write_queue)) == NULL)
 		goto out;
 
+	if (inet->cork.gso_size) {
+		err = udp_gso_setup(sk, skb);
+		if (err) {
+			ip_flush_pending_frames(sk);
+			goto out;
+		}
+	}
+
 	/*
 	 * Create a UDP header
 	 */
@@ -576,6 +620,32 @@ out:
 	return err;
 }
 
+/* Returns 1 if there are IP level control messages left to parse */
+static int udp_cmsg_send(struct sock *sk, struct msghdr *msg, u16 *gso_size)
+{
+	struct cmsghdr *cmsg;
+	int need_ip = 0;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (!CMSG_OK(msg, cmsg))
+			return -EINVAL;
+		if (cmsg->cmsg_level != SOL_UDP) {
+			need_ip = 1;
+			continue;
+		}
+		switch (cmsg->cmsg_type) {
+		case UDP_SEGMENT:
+			if (cmsg->cmsg_len != CMSG_LEN(sizeof(__u16)))
+				return -EINVAL;
+			*gso_size = *(__u16 *)CMSG_DATA(cmsg);
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+	return need_ip;
+}
+
 int udp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 		size_t len)
 {
@@ -605,6 +675,7 @@ int udp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 
 	ipc.opt = NULL;
 	ipc.shtx.flags = 0;
+	ipc.gso_size = up->gso_size;
 
 	if (up->pending) {
 		/*
@@ -656,7 +727,9 @@ int udp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 	if (err)
 		return err;
 	if (msg->msg_controllen) {
-		err = ip_cmsg_send(sock_net(sk), msg, &ipc);
+		err = udp_cmsg_send(sk, msg, &ipc.gso_size);
+		if (err > 0)
+			err = ip_cmsg_send(sock_net(sk), msg, &ipc);
 		if (err)
 			return err;
 		if (ipc.opt)
@@ -993,6 +1066,11 @@ try_again:
 	}
 	if (inet->cmsg_flags)
 		ip_cmsg_recv(msg, skb);
+	if (udp_sk(sk)->gro_enabled && skb_is_gso(skb)) {
+		int gso_size = skb_shinfo(skb)->gso_size;
+
+		put_cmsg(msg, SOL_UDP, UDP_GRO, sizeof(gso_size), &gso_size);
+	}
 
 	err = copied;
 	if (flags & MSG_TRUNC)
@@ -1063,6 +1141,9 @@ static int __udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 	int is_udplite = IS_UDPLITE(sk);
 	int rc;
 
+	if (inet_sk(sk)->daddr)
+		sk_mark_napi_id(sk, skb);
+
 	if ((rc = sock_queue_rcv_skb(sk, skb)) < 0) {
 		/* Note that an ENOMEM error is charged twice */
 		if (rc == -ENOMEM) {
@@ -1089,7 +1170,7 @@ drop:
  * Note that in the success and error cases, the skb is assumed to
  * have either been requeued or freed.
  */
-int udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
+static int udp_queue_rcv_one_skb(struct sock *sk, struct sk_buff *skb)
 {
 	struct udp_sock *up = udp_sk(sk);
 	int rc;
@@ -1189,6 +1270,41 @@ drop:
 	return -1;
 }
 
+/* Split a coalesced datagram for a socket that has not asked for them */
+static struct sk_buff *udp_rcv_segment(struct sk_buff *skb)
+{
+	struct sk_buff *segs;
+
+	__skb_push(skb, skb->data - skb_network_header(skb));
+	segs = skb_gso_segment(skb, NETIF_F_SG | NETIF_F_HW_CSUM);
+	if (IS_ERR(segs))
+		segs = NULL;
+	if (segs)
+		consume_skb(skb);
+	else
+		kfree_skb(skb);
+	return segs;
+}
+
+int udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
+{
+	struct sk_buff *next, *segs;
+
+	if (likely(!skb_is_gso(skb) || udp_sk(sk)->gro_enabled))
+		return udp_queue_rcv_one_skb(sk, skb);
+
+	segs = udp_rcv_segment(skb);
+	for (skb = segs; skb; skb = next) {
+		next = skb->next;
+		skb->next = NULL;
+		__skb_pull(skb, skb_transport_offset(skb));
+		/* No resubmission, GRO is never done for encapsulation */
+		if (udp_queue_rcv_one_skb(sk, skb) > 0)
+			kfree_skb(skb);
+	}
+	return 0;
+}
+
 /*
  *	Multicasts and broadcasts go to each listener.
  *
@@ -1434,6 +1550,22 @@ int udp_lib_setsockopt(struct sock *sk, int level, int optname,
 		}
 		break;
 
+	case UDP_SEGMENT:
+		if (is_udplite)
+			return -ENOPROTOOPT;
+		if (val < 0 || val > USHORT_MAX)
+			return -EINVAL;
+		up->gso_size = val;
+		break;
+
+	case UDP_GRO:
+		if (is_udplite)
+			return -ENOPROTOOPT;
+		if (val)
+			udp_gro_needed = 1;
+		up->gro_enabled = val ? 1 : 0;
+		break;
+
 	/*
 	 * 	UDP-Lite's partial checksum coverage (RFC 3828).
 	 */
@@ -1516,6 +1648,14 @@ int udp_lib_getsockopt(struct sock *sk, int level, int optname,
 		val = up->encap_type;
 		break;
 
+	case UDP_SEGMENT:
+		val = up->gso_size;
+		break;
+
+	case UDP_GRO:
+		val = up->gro_enabled;
+		break;
+
 	/* The following two cannot be changed on UDP sockets, the return is
 	 * always 0 (which corresponds to the full checksum coverage of UDP). */
 	case UDPLITE_SEND_CSCOV:
@@ -1912,3 +2052,179 @@ out:
 	return segs;
 }
 
+/* Split a train of equal sized datagrams, each segment gets a UDP header
+ * of its own with the length and checksum fixed up. */
+static struct sk_buff *__udp4_gso_segment(struct sk_buff *skb, int features)
+{
+	struct sk_buff *segs = ERR_PTR(-EINVAL);
+	struct sk_buff *seg;
+	const struct iphdr *iph;
+	struct udphdr *uh;
+	unsigned int mss, ulen;
+	__wsum csum;
+
+	mss = skb_shinfo(skb)->gso_size;
+	if (unlikely(skb->len <= sizeof(*uh) + mss))
+		goto out;
+
+	if (unlikely(!pskb_may_pull(skb, sizeof(*uh))))
+		goto out;
+
+	if (skb_gso_ok(skb, features | NETIF_F_GSO_ROBUST)) {
+		/* Packet is from an untrusted source, reset gso_segs. */
+		int type = skb_shinfo(skb)->gso_type;
+
+		if (unlikely(type & ~(SKB_GSO_UDP_L4 | SKB_GSO_DODGY)))
+			goto out;
+
+		skb_shinfo(skb)->gso_segs = DIV_ROUND_UP(skb->len - sizeof(*uh),
+							 mss);
+
+		segs = NULL;
+		goto out;
+	}
+
+	__skb_pull(skb, sizeof(*uh));
+
+	segs = skb_segment(skb, features);
+	if (IS_ERR(segs))
+		goto out;
+
+	for (seg = segs; seg; seg = seg->next) {
+		iph = ip_hdr(seg);
+		uh = udp_hdr(seg);
+		ulen = seg->len - skb_transport_offset(seg);
+
+		uh->len = htons(ulen);
+		if (seg->ip_summed == CHECKSUM_PARTIAL) {
+			uh->check = ~csum_tcpudp_magic(iph->saddr, iph->daddr,
+						       ulen, IPPROTO_UDP, 0);
+			continue;
+		}
+
+		uh->check = 0;
+		csum = csum_partial(uh, sizeof(*uh), seg->csum);
+		uh->check = csum_tcpudp_magic(iph->saddr, iph->daddr, ulen,
+					      IPPROTO_UDP, csum);
+		if (uh->check == 0)
+			uh->check = CSUM_MANGLED_0;
+	}
+out:
+	return segs;
+}
+
+struct sk_buff *udp4_gso_segment(struct sk_buff *skb, int features)
+{
+	if (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4)
+		return __udp4_gso_segment(skb, features);
+	return udp4_ufo_fragment(skb, features);
+}
+
+/* Only datagrams for sockets that asked for it with UDP_GRO are merged:
+ * everybody else expects datagram boundaries to be kept.  A train ends
+ * with the first datagram shorter than the ones before it. */
+struct sk_buff **udp4_gro_receive(struct sk_buff **head, struct sk_buff *skb)
+{
+	struct sk_buff **pp = NULL;
+	struct sk_buff *p;
+	struct iphdr *iph;
+	struct udphdr *uh, *uh2;
+	unsigned int hlen, off, len;
+	struct sock *sk;
+	int flush = 1;
+
+	if (!udp_gro_needed || skb->pkt_type != PACKET_HOST)
+		goto out;
+
+	off = skb_gro_offset(skb);
+	hlen = off + sizeof(*uh);
+	uh = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, hlen)) {
+		uh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!uh))
+			goto out;
+	}
+
+	len = skb_gro_len(skb);
+	if (ntohs(uh->len) != len || len <= sizeof(*uh))
+		goto out;
+
+	iph = skb_gro_network_header(skb);
+	if (uh->check) {
+		switch (skb->ip_summed) {
+		case CHECKSUM_COMPLETE:
+			if (!csum_tcpudp_magic(iph->saddr, iph->daddr, len,
+					       IPPROTO_UDP, skb->csum)) {
+				skb->ip_summed = CHECKSUM_UNNECESSARY;
+				break;
+			}
+
+			/* fall through */
+		case CHECKSUM_NONE:
+			goto out;
+		}
+	}
+
+	sk = __udp4_lib_lookup(dev_net(skb->dev), iph->saddr, uh->source,
+			       iph->daddr, uh->dest, skb->dev->ifindex,
+			       &udp_table);
+	if (!sk)
+		goto out;
+	if (sk->sk_family != AF_INET || !udp_sk(sk)->gro_enabled ||
+	    udp_sk(sk)->encap_type) {
+		sock_put(sk);
+		goto out;
+	}
+	sock_put(sk);
+
+	skb_gro_pull(skb, sizeof(*uh));
+	len -= sizeof(*uh);
+	flush = 0;
+
+	for (; (p = *head); head = &p->next) {
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		uh2 = udp_hdr(p);
+		if (*(u32 *)&uh->source != *(u32 *)&uh2->source) {
+			NAPI_GRO_CB(p)->same_flow = 0;
+			continue;
+		}
+
+		/* A larger datagram starts a train of its own */
+		if (NAPI_GRO_CB(p)->flush || len > skb_shinfo(p)->gso_size ||
+		    skb_gro_receive(head, skb)) {
+			pp = head;
+			break;
+		}
+
+		if (len < skb_shinfo(p)->gso_size)
+			pp = head;
+		break;
+	}
+
+out:
+	NAPI_GRO_CB(skb)->flush |= flush;
+
+	return pp;
+}
+
+int udp4_gro_complete(struct sk_buff *skb)
+{
+	const struct iphdr *iph = ip_hdr(skb);
+	struct udphdr *uh = udp_hdr(skb);
+	unsigned int ulen = skb->len - skb_transport_offset(skb);
+
+	uh->len = htons(ulen);
+	uh->check = ~csum_tcpudp_magic(iph->saddr, iph->daddr, ulen,
+				       IPPROTO_UDP, 0);
+	skb->csum_start = skb_transport_header(skb) - skb->head;
+	skb->csum_offset = offsetof(struct udphdr, check);
+	skb->ip_summed = CHECKSUM_PARTIAL;
+
+	skb_shinfo(skb)->gso_type = SKB_GSO_UDP_L4;
+	skb_shinfo(skb)->gso_segs = NAPI_GRO_CB(skb)->count;
+
+	return 0;
+}
+
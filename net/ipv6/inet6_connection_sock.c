@@ -57,7 +57,7 @@ EXPORT_SYMBOL_GPL(inet6_csk_bind_conflict);
  * request_sock (formerly open request) hash tables.
  */
 static u32 inet6_synq_hash(const struct in6_addr *raddr, const __be16 rport,
-			   const u32 rnd, const u16 synq_hsize)
+			   const u32 rnd)
 {
 	u32 a = (__force u32)raddr->s6_addr32[0];
 	u32 b = (__force u32)raddr->s6_addr32[1];
@@ -72,25 +72,28 @@ static u32 inet6_synq_hash(const struct in6_addr *raddr, const __be16 rport,
 	b += (__force u32)rport;
 	__jhash_mix(a, b, c);
 
-	return c & (synq_hsize - 1);
+	return c;
 }
 
 struct request_sock *inet6_csk_search_req(const struct sock *sk,
-					  struct request_sock ***prevp,
 					  const __be16 rport,
 					  const struct in6_addr *raddr,
 					  const struct in6_addr *laddr,
 					  const int iif)
 {
-	const struct inet_connection_sock *icsk = inet_csk(sk);
-	struct listen_sock *lopt = icsk->icsk_accept_queue.listen_opt;
-	struct request_sock *req, **prev;
-
-	for (prev = &lopt->syn_table[inet6_synq_hash(raddr, rport,
-						     lopt->hash_rnd,
-						     lopt->nr_table_entries)];
-	     (req = *prev) != NULL;
-	     prev = &req->dl_next) {
+	struct request_sock_queue *queue = &inet_csk(sk)->icsk_accept_queue;
+	struct listen_sock *lopt;
+	struct request_sock *req;
+	spinlock_t *lock;
+	u32 hash;
+
+	read_lock(&queue->syn_wait_lock);
+	lopt = queue->listen_opt;
+	hash = inet6_synq_hash(raddr, rport, lopt->hash_rnd);
+	lock = reqsk_queue_lockp(lopt, hash);
+	spin_lock(lock);
+	for (req = *reqsk_queue_bucket(lopt, hash); req != NULL;
+	     req = req->dl_next) {
 		const struct inet6_request_sock *treq = inet6_rsk(req);
 
 		if (inet_rsk(req)->rmt_port == rport &&
@@ -99,12 +102,13 @@ struct request_sock *inet6_csk_search_req(const struct sock *sk,
 		    ipv6_addr_equal(&treq->loc_addr, laddr) &&
 		    (!treq->iif || treq->iif == iif)) {
 			WARN_ON(req->sk != NULL);
-			*prevp = prev;
-			return req;
+			break;
 		}
 	}
+	spin_unlock(lock);
+	read_unlock(&queue->syn_wait_lock);
 
-	return NULL;
+	return req;
 }
 
 EXPORT_SYMBOL_GPL(inet6_csk_search_req);
@@ -117,7 +121,7 @@ void inet6_csk_reqsk_queue_hash_add(struct sock *sk,
 	struct listen_sock *lopt = icsk->icsk_accept_queue.listen_opt;
 	const u32 h = inet6_synq_hash(&inet6_rsk(req)->rmt_addr,
 				      inet_rsk(req)->rmt_port,
-				      lopt->hash_rnd, lopt->nr_table_entries);
+				      lopt->hash_rnd);
 
 	reqsk_queue_hash_req(&icsk->icsk_accept_queue, h, req, timeout);
 	inet_csk_reqsk_queue_added(sk, timeout);
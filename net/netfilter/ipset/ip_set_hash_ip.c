@@ -0,0 +1,175 @@
+/* Copyright (C) 2003-2010 Jozsef Kadlecsik <kadlec@blackhole.kfki.hu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* Kernel module implementing an IP set type: the hash:ip type */
+
+#include <linux/module.h>
+#include <linux/ip.h>
+#include <linux/skbuff.h>
+#include <linux/errno.h>
+#include <linux/netlink.h>
+#include <net/netlink.h>
+
+#include <linux/netfilter.h>
+#include <linux/netfilter/ipset/ip_set.h>
+#include <linux/netfilter/ipset/ip_set_ahash.h>
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Jozsef Kadlecsik <kadlec@blackhole.kfki.hu>");
+MODULE_DESCRIPTION("hash:ip type of IP sets");
+MODULE_ALIAS("ip_set_hash:ip");
+
+/* Member elements */
+struct hash_ip4_elem {
+	__be32 ip;
+};
+
+#define HASH_IP4_KEY_LEN	(sizeof(struct hash_ip4_elem) / sizeof(u32))
+
+static int
+hash_ip4_data_list(struct sk_buff *skb, const u32 *key)
+{
+	const struct hash_ip4_elem *e = (const struct hash_ip4_elem *)key;
+
+	NLA_PUT_IPADDR4(skb, IPSET_ATTR_IP, e->ip);
+	return 0;
+
+nla_put_failure:
+	return 1;
+}
+
+static int
+hash_ip4_kadt(struct ip_set *set, const struct sk_buff *skb,
+	      enum ipset_adt adt, u8 pf, u8 dim, u8 flags)
+{
+	ipset_adtfn adtfn = set->variant->adt[adt];
+	struct hash_ip4_elem e;
+
+	e.ip = ip4addr(skb, flags & IPSET_DIM_ONE_SRC);
+
+	return adtfn(set, &e, flags);
+}
+
+static int
+hash_ip4_uadt(struct ip_set *set, struct nlattr *tb[],
+	      enum ipset_adt adt, u32 *lineno, u32 flags)
+{
+	const struct ip_set_hash *h = set->data;
+	ipset_adtfn adtfn = set->variant->adt[adt];
+	struct hash_ip4_elem e;
+	u32 ip, ip_to;
+	int ret;
+
+	if (unlikely(!tb[IPSET_ATTR_IP]))
+		return -IPSET_ERR_PROTOCOL;
+
+	if (tb[IPSET_ATTR_LINENO])
+		*lineno = nla_get_u32(tb[IPSET_ATTR_LINENO]);
+
+	ret = ip_set_get_hostipaddr4(tb[IPSET_ATTR_IP], &ip);
+	if (ret)
+		return ret;
+
+	if (adt == IPSET_TEST) {
+		e.ip = htonl(ip);
+		return adtfn(set, &e, flags);
+	}
+
+	if (tb[IPSET_ATTR_IP_TO]) {
+		ret = ip_set_get_hostipaddr4(tb[IPSET_ATTR_IP_TO], &ip_to);
+		if (ret)
+			return ret;
+		if (ip > ip_to)
+			swap(ip, ip_to);
+	} else if (tb[IPSET_ATTR_CIDR]) {
+		u8 cidr = nla_get_u8(tb[IPSET_ATTR_CIDR]);
+
+		if (!cidr || cidr > 32)
+			return -IPSET_ERR_INVALID_CIDR;
+		ip &= ip_set_hostmask(cidr);
+		ip_to = ip | ~ip_set_hostmask(cidr);
+	} else
+		ip_to = ip;
+
+	/* The range is walked with the set locked: bound it */
+	if (ip_to - ip >= h->maxelem)
+		return -IPSET_ERR_HASH_FULL;
+
+	for (;;) {
+		e.ip = htonl(ip);
+		ret = adtfn(set, &e, flags);
+		if (ret && !ip_set_eexist(ret, flags))
+			return ret;
+		if (ip == ip_to)
+			break;
+		ip++;
+	}
+	return 0;
+}
+
+static int
+hash_ip4_list(const struct ip_set *set, struct sk_buff *skb,
+	      struct netlink_callback *cb)
+{
+	return ahash_list(set, skb, cb, hash_ip4_data_list);
+}
+
+static const struct ip_set_type_variant hash_ip4_variant = {
+	.kadt	= hash_ip4_kadt,
+	.uadt	= hash_ip4_uadt,
+	.adt	= {
+		[IPSET_ADD] = ahash_add,
+		[IPSET_DEL] = ahash_del,
+		[IPSET_TEST] = ahash_test,
+	},
+	.destroy = ahash_destroy,
+	.flush	= ahash_flush,
+	.head	= ahash_head,
+	.list	= hash_ip4_list,
+	.same_set = ahash_same_set,
+};
+
+static int
+hash_ip_create(struct ip_set *set, struct nlattr *tb[], u32 flags)
+{
+	return ahash_create(set, tb, HASH_IP4_KEY_LEN, &hash_ip4_variant);
+}
+
+static struct ip_set_type hash_ip_type __read_mostly = {
+	.name		= "hash:ip",
+	.protocol	= IPSET_PROTOCOL,
+	.dimension	= IPSET_DIM_ONE,
+	.family		= AF_INET,
+	.revision	= 0,
+	.create		= hash_ip_create,
+	.create_policy	= {
+		[IPSET_ATTR_HASHSIZE]	= { .type = NLA_U32 },
+		[IPSET_ATTR_MAXELEM]	= { .type = NLA_U32 },
+	},
+	.adt_policy	= {
+		[IPSET_ATTR_IP]		= { .type = NLA_NESTED },
+		[IPSET_ATTR_IP_TO]	= { .type = NLA_NESTED },
+		[IPSET_ATTR_CIDR]	= { .type = NLA_U8 },
+		[IPSET_ATTR_LINENO]	= { .type = NLA_U32 },
+	},
+	.me		= THIS_MODULE,
+};
+
+static int __init
+hash_ip_init(void)
+{
+	return ip_set_type_register(&hash_ip_type);
+}
+
+static void __exit
+hash_ip_fini(void)
+{
+	ip_set_type_unregister(&hash_ip_type);
+}
+
+module_init(hash_ip_init);
+module_exit(hash_ip_fini);
@@ -0,0 +1,201 @@
+/* Copyright (C) 2003-2010 Jozsef Kadlecsik <kadlec@blackhole.kfki.hu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* Kernel module implementing an IP set type: the hash:net type */
+
+#include <linux/module.h>
+#include <linux/ip.h>
+#include <linux/skbuff.h>
+#include <linux/errno.h>
+#include <linux/netlink.h>
+#include <net/netlink.h>
+
+#include <linux/netfilter.h>
+#include <linux/netfilter/ipset/ip_set.h>
+#include <linux/netfilter/ipset/ip_set_ahash.h>
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Jozsef Kadlecsik <kadlec@blackhole.kfki.hu>");
+MODULE_DESCRIPTION("hash:net type of IP sets");
+MODULE_ALIAS("ip_set_hash:net");
+
+#define HOST_MASK	32
+
+/* Member elements: the network address is stored masked */
+struct hash_net4_elem {
+	__be32 ip;
+	u8 cidr;
+	u8 padding[3];
+};
+
+#define HASH_NET4_KEY_LEN	(sizeof(struct hash_net4_elem) / sizeof(u32))
+
+static int
+hash_net4_data_list(struct sk_buff *skb, const u32 *key)
+{
+	const struct hash_net4_elem *e = (const struct hash_net4_elem *)key;
+
+	NLA_PUT_IPADDR4(skb, IPSET_ATTR_IP, e->ip);
+	NLA_PUT_U8(skb, IPSET_ATTR_CIDR, e->cidr);
+	return 0;
+
+nla_put_failure:
+	return 1;
+}
+
+/* The element counts per prefix length tell which masks to try */
+static int
+hash_net4_add(struct ip_set *set, void *value, u32 flags)
+{
+	struct ip_set_hash *h = set->data;
+	const struct hash_net4_elem *e = value;
+	int ret;
+
+	ret = ahash_add(set, value, flags);
+	if (!ret)
+		h->nets[e->cidr]++;
+	return ret;
+}
+
+static int
+hash_net4_del(struct ip_set *set, void *value, u32 flags)
+{
+	struct ip_set_hash *h = set->data;
+	const struct hash_net4_elem *e = value;
+	int ret;
+
+	ret = ahash_del(set, value, flags);
+	if (!ret)
+		h->nets[e->cidr]--;
+	return ret;
+}
+
+/* A host address matches the most specific network stored for it */
+static int
+hash_net4_test(struct ip_set *set, void *value, u32 flags)
+{
+	const struct ip_set_hash *h = set->data;
+	const struct hash_net4_elem *d = value;
+	struct hash_net4_elem e = { };
+	int cidr;
+
+	if (d->cidr != HOST_MASK)
+		return ahash_test(set, value, flags);
+
+	for (cidr = HOST_MASK; cidr > 0; cidr--) {
+		if (!h->nets[cidr])
+			continue;
+		e.ip = d->ip & ip_set_netmask(cidr);
+		e.cidr = cidr;
+		if (ahash_test(set, &e, flags))
+			return 1;
+	}
+	return 0;
+}
+
+static int
+hash_net4_kadt(struct ip_set *set, const struct sk_buff *skb,
+	       enum ipset_adt adt, u8 pf, u8 dim, u8 flags)
+{
+	ipset_adtfn adtfn = set->variant->adt[adt];
+	struct hash_net4_elem e = { .cidr = HOST_MASK };
+
+	e.ip = ip4addr(skb, flags & IPSET_DIM_ONE_SRC);
+
+	return adtfn(set, &e, flags);
+}
+
+static int
+hash_net4_uadt(struct ip_set *set, struct nlattr *tb[],
+	       enum ipset_adt adt, u32 *lineno, u32 flags)
+{
+	ipset_adtfn adtfn = set->variant->adt[adt];
+	struct hash_net4_elem e = { .cidr = HOST_MASK };
+	int ret;
+
+	if (unlikely(!tb[IPSET_ATTR_IP]))
+		return -IPSET_ERR_PROTOCOL;
+
+	if (tb[IPSET_ATTR_LINENO])
+		*lineno = nla_get_u32(tb[IPSET_ATTR_LINENO]);
+
+	ret = ip_set_get_ipaddr4(tb[IPSET_ATTR_IP], &e.ip);
+	if (ret)
+		return ret;
+
+	if (tb[IPSET_ATTR_CIDR])
+		e.cidr = nla_get_u8(tb[IPSET_ATTR_CIDR]);
+
+	if (!e.cidr || e.cidr > HOST_MASK)
+		return -IPSET_ERR_INVALID_CIDR;
+
+	e.ip &= ip_set_netmask(e.cidr);
+
+	return adtfn(set, &e, flags);
+}
+
+static int
+hash_net4_list(const struct ip_set *set, struct sk_buff *skb,
+	       struct netlink_callback *cb)
+{
+	return ahash_list(set, skb, cb, hash_net4_data_list);
+}
+
+static const struct ip_set_type_variant hash_net4_variant = {
+	.kadt	= hash_net4_kadt,
+	.uadt	= hash_net4_uadt,
+	.adt	= {
+		[IPSET_ADD] = hash_net4_add,
+		[IPSET_DEL] = hash_net4_del,
+		[IPSET_TEST] = hash_net4_test,
+	},
+	.destroy = ahash_destroy,
+	.flush	= ahash_flush,
+	.head	= ahash_head,
+	.list	= hash_net4_list,
+	.same_set = ahash_same_set,
+};
+
+static int
+hash_net_create(struct ip_set *set, struct nlattr *tb[], u32 flags)
+{
+	return ahash_create(set, tb, HASH_NET4_KEY_LEN, &hash_net4_variant);
+}
+
+static struct ip_set_type hash_net_type __read_mostly = {
+	.name		= "hash:net",
+	.protocol	= IPSET_PROTOCOL,
+	.dimension	= IPSET_DIM_ONE,
+	.family		= AF_INET,
+	.revision	= 0,
+	.create		= hash_net_create,
+	.create_policy	= {
+		[IPSET_ATTR_HASHSIZE]	= { .type = NLA_U32 },
+		[IPSET_ATTR_MAXELEM]	= { .type = NLA_U32 },
+	},
+	.adt_policy	= {
+		[IPSET_ATTR_IP]		= { .type = NLA_NESTED },
+		[IPSET_ATTR_CIDR]	= { .type = NLA_U8 },
+		[IPSET_ATTR_LINENO]	= { .type = NLA_U32 },
+	},
+	.me		= THIS_MODULE,
+};
+
+static int __init
+hash_net_init(void)
+{
+	return ip_set_type_register(&hash_net_type);
+}
+
+static void __exit
+hash_net_fini(void)
+{
+	ip_set_type_unregister(&hash_net_type);
+}
+
+module_init(hash_net_init);
+module_exit(hash_net_fini);
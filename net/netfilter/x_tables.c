@@ -655,6 +655,10 @@ void xt_free_table_info(struct xt_table_info *info)
 		else
 			vfree(info->entries[cpu]);
 	}
+	if (info->classify_size <= PAGE_SIZE)
+		kfree(info->classify);
+	else
+		vfree(info->classify);
 	kfree(info);
 }
 EXPORT_SYMBOL(xt_free_table_info);